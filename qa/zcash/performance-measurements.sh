@@ -100,7 +100,7 @@ EOF
 case "$1" in
     *)
         case "$2" in
-            verifyjoinsplit)
+            verifyjoinsplit|verifyjoinsplitblock)
                 anond_start
                 RAWJOINSPLIT=$(zcash_rpc zcsamplejoinsplit)
                 anond_stop
@@ -123,6 +123,9 @@ case "$1" in
             verifyjoinsplit)
                 zcash_rpc zcbenchmark verifyjoinsplit 1000 "\"$RAWJOINSPLIT\""
                 ;;
+            verifyjoinsplitblock)
+                zcash_rpc zcbenchmark verifyjoinsplitblock 10 "\"$RAWJOINSPLIT\"" "${@:3}"
+                ;;
             solveequihash)
                 zcash_rpc_slow zcbenchmark solveequihash 50 "${@:3}"
                 ;;
@@ -142,6 +145,16 @@ case "$1" in
                 extract_benchmark_data
                 zcash_rpc zcbenchmark connectblockslow 10
                 ;;
+            serveblocks)
+                anond_generate
+                zcash_rpc zcbenchmark serveblocks 10 100 "${@:3}"
+                ;;
+            masternodelookups)
+                zcash_rpc zcbenchmark masternodelookups 10 "${@:3}"
+                ;;
+            governancevotesync)
+                zcash_rpc zcbenchmark governancevotesync 1 "${@:3}"
+                ;;
             *)
                 anond_stop
                 echo "Bad arguments."
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "version.h"
+
+CBlockCache blockCache;
+
+CBlockCache::CBlockCache() : nUsage(0), nMaxUsage(DEFAULT_BLOCK_CACHE_SIZE << 20), nHits(0), nMisses(0) {}
+
+void CBlockCache::Touch(CBlockCacheEntry& entry)
+{
+    listLRU.splice(listLRU.begin(), listLRU, entry.itLRU);
+}
+
+void CBlockCache::Evict(size_t nMaxUsageAfter)
+{
+    while (nUsage > nMaxUsageAfter && !listLRU.empty()) {
+        std::map<uint256, CBlockCacheEntry>::iterator it = mapBlocks.find(listLRU.back());
+        nUsage -= it->second.nUsage;
+        mapBlocks.erase(it);
+        listLRU.pop_back();
+    }
+}
+
+void CBlockCache::Add(const CBlock& block)
+{
+    uint256 hash = block.GetHash();
+    {
+        LOCK(cs);
+        if (nMaxUsage == 0 || mapBlocks.count(hash))
+            return;
+    }
+
+    // Copy and serialize outside the lock
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlockCacheEntry entry;
+    entry.pserialized = std::make_shared<CSerializeData>(ss.begin(), ss.end());
+    entry.pblock = std::make_shared<CBlock>(block);
+    entry.nUsage = sizeof(CBlock) + RecursiveDynamicUsage(block) + memusage::MallocUsage(ss.size());
+
+    LOCK(cs);
+    if (entry.nUsage > nMaxUsage || mapBlocks.count(hash))
+        return;
+    Evict(nMaxUsage - entry.nUsage);
+    listLRU.push_front(hash);
+    entry.itLRU = listLRU.begin();
+    nUsage += entry.nUsage;
+    mapBlocks.insert(std::make_pair(hash, entry));
+}
+
+std::shared_ptr<const CBlock> CBlockCache::GetBlock(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, CBlockCacheEntry>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        nMisses++;
+        return std::shared_ptr<const CBlock>();
+    }
+    nHits++;
+    Touch(it->second);
+    return it->second.pblock;
+}
+
+bool CBlockCache::GetSerializedBlock(const uint256& hash, CDataStream& ss)
+{
+    std::shared_ptr<const CSerializeData> pserialized;
+    {
+        LOCK(cs);
+        std::map<uint256, CBlockCacheEntry>::iterator it = mapBlocks.find(hash);
+        if (it == mapBlocks.end()) {
+            nMisses++;
+            return false;
+        }
+        nHits++;
+        Touch(it->second);
+        pserialized = it->second.pserialized;
+    }
+    ss.write(&(*pserialized)[0], pserialized->size());
+    return true;
+}
+
+void CBlockCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Evict(nMaxUsage);
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    mapBlocks.clear();
+    listLRU.clear();
+    nUsage = 0;
+}
+
+void CBlockCache::GetStats(size_t& nEntriesRet, size_t& nUsageRet, size_t& nMaxUsageRet, uint64_t& nHitsRet, uint64_t& nMissesRet) const
+{
+    LOCK(cs);
+    nEntriesRet = mapBlocks.size();
+    nUsageRet = nUsage;
+    nMaxUsageRet = nMaxUsage;
+    nHitsRet = nHits;
+    nMissesRet = nMisses;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "streams.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+/** Default for -blockcachesize, megabytes of recently connected blocks kept in memory */
+static const int64_t DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+/**
+ * Least recently used cache of recently connected blocks, both parsed and serialized,
+ * so the peers and RPC clients asking for a new tip do not each read it from disk.
+ * Entries are immutable and handed out by shared pointer, so they can be used after
+ * the cache lock is released even if they get evicted meanwhile.
+ */
+class CBlockCache
+{
+private:
+    struct CBlockCacheEntry {
+        std::shared_ptr<const CBlock> pblock;
+        std::shared_ptr<const CSerializeData> pserialized;
+        size_t nUsage;
+        std::list<uint256>::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<uint256, CBlockCacheEntry> mapBlocks;
+    std::list<uint256> listLRU; //! most recently used first
+    size_t nUsage;
+    size_t nMaxUsage;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Touch(CBlockCacheEntry& entry);
+    void Evict(size_t nMaxUsageAfter);
+
+public:
+    CBlockCache();
+
+    /** Cache a block, evicting the least recently used ones to stay within budget */
+    void Add(const CBlock& block);
+    /** The cached block, or NULL */
+    std::shared_ptr<const CBlock> GetBlock(const uint256& hash);
+    /** Append the serialized cached block to ss, false if it is not cached */
+    bool GetSerializedBlock(const uint256& hash, CDataStream& ss);
+
+    void SetMaxUsage(size_t nMaxUsageIn);
+    void Clear();
+    void GetStats(size_t& nEntriesRet, size_t& nUsageRet, size_t& nMaxUsageRet, uint64_t& nHitsRet, uint64_t& nMissesRet) const;
+};
+
+extern CBlockCache blockCache;
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "hash.h"
+#include "random.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <boost/unordered_map.hpp>
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+        nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+        header(block.GetBlockHeader())
+{
+    FillShortTxIDSelector();
+    // The coinbase is never in the receiver's mempool
+    prefilledtxn.resize(1);
+    prefilledtxn[0].index = 0;
+    prefilledtxn[0].tx = block.vtx[0];
+    shorttxids.reserve(block.vtx.size() - 1);
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        shorttxids.push_back(GetShortID(block.vtx[i].GetHash()));
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector()
+{
+    CHashWriter hasher(SER_GETHASH, 0);
+    hasher << header << nonce;
+    shorttxidk = hasher.GetHash();
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return txhash.GetHash(shorttxidk) & 0xffffffffffffULL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool)
+{
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > std::numeric_limits<uint16_t>::max())
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    txn_available.assign(cmpctblock.BlockTxCount(), CTransaction());
+    have.assign(cmpctblock.BlockTxCount(), false);
+
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        const PrefilledTransaction& prefilled = cmpctblock.prefilledtxn[i];
+        if (prefilled.index >= txn_available.size() || have[prefilled.index] || prefilled.tx.IsNull())
+            return READ_STATUS_INVALID;
+        txn_available[prefilled.index] = prefilled.tx;
+        have[prefilled.index] = true;
+    }
+
+    // The short ids fill the remaining slots in order
+    boost::unordered_map<uint64_t, uint16_t> mapShortIDs;
+    mapShortIDs.reserve(cmpctblock.shorttxids.size());
+    uint16_t nIndex = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (have[nIndex])
+            nIndex++;
+        if (!mapShortIDs.insert(std::make_pair(cmpctblock.shorttxids[i], nIndex)).second) {
+            // Two transactions of the block share a short id, which is only
+            // expected once in a few hundred thousand blocks
+            return READ_STATUS_FAILED;
+        }
+        nIndex++;
+    }
+
+    // Mempool transactions claiming the same short id cannot be told apart,
+    // so that index gets requested from the peer instead
+    std::vector<bool> collided(txn_available.size(), false);
+    {
+        LOCK(pool.cs);
+        for (CTxMemPool::txentry_map_t::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+            boost::unordered_map<uint64_t, uint16_t>::const_iterator itID = mapShortIDs.find(cmpctblock.GetShortID(it->first));
+            if (itID == mapShortIDs.end() || collided[itID->second])
+                continue;
+            if (have[itID->second]) {
+                have[itID->second] = false;
+                txn_available[itID->second] = CTransaction();
+                collided[itID->second] = true;
+            } else {
+                have[itID->second] = true;
+                txn_available[itID->second] = it->second.GetTx();
+            }
+        }
+    }
+
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(index < have.size());
+    return have[index];
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const
+{
+    assert(!header.IsNull());
+    block = CBlock(header);
+    block.vtx.resize(txn_available.size());
+
+    size_t nMissing = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (have[i]) {
+            block.vtx[i] = txn_available[i];
+        } else {
+            if (nMissing >= vtx_missing.size())
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtx_missing[nMissing++];
+        }
+    }
+    if (nMissing != vtx_missing.size())
+        return READ_STATUS_INVALID;
+
+    // A short id may have matched the wrong mempool transaction; the block
+    // is then rebuilt from the full copy rather than treated as invalid.
+    bool fMutated = false;
+    if (block.BuildMerkleTree(&fMutated) != header.hashMerkleRoot || fMutated) {
+        LogPrint("net", "%s: short id collision rebuilding block %s\n", __func__, header.GetHash().ToString());
+        return READ_STATUS_FAILED;
+    }
+
+    return READ_STATUS_OK;
+}
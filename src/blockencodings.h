@@ -0,0 +1,208 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKENCODINGS_H
+#define BITCOIN_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <ios>
+#include <limits>
+#include <vector>
+
+class CTxMemPool;
+
+/** Only blocks this close to the tip are sent as compact blocks, older ones go out whole */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Only transactions of blocks this close to the tip are served by getblocktxn */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+
+/** Serializes a vector of ascending indexes as differences to the previous index plus one */
+template <typename Stream>
+void WriteDifferentialIndexes(Stream& s, const std::vector<uint16_t>& indexes)
+{
+    WriteCompactSize(s, indexes.size());
+    for (size_t i = 0; i < indexes.size(); i++)
+        WriteCompactSize(s, indexes[i] - (i == 0 ? 0 : indexes[i - 1] + 1));
+}
+
+template <typename Stream>
+void ReadDifferentialIndexes(Stream& s, std::vector<uint16_t>& indexes)
+{
+    uint64_t nCount = ReadCompactSize(s);
+    if (nCount > MAX_BLOCK_SIZE)
+        throw std::ios_base::failure("too many differential indexes");
+    indexes.clear();
+    uint64_t nIndex = 0;
+    for (uint64_t i = 0; i < nCount; i++) {
+        nIndex += ReadCompactSize(s) + (i == 0 ? 0 : 1);
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("differential index overflowed 16 bits");
+        indexes.push_back(nIndex);
+    }
+}
+
+/** The indexes of the transactions a peer is missing to rebuild a compact block */
+class BlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        s << blockhash;
+        WriteDifferentialIndexes(s, indexes);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        s >> blockhash;
+        ReadDifferentialIndexes(s, indexes);
+    }
+};
+
+/** The transactions answering a BlockTransactionsRequest, in the requested order */
+class BlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    BlockTransactions() {}
+    BlockTransactions(const BlockTransactionsRequest& req) : blockhash(req.blockhash), txn(req.indexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+/** A transaction sent along with a compact block, at its index in the block */
+struct PrefilledTransaction {
+    uint16_t index;
+    CTransaction tx;
+};
+
+/**
+ * A block announced by its header and 6 byte short ids of its transactions, which
+ * the receiver looks up in its mempool. The coinbase can never be in a mempool, so it
+ * is always sent along.
+ *
+ * The short ids are the salted transaction id hash the coins and mempool maps already
+ * use, salted with the hash of the header and a random nonce so that nobody can mine
+ * colliding transactions ahead of a block. Transaction ids commit to the JoinSplits,
+ * their proofs and signatures, so a mempool match is the exact transaction that was mined.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    uint64_t nonce;
+    uint256 shorttxidk;
+
+    void FillShortTxIDSelector();
+
+public:
+    static const int SHORTTXIDS_LENGTH = 6;
+
+    CBlockHeader header;
+    std::vector<uint64_t> shorttxids;
+    std::vector<PrefilledTransaction> prefilledtxn;
+
+    CBlockHeaderAndShortTxIDs() : nonce(0) {}
+    CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        s << header;
+        s << nonce;
+        WriteCompactSize(s, shorttxids.size());
+        for (size_t i = 0; i < shorttxids.size(); i++) {
+            uint32_t lsb = shorttxids[i] & 0xffffffff;
+            uint16_t msb = (shorttxids[i] >> 32) & 0xffff;
+            s << lsb << msb;
+        }
+        std::vector<uint16_t> indexes;
+        for (size_t i = 0; i < prefilledtxn.size(); i++)
+            indexes.push_back(prefilledtxn[i].index);
+        WriteDifferentialIndexes(s, indexes);
+        for (size_t i = 0; i < prefilledtxn.size(); i++)
+            s << prefilledtxn[i].tx;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        s >> header;
+        s >> nonce;
+        uint64_t nShortTxIDs = ReadCompactSize(s);
+        if (nShortTxIDs > MAX_BLOCK_SIZE)
+            throw std::ios_base::failure("too many short txids");
+        shorttxids.clear();
+        for (uint64_t i = 0; i < nShortTxIDs; i++) {
+            uint32_t lsb;
+            uint16_t msb;
+            s >> lsb >> msb;
+            shorttxids.push_back((uint64_t(msb) << 32) | uint64_t(lsb));
+        }
+        std::vector<uint16_t> indexes;
+        ReadDifferentialIndexes(s, indexes);
+        prefilledtxn.resize(indexes.size());
+        for (size_t i = 0; i < prefilledtxn.size(); i++) {
+            prefilledtxn[i].index = indexes[i];
+            s >> prefilledtxn[i].tx;
+        }
+        FillShortTxIDSelector();
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! the peer sent something malformed
+    READ_STATUS_FAILED,  //! could not rebuild the block, ask for it whole
+};
+
+/** A compact block being rebuilt from the mempool and the transactions requested from the peer */
+class PartiallyDownloadedBlock
+{
+private:
+    std::vector<CTransaction> txn_available;
+    std::vector<bool> have;
+
+public:
+    CBlockHeader header;
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+    bool IsTxAvailable(size_t index) const;
+    /** Complete the block with the missing transactions, in index order */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
+};
+
+#endif // BITCOIN_BLOCKENCODINGS_H
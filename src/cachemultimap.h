@@ -59,7 +59,7 @@ public:
           mapIndex()
     {}
 
-    CacheMultiMap(const CacheMap<K,V>& other)
+    CacheMultiMap(const CacheMultiMap<K,V>& other)
         : nMaxSize(other.nMaxSize),
           nCurrentSize(other.nCurrentSize),
           listItems(other.listItems),
@@ -194,7 +194,7 @@ public:
         return listItems;
     }
 
-    CacheMap<K,V>& operator=(const CacheMap<K,V>& other)
+    CacheMultiMap<K,V>& operator=(const CacheMultiMap<K,V>& other)
     {
         nMaxSize = other.nMaxSize;
         nCurrentSize = other.nCurrentSize;
@@ -150,13 +150,13 @@ public:
     uint256 hashAnchorEnd;
 
     //! block header
+    //! The Equihash solution is not kept in memory; see GetBlockHeader() in main.h
     int nVersion;
     uint256 hashMerkleRoot;
     uint256 hashReserved;
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
-    std::vector<unsigned char> nSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
@@ -184,7 +184,6 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = uint256();
-        nSolution.clear();
     }
 
     CBlockIndex()
@@ -202,7 +201,6 @@ public:
         nTime = block.nTime;
         nBits = block.nBits;
         nNonce = block.nNonce;
-        nSolution = block.nSolution;
     }
 
     CDiskBlockPos GetBlockPos() const
@@ -225,7 +223,8 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! The header fields held in memory, with an empty nSolution
+    CBlockHeader GetBlockHeaderWithoutSolution() const
     {
         CBlockHeader block;
         block.nVersion = nVersion;
@@ -236,7 +235,6 @@ public:
         block.nTime = nTime;
         block.nBits = nBits;
         block.nNonce = nNonce;
-        block.nSolution = nSolution;
         return block;
     }
 
@@ -311,6 +309,7 @@ class CDiskBlockIndex : public CBlockIndex
 public:
     uint256 hash;
     uint256 hashPrev;
+    std::vector<unsigned char> nSolution;
 
     CDiskBlockIndex()
     {
@@ -318,7 +317,7 @@ public:
         hashPrev = uint256();
     }
 
-    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
+    CDiskBlockIndex(const CBlockIndex* pindex, const std::vector<unsigned char>& nSolutionIn) : CBlockIndex(*pindex), nSolution(nSolutionIn)
     {
         hash = (hash == uint256() ? pindex->GetBlockHash() : hash);
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
@@ -2,6 +2,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "activemasternode.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/validation.h"
 #include "darksend.h"
@@ -9,12 +10,16 @@
 #include "masternode-payments.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "random.h"
 #include "script/sign.h"
 // #include "txmempool.h"
 #include "util.h"
 // #include "utilmoneystr.h"
 
+#include <atomic>
+
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 // int nPrivateSendRounds = DEFAULT_PRIVATESEND_ROUNDS;
 // int nPrivateSendAmount = DEFAULT_PRIVATESEND_AMOUNT;
@@ -2290,28 +2295,148 @@ bool CDarkSendSigner::SignMessage(std::string strMessage, std::vector<unsigned c
     return key.SignCompact(ss.GetHash(), vchSigRet);
 }
 
+namespace {
+
+/**
+ * Valid message signature cache. Masternode pings, broadcasts and payment votes and
+ * governance objects and votes are verified again whenever they are relayed to us
+ * by another peer or rechecked later; this avoids recovering the public key again.
+ *
+ * Entries are hashes of (message hash, signature, key ID) salted with a per-process
+ * nonce, so peers can not predict which entries collide or get evicted.
+ */
+class CMessageSignatureCache
+{
+private:
+    uint256 nonce;
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_msgsigcache;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    uint256 GetEntry(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << hashMessage << vchSig << keyID;
+        return ss.GetHash();
+    }
+
+public:
+    CMessageSignatureCache() : nHits(0), nMisses(0)
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    bool Get(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID)
+    {
+        uint256 entry = GetEntry(hashMessage, vchSig, keyID);
+        boost::shared_lock<boost::shared_mutex> lock(cs_msgsigcache);
+        if (setValid.count(entry)) {
+            nHits++;
+            return true;
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Set(const uint256& hashMessage, const std::vector<unsigned char>& vchSig, const CKeyID& keyID)
+    {
+        int64_t nMaxCacheSize = GetArg("-maxmsgsigcachesize", DEFAULT_MAX_MSG_SIG_CACHE_SIZE);
+        if (nMaxCacheSize <= 0) return;
+
+        uint256 entry = GetEntry(hashMessage, vchSig, keyID);
+        boost::unique_lock<boost::shared_mutex> lock(cs_msgsigcache);
+
+        while (static_cast<int64_t>(setValid.size()) >= nMaxCacheSize)
+        {
+            // Evict a random entry, same as the script signature cache
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+
+        setValid.insert(entry);
+    }
+
+    void GetStats(size_t& nEntriesRet, uint64_t& nHitsRet, uint64_t& nMissesRet)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_msgsigcache);
+        nEntriesRet = setValid.size();
+        nHitsRet = nHits;
+        nMissesRet = nMisses;
+    }
+};
+
+CMessageSignatureCache& GetMessageSignatureCache()
+{
+    // constructed on first use, after the random number generator is set up
+    static CMessageSignatureCache messageSignatureCache;
+    return messageSignatureCache;
+}
+
+CCheckQueue<CMessageSignatureCheck> msgsigcheckqueue(128);
+
+}
+
+bool CMessageSignatureCheck::operator()()
+{
+    std::string strError;
+    darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, strError);
+    return true;
+}
+
+void ThreadMessageSignatureCheck()
+{
+    RenameThread("anon-msgsigch");
+    msgsigcheckqueue.Thread();
+}
+
 bool CDarkSendSigner::VerifyMessage(CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string strMessage, std::string& strErrorRet)
 {
     CHashWriter ss(SER_GETHASH, 0);
     ss << strMessageMagic;
     ss << strMessage;
+    uint256 hashMessage = ss.GetHash();
+
+    CKeyID keyID = pubkey.GetID();
+    if(GetMessageSignatureCache().Get(hashMessage, vchSig, keyID)) {
+        return true;
+    }
 
     CPubKey pubkeyFromSig;
-    if(!pubkeyFromSig.RecoverCompact(ss.GetHash(), vchSig)) {
+    if(!pubkeyFromSig.RecoverCompact(hashMessage, vchSig)) {
         strErrorRet = "Error recovering public key.";
         return false;
     }
 
-    if(pubkeyFromSig.GetID() != pubkey.GetID()) {
+    if(pubkeyFromSig.GetID() != keyID) {
         strErrorRet = strprintf("Keys don't match: pubkey=%s, pubkeyFromSig=%s, strMessage=%s, vchSig=%s",
-                    pubkey.GetID().ToString(), pubkeyFromSig.GetID().ToString(), strMessage,
+                    keyID.ToString(), pubkeyFromSig.GetID().ToString(), strMessage,
                     EncodeBase64(&vchSig[0], vchSig.size()));
         return false;
     }
 
+    GetMessageSignatureCache().Set(hashMessage, vchSig, keyID);
     return true;
 }
 
+void CDarkSendSigner::VerifyMessages(std::vector<CMessageSignatureCheck>& vChecks)
+{
+    // Without check threads the messages get verified one by one when processed anyway
+    if (nScriptCheckThreads == 0 || vChecks.size() < 2)
+        return;
+
+    CCheckQueueControl<CMessageSignatureCheck> control(&msgsigcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+void CDarkSendSigner::GetCacheStats(size_t& nEntriesRet, uint64_t& nHitsRet, uint64_t& nMissesRet)
+{
+    GetMessageSignatureCache().GetStats(nEntriesRet, nHitsRet, nMissesRet);
+}
+
 // bool CDarkSendEntry::AddScriptSig(const CTxIn& txin)
 // {
 //     BOOST_FOREACH(CTxDSIn& txdsin, vecTxDSIn) {
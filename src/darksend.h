@@ -35,6 +35,9 @@ static const int PRIVATESEND_KEYS_THRESHOLD_WARNING = 100;
 // Stop mixing completely, it's too dangerous to continue when we have only this many keys left
 static const int PRIVATESEND_KEYS_THRESHOLD_STOP    = 50;
 
+//! -maxmsgsigcachesize default, number of verified masternode/governance message signatures to remember
+static const int64_t DEFAULT_MAX_MSG_SIG_CACHE_SIZE = 50000;
+
 extern int nPrivateSendRounds;
 extern int nPrivateSendAmount;
 extern int nLiquidityProvider;
@@ -216,6 +219,36 @@ extern CDarkSendSigner darkSendSigner;
 //     bool CheckSignature(const CPubKey& pubKeyMasternode);
 // };
 
+/**
+ * A deferred CDarkSendSigner::VerifyMessage() call, so a burst of signed messages can be
+ * verified on the message signature check threads. It only warms the signature cache:
+ * it always succeeds so one bad signature does not stop the rest of a batch from
+ * being checked, and the message is verified again (from the cache) when processed.
+ */
+class CMessageSignatureCheck
+{
+private:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+
+public:
+    CMessageSignatureCheck() {}
+    CMessageSignatureCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn) :
+        pubkey(pubkeyIn), vchSig(vchSigIn), strMessage(strMessageIn) {}
+
+    bool operator()();
+
+    void swap(CMessageSignatureCheck& check) {
+        std::swap(pubkey, check.pubkey);
+        vchSig.swap(check.vchSig);
+        strMessage.swap(check.strMessage);
+    }
+};
+
+/** Run a message signature check thread */
+void ThreadMessageSignatureCheck();
+
 /** Helper object for signing and checking signatures
  */
 class CDarkSendSigner
@@ -229,6 +262,10 @@ public:
     bool SignMessage(std::string strMessage, std::vector<unsigned char>& vchSigRet, CKey key);
     /// Verify the message, returns true if succcessful
     bool VerifyMessage(CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string strMessage, std::string& strErrorRet);
+    /// Verify a batch of messages in parallel to fill the signature cache ahead of processing them
+    void VerifyMessages(std::vector<CMessageSignatureCheck>& vChecks);
+    /// Signature cache size and lookup counters
+    static void GetCacheStats(size_t& nEntriesRet, uint64_t& nHitsRet, uint64_t& nMissesRet);
 };
 
 /** Used to keep track of current status of mixing pool
@@ -0,0 +1,402 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flat-database.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+
+namespace {
+
+const unsigned char JOURNAL_MAGIC[8] = {'f', 'l', 'a', 't', 'j', 'r', 'n', 1};
+
+const uint8_t RECORD_CHUNK = 1;
+const uint8_t RECORD_MANIFEST = 2;
+
+// type, payload size and checksum
+const size_t RECORD_HEADER_SIZE = 9;
+
+// never compact less than this much garbage
+const uint64_t COMPACT_MIN_GARBAGE = 1 << 20;
+
+// Chunks of 1 to 64 KiB, 5 KiB on average
+const size_t CHUNK_MIN_SIZE = 1024;
+const size_t CHUNK_MAX_SIZE = 65536;
+const int CHUNK_BOUNDARY_BITS = 12;
+
+typedef std::vector<std::pair<uint256, std::pair<size_t, size_t> > > chunk_vec_t;
+
+struct CGearTable {
+    uint64_t table[256];
+
+    CGearTable()
+    {
+        // splitmix64, the table has to stay the same for the chunks of a journal to be reused
+        uint64_t x = 0;
+        for (int i = 0; i < 256; i++) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            table[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+const uint64_t* GearTable()
+{
+    static const CGearTable gear;
+    return gear.table;
+}
+
+// Cut where the top bits of a gear hash over the last 64 bytes are zero
+void SplitChunks(const unsigned char* pData, size_t nSize, chunk_vec_t& vChunksRet)
+{
+    const uint64_t* gear = GearTable();
+    size_t nBegin = 0;
+    while (nBegin < nSize) {
+        size_t nEnd = std::min(nSize, nBegin + CHUNK_MAX_SIZE);
+        uint64_t h = 0;
+        for (size_t i = nBegin + CHUNK_MIN_SIZE; i < nEnd; i++) {
+            h = (h << 1) + gear[pData[i]];
+            if ((h >> (64 - CHUNK_BOUNDARY_BITS)) == 0) {
+                nEnd = i + 1;
+                break;
+            }
+        }
+        vChunksRet.push_back(std::make_pair(Hash(pData + nBegin, pData + nEnd), std::make_pair(nBegin, nEnd - nBegin)));
+        nBegin = nEnd;
+    }
+}
+
+void AppendRecord(std::vector<unsigned char>& vchOut, uint8_t nType, const unsigned char* pPayload, size_t nSize, const uint256& hash)
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    header[0] = nType;
+    WriteLE32(header + 1, nSize);
+    WriteLE32(header + 5, ReadLE32(hash.begin()));
+    vchOut.insert(vchOut.end(), header, header + sizeof(header));
+    vchOut.insert(vchOut.end(), pPayload, pPayload + nSize);
+}
+
+void AppendManifest(std::vector<unsigned char>& vchOut, const std::vector<uint256>& vManifest)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << vManifest;
+    const unsigned char* pPayload = (const unsigned char*)&ss[0];
+    AppendRecord(vchOut, RECORD_MANIFEST, pPayload, ss.size(), Hash(pPayload, pPayload + ss.size()));
+}
+
+bool WriteAll(FILE* file, const std::vector<unsigned char>& vch)
+{
+    return vch.empty() || fwrite(&vch[0], 1, vch.size(), file) == vch.size();
+}
+
+}
+
+CFlatDBJournal::CFlatDBJournal(const boost::filesystem::path& pathIn)
+    : pathJournal(pathIn),
+      file(NULL),
+      nFileSize(0),
+      nLiveSize(0),
+      fCompacting(false),
+      nCompactEnd(0)
+{
+}
+
+CFlatDBJournal::~CFlatDBJournal()
+{
+    WaitForCompaction();
+    if (file)
+        fclose(file);
+}
+
+bool CFlatDBJournal::Exists() const
+{
+    return boost::filesystem::exists(pathJournal);
+}
+
+void CFlatDBJournal::WaitForCompaction()
+{
+    if (threadCompact.joinable())
+        threadCompact.join();
+}
+
+void CFlatDBJournal::GetStats(uint64_t& nFileSizeRet, uint64_t& nLiveSizeRet) const
+{
+    LOCK(cs);
+    nFileSizeRet = nFileSize;
+    nLiveSizeRet = nLiveSize;
+}
+
+bool CFlatDBJournal::HasChunk(const uint256& hash) const
+{
+    std::map<uint256, CRecordPos>::const_iterator it = mapChunks.find(hash);
+    if (it == mapChunks.end())
+        return false;
+    // the running compaction drops the chunks it does not keep
+    return !fCompacting || it->second.nPos >= nCompactEnd || setCompactChunks.count(hash);
+}
+
+bool CFlatDBJournal::Read(std::vector<unsigned char>& vchDataRet)
+{
+    WaitForCompaction();
+    LOCK(cs);
+
+    FILE* filein = fopen(pathJournal.string().c_str(), "rb");
+    if (!filein)
+        return false;
+    std::vector<unsigned char> vchFile(boost::filesystem::file_size(pathJournal));
+    bool fRead = vchFile.empty() || fread(&vchFile[0], 1, vchFile.size(), filein) == vchFile.size();
+    fclose(filein);
+    if (!fRead)
+        return error("%s: Failed to read %s", __func__, pathJournal.string());
+    if (vchFile.size() < sizeof(JOURNAL_MAGIC) || memcmp(&vchFile[0], JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)))
+        return error("%s: %s is not a journal", __func__, pathJournal.string());
+
+    std::map<uint256, CRecordPos> mapChunksRead;
+    std::vector<uint256> vManifestRead;
+    bool fManifest = false;
+    uint64_t nPos = sizeof(JOURNAL_MAGIC);
+    while (nPos + RECORD_HEADER_SIZE <= vchFile.size()) {
+        const unsigned char* pHeader = &vchFile[nPos];
+        uint32_t nSize = ReadLE32(pHeader + 1);
+        if (nSize > vchFile.size() - nPos - RECORD_HEADER_SIZE)
+            break;
+        const unsigned char* pPayload = pHeader + RECORD_HEADER_SIZE;
+        uint256 hash = Hash(pPayload, pPayload + nSize);
+        if (ReadLE32(pHeader + 5) != ReadLE32(hash.begin()))
+            break;
+
+        if (pHeader[0] == RECORD_CHUNK) {
+            CRecordPos pos = {nPos, (uint32_t)(RECORD_HEADER_SIZE + nSize)};
+            mapChunksRead[hash] = pos;
+        } else if (pHeader[0] == RECORD_MANIFEST) {
+            std::vector<uint256> vManifestIn;
+            try {
+                CDataStream ss((const char*)pPayload, (const char*)pPayload + nSize, SER_DISK, CLIENT_VERSION);
+                ss >> vManifestIn;
+            } catch (const std::exception& e) {
+                break;
+            }
+            bool fComplete = true;
+            for (size_t i = 0; i < vManifestIn.size() && fComplete; i++)
+                fComplete = mapChunksRead.count(vManifestIn[i]) > 0;
+            if (!fComplete)
+                break;
+            vManifestRead.swap(vManifestIn);
+            fManifest = true;
+        } else {
+            break;
+        }
+        nPos += RECORD_HEADER_SIZE + nSize;
+    }
+    if (!fManifest)
+        return error("%s: No complete write in %s", __func__, pathJournal.string());
+
+    if (nPos < vchFile.size())
+        LogPrintf("%s: Dropping %u bytes of damaged records at the end of %s\n", __func__, vchFile.size() - nPos, pathJournal.string());
+
+    vchDataRet.clear();
+    std::set<uint256> setLive;
+    nLiveSize = sizeof(JOURNAL_MAGIC);
+    for (size_t i = 0; i < vManifestRead.size(); i++) {
+        const CRecordPos& pos = mapChunksRead[vManifestRead[i]];
+        vchDataRet.insert(vchDataRet.end(), vchFile.begin() + pos.nPos + RECORD_HEADER_SIZE, vchFile.begin() + pos.nPos + pos.nSize);
+        if (setLive.insert(vManifestRead[i]).second)
+            nLiveSize += pos.nSize;
+    }
+    nLiveSize += RECORD_HEADER_SIZE + GetSerializeSize(vManifestRead, SER_DISK, CLIENT_VERSION);
+
+    if (file)
+        fclose(file);
+    file = fopen(pathJournal.string().c_str(), "ab");
+    if (!file || !TruncateFile(file, nPos)) {
+        if (file)
+            fclose(file);
+        file = NULL;
+        return error("%s: Failed to open %s for appending", __func__, pathJournal.string());
+    }
+    nFileSize = nPos;
+    mapChunks.swap(mapChunksRead);
+    vManifest.swap(vManifestRead);
+    return true;
+}
+
+bool CFlatDBJournal::WriteSnapshot(const chunk_vec_t& vChunks, const unsigned char* pData)
+{
+    // caller holds cs
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+    mapChunks.clear();
+    vManifest.clear();
+
+    std::vector<unsigned char> vchOut(JOURNAL_MAGIC, JOURNAL_MAGIC + sizeof(JOURNAL_MAGIC));
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        const uint256& hash = vChunks[i].first;
+        if (!mapChunks.count(hash)) {
+            CRecordPos pos = {vchOut.size(), (uint32_t)(RECORD_HEADER_SIZE + vChunks[i].second.second)};
+            mapChunks[hash] = pos;
+            AppendRecord(vchOut, RECORD_CHUNK, pData + vChunks[i].second.first, vChunks[i].second.second, hash);
+        }
+        vManifest.push_back(hash);
+    }
+    AppendManifest(vchOut, vManifest);
+
+    boost::filesystem::path pathNew = pathJournal.string() + ".new";
+    FILE* fileNew = fopen(pathNew.string().c_str(), "wb");
+    if (!fileNew)
+        return error("%s: Failed to open %s", __func__, pathNew.string());
+    bool fWritten = WriteAll(fileNew, vchOut);
+    FileCommit(fileNew);
+    fclose(fileNew);
+    if (!fWritten || !RenameOver(pathNew, pathJournal))
+        return error("%s: Failed to write %s", __func__, pathJournal.string());
+
+    file = fopen(pathJournal.string().c_str(), "ab");
+    if (!file)
+        return error("%s: Failed to open %s for appending", __func__, pathJournal.string());
+    nFileSize = nLiveSize = vchOut.size();
+    return true;
+}
+
+bool CFlatDBJournal::Write(const CDataStream& ssObj)
+{
+    const unsigned char* pData = ssObj.empty() ? NULL : (const unsigned char*)&ssObj[0];
+    chunk_vec_t vChunks;
+    SplitChunks(pData, ssObj.size(), vChunks);
+
+    LOCK(cs);
+    if (!file)
+        return WriteSnapshot(vChunks, pData);
+
+    std::vector<unsigned char> vchOut;
+    std::map<uint256, CRecordPos> mapChunksNew;
+    std::vector<uint256> vManifestNew;
+    std::set<uint256> setLive;
+    uint64_t nLiveSizeNew = sizeof(JOURNAL_MAGIC);
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        const uint256& hash = vChunks[i].first;
+        uint32_t nRecordSize = RECORD_HEADER_SIZE + vChunks[i].second.second;
+        if (!HasChunk(hash) && !mapChunksNew.count(hash)) {
+            CRecordPos pos = {nFileSize + vchOut.size(), nRecordSize};
+            mapChunksNew[hash] = pos;
+            AppendRecord(vchOut, RECORD_CHUNK, pData + vChunks[i].second.first, vChunks[i].second.second, hash);
+        }
+        if (setLive.insert(hash).second)
+            nLiveSizeNew += nRecordSize;
+        vManifestNew.push_back(hash);
+    }
+    size_t nManifestPos = vchOut.size();
+    AppendManifest(vchOut, vManifestNew);
+    nLiveSizeNew += vchOut.size() - nManifestPos;
+
+    bool fWritten = WriteAll(file, vchOut);
+    FileCommit(file);
+    if (!fWritten) {
+        // drop what was written of the records, the journal ends at the previous write
+        TruncateFile(file, nFileSize);
+        return error("%s: Failed to write %s", __func__, pathJournal.string());
+    }
+
+    for (std::map<uint256, CRecordPos>::const_iterator it = mapChunksNew.begin(); it != mapChunksNew.end(); ++it)
+        mapChunks[it->first] = it->second;
+    vManifest.swap(vManifestNew);
+    nFileSize += vchOut.size();
+    nLiveSize = nLiveSizeNew;
+
+    if (!fCompacting && nFileSize - nLiveSize > std::max(nLiveSize, COMPACT_MIN_GARBAGE)) {
+        WaitForCompaction();
+        fCompacting = true;
+        nCompactEnd = nFileSize;
+        vCompactManifest = vManifest;
+        setCompactChunks = std::set<uint256>(vManifest.begin(), vManifest.end());
+        threadCompact = boost::thread(&CFlatDBJournal::Compact, this);
+    }
+    return true;
+}
+
+void CFlatDBJournal::Compact()
+{
+    RenameThread("anon-journal");
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path pathNew = pathJournal.string() + ".new";
+
+    std::vector<uint256> vKeep;
+    std::map<uint256, CRecordPos> mapKeep;
+    {
+        LOCK(cs);
+        vKeep.swap(vCompactManifest);
+        for (std::set<uint256>::const_iterator it = setCompactChunks.begin(); it != setCompactChunks.end(); ++it)
+            mapKeep[*it] = mapChunks[*it];
+    }
+
+    // records before nCompactEnd are not written to anymore, no lock needed to copy them
+    FILE* fileOld = fopen(pathJournal.string().c_str(), "rb");
+    FILE* fileNew = fopen(pathNew.string().c_str(), "wb");
+    bool fOk = fileOld && fileNew;
+    std::vector<unsigned char> vchOut(JOURNAL_MAGIC, JOURNAL_MAGIC + sizeof(JOURNAL_MAGIC));
+    std::vector<unsigned char> vchRecord;
+    for (std::map<uint256, CRecordPos>::iterator it = mapKeep.begin(); fOk && it != mapKeep.end(); ++it) {
+        vchRecord.resize(it->second.nSize);
+        fOk = fseek(fileOld, it->second.nPos, SEEK_SET) == 0 &&
+              fread(&vchRecord[0], 1, vchRecord.size(), fileOld) == vchRecord.size();
+        it->second.nPos = vchOut.size();
+        vchOut.insert(vchOut.end(), vchRecord.begin(), vchRecord.end());
+    }
+    AppendManifest(vchOut, vKeep);
+    fOk = fOk && WriteAll(fileNew, vchOut);
+
+    {
+        LOCK(cs);
+        // append what was written since, then switch files
+        if (fOk && nFileSize > nCompactEnd) {
+            vchRecord.resize(nFileSize - nCompactEnd);
+            fOk = fseek(fileOld, nCompactEnd, SEEK_SET) == 0 &&
+                  fread(&vchRecord[0], 1, vchRecord.size(), fileOld) == vchRecord.size() &&
+                  WriteAll(fileNew, vchRecord);
+        }
+        if (fileNew)
+            FileCommit(fileNew);
+        if (fileOld)
+            fclose(fileOld);
+        if (fileNew)
+            fclose(fileNew);
+
+        if (fOk) {
+            fclose(file);
+            fOk = RenameOver(pathNew, pathJournal);
+            file = fopen(pathJournal.string().c_str(), "ab");
+        }
+        if (fOk && file) {
+            uint64_t nTailStart = vchOut.size();
+            std::map<uint256, CRecordPos>::iterator it = mapChunks.begin();
+            while (it != mapChunks.end()) {
+                if (it->second.nPos >= nCompactEnd) {
+                    it->second.nPos = it->second.nPos - nCompactEnd + nTailStart;
+                    ++it;
+                } else if (mapKeep.count(it->first)) {
+                    it->second.nPos = mapKeep[it->first].nPos;
+                    ++it;
+                } else {
+                    mapChunks.erase(it++);
+                }
+            }
+            LogPrintf("Compacted %s from %u to %u bytes  %dms\n", pathJournal.filename().string(), nFileSize, nTailStart + nFileSize - nCompactEnd, GetTimeMillis() - nStart);
+            nFileSize = nTailStart + nFileSize - nCompactEnd;
+        } else {
+            boost::filesystem::remove(pathNew);
+            LogPrintf("%s: Failed to compact %s\n", __func__, pathJournal.string());
+            if (!file) {
+                // reopened later as a new file by the next write
+                mapChunks.clear();
+                vManifest.clear();
+            }
+        }
+        fCompacting = false;
+        setCompactChunks.clear();
+    }
+}
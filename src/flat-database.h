@@ -8,9 +8,87 @@
 #include "clientversion.h"
 #include "hash.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+/** Default for -cachejournal */
+static const bool DEFAULT_FLATDB_JOURNAL = true;
+/** Default for -cachedumpinterval, in seconds */
+static const int64_t DEFAULT_CACHE_DUMP_INTERVAL = 15 * 60;
+
+/**
+ * Append-only journal of the serialized form of a cache.
+ *
+ * The serialized cache is cut into chunks at content defined boundaries, so a change
+ * to the cache only changes the chunks around it. The file holds chunk records, each
+ * chunk written once, and manifest records listing the chunks of the cache as of one
+ * write. Every record carries a checksum. Replay stops at the first damaged record,
+ * so a write torn by a crash only loses that write.
+ *
+ * Once the file is more than twice the size of the live chunks, it is compacted
+ * into a new file of those in the background, while writes keep being appended.
+ */
+class CFlatDBJournal
+{
+private:
+    struct CRecordPos {
+        uint64_t nPos;
+        uint32_t nSize;
+    };
+
+    mutable CCriticalSection cs;
+    boost::filesystem::path pathJournal;
+    /// open for appending after the first Read or Write
+    FILE* file;
+    uint64_t nFileSize;
+    /// chunk records in the file by chunk hash
+    std::map<uint256, CRecordPos> mapChunks;
+    /// chunks of the last write
+    std::vector<uint256> vManifest;
+    /// size of the records a compacted file would have
+    uint64_t nLiveSize;
+
+    boost::thread threadCompact;
+    bool fCompacting;
+    /// file size when the running compaction started, the manifest it writes and the chunks it keeps
+    uint64_t nCompactEnd;
+    std::vector<uint256> vCompactManifest;
+    std::set<uint256> setCompactChunks;
+
+    bool HasChunk(const uint256& hash) const;
+    bool WriteSnapshot(const std::vector<std::pair<uint256, std::pair<size_t, size_t> > >& vChunks, const unsigned char* pData);
+    void Compact();
+
+public:
+    CFlatDBJournal(const boost::filesystem::path& pathIn);
+    ~CFlatDBJournal();
+
+    bool Exists() const;
+
+    /**
+     * Replay the journal into the serialized cache of its last complete write. A
+     * damaged tail is cut off. False if the journal is missing or holds no write.
+     */
+    bool Read(std::vector<unsigned char>& vchDataRet);
+
+    /**
+     * Append the chunks of the serialized cache that are not in the file yet, and
+     * its manifest. Starts a new file if the journal was not read.
+     */
+    bool Write(const CDataStream& ssObj);
+
+    void WaitForCompaction();
+
+    void GetStats(uint64_t& nFileSizeRet, uint64_t& nLiveSizeRet) const;
+};
 
 /** 
 *   Generic Dumping and Loading
@@ -34,6 +112,38 @@ private:
     boost::filesystem::path pathDB;
     std::string strFilename;
     std::string strMagicMessage;
+    std::unique_ptr<CFlatDBJournal> pjournal;
+
+    /// background dumps
+    boost::thread threadDump;
+    mutable CCriticalSection csDump;
+    bool fDumpRunning;
+    int nDumps;
+    int64_t nLastPauseMicros;
+    int64_t nMaxPauseMicros;
+    int64_t nLastWriteMillis;
+
+    void WriteSnapshot(std::shared_ptr<T> pSnapshot)
+    {
+        RenameThread("anon-dump");
+        int64_t nStart = GetTimeMillis();
+        try {
+            Write(*pSnapshot);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Failed to dump %s - %s\n", __func__, strFilename, e.what());
+        }
+        pSnapshot.reset();
+        LOCK(csDump);
+        nLastWriteMillis = GetTimeMillis() - nStart;
+        fDumpRunning = false;
+    }
+
+    void SerializeObj(const T& objToSave, CDataStream& ssObj)
+    {
+        ssObj << strMagicMessage;                   // specific magic message for this type of object
+        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
+        ssObj << objToSave;
+    }
 
     bool Write(const T& objToSave)
     {
@@ -43,17 +153,23 @@ private:
 
         // serialize, checksum data up to that point, then append checksum
         CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-        ssObj << strMagicMessage;                   // specific magic message for this type of object
-        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-        ssObj << objToSave;
+        SerializeObj(objToSave, ssObj);
+        if (pjournal) {
+            if (!pjournal->Write(ssObj))
+                return false;
+            LogPrintf("Written info to %s.journal  %dms\n", strFilename, GetTimeMillis() - nStart);
+            return true;
+        }
         uint256 hash = Hash(ssObj.begin(), ssObj.end());
         ssObj << hash;
 
-        // open output file, and associate with CAutoFile
-        FILE* file = fopen(pathDB.string().c_str(), "wb");
+        // open output file, and associate with CAutoFile; written aside and renamed over,
+        // a dump from the background may be cut short by a crash
+        boost::filesystem::path pathTmp = pathDB.string() + ".new";
+        FILE* file = fopen(pathTmp.string().c_str(), "wb");
         CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
         if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
+            return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
         // Write and commit header, data
         try {
@@ -61,7 +177,10 @@ private:
         } catch (std::exception& e) {
             return error("%s: Serialize or I/O error - %s", __func__, e.what());
         }
+        FileCommit(fileout.Get());
         fileout.fclose();
+        if (!RenameOver(pathTmp, pathDB))
+            return error("%s: Failed to rename %s", __func__, pathTmp.string());
 
         LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
 
@@ -110,7 +229,11 @@ private:
             return IncorrectHash;
         }
 
+        return ReadStream(ssObj, objToLoad, fDryRun, nStart);
+    }
 
+    ReadResult ReadStream(CDataStream& ssObj, T& objToLoad, bool fDryRun, int64_t nStart)
+    {
         unsigned char pchMsgTmp[4];
         std::string strMagicMessageTmp;
         try {
@@ -154,15 +277,46 @@ private:
 
 
 public:
-    CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn)
+    CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn, bool fJournal = false)
+        : fDumpRunning(false),
+          nDumps(0),
+          nLastPauseMicros(0),
+          nMaxPauseMicros(0),
+          nLastWriteMillis(0)
     {
         pathDB = GetDataDir() / strFilenameIn;
         strFilename = strFilenameIn;
         strMagicMessage = strMagicMessageIn;
+        if (fJournal)
+            pjournal.reset(new CFlatDBJournal(GetDataDir() / (strFilenameIn + ".journal")));
+    }
+
+    ~CFlatDB()
+    {
+        WaitForDump();
     }
 
     bool Load(T& objToLoad)
     {
+        // the plain file is only read when there is no journal to replay yet
+        if (pjournal && pjournal->Exists()) {
+            LogPrintf("Reading info from %s.journal...\n", strFilename);
+            int64_t nStart = GetTimeMillis();
+            std::vector<unsigned char> vchData;
+            if (pjournal->Read(vchData)) {
+                CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+                ReadResult readResult = ReadStream(ssObj, objToLoad, false, nStart);
+                if (readResult == IncorrectFormat) {
+                    LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
+                } else if (readResult != Ok) {
+                    LogPrintf("%s: File format is unknown or invalid, please fix it manually\n", __func__);
+                    return false;
+                }
+                return true;
+            }
+            LogPrintf("Nothing to replay in %s.journal\n", strFilename);
+        }
+
         LogPrintf("Reading info from %s...\n", strFilename);
         ReadResult readResult = Read(objToLoad);
         if (readResult == FileError)
@@ -182,8 +336,18 @@ public:
 
     bool Dump(T& objToSave)
     {
+        WaitForDump();
         int64_t nStart = GetTimeMillis();
 
+        // the records of the journal were checked when it was read
+        if (pjournal) {
+            LogPrintf("Writting info to %s.journal...\n", strFilename);
+            if (!Write(objToSave))
+                return false;
+            LogPrintf("%s dump finished  %dms\n", strFilename, GetTimeMillis() - nStart);
+            return true;
+        }
+
         LogPrintf("Verifying %s format...\n", strFilename);
         T tmpObjToLoad;
         ReadResult readResult = Read(tmpObjToLoad, true);
@@ -207,6 +371,51 @@ public:
 
         return true;
     }
+
+    /**
+     * Dump objToSave from a background thread. The caller is only held up, with the
+     * locks of objToSave, while a snapshot of it is copied; serializing and writing
+     * the snapshot happen on the thread. False if the previous dump is still running.
+     */
+    bool DumpInBackground(const T& objToSave, int64_t& nPauseMicrosRet)
+    {
+        {
+            LOCK(csDump);
+            if (fDumpRunning)
+                return false;
+            fDumpRunning = true;
+        }
+        WaitForDump();
+
+        int64_t nStart = GetTimeMicros();
+        std::shared_ptr<T> pSnapshot(new T());
+        objToSave.GetSnapshot(*pSnapshot);
+        nPauseMicrosRet = GetTimeMicros() - nStart;
+        {
+            LOCK(csDump);
+            nDumps++;
+            nLastPauseMicros = nPauseMicrosRet;
+            nMaxPauseMicros = std::max(nMaxPauseMicros, nPauseMicrosRet);
+        }
+
+        threadDump = boost::thread(&CFlatDB<T>::WriteSnapshot, this, pSnapshot);
+        return true;
+    }
+
+    void WaitForDump()
+    {
+        if (threadDump.joinable())
+            threadDump.join();
+    }
+
+    void GetDumpStats(int& nDumpsRet, int64_t& nLastPauseMicrosRet, int64_t& nMaxPauseMicrosRet, int64_t& nLastWriteMillisRet) const
+    {
+        LOCK(csDump);
+        nDumpsRet = nDumps;
+        nLastPauseMicrosRet = nLastPauseMicros;
+        nMaxPauseMicrosRet = nMaxPauseMicros;
+        nLastWriteMillisRet = nLastWriteMillis;
+    }
 };
 
 
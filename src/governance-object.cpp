@@ -8,6 +8,7 @@
 #include "governance-object.h"
 #include "governance-vote.h"
 #include "masternodeman.h"
+#include "memusage.h"
 #include "util.h"
 
 #include <univalue.h>
@@ -34,6 +35,7 @@ CGovernanceObject::CGovernanceObject()
   fExpired(false),
   fUnparsable(false),
   mapCurrentMNVotes(),
+  voteTally(),
   mapOrphanVotes(),
   fileVotes()
 {
@@ -62,6 +64,7 @@ CGovernanceObject::CGovernanceObject(uint256 nHashParentIn, int nRevisionIn, int
   fExpired(false),
   fUnparsable(false),
   mapCurrentMNVotes(),
+  voteTally(),
   mapOrphanVotes(),
   fileVotes()
 {
@@ -90,6 +93,7 @@ CGovernanceObject::CGovernanceObject(const CGovernanceObject& other)
   fExpired(other.fExpired),
   fUnparsable(other.fUnparsable),
   mapCurrentMNVotes(other.mapCurrentMNVotes),
+  voteTally(other.voteTally),
   mapOrphanVotes(other.mapOrphanVotes),
   fileVotes(other.fileVotes)
 {}
@@ -187,10 +191,20 @@ bool CGovernanceObject::ProcessVote(CNode* pfrom,
         exception = CGovernanceException(ostr.str(), GOVERNANCE_EXCEPTION_PERMANENT_ERROR);
         return false;
     }
-    voteInstance = vote_instance_t(vote.GetOutcome(), nVoteTimeUpdate, vote.GetTimestamp());
-    if(!fileVotes.HasVote(vote.GetHash())) {
-        fileVotes.AddVote(vote);
+    if(!fileVotes.AddVote(vote)) {
+        std::ostringstream ostr;
+        ostr << "CGovernanceObject::ProcessVote -- Unable to store governance vote "
+             << ", MN outpoint = " << vote.GetVinMasternode().prevout.ToStringShort()
+             << ", governance object hash = " << GetHash().ToString() << "\n";
+        LogPrintf(ostr.str().c_str());
+        exception = CGovernanceException(ostr.str(), GOVERNANCE_EXCEPTION_PERMANENT_ERROR);
+        return false;
     }
+    // IsValid(true) above checked it against the current masternode key
+    fileVotes.SetVoteValidated(vote.GetHash());
+    voteTally.Add(eSignal, voteInstance.eOutcome, -1);
+    voteInstance = vote_instance_t(vote.GetOutcome(), nVoteTimeUpdate, vote.GetTimestamp());
+    voteTally.Add(eSignal, voteInstance.eOutcome, 1);
     fDirtyCache = true;
     return true;
 }
@@ -208,6 +222,31 @@ void CGovernanceObject::RebuildVoteMap()
         }
     }
     mapCurrentMNVotes = mapMNVotesNew;
+    RebuildVoteTally();
+}
+
+void CGovernanceObject::GetVoteMemoryUsage(size_t& nVoteStoreBytesRet, size_t& nVoteRecordBytesRet) const
+{
+    nVoteStoreBytesRet = fileVotes.DynamicMemoryUsage();
+    nVoteRecordBytesRet = memusage::DynamicUsage(mapCurrentMNVotes);
+    for(vote_m_cit it = mapCurrentMNVotes.begin(); it != mapCurrentMNVotes.end(); ++it) {
+        nVoteRecordBytesRet += memusage::DynamicUsage(it->second.mapInstances);
+    }
+}
+
+void CGovernanceObject::AddToVoteTally(const vote_rec_t& recVote, int nDelta)
+{
+    for(vote_instance_m_cit it = recVote.mapInstances.begin(); it != recVote.mapInstances.end(); ++it) {
+        voteTally.Add(it->first, it->second.eOutcome, nDelta);
+    }
+}
+
+void CGovernanceObject::RebuildVoteTally()
+{
+    voteTally = vote_tally_t();
+    for(vote_m_cit it = mapCurrentMNVotes.begin(); it != mapCurrentMNVotes.end(); ++it) {
+        AddToVoteTally(it->second, 1);
+    }
 }
 
 void CGovernanceObject::ClearMasternodeVotes()
@@ -227,6 +266,7 @@ void CGovernanceObject::ClearMasternodeVotes()
         }
 
         if(fRemove) {
+            AddToVoteTally(it->second, -1);
             mapCurrentMNVotes.erase(it++);
         }
         else {
@@ -604,19 +644,7 @@ bool CGovernanceObject::IsCollateralValid(std::string& strError)
 
 int CGovernanceObject::CountMatchingVotes(vote_signal_enum_t eVoteSignalIn, vote_outcome_enum_t eVoteOutcomeIn) const
 {
-    int nCount = 0;
-    for(vote_m_cit it = mapCurrentMNVotes.begin(); it != mapCurrentMNVotes.end(); ++it) {
-        const vote_rec_t& recVote = it->second;
-        vote_instance_m_cit it2 = recVote.mapInstances.find(eVoteSignalIn);
-        if(it2 == recVote.mapInstances.end()) {
-            continue;
-        }
-        const vote_instance_t& voteInstance = it2->second;
-        if(voteInstance.eOutcome == eVoteOutcomeIn) {
-            ++nCount;
-        }
-    }
-    return nCount;
+    return voteTally.Get(eVoteSignalIn, eVoteOutcomeIn);
 }
 
 /**
@@ -102,6 +102,38 @@ struct vote_rec_t {
      }
 };
 
+/**
+ * Number of current masternode votes by signal and outcome, kept up to date as votes
+ * come in so that the vote counts do not walk every masternode's vote record.
+ * Only the supported signals and the yes, no and abstain outcomes are counted.
+ */
+struct vote_tally_t {
+    int anCounts[MAX_SUPPORTED_VOTE_SIGNAL + 1][VOTE_OUTCOME_ABSTAIN + 1];
+
+    vote_tally_t()
+    {
+        memset(anCounts, 0, sizeof(anCounts));
+    }
+
+    static bool IsCounted(int nSignal, int nOutcome)
+    {
+        return nSignal >= 0 && nSignal <= MAX_SUPPORTED_VOTE_SIGNAL &&
+               nOutcome > VOTE_OUTCOME_NONE && nOutcome <= VOTE_OUTCOME_ABSTAIN;
+    }
+
+    void Add(int nSignal, int nOutcome, int nDelta)
+    {
+        if(IsCounted(nSignal, nOutcome)) {
+            anCounts[nSignal][nOutcome] += nDelta;
+        }
+    }
+
+    int Get(int nSignal, int nOutcome) const
+    {
+        return IsCounted(nSignal, nOutcome) ? anCounts[nSignal][nOutcome] : 0;
+    }
+};
+
 /**
 * Governance Object
 *
@@ -182,6 +214,9 @@ private:
 
     vote_m_t mapCurrentMNVotes;
 
+    /// Tally of mapCurrentMNVotes
+    vote_tally_t voteTally;
+
     /// Limited map of votes orphaned by MN
     vote_mcache_t mapOrphanVotes;
 
@@ -250,6 +285,13 @@ public:
         return fileVotes;
     }
 
+    const CGovernanceObjectVoteFile& GetVoteFile() const {
+        return fileVotes;
+    }
+
+    /// Heap memory used by the masternode vote records and the vote file
+    void GetVoteMemoryUsage(size_t& nVoteStoreBytesRet, size_t& nVoteRecordBytesRet) const;
+
     // Signature related functions
 
     void SetMasternodeInfo(const CTxIn& vin);
@@ -321,6 +363,9 @@ public:
             READWRITE(nDeletionTime);
             READWRITE(fExpired);
             READWRITE(mapCurrentMNVotes);
+            if(ser_action.ForRead()) {
+                RebuildVoteTally();
+            }
             READWRITE(fileVotes);
             LogPrint("gobject", "CGovernanceObject::SerializationOp hash = %s, vote count = %d\n", GetHash().ToString(), fileVotes.GetVoteCount());
         }
@@ -345,6 +390,10 @@ private:
 
     void RebuildVoteMap();
 
+    void AddToVoteTally(const vote_rec_t& recVote, int nDelta);
+
+    void RebuildVoteTally();
+
     /// Called when MN's which have voted on this object have been removed
     void ClearMasternodeVotes();
 
@@ -11,6 +11,7 @@
 using namespace std;
 
 class CGovernanceVote;
+class CMessageSignatureCheck;
 
 // INTENTION OF MASTERNODES REGARDING ITEM
 enum vote_outcome_enum_t  {
@@ -118,8 +119,19 @@ public:
 
     void SetSignature(const std::vector<unsigned char>& vchSigIn) { vchSig = vchSigIn; }
 
+    const std::vector<unsigned char>& GetSignature() const { return vchSig; }
+
+    /// The message signed by the masternode
+    std::string GetSignatureMessage() const;
+
+    /// Prepare the signature check for parallel verification, false if the masternode is unknown
+    bool GetSignatureCheck(CMessageSignatureCheck& checkRet) const;
+
     bool Sign(CKey& keyMasternode, CPubKey& pubKeyMasternode);
     bool IsValid(bool fSignatureCheck) const;
+
+    /// fMasternodeMissing is set when the vote failed only because its masternode is unknown
+    bool IsValid(bool fSignatureCheck, bool& fMasternodeMissing) const;
     void Relay() const;
 
     std::string GetVoteString() const {
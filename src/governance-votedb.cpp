@@ -3,93 +3,280 @@
 
 #include "governance-votedb.h"
 
+#include "crypto/common.h"
+#include "memusage.h"
+
+const uint32_t CGovernanceObjectVoteFile::INDEX_EMPTY;
+
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile()
     : nMemoryVotes(0),
-      listVotes(),
-      mapVoteIndex()
+      nParentHash(),
+      vecRecords(),
+      vchBlobs(),
+      vecIndex(),
+      nRemovedVotes(0),
+      nUncheckedVotes(0),
+      nUnknownMasternodeVotes(0)
 {}
 
-CGovernanceObjectVoteFile::CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other)
-    : nMemoryVotes(other.nMemoryVotes),
-      listVotes(other.listVotes),
-      mapVoteIndex()
+bool CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
 {
-    RebuildIndex();
-}
+    const std::vector<unsigned char>& vchSig = vote.GetSignature();
+    const CTxIn& vinMasternode = vote.GetVinMasternode();
+    if(int(vote.GetSignal()) < 0 || int(vote.GetSignal()) > 0xff ||
+       int(vote.GetOutcome()) < 0 || int(vote.GetOutcome()) > 0xff ||
+       vchSig.size() > 0xff || vinMasternode.scriptSig.size() > 0xffff) {
+        return false;
+    }
+    if(vecRecords.empty()) {
+        nParentHash = vote.GetParentHash();
+    }
+    else if(vote.GetParentHash() != nParentHash) {
+        return false;
+    }
 
-void CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
-{
-    listVotes.push_front(vote);
-    mapVoteIndex[vote.GetHash()] = listVotes.begin();
+    if((vecRecords.size() + 1) * 2 > vecIndex.size()) {
+        RebuildIndex((vecRecords.size() + 1) * 2);
+    }
+    uint256 nHash = vote.GetHash();
+    size_t nSlot = FindSlot(nHash);
+    if(vecIndex[nSlot] != INDEX_EMPTY && !(vecRecords[vecIndex[nSlot]].nFlags & VOTE_REMOVED)) {
+        return true;
+    }
+
+    CVoteRecord rec;
+    rec.nHash = nHash;
+    rec.outpointMasternode = vinMasternode.prevout;
+    rec.nBlobPos = vchBlobs.size();
+    rec.nTime = vote.GetTimestamp();
+    rec.nScriptSize = vinMasternode.scriptSig.size();
+    rec.nSigSize = vchSig.size();
+    rec.nSignal = vote.GetSignal();
+    rec.nOutcome = vote.GetOutcome();
+    rec.nFlags = 0;
+    vchBlobs.insert(vchBlobs.end(), vchSig.begin(), vchSig.end());
+    if(!vinMasternode.scriptSig.empty() || vinMasternode.nSequence != std::numeric_limits<uint32_t>::max()) {
+        rec.nFlags |= VOTE_CUSTOM_INPUT;
+        unsigned char vchSequence[4];
+        WriteLE32(vchSequence, vinMasternode.nSequence);
+        vchBlobs.insert(vchBlobs.end(), vchSequence, vchSequence + 4);
+        vchBlobs.insert(vchBlobs.end(), vinMasternode.scriptSig.begin(), vinMasternode.scriptSig.end());
+    }
+
+    // a removed vote with the same hash hands its slot over
+    vecIndex[nSlot] = vecRecords.size();
+    vecRecords.push_back(rec);
     ++nMemoryVotes;
+    ++nUncheckedVotes;
+    return true;
 }
 
 bool CGovernanceObjectVoteFile::HasVote(const uint256& nHash) const
 {
-    vote_m_cit it = mapVoteIndex.find(nHash);
-    if(it == mapVoteIndex.end()) {
-        return false;
-    }
-    return true;
+    return FindRecord(nHash) >= 0;
 }
 
 bool CGovernanceObjectVoteFile::GetVote(const uint256& nHash, CGovernanceVote& vote) const
 {
-    vote_m_cit it = mapVoteIndex.find(nHash);
-    if(it == mapVoteIndex.end()) {
+    int nPos = FindRecord(nHash);
+    if(nPos < 0) {
         return false;
     }
-    vote = *(it->second);
+    GetVoteAt(nPos, vote);
     return true;
 }
 
 std::vector<CGovernanceVote> CGovernanceObjectVoteFile::GetVotes() const
 {
     std::vector<CGovernanceVote> vecResult;
-    for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
-        vecResult.push_back(*it);
+    vecResult.reserve(nMemoryVotes);
+    for(size_t i = vecRecords.size(); i-- > 0; ) {
+        if(!(vecRecords[i].nFlags & VOTE_REMOVED)) {
+            vecResult.push_back(CGovernanceVote());
+            GetVoteAt(i, vecResult.back());
+        }
     }
     return vecResult;
 }
 
-void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const CTxIn& vinMasternode)
+void CGovernanceObjectVoteFile::SetVoteValidated(const uint256& nHash)
+{
+    int nPos = FindRecord(nHash);
+    if(nPos >= 0 && !(vecRecords[nPos].nFlags & VOTE_VALIDATED)) {
+        vecRecords[nPos].nFlags |= VOTE_VALIDATED;
+        --nUncheckedVotes;
+    }
+}
+
+int CGovernanceObjectVoteFile::ValidateVotes()
 {
-    vote_l_it it = listVotes.begin();
-    while(it != listVotes.end()) {
-        if(it->GetVinMasternode() == vinMasternode) {
-            --nMemoryVotes;
-            mapVoteIndex.erase(it->GetHash());
-            listVotes.erase(it++);
+    CGovernanceVote vote;
+    bool fMasternodeMissing;
+    for(size_t i = 0; i < vecRecords.size() && nUncheckedVotes > nUnknownMasternodeVotes; ++i) {
+        CVoteRecord& rec = vecRecords[i];
+        if(rec.nFlags & (VOTE_REMOVED | VOTE_VALIDATED | VOTE_MASTERNODE_UNKNOWN)) {
+            continue;
+        }
+        GetVoteAt(i, vote);
+        if(vote.IsValid(true, fMasternodeMissing)) {
+            rec.nFlags |= VOTE_VALIDATED;
+            --nUncheckedVotes;
+        }
+        else if(fMasternodeMissing) {
+            rec.nFlags |= VOTE_MASTERNODE_UNKNOWN;
+            ++nUnknownMasternodeVotes;
         }
         else {
-            ++it;
+            // the vote was accepted before, so its masternode changed key since
+            RemoveAt(i);
+        }
+    }
+    if(nRemovedVotes > nMemoryVotes) {
+        Compact();
+    }
+    return GetValidatedVoteCount();
+}
+
+void CGovernanceObjectVoteFile::RecheckUnknownMasternodeVotes()
+{
+    for(size_t i = 0; i < vecRecords.size() && nUnknownMasternodeVotes > 0; ++i) {
+        CVoteRecord& rec = vecRecords[i];
+        if(rec.nFlags & VOTE_MASTERNODE_UNKNOWN) {
+            rec.nFlags &= ~VOTE_MASTERNODE_UNKNOWN;
+            --nUnknownMasternodeVotes;
+        }
+    }
+}
+
+int CGovernanceObjectVoteFile::GetValidatedVoteCount() const
+{
+    return nMemoryVotes - nUncheckedVotes;
+}
+
+void CGovernanceObjectVoteFile::InvalidateVotesFromMasternode(const CTxIn& vinMasternode)
+{
+    for(size_t i = 0; i < vecRecords.size(); ++i) {
+        CVoteRecord& rec = vecRecords[i];
+        if(rec.outpointMasternode == vinMasternode.prevout && (rec.nFlags & (VOTE_REMOVED | VOTE_VALIDATED)) == VOTE_VALIDATED) {
+            rec.nFlags &= ~VOTE_VALIDATED;
+            ++nUncheckedVotes;
+        }
+    }
+}
+
+void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const CTxIn& vinMasternode)
+{
+    for(size_t i = 0; i < vecRecords.size(); ++i) {
+        if(vecRecords[i].outpointMasternode == vinMasternode.prevout && !(vecRecords[i].nFlags & VOTE_REMOVED)) {
+            RemoveAt(i);
         }
     }
+    if(nRemovedVotes > nMemoryVotes) {
+        Compact();
+    }
 }
 
-CGovernanceObjectVoteFile& CGovernanceObjectVoteFile::operator=(const CGovernanceObjectVoteFile& other)
+size_t CGovernanceObjectVoteFile::DynamicMemoryUsage() const
 {
-    nMemoryVotes = other.nMemoryVotes;
-    listVotes = other.listVotes;
-    RebuildIndex();
-    return *this;
+    return memusage::DynamicUsage(vecRecords) + memusage::DynamicUsage(vchBlobs) + memusage::DynamicUsage(vecIndex);
 }
 
-void CGovernanceObjectVoteFile::RebuildIndex()
+void CGovernanceObjectVoteFile::Clear()
 {
-    mapVoteIndex.clear();
     nMemoryVotes = 0;
-    vote_l_it it = listVotes.begin();
-    while(it != listVotes.end()) {
-        CGovernanceVote& vote = *it;
-        uint256 nHash = vote.GetHash();
-        if(mapVoteIndex.find(nHash) == mapVoteIndex.end()) {
-            mapVoteIndex[nHash] = it;
-            ++nMemoryVotes;
-            ++it;
+    nParentHash = uint256();
+    vecRecords.clear();
+    vchBlobs.clear();
+    vecIndex.clear();
+    nRemovedVotes = 0;
+    nUncheckedVotes = 0;
+    nUnknownMasternodeVotes = 0;
+}
+
+size_t CGovernanceObjectVoteFile::FindSlot(const uint256& nHash) const
+{
+    size_t nMask = vecIndex.size() - 1;
+    size_t nSlot = nHash.GetCheapHash() & nMask;
+    while(vecIndex[nSlot] != INDEX_EMPTY && vecRecords[vecIndex[nSlot]].nHash != nHash) {
+        nSlot = (nSlot + 1) & nMask;
+    }
+    return nSlot;
+}
+
+int CGovernanceObjectVoteFile::FindRecord(const uint256& nHash) const
+{
+    if(vecIndex.empty()) {
+        return -1;
+    }
+    uint32_t nPos = vecIndex[FindSlot(nHash)];
+    if(nPos == INDEX_EMPTY || (vecRecords[nPos].nFlags & VOTE_REMOVED)) {
+        return -1;
+    }
+    return nPos;
+}
+
+void CGovernanceObjectVoteFile::GetVoteAt(size_t nPos, CGovernanceVote& vote) const
+{
+    const CVoteRecord& rec = vecRecords[nPos];
+    const unsigned char* pBlob = vchBlobs.data() + rec.nBlobPos;
+    CTxIn vinMasternode(rec.outpointMasternode);
+    if(rec.nFlags & VOTE_CUSTOM_INPUT) {
+        const unsigned char* pInput = pBlob + rec.nSigSize;
+        vinMasternode.nSequence = ReadLE32(pInput);
+        vinMasternode.scriptSig = CScript(pInput + 4, pInput + 4 + rec.nScriptSize);
+    }
+    vote = CGovernanceVote(vinMasternode, nParentHash, vote_signal_enum_t(rec.nSignal), vote_outcome_enum_t(rec.nOutcome));
+    vote.SetTime(rec.nTime);
+    vote.SetSignature(std::vector<unsigned char>(pBlob, pBlob + rec.nSigSize));
+}
+
+void CGovernanceObjectVoteFile::RemoveAt(size_t nPos)
+{
+    CVoteRecord& rec = vecRecords[nPos];
+    if(!(rec.nFlags & VOTE_VALIDATED)) {
+        --nUncheckedVotes;
+    }
+    if(rec.nFlags & VOTE_MASTERNODE_UNKNOWN) {
+        rec.nFlags &= ~VOTE_MASTERNODE_UNKNOWN;
+        --nUnknownMasternodeVotes;
+    }
+    rec.nFlags |= VOTE_REMOVED;
+    --nMemoryVotes;
+    ++nRemovedVotes;
+}
+
+void CGovernanceObjectVoteFile::RebuildIndex(size_t nMinSlots)
+{
+    size_t nSlots = 16;
+    while(nSlots < nMinSlots || nSlots < vecRecords.size() * 2) {
+        nSlots *= 2;
+    }
+    vecIndex.assign(nSlots, INDEX_EMPTY);
+    for(size_t i = 0; i < vecRecords.size(); ++i) {
+        if(!(vecRecords[i].nFlags & VOTE_REMOVED)) {
+            vecIndex[FindSlot(vecRecords[i].nHash)] = i;
         }
-        else {
-            listVotes.erase(it++);
+    }
+}
+
+void CGovernanceObjectVoteFile::Compact()
+{
+    std::vector<CVoteRecord> vecRecordsNew;
+    std::vector<unsigned char> vchBlobsNew;
+    vecRecordsNew.reserve(nMemoryVotes);
+    for(size_t i = 0; i < vecRecords.size(); ++i) {
+        CVoteRecord rec = vecRecords[i];
+        if(rec.nFlags & VOTE_REMOVED) {
+            continue;
         }
+        size_t nBlobSize = rec.nSigSize + ((rec.nFlags & VOTE_CUSTOM_INPUT) ? 4 + rec.nScriptSize : 0);
+        std::vector<unsigned char>::const_iterator itBlob = vchBlobs.begin() + rec.nBlobPos;
+        rec.nBlobPos = vchBlobsNew.size();
+        vchBlobsNew.insert(vchBlobsNew.end(), itBlob, itBlob + nBlobSize);
+        vecRecordsNew.push_back(rec);
     }
+    vecRecords.swap(vecRecordsNew);
+    vchBlobs.swap(vchBlobsNew);
+    nRemovedVotes = 0;
+    RebuildIndex(0);
 }
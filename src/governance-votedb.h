@@ -4,54 +4,81 @@
 #ifndef GOVERNANCE_VOTEDB_H
 #define GOVERNANCE_VOTEDB_H
 
-#include <list>
-#include <map>
+#include <algorithm>
+#include <vector>
 
 #include "governance-vote.h"
 #include "serialize.h"
 #include "uint256.h"
 
 /**
- * Represents the collection of votes associated with a given CGovernanceObject
- * Recently received votes are held in memory until a maximum size is reached after
- * which older votes a flushed to a disk file.
+ * Represents the collection of votes associated with a given CGovernanceObject.
  *
- * Note: This is a stub implementation that doesn't limit the number of votes held
- * in memory and doesn't flush to disk.
+ * Votes are kept as fixed size records in one vector, in the order they were added,
+ * with their signatures in a separate blob vector and an open addressing hash index
+ * of record positions. All votes of a file share the parent object hash, which is
+ * stored once. Removed votes are only flagged, the vectors are compacted once most
+ * records are removed ones.
+ *
+ * The file also remembers which votes were found valid against the current key of
+ * their masternode, so that peers syncing the object are sent those without checking
+ * every signature again. A vote is only checked again when its masternode changes key,
+ * or when masternodes are added if its masternode was unknown.
  */
 class CGovernanceObjectVoteFile
 {
-public: // Types
-    typedef std::list<CGovernanceVote> vote_l_t;
-
-    typedef vote_l_t::iterator vote_l_it;
+private:
+    static const uint32_t INDEX_EMPTY = 0xffffffff;
+
+    enum {
+        VOTE_REMOVED = (1 << 0),
+        VOTE_VALIDATED = (1 << 1),
+        /// the masternode input has a scriptSig or sequence, stored in the blob after the signature
+        VOTE_CUSTOM_INPUT = (1 << 2),
+        /// not validated as its masternode was unknown, checked again once masternodes are added
+        VOTE_MASTERNODE_UNKNOWN = (1 << 3),
+    };
+
+    /// A vote without its parent hash and signature
+    struct CVoteRecord {
+        uint256 nHash;
+        COutPoint outpointMasternode;
+        uint32_t nBlobPos;
+        int64_t nTime;
+        uint16_t nScriptSize;
+        uint8_t nSigSize;
+        uint8_t nSignal;
+        uint8_t nOutcome;
+        uint8_t nFlags;
+    };
 
-    typedef vote_l_t::const_iterator vote_l_cit;
+    int nMemoryVotes;
 
-    typedef std::map<uint256,vote_l_it> vote_m_t;
+    uint256 nParentHash;
 
-    typedef vote_m_t::iterator vote_m_it;
+    std::vector<CVoteRecord> vecRecords;
 
-    typedef vote_m_t::const_iterator vote_m_cit;
+    std::vector<unsigned char> vchBlobs;
 
-private:
-    static const int MAX_MEMORY_VOTES = -1;
+    /// Record positions by vote hash, INDEX_EMPTY for free slots, size a power of two
+    std::vector<uint32_t> vecIndex;
 
-    int nMemoryVotes;
+    int nRemovedVotes;
 
-    vote_l_t listVotes;
+    int nUncheckedVotes;
 
-    vote_m_t mapVoteIndex;
+    /// Unchecked votes waiting for their masternode
+    int nUnknownMasternodeVotes;
 
 public:
     CGovernanceObjectVoteFile();
 
-    CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other);
-
     /**
-     * Add a vote to the file
+     * Add a vote to the file unless it has it already. False if the vote does not fit
+     * a record: a vote for another object, or with a signature, signal or outcome out
+     * of the range any valid vote has.
      */
-    void AddVote(const CGovernanceVote& vote);
+    bool AddVote(const CGovernanceVote& vote);
 
     /**
      * Return true if the vote with this hash is currently cached in memory
@@ -63,30 +90,122 @@ public:
      */
     bool GetVote(const uint256& nHash, CGovernanceVote& vote) const;
 
-    int GetVoteCount() {
+    int GetVoteCount() const {
         return nMemoryVotes;
     }
 
+    /**
+     * All votes, the most recently added first
+     */
     std::vector<CGovernanceVote> GetVotes() const;
 
-    CGovernanceObjectVoteFile& operator=(const CGovernanceObjectVoteFile& other);
+    /**
+     * Record that the vote with this hash was found valid against the current
+     * key of its masternode
+     */
+    void SetVoteValidated(const uint256& nHash);
+
+    /**
+     * Check the votes not validated yet, returns the number of validated votes.
+     * Votes that fail for good, like on a bad signature, are removed. Votes of
+     * unknown masternodes are skipped until RecheckUnknownMasternodeVotes.
+     * Requires cs_main and the governance lock, as CGovernanceVote::IsValid does.
+     */
+    int ValidateVotes();
+
+    /**
+     * Have ValidateVotes check the votes of unknown masternodes again, masternodes were added
+     */
+    void RecheckUnknownMasternodeVotes();
+
+    int GetValidatedVoteCount() const;
+
+    /**
+     * Call f with the hash of each vote found valid, as of the last ValidateVotes
+     */
+    template <typename Callable>
+    void ForEachValidatedVote(Callable f) const
+    {
+        for(size_t i = 0; i < vecRecords.size(); ++i) {
+            if((vecRecords[i].nFlags & (VOTE_REMOVED | VOTE_VALIDATED)) == VOTE_VALIDATED) {
+                f(vecRecords[i].nHash);
+            }
+        }
+    }
+
+    /**
+     * Check the votes of this masternode again, its key changed
+     */
+    void InvalidateVotesFromMasternode(const CTxIn& vinMasternode);
 
     void RemoveVotesFromMasternode(const CTxIn& vinMasternode);
 
-    ADD_SERIALIZE_METHODS;
+    /**
+     * Heap memory used by the records, signatures and index
+     */
+    size_t DynamicMemoryUsage() const;
+
+    /**
+     * Same format as the list of votes this file used to keep, the most recently added first
+     */
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        s << nMemoryVotes;
+        WriteCompactSize(s, nMemoryVotes);
+        CGovernanceVote vote;
+        for(size_t i = vecRecords.size(); i-- > 0; ) {
+            if(!(vecRecords[i].nFlags & VOTE_REMOVED)) {
+                GetVoteAt(i, vote);
+                s << vote;
+            }
+        }
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
     {
-        READWRITE(nMemoryVotes);
-        READWRITE(listVotes);
-        if(ser_action.ForRead()) {
-            RebuildIndex();
+        Clear();
+        int nMemoryVotesIn;
+        s >> nMemoryVotesIn;
+        uint64_t nCount = ReadCompactSize(s);
+        CGovernanceVote vote;
+        for(uint64_t i = 0; i < nCount; ++i) {
+            s >> vote;
+            // of duplicates, the first in the list is kept
+            AddVote(vote);
         }
+        std::reverse(vecRecords.begin(), vecRecords.end());
+        vecRecords.shrink_to_fit();
+        vchBlobs.shrink_to_fit();
+        RebuildIndex(0);
     }
+
 private:
-    void RebuildIndex();
+    void Clear();
+
+    /// Position of the index slot for this hash, either empty or pointing at its record
+    size_t FindSlot(const uint256& nHash) const;
+
+    /// Position of the record of the vote with this hash, -1 if none or removed
+    int FindRecord(const uint256& nHash) const;
+
+    void GetVoteAt(size_t nPos, CGovernanceVote& vote) const;
+
+    void RemoveAt(size_t nPos);
+
+    /// Grow the index to keep it at most half full, and rebuild it
+    void RebuildIndex(size_t nMinSlots);
 
+    /// Drop the removed records and their signatures
+    void Compact();
 };
 
 #endif
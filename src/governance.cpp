@@ -77,6 +77,22 @@ int CGovernanceManager::GetVoteCount() const
     return (int)mapVoteToObject.GetSize();
 }
 
+void CGovernanceManager::GetVoteMemoryUsage(int& nObjectsRet, int& nVotesRet, size_t& nVoteStoreBytesRet, size_t& nVoteRecordBytesRet) const
+{
+    LOCK(cs);
+    nObjectsRet = mapObjects.size();
+    nVotesRet = 0;
+    nVoteStoreBytesRet = 0;
+    nVoteRecordBytesRet = 0;
+    for(object_m_cit it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        size_t nVoteStoreBytes, nVoteRecordBytes;
+        it->second.GetVoteMemoryUsage(nVoteStoreBytes, nVoteRecordBytes);
+        nVotesRet += it->second.GetVoteFile().GetVoteCount();
+        nVoteStoreBytesRet += nVoteStoreBytes;
+        nVoteRecordBytesRet += nVoteRecordBytes;
+    }
+}
+
 bool CGovernanceManager::SerializeVoteForHash(uint256 nHash, CDataStream& ss)
 {
     LOCK(cs);
@@ -467,6 +483,8 @@ void CGovernanceManager::UpdateCachesAndClean()
         it->second.fDirtyCache = true;
     }
 
+    InvalidateRekeyedMasternodeVotes();
+
     // DOUBLE CHECK THAT WE HAVE A VALID POINTER TO TIP
 
     if(!pCurrentBlockIndex) return;
@@ -797,17 +815,18 @@ void CGovernanceManager::Sync(CNode* pfrom, const uint256& nProp, const CBloomFi
             pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT, it->first));
             ++nObjCount;
 
-            std::vector<CGovernanceVote> vecVotes = govobj.GetVoteFile().GetVotes();
-            for(size_t i = 0; i < vecVotes.size(); ++i) {
-                if(!vecVotes[i].IsValid(true)) {
-                    continue;
-                }
-                if(filter.contains(vecVotes[i].GetHash())) {
-                    continue;
+            // Only votes not validated yet or from rekeyed masternodes are checked here,
+            // the others were checked against the current masternode key before
+            InvalidateRekeyedMasternodeVotes();
+            CGovernanceObjectVoteFile& fileVotes = govobj.GetVoteFile();
+            fileVotes.ValidateVotes();
+            fileVotes.ForEachValidatedVote([&](const uint256& nHashVote) {
+                if(filter.contains(nHashVote)) {
+                    return;
                 }
-                pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT_VOTE, vecVotes[i].GetHash()));
+                pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT_VOTE, nHashVote));
                 ++nVoteCount;
-            }
+            });
         }
     }
 
@@ -989,12 +1008,27 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
     return fOk;
 }
 
+void CGovernanceManager::InvalidateRekeyedMasternodeVotes()
+{
+    std::vector<CTxIn> vecRekeyed = mnodeman.GetAndClearRekeyedMasternodes();
+    if(vecRekeyed.empty()) {
+        return;
+    }
+    LogPrint("gobject", "CGovernanceManager::InvalidateRekeyedMasternodeVotes -- %d masternodes changed key\n", vecRekeyed.size());
+    for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        for(size_t i = 0; i < vecRekeyed.size(); ++i) {
+            it->second.GetVoteFile().InvalidateVotesFromMasternode(vecRekeyed[i]);
+        }
+    }
+}
+
 void CGovernanceManager::CheckMasternodeOrphanVotes()
 {
     LOCK2(cs_main, cs);
     fRateChecksEnabled = false;
     for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
         it->second.CheckOrphanVotes();
+        it->second.GetVoteFile().RecheckUnknownMasternodeVotes();
     }
     fRateChecksEnabled = true;
 }
@@ -1267,6 +1301,21 @@ void CGovernanceManager::InitOnLoad()
     LogPrintf("     %s\n", ToString());
 }
 
+void CGovernanceManager::GetSnapshot(CGovernanceManager& snapshotRet) const
+{
+    LOCK(cs);
+    snapshotRet.mapSeenGovernanceObjects = mapSeenGovernanceObjects;
+    snapshotRet.mapInvalidVotes = mapInvalidVotes;
+    snapshotRet.mapOrphanVotes = mapOrphanVotes;
+    // copy constructed, assigning a CGovernanceObject leaves its votes behind
+    snapshotRet.mapObjects.clear();
+    snapshotRet.mapObjects.insert(mapObjects.begin(), mapObjects.end());
+    snapshotRet.mapWatchdogObjects = mapWatchdogObjects;
+    snapshotRet.nHashWatchdogCurrent = nHashWatchdogCurrent;
+    snapshotRet.nTimeWatchdogCurrent = nTimeWatchdogCurrent;
+    snapshotRet.mapLastMasternodeObject = mapLastMasternodeObject;
+}
+
 std::string CGovernanceManager::ToString() const
 {
     LOCK(cs);
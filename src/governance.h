@@ -318,6 +318,9 @@ public:
         mapLastMasternodeObject.clear();
     }
 
+    /// Copy what is stored in governance.dat, so that it can be serialized without holding the lock
+    void GetSnapshot(CGovernanceManager& snapshotRet) const;
+
     std::string ToString() const;
 
     ADD_SERIALIZE_METHODS;
@@ -360,6 +363,9 @@ public:
 
     int GetVoteCount() const;
 
+    /// Votes stored and heap memory used by the vote files and masternode vote records of all objects
+    void GetVoteMemoryUsage(int& nObjectsRet, int& nVotesRet, size_t& nVoteStoreBytesRet, size_t& nVoteRecordBytesRet) const;
+
     bool SerializeObjectForHash(uint256 nHash, CDataStream& ss);
 
     bool SerializeVoteForHash(uint256 nHash, CDataStream& ss);
@@ -419,6 +425,9 @@ private:
 
     void CheckOrphanVotes(CGovernanceObject& govobj, CGovernanceException& exception);
 
+    /// Have the votes of masternodes that changed key checked again before they are synced
+    void InvalidateRekeyedMasternodeVotes();
+
     void RebuildIndexes();
 
     /// Returns MN index, handling the case of index rebuilds
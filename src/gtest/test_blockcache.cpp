@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include "blockcache.h"
+#include "random.h"
+#include "version.h"
+
+static CBlock RandomBlock()
+{
+    CBlock block;
+    block.hashPrevBlock = GetRandHash();
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    block.vtx.push_back(mtx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+TEST(BlockCache, ServesParsedAndSerializedBlocks) {
+    CBlockCache cache;
+    CBlock block = RandomBlock();
+    uint256 hash = block.GetHash();
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    EXPECT_TRUE(cache.GetBlock(hash) == NULL);
+    EXPECT_FALSE(cache.GetSerializedBlock(hash, ss));
+    EXPECT_EQ(0, ss.size());
+
+    cache.Add(block);
+    std::shared_ptr<const CBlock> pblock = cache.GetBlock(hash);
+    ASSERT_TRUE(pblock != NULL);
+    EXPECT_EQ(hash, pblock->GetHash());
+    EXPECT_EQ(block.vtx[0].GetHash(), pblock->vtx[0].GetHash());
+
+    // Serialized bytes are appended to what is already in the stream
+    ss << std::string("prefix");
+    size_t nPrefixSize = ss.size();
+    EXPECT_TRUE(cache.GetSerializedBlock(hash, ss));
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << block;
+    EXPECT_EQ(ssExpected.str(), ss.str().substr(nPrefixSize));
+
+    size_t nEntries, nUsage, nMaxUsage;
+    uint64_t nHits, nMisses;
+    cache.GetStats(nEntries, nUsage, nMaxUsage, nHits, nMisses);
+    EXPECT_EQ(1, nEntries);
+    EXPECT_GT(nUsage, ssExpected.size());
+    EXPECT_EQ(2, nHits);
+    EXPECT_EQ(2, nMisses);
+}
+
+TEST(BlockCache, EvictsLeastRecentlyUsed) {
+    CBlockCache cache;
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 3; i++) {
+        vBlocks.push_back(RandomBlock());
+        cache.Add(vBlocks.back());
+    }
+    size_t nEntries, nUsage, nMaxUsage;
+    uint64_t nHits, nMisses;
+    cache.GetStats(nEntries, nUsage, nMaxUsage, nHits, nMisses);
+    ASSERT_EQ(3, nEntries);
+
+    // Use the oldest block so the second one becomes least recently used
+    EXPECT_TRUE(cache.GetBlock(vBlocks[0].GetHash()) != NULL);
+    cache.SetMaxUsage(nUsage - 1);
+    EXPECT_TRUE(cache.GetBlock(vBlocks[0].GetHash()) != NULL);
+    EXPECT_TRUE(cache.GetBlock(vBlocks[1].GetHash()) == NULL);
+    EXPECT_TRUE(cache.GetBlock(vBlocks[2].GetHash()) != NULL);
+
+    // Nothing is cached without a budget
+    cache.SetMaxUsage(0);
+    cache.Add(RandomBlock());
+    cache.GetStats(nEntries, nUsage, nMaxUsage, nHits, nMisses);
+    EXPECT_EQ(0, nEntries);
+    EXPECT_EQ(0, nUsage);
+}
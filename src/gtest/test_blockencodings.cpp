@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+static CTransaction RandomTransaction()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    return mtx;
+}
+
+static CBlock BlockWithTransactions(int nTransactions)
+{
+    CBlock block;
+    CMutableTransaction mtxCoinbase;
+    mtxCoinbase.vin.resize(1);
+    mtxCoinbase.vin[0].prevout.SetNull();
+    mtxCoinbase.vout.resize(1);
+    mtxCoinbase.vout[0].nValue = 50000;
+    block.vtx.push_back(mtxCoinbase);
+    for (int i = 0; i < nTransactions; i++)
+        block.vtx.push_back(RandomTransaction());
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+// What the receiving node gets over the wire
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblock;
+    CBlockHeaderAndShortTxIDs cmpctblockRecv;
+    ss >> cmpctblockRecv;
+    EXPECT_TRUE(ss.empty());
+    return cmpctblockRecv;
+}
+
+TEST(BlockEncodings, RebuildsFromMempool) {
+    CBlock block = BlockWithTransactions(20);
+    CTxMemPool pool(CFeeRate(0));
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        pool.addUnchecked(block.vtx[i].GetHash(), CTxMemPoolEntry(block.vtx[i], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+    EXPECT_EQ(block.vtx.size(), cmpctblock.BlockTxCount());
+    EXPECT_EQ(block.GetHash(), cmpctblock.header.GetHash());
+
+    PartiallyDownloadedBlock partialBlock;
+    ASSERT_EQ(READ_STATUS_OK, partialBlock.InitData(cmpctblock, pool));
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        EXPECT_TRUE(partialBlock.IsTxAvailable(i));
+
+    CBlock blockRebuilt;
+    ASSERT_EQ(READ_STATUS_OK, partialBlock.FillBlock(blockRebuilt, std::vector<CTransaction>()));
+    EXPECT_EQ(block.GetHash(), blockRebuilt.GetHash());
+    ASSERT_EQ(block.vtx.size(), blockRebuilt.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        EXPECT_EQ(block.vtx[i], blockRebuilt.vtx[i]);
+}
+
+TEST(BlockEncodings, RequestsMissingTransactions) {
+    CBlock block = BlockWithTransactions(10);
+    CTxMemPool pool(CFeeRate(0));
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (i % 3 != 0)
+            pool.addUnchecked(block.vtx[i].GetHash(), CTxMemPoolEntry(block.vtx[i], 0, 0, 0.0, 1));
+    }
+
+    CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block));
+    PartiallyDownloadedBlock partialBlock;
+    ASSERT_EQ(READ_STATUS_OK, partialBlock.InitData(cmpctblock, pool));
+
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        EXPECT_EQ(i == 0 || i % 3 != 0, partialBlock.IsTxAvailable(i));
+        if (!partialBlock.IsTxAvailable(i))
+            req.indexes.push_back(i);
+    }
+    ASSERT_EQ(3, req.indexes.size());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << req;
+    BlockTransactionsRequest reqRecv;
+    ss >> reqRecv;
+    EXPECT_EQ(req.indexes, reqRecv.indexes);
+
+    BlockTransactions resp(reqRecv);
+    for (size_t i = 0; i < reqRecv.indexes.size(); i++)
+        resp.txn[i] = block.vtx[reqRecv.indexes[i]];
+
+    // Too few or too many transactions is the peer's fault
+    CBlock blockRebuilt;
+    std::vector<CTransaction> vtxShort(resp.txn.begin(), resp.txn.end() - 1);
+    EXPECT_EQ(READ_STATUS_INVALID, partialBlock.FillBlock(blockRebuilt, vtxShort));
+    std::vector<CTransaction> vtxLong(resp.txn);
+    vtxLong.push_back(RandomTransaction());
+    EXPECT_EQ(READ_STATUS_INVALID, partialBlock.FillBlock(blockRebuilt, vtxLong));
+
+    // A wrong transaction fails the merkle root check, the full block is needed then
+    std::vector<CTransaction> vtxWrong(resp.txn);
+    vtxWrong[0] = RandomTransaction();
+    EXPECT_EQ(READ_STATUS_FAILED, partialBlock.FillBlock(blockRebuilt, vtxWrong));
+
+    ASSERT_EQ(READ_STATUS_OK, partialBlock.FillBlock(blockRebuilt, resp.txn));
+    EXPECT_EQ(block.BuildMerkleTree(), blockRebuilt.BuildMerkleTree());
+}
+
+TEST(BlockEncodings, RejectsMalformedCompactBlocks) {
+    CBlock block = BlockWithTransactions(5);
+    CTxMemPool pool(CFeeRate(0));
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    cmpctblock.prefilledtxn[0].index = block.vtx.size();
+    PartiallyDownloadedBlock partialBlock;
+    EXPECT_EQ(READ_STATUS_INVALID, partialBlock.InitData(cmpctblock, pool));
+
+    CBlockHeaderAndShortTxIDs cmpctblockDuplicate(block);
+    cmpctblockDuplicate.shorttxids[1] = cmpctblockDuplicate.shorttxids[0];
+    EXPECT_EQ(READ_STATUS_FAILED, partialBlock.InitData(cmpctblockDuplicate, pool));
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include "chainparams.h"
+#include "flat-database.h"
+#include "random.h"
+#include "util.h"
+#include "utils.h"
+
+#include <boost/filesystem.hpp>
+
+// Stands in for the masternode caches
+class CTestCache
+{
+public:
+    std::map<uint256, std::string> mapEntries;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(mapEntries);
+    }
+
+    void GetSnapshot(CTestCache& snapshotRet) const { snapshotRet.mapEntries = mapEntries; }
+    void Clear() { mapEntries.clear(); }
+    void CheckAndRemove() {}
+    std::string ToString() const { return strprintf("Entries: %d", mapEntries.size()); }
+
+    void AddEntries(int nCount)
+    {
+        for (int i = 0; i < nCount; i++)
+            mapEntries[GetRandHash()] = std::string(100 + GetRandInt(200), 'a' + i % 26);
+    }
+};
+
+class FlatDBTest : public TempDatadirTest {
+protected:
+    virtual void SetUp() {
+        SelectParams(CBaseChainParams::MAIN);
+        TempDatadirTest::SetUp();
+    }
+
+    uint64_t JournalSize() {
+        return boost::filesystem::file_size(pathTemp / "test.dat.journal");
+    }
+};
+
+TEST_F(FlatDBTest, JournalAppendsChanges) {
+    CTestCache cache;
+    cache.AddEntries(2000);
+    CFlatDB<CTestCache> flatdb("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdb.Dump(cache));
+    uint64_t nSizeFirst = JournalSize();
+
+    // A few changed entries only add the chunks around them
+    cache.mapEntries.erase(cache.mapEntries.begin());
+    cache.mapEntries.begin()->second = "changed";
+    cache.AddEntries(1);
+    ASSERT_TRUE(flatdb.Dump(cache));
+    EXPECT_LT(JournalSize() - nSizeFirst, nSizeFirst / 4);
+
+    CTestCache cacheLoaded;
+    CFlatDB<CTestCache> flatdbLoad("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdbLoad.Load(cacheLoaded));
+    EXPECT_EQ(cache.mapEntries, cacheLoaded.mapEntries);
+    EXPECT_FALSE(boost::filesystem::exists(pathTemp / "test.dat"));
+}
+
+TEST_F(FlatDBTest, JournalReplayStopsAtDamagedWrite) {
+    CTestCache cache;
+    cache.AddEntries(500);
+    CTestCache cacheFirst = cache;
+    {
+        CFlatDB<CTestCache> flatdb("test.dat", "magicTestCache", true);
+        ASSERT_TRUE(flatdb.Dump(cache));
+        cache.AddEntries(100);
+        ASSERT_TRUE(flatdb.Dump(cache));
+    }
+
+    // As if the node crashed while appending the second write
+    boost::filesystem::resize_file(pathTemp / "test.dat.journal", JournalSize() - 10);
+    uint64_t nSizeDamaged = JournalSize();
+
+    CTestCache cacheLoaded;
+    CFlatDB<CTestCache> flatdb("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdb.Load(cacheLoaded));
+    EXPECT_EQ(cacheFirst.mapEntries, cacheLoaded.mapEntries);
+    EXPECT_LT(JournalSize(), nSizeDamaged);
+
+    // and the next write follows the last good one
+    ASSERT_TRUE(flatdb.Dump(cache));
+    CFlatDB<CTestCache> flatdbLoad("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdbLoad.Load(cacheLoaded));
+    EXPECT_EQ(cache.mapEntries, cacheLoaded.mapEntries);
+}
+
+TEST_F(FlatDBTest, JournalStartsFromPlainFile) {
+    CTestCache cache;
+    cache.AddEntries(100);
+    ASSERT_TRUE(CFlatDB<CTestCache>("test.dat", "magicTestCache").Dump(cache));
+
+    CTestCache cacheLoaded;
+    CFlatDB<CTestCache> flatdb("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdb.Load(cacheLoaded));
+    EXPECT_EQ(cache.mapEntries, cacheLoaded.mapEntries);
+    ASSERT_TRUE(flatdb.Dump(cacheLoaded));
+    EXPECT_TRUE(boost::filesystem::exists(pathTemp / "test.dat.journal"));
+
+    // A cache for another purpose is not loaded from it
+    CTestCache cacheOther;
+    CFlatDB<CTestCache> flatdbOther("test.dat", "magicOtherCache", true);
+    EXPECT_FALSE(flatdbOther.Load(cacheOther));
+}
+
+TEST_F(FlatDBTest, JournalCompactsWhileWriting) {
+    CFlatDBJournal journal(pathTemp / "test.journal");
+    std::vector<unsigned char> vchData;
+    for (int i = 0; i < 20; i++) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        for (int j = 0; j < 10000; j++)
+            ss << GetRandHash();
+        vchData.assign(ss.begin(), ss.end());
+        ASSERT_TRUE(journal.Write(ss));
+    }
+    journal.WaitForCompaction();
+
+    uint64_t nFileSize, nLiveSize;
+    journal.GetStats(nFileSize, nLiveSize);
+    EXPECT_EQ(nFileSize, boost::filesystem::file_size(pathTemp / "test.journal"));
+    EXPECT_LT(nFileSize, 5 * nLiveSize);
+    EXPECT_GE(nLiveSize, vchData.size());
+
+    std::vector<unsigned char> vchRead;
+    CFlatDBJournal journalRead(pathTemp / "test.journal");
+    ASSERT_TRUE(journalRead.Read(vchRead));
+    EXPECT_EQ(vchData, vchRead);
+}
+
+TEST_F(FlatDBTest, DumpsSnapshotInBackground) {
+    CTestCache cache;
+    cache.AddEntries(1000);
+    CTestCache cacheDumped = cache;
+    CFlatDB<CTestCache> flatdb("test.dat", "magicTestCache", true);
+    int64_t nPauseMicros = -1;
+    ASSERT_TRUE(flatdb.DumpInBackground(cache, nPauseMicros));
+    EXPECT_GE(nPauseMicros, 0);
+
+    // Changes made while the dump is written are not in it
+    cache.AddEntries(10);
+    flatdb.WaitForDump();
+    int nDumps;
+    int64_t nLastPauseMicros, nMaxPauseMicros, nLastWriteMillis;
+    flatdb.GetDumpStats(nDumps, nLastPauseMicros, nMaxPauseMicros, nLastWriteMillis);
+    EXPECT_EQ(1, nDumps);
+    EXPECT_EQ(nPauseMicros, nLastPauseMicros);
+    EXPECT_EQ(nPauseMicros, nMaxPauseMicros);
+
+    CTestCache cacheLoaded;
+    CFlatDB<CTestCache> flatdbLoad("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdbLoad.Load(cacheLoaded));
+    EXPECT_EQ(cacheDumped.mapEntries, cacheLoaded.mapEntries);
+
+    // A dump in the foreground waits for the one in the background
+    ASSERT_TRUE(flatdb.DumpInBackground(cache, nPauseMicros));
+    ASSERT_TRUE(flatdb.Dump(cache));
+    CFlatDB<CTestCache> flatdbReload("test.dat", "magicTestCache", true);
+    ASSERT_TRUE(flatdbReload.Load(cacheLoaded));
+    EXPECT_EQ(cache.mapEntries, cacheLoaded.mapEntries);
+}
@@ -0,0 +1,257 @@
+#include <gtest/gtest.h>
+
+#include "bloom.h"
+#include "cachemultimap.h"
+#include "darksend.h"
+#include "governance-votedb.h"
+#include "key.h"
+#include "masternodeman.h"
+#include "memusage.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+#include <list>
+
+class GovernanceVoteFileTest : public ::testing::Test {
+protected:
+    std::vector<CKey> vKeys;
+    std::vector<CTxIn> vMasternodes;
+
+    virtual void TearDown() {
+        mnodeman.Clear();
+    }
+
+    void AddMasternodes(int nCount) {
+        for (int i = 0; i < nCount; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            CTxIn vin(COutPoint(GetRandHash(), 0));
+            CMasternode mn(CService(), vin, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+            ASSERT_TRUE(mnodeman.Add(mn));
+            vKeys.push_back(key);
+            vMasternodes.push_back(vin);
+        }
+    }
+
+    // Signed without CGovernanceVote::Sign, which would put the signature in the cache
+    CGovernanceVote SignedVote(size_t nMasternode, const uint256& nParentHash) {
+        CGovernanceVote vote(vMasternodes[nMasternode], nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+        std::vector<unsigned char> vchSig;
+        EXPECT_TRUE(darkSendSigner.SignMessage(vote.GetSignatureMessage(), vchSig, vKeys[nMasternode]));
+        vote.SetSignature(vchSig);
+        return vote;
+    }
+};
+
+// What CGovernanceManager::Sync sends for one object, minus the network
+static int CountVotesToSync(CGovernanceObjectVoteFile& fileVotes, const CBloomFilter& filter)
+{
+    fileVotes.ValidateVotes();
+    int nCount = 0;
+    fileVotes.ForEachValidatedVote([&](const uint256& nHash) {
+        if (!filter.contains(nHash))
+            ++nCount;
+    });
+    return nCount;
+}
+
+// Timed by the governancevotesync benchmark
+TEST_F(GovernanceVoteFileTest, SyncsProposalWithValidatedVotes) {
+    const int nVotes = 200;
+    AddMasternodes(nVotes);
+    uint256 nParentHash = GetRandHash();
+
+    // As loaded from governance.dat, nothing validated yet
+    CGovernanceObjectVoteFile fileVotes;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < nVotes; i++) {
+        CGovernanceVote vote = SignedVote(i, nParentHash);
+        fileVotes.AddVote(vote);
+        vHashes.push_back(vote.GetHash());
+    }
+    ASSERT_EQ(nVotes, fileVotes.GetVoteCount());
+    EXPECT_EQ(0, fileVotes.GetValidatedVoteCount());
+
+    // The peer has the first 50 votes already
+    CBloomFilter filter(nVotes, 0.0001, GetRandInt(999999), BLOOM_UPDATE_ALL);
+    for (int i = 0; i < 50; i++)
+        filter.insert(vHashes[i]);
+
+    // Sync as it was done before, copying and checking every vote
+    int nCountLegacy = 0;
+    std::vector<CGovernanceVote> vecVotes = fileVotes.GetVotes();
+    for (size_t i = 0; i < vecVotes.size(); ++i) {
+        if (vecVotes[i].IsValid(true) && !filter.contains(vecVotes[i].GetHash()))
+            ++nCountLegacy;
+    }
+
+    int nCountFirst = CountVotesToSync(fileVotes, filter);
+    int nCountCached = CountVotesToSync(fileVotes, filter);
+
+    EXPECT_EQ(nVotes, fileVotes.GetValidatedVoteCount());
+    EXPECT_LE(nCountLegacy, nVotes - 50);
+    EXPECT_GE(nCountLegacy, nVotes - 55);
+    EXPECT_EQ(nCountLegacy, nCountFirst);
+    EXPECT_EQ(nCountLegacy, nCountCached);
+}
+
+TEST_F(GovernanceVoteFileTest, RekeyedMasternodeVotesCheckedAgain) {
+    AddMasternodes(10);
+    uint256 nParentHash = GetRandHash();
+    mnodeman.GetAndClearRekeyedMasternodes();
+
+    CGovernanceObjectVoteFile fileVotes;
+    for (int i = 0; i < 10; i++)
+        fileVotes.AddVote(SignedVote(i, nParentHash));
+    EXPECT_EQ(10, fileVotes.ValidateVotes());
+
+    // Copies keep what was validated
+    CGovernanceObjectVoteFile fileCopy(fileVotes);
+    EXPECT_EQ(10, fileCopy.GetValidatedVoteCount());
+
+    // The votes signed with the old key do not validate anymore
+    CMasternode* pmn = mnodeman.Find(vMasternodes[3]);
+    ASSERT_TRUE(pmn != NULL);
+    CPubKey pubKeyOld = pmn->pubKeyMasternode;
+    CKey keyNew;
+    keyNew.MakeNewKey(true);
+    pmn->pubKeyMasternode = keyNew.GetPubKey();
+    mnodeman.UpdateLookupIndexes(pubKeyOld, pmn);
+
+    std::vector<CTxIn> vecRekeyed = mnodeman.GetAndClearRekeyedMasternodes();
+    ASSERT_EQ(1, vecRekeyed.size());
+    EXPECT_EQ(vMasternodes[3], vecRekeyed[0]);
+    EXPECT_TRUE(mnodeman.GetAndClearRekeyedMasternodes().empty());
+
+    fileVotes.InvalidateVotesFromMasternode(vecRekeyed[0]);
+    EXPECT_EQ(9, fileVotes.GetValidatedVoteCount());
+    EXPECT_EQ(9, fileVotes.ValidateVotes());
+
+    // until the masternode votes again with its new key
+    CGovernanceVote vote(vMasternodes[3], nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_NO);
+    std::vector<unsigned char> vchSig;
+    ASSERT_TRUE(darkSendSigner.SignMessage(vote.GetSignatureMessage(), vchSig, keyNew));
+    vote.SetSignature(vchSig);
+    fileVotes.AddVote(vote);
+    EXPECT_EQ(10, fileVotes.ValidateVotes());
+
+    // Removed votes are not synced
+    fileVotes.RemoveVotesFromMasternode(vMasternodes[5]);
+    EXPECT_EQ(9, fileVotes.GetValidatedVoteCount());
+    EXPECT_EQ(9, fileVotes.ValidateVotes());
+}
+
+TEST_F(GovernanceVoteFileTest, FailedVotesNotCheckedOnEverySync) {
+    AddMasternodes(3);
+    uint256 nParentHash = GetRandHash();
+
+    CGovernanceObjectVoteFile fileVotes;
+    fileVotes.AddVote(SignedVote(0, nParentHash));
+
+    // A bad signature is dropped
+    CGovernanceVote voteBad = SignedVote(1, nParentHash);
+    voteBad.SetSignature(SignedVote(2, nParentHash).GetSignature());
+    fileVotes.AddVote(voteBad);
+
+    // A masternode we do not know yet waits until masternodes are added
+    CKey key;
+    key.MakeNewKey(true);
+    CTxIn vin(COutPoint(GetRandHash(), 0));
+    CGovernanceVote voteUnknown(vin, nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+    std::vector<unsigned char> vchSig;
+    ASSERT_TRUE(darkSendSigner.SignMessage(voteUnknown.GetSignatureMessage(), vchSig, key));
+    voteUnknown.SetSignature(vchSig);
+    fileVotes.AddVote(voteUnknown);
+
+    EXPECT_EQ(1, fileVotes.ValidateVotes());
+    EXPECT_EQ(2, fileVotes.GetVoteCount());
+    EXPECT_FALSE(fileVotes.HasVote(voteBad.GetHash()));
+    EXPECT_TRUE(fileVotes.HasVote(voteUnknown.GetHash()));
+
+    CMasternode mn(CService(), vin, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+    ASSERT_TRUE(mnodeman.Add(mn));
+    EXPECT_EQ(1, fileVotes.ValidateVotes());
+    fileVotes.RecheckUnknownMasternodeVotes();
+    EXPECT_EQ(2, fileVotes.ValidateVotes());
+}
+
+TEST(GovernanceVoteFile, KeepsVotesAcrossRemovalAndReload) {
+    uint256 nParentHash = GetRandHash();
+    CGovernanceObjectVoteFile fileVotes;
+    std::vector<CGovernanceVote> vecVotes;
+    for (int i = 0; i < 2000; i++) {
+        CTxIn vin(COutPoint(GetRandHash(), 0));
+        if (i % 10 == 0)
+            vin.scriptSig = CScript() << OP_TRUE;
+        CGovernanceVote vote(vin, nParentHash, VOTE_SIGNAL_FUNDING, vote_outcome_enum_t(1 + i % 3));
+        vote.SetTime(i);
+        vote.SetSignature(std::vector<unsigned char>(65, i & 0xff));
+        ASSERT_TRUE(fileVotes.AddVote(vote));
+        vecVotes.push_back(vote);
+    }
+    // Duplicates are ignored, votes for another object do not fit
+    EXPECT_TRUE(fileVotes.AddVote(vecVotes[0]));
+    EXPECT_FALSE(fileVotes.AddVote(CGovernanceVote(vecVotes[0].GetVinMasternode(), GetRandHash(), VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES)));
+    ASSERT_EQ(2000, fileVotes.GetVoteCount());
+
+    for (size_t i = 0; i < vecVotes.size(); i++) {
+        CGovernanceVote vote;
+        ASSERT_TRUE(fileVotes.GetVote(vecVotes[i].GetHash(), vote));
+        EXPECT_EQ(vecVotes[i].GetHash(), vote.GetHash());
+        EXPECT_EQ(vecVotes[i].GetSignature(), vote.GetSignature());
+    }
+
+    // Serialized as the list of votes, the most recent first, as governance.dat always had them
+    std::list<CGovernanceVote> listVotes(vecVotes.rbegin(), vecVotes.rend());
+    CDataStream ssList(SER_DISK, PROTOCOL_VERSION);
+    ssList << (int)listVotes.size() << listVotes;
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << fileVotes;
+    EXPECT_EQ(ssList.str(), ss.str());
+
+    CGovernanceObjectVoteFile fileLoaded;
+    ss >> fileLoaded;
+    std::vector<CGovernanceVote> vecLoaded = fileLoaded.GetVotes();
+    ASSERT_EQ(vecVotes.size(), vecLoaded.size());
+    for (size_t i = 0; i < vecLoaded.size(); i++)
+        EXPECT_EQ(vecVotes[vecVotes.size() - 1 - i].GetHash(), vecLoaded[i].GetHash());
+
+    // Far less than the list of votes with a map index over it they were loaded into before
+    size_t nLegacyUsage = vecVotes.size() * (memusage::MallocUsage(sizeof(CGovernanceVote) + 2 * sizeof(void*)) +
+                                             memusage::MallocUsage(65) +
+                                             memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const uint256, void*> >)));
+    EXPECT_LT(fileLoaded.DynamicMemoryUsage() * 2, nLegacyUsage);
+
+    // Removing most votes compacts the store
+    size_t nUsage = fileLoaded.DynamicMemoryUsage();
+    for (size_t i = 0; i < 1500; i++)
+        fileLoaded.RemoveVotesFromMasternode(vecVotes[i].GetVinMasternode());
+    EXPECT_EQ(500, fileLoaded.GetVoteCount());
+    EXPECT_LT(fileLoaded.DynamicMemoryUsage(), nUsage);
+    for (size_t i = 0; i < vecVotes.size(); i++)
+        EXPECT_EQ(i >= 1500, fileLoaded.HasVote(vecVotes[i].GetHash()));
+
+    // and a removed vote can come back
+    ASSERT_TRUE(fileLoaded.AddVote(vecVotes[7]));
+    EXPECT_TRUE(fileLoaded.HasVote(vecVotes[7].GetHash()));
+    EXPECT_EQ(501, fileLoaded.GetVoteCount());
+}
+
+TEST(GovernanceCaches, CopiedMultiMapHasItsOwnIndex) {
+    CacheMultiMap<int, int> mapCopy;
+    {
+        CacheMultiMap<int, int> mapOrig(10);
+        for (int i = 0; i < 5; i++)
+            mapOrig.Insert(i % 2, i);
+        mapCopy = mapOrig;
+        CacheMultiMap<int, int> mapCopyConstructed(mapOrig);
+        mapOrig.Erase(0);
+        EXPECT_TRUE(mapCopyConstructed.HasKey(0));
+    }
+    std::vector<int> vecValues;
+    ASSERT_TRUE(mapCopy.GetAll(0, vecValues));
+    EXPECT_EQ(3u, vecValues.size());
+    mapCopy.Erase(0, 2);
+    EXPECT_EQ(4, mapCopy.GetSize());
+}
@@ -0,0 +1,310 @@
+#include <gtest/gtest.h>
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "main.h"
+#include "masternode-payments.h"
+#include "masternodeman.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "timedata.h"
+
+// Only the key bytes matter to the lookup indexes, so skip real key generation
+static CPubKey RandomPubKey()
+{
+    std::vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    GetRandBytes(vch.data() + 1, 32);
+    return CPubKey(vch);
+}
+
+static CMasternode RandomMasternode()
+{
+    CTxIn vin(COutPoint(GetRandHash(), 0));
+    return CMasternode(CService(), vin, RandomPubKey(), RandomPubKey(), PROTOCOL_VERSION);
+}
+
+static CScript PayeeOf(const CMasternode& mn)
+{
+    return GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+}
+
+TEST(MasternodeMan, FindUsesLookupIndexes) {
+    CMasternodeMan mnman;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 100; i++) {
+        vMasternodes.push_back(RandomMasternode());
+        EXPECT_TRUE(mnman.Add(vMasternodes.back()));
+    }
+    // Duplicate collateral is rejected
+    EXPECT_FALSE(mnman.Add(vMasternodes[0]));
+    EXPECT_EQ(100, mnman.size());
+
+    for (const CMasternode& mn : vMasternodes) {
+        CMasternode* pmn = mnman.Find(mn.vin);
+        ASSERT_TRUE(pmn != NULL);
+        EXPECT_EQ(mn.vin, pmn->vin);
+        EXPECT_EQ(pmn, mnman.Find(mn.pubKeyMasternode));
+        EXPECT_EQ(pmn, mnman.Find(PayeeOf(mn)));
+    }
+
+    CMasternode mnUnknown = RandomMasternode();
+    EXPECT_TRUE(mnman.Find(mnUnknown.vin) == NULL);
+    EXPECT_TRUE(mnman.Find(mnUnknown.pubKeyMasternode) == NULL);
+    EXPECT_TRUE(mnman.Find(PayeeOf(mnUnknown)) == NULL);
+
+    mnman.Clear();
+    EXPECT_EQ(0, mnman.size());
+    EXPECT_TRUE(mnman.Find(vMasternodes[0].vin) == NULL);
+    EXPECT_TRUE(mnman.Find(vMasternodes[0].pubKeyMasternode) == NULL);
+    EXPECT_TRUE(mnman.Find(PayeeOf(vMasternodes[0])) == NULL);
+}
+
+TEST(MasternodeMan, DuplicateKeysResolveToFirstMasternode) {
+    CMasternodeMan mnman;
+    CMasternode mn1 = RandomMasternode();
+    CMasternode mn2 = RandomMasternode();
+    mn2.pubKeyMasternode = mn1.pubKeyMasternode;
+    mnman.Add(mn1);
+    mnman.Add(mn2);
+
+    CMasternode* pmn1 = mnman.Find(mn1.vin);
+    CMasternode* pmn2 = mnman.Find(mn2.vin);
+    EXPECT_EQ(pmn1, mnman.Find(mn1.pubKeyMasternode));
+
+    // Re-keying the first masternode hands the shared key over to the second
+    CPubKey pubKeyOld = pmn1->pubKeyMasternode;
+    pmn1->pubKeyMasternode = RandomPubKey();
+    mnman.UpdateLookupIndexes(pubKeyOld, pmn1);
+    EXPECT_EQ(pmn2, mnman.Find(pubKeyOld));
+    EXPECT_EQ(pmn1, mnman.Find(pmn1->pubKeyMasternode));
+
+    // and re-keying it back makes it the first match again
+    CPubKey pubKeyNew = pmn1->pubKeyMasternode;
+    pmn1->pubKeyMasternode = pubKeyOld;
+    mnman.UpdateLookupIndexes(pubKeyNew, pmn1);
+    EXPECT_EQ(pmn1, mnman.Find(pubKeyOld));
+    EXPECT_TRUE(mnman.Find(pubKeyNew) == NULL);
+}
+
+TEST(MasternodeMan, LookupIndexesRebuiltOnDeserialization) {
+    CMasternodeMan mnman;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 10; i++) {
+        vMasternodes.push_back(RandomMasternode());
+        mnman.Add(vMasternodes.back());
+    }
+
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << mnman;
+    CMasternodeMan mnmanLoaded;
+    ss >> mnmanLoaded;
+
+    EXPECT_EQ(10, mnmanLoaded.size());
+    for (const CMasternode& mn : vMasternodes) {
+        CMasternode* pmn = mnmanLoaded.Find(mn.vin);
+        ASSERT_TRUE(pmn != NULL);
+        EXPECT_EQ(pmn, mnmanLoaded.Find(mn.pubKeyMasternode));
+        EXPECT_EQ(pmn, mnmanLoaded.Find(PayeeOf(mn)));
+    }
+}
+
+// The payment queue selection as it was done before the queue was kept sorted:
+// collect eligible masternodes, sort by last paid block and score the oldest tenth.
+static CMasternode* LegacyNextInQueue(std::vector<CMasternode*> vecMasternodes,
+                                      const std::function<bool(CMasternode&, const CScript&)>& fEligible,
+                                      int nTenthNetwork, const uint256& blockHash, int& nCount)
+{
+    std::vector<std::pair<int, CMasternode*>> vecMasternodeLastPaid;
+    for (CMasternode* pmn : vecMasternodes) {
+        if (fEligible(*pmn, PayeeOf(*pmn))) {
+            vecMasternodeLastPaid.push_back(std::make_pair(pmn->GetLastPaidBlock(), pmn));
+        }
+    }
+    nCount = vecMasternodeLastPaid.size();
+    std::sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(),
+        [](const std::pair<int, CMasternode*>& t1, const std::pair<int, CMasternode*>& t2) {
+            return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
+        });
+
+    int nCountTenth = 0;
+    arith_uint256 nHighest = 0;
+    CMasternode* pBestMasternode = NULL;
+    for (auto& s : vecMasternodeLastPaid) {
+        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+        if (nScore > nHighest) {
+            nHighest = nScore;
+            pBestMasternode = s.second;
+        }
+        nCountTenth++;
+        if (nCountTenth >= nTenthNetwork)
+            break;
+    }
+    return pBestMasternode;
+}
+
+TEST(MasternodeMan, NextInQueueSelectsSameWinnerAsFullSort) {
+    // A chain for the collateral ages and the scoring block hash. It is static
+    // because mnpayments keeps pointing at its tip after the test.
+    static std::vector<uint256> vHashes(300);
+    static std::vector<CBlockIndex> vIndices(300);
+    for (size_t i = 0; i < vIndices.size(); i++) {
+        vHashes[i] = GetRandHash();
+        vIndices[i].phashBlock = &vHashes[i];
+        vIndices[i].pprev = i > 0 ? &vIndices[i - 1] : NULL;
+        vIndices[i].nHeight = i;
+    }
+    CBlockIndex* pindexTip = &vIndices.back();
+    chainActive.SetTip(pindexTip);
+    mnpayments.UpdatedBlockTip(pindexTip);
+    int nBlockHeight = pindexTip->nHeight + 1;
+    uint256 blockHash = vHashes[nBlockHeight - 101];
+
+    // Every tenth masternode runs an old protocol, is too new, or has too
+    // young a collateral, and every twentieth is already scheduled for payment
+    CMasternodeMan mnman;
+    std::vector<CMasternode*> vpMasternodes;
+    std::set<COutPoint> setOldProtocol, setTooNew, setImmature;
+    std::set<CScript> setScheduled;
+    for (int i = 0; i < 60; i++) {
+        CMasternode mn = RandomMasternode();
+        mnman.Add(mn);
+        CMasternode* pmn = mnman.Find(mn.vin);
+        ASSERT_TRUE(pmn != NULL);
+        vpMasternodes.push_back(pmn);
+
+        pmn->sigTime = GetAdjustedTime() - 24 * 60 * 60;
+        pmn->nCacheCollateralBlock = 1;
+        if (i % 10 == 1) {
+            pmn->nProtocolVersion = mnpayments.GetMinMasternodePaymentsProto() - 1;
+            setOldProtocol.insert(mn.vin.prevout);
+        } else if (i % 10 == 2) {
+            pmn->sigTime = GetAdjustedTime();
+            setTooNew.insert(mn.vin.prevout);
+        } else if (i % 10 == 3) {
+            pmn->nCacheCollateralBlock = pindexTip->nHeight - 5;
+            setImmature.insert(mn.vin.prevout);
+        } else if (i % 20 == 4) {
+            int h = pindexTip->nHeight + (i % 40 == 4 ? 0 : 2);
+            CMasternodeBlockPayees& payees = mnpayments.mapMasternodeBlocks[h];
+            payees.nBlockHeight = h;
+            payees.vecPayees.push_back(CMasternodePayee(PayeeOf(mn), GetRandHash()));
+            setScheduled.insert(PayeeOf(mn));
+        }
+    }
+    int nMnCount = 60 - setOldProtocol.size();
+    EXPECT_EQ(nMnCount, mnman.CountEnabled());
+
+    auto fEligible = [&](CMasternode& mn, const CScript& payee) {
+        return !setOldProtocol.count(mn.vin.prevout) && !setTooNew.count(mn.vin.prevout) &&
+               !setImmature.count(mn.vin.prevout) && !setScheduled.count(payee);
+    };
+    for (int nRound = 0; nRound < 10; nRound++) {
+        // few distinct heights so that ties on the last paid block are common
+        for (CMasternode* pmn : vpMasternodes) {
+            if (GetRandInt(4) == 0) {
+                int nHeight = 100 + GetRandInt(50);
+                EXPECT_TRUE(mnman.SetLastPaid(pmn->vin, nHeight, nHeight * 150));
+            }
+        }
+
+        int nCountLegacy, nCount;
+        CMasternode* pmnLegacy = LegacyNextInQueue(vpMasternodes, fEligible, nMnCount / 10, blockHash, nCountLegacy);
+        ASSERT_TRUE(pmnLegacy != NULL);
+        EXPECT_EQ(pmnLegacy, mnman.GetNextMasternodeInQueueForPayment(nBlockHeight, true, nCount));
+        EXPECT_EQ(nCountLegacy, nCount);
+        EXPECT_EQ(39, nCount);
+    }
+
+    // Without the sigTime filter the new masternodes are paid too
+    auto fEligibleAnyTime = [&](CMasternode& mn, const CScript& payee) {
+        return !setOldProtocol.count(mn.vin.prevout) && !setImmature.count(mn.vin.prevout) &&
+               !setScheduled.count(payee);
+    };
+    int nCountLegacy, nCount;
+    CMasternode* pmnLegacy = LegacyNextInQueue(vpMasternodes, fEligibleAnyTime, nMnCount / 10, blockHash, nCountLegacy);
+    EXPECT_EQ(pmnLegacy, mnman.GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount));
+    EXPECT_EQ(nCountLegacy, nCount);
+    EXPECT_EQ(45, nCount);
+
+    // When fewer than a third pass the sigTime filter, as while the network
+    // upgrades, it is dropped rather than paying only the few old masternodes
+    for (CMasternode* pmn : vpMasternodes) {
+        if (setTooNew.size() >= 40)
+            break;
+        if (!setOldProtocol.count(pmn->vin.prevout)) {
+            pmn->sigTime = GetAdjustedTime();
+            setTooNew.insert(pmn->vin.prevout);
+        }
+    }
+    EXPECT_EQ(pmnLegacy, mnman.GetNextMasternodeInQueueForPayment(nBlockHeight, true, nCount));
+    EXPECT_EQ(45, nCount);
+
+    mnpayments.mapMasternodeBlocks.clear();
+    chainActive.SetTip(NULL);
+}
+
+TEST(MasternodeMan, ListInventoryServedFromSerializedMessages) {
+    CMasternodeMan mnman;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 10; i++) {
+        vMasternodes.push_back(RandomMasternode());
+        vMasternodes.back().addr = CService(CNetAddr("8.8.8.8"), 9999 + i);
+        mnman.Add(vMasternodes.back());
+    }
+    // Masternodes on a local address are not sent
+    CMasternode mnLocal = RandomMasternode();
+    mnman.Add(mnLocal);
+
+    std::vector<CInv> vInv;
+    EXPECT_EQ(10, mnman.GetListInventory(CTxIn(), vInv));
+    EXPECT_EQ(20u, vInv.size());
+
+    CMasternode* pmn = mnman.Find(vMasternodes[3].vin);
+    ASSERT_TRUE(pmn != NULL);
+    vInv.clear();
+    EXPECT_EQ(1, mnman.GetListInventory(pmn->vin, vInv));
+    ASSERT_EQ(2u, vInv.size());
+    EXPECT_EQ(MSG_MASTERNODE_ANNOUNCE, vInv[0].type);
+    EXPECT_EQ(CMasternodeBroadcast(*pmn).GetHash(), vInv[0].hash);
+
+    CDataStream ssExpected(SER_NETWORK, PROTOCOL_VERSION);
+    ssExpected << CMasternodeBroadcast(*pmn);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ASSERT_TRUE(mnman.GetSerializedBroadcast(vInv[0].hash, ss));
+    EXPECT_EQ(ssExpected.str(), ss.str());
+    // There is no ping to send yet
+    EXPECT_FALSE(mnman.GetSerializedPing(vInv[1].hash, ss));
+
+    // A new ping is serialized again, and the old one is no longer sent
+    uint256 hashBroadcastOld = vInv[0].hash;
+    uint256 hashPingOld = vInv[1].hash;
+    pmn->lastPing.vin = pmn->vin;
+    pmn->lastPing.blockHash = GetRandHash();
+    pmn->lastPing.sigTime = 1000;
+    vInv.clear();
+    mnman.GetListInventory(pmn->vin, vInv);
+    ASSERT_EQ(2u, vInv.size());
+    EXPECT_EQ(hashBroadcastOld, vInv[0].hash);
+    EXPECT_NE(hashPingOld, vInv[1].hash);
+
+    ssExpected.clear();
+    ssExpected << pmn->lastPing;
+    ss.clear();
+    ASSERT_TRUE(mnman.GetSerializedPing(vInv[1].hash, ss));
+    EXPECT_EQ(ssExpected.str(), ss.str());
+    EXPECT_FALSE(mnman.GetSerializedPing(hashPingOld, ss));
+
+    ssExpected.clear();
+    ssExpected << CMasternodeBroadcast(*pmn);
+    ss.clear();
+    ASSERT_TRUE(mnman.GetSerializedBroadcast(hashBroadcastOld, ss));
+    EXPECT_EQ(ssExpected.str(), ss.str());
+
+    EXPECT_FALSE(mnman.GetSerializedBroadcast(GetRandHash(), ss));
+    EXPECT_FALSE(mnman.GetSerializedPing(GetRandHash(), ss));
+
+    mnman.Clear();
+    EXPECT_FALSE(mnman.GetSerializedBroadcast(hashBroadcastOld, ss));
+}
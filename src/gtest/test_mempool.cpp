@@ -7,7 +7,9 @@
 #include "primitives/transaction.h"
 #include "txmempool.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "util.h"
+#include "utils.h"
 
 // Fake the input of transaction 5295156213414ed77f6e538e7e8ebe14492156906b9fe995b242477818789364
 // - 532639cc6bebed47c1c69ae36dd498c68a012e74ad12729adbd3dbb56f8f3f4a, 0
@@ -136,3 +138,202 @@ TEST(Mempool, TxInputLimit) {
     EXPECT_EQ(state4.GetRejectReason(), "bad-txns-version-too-low");
 }
 
+
+TEST(Mempool, TrimToSizeEvictsLowestDescendantScore) {
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Same size transactions, so the fee rate follows the fee
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < 10; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 1000;
+        vtx.push_back(mtx);
+        pool.addUnchecked(vtx.back().GetHash(), CTxMemPoolEntry(vtx.back(), (i + 1) * 1000, 0, 0.0, 1));
+    }
+    unsigned int nTxSize = pool.mapTx[vtx[0].GetHash()].GetTxSize();
+
+    // A well paying child of the lowest fee rate transaction pays for its parent
+    CMutableTransaction mtxChild;
+    mtxChild.vin.resize(1);
+    mtxChild.vin[0].prevout = COutPoint(vtx[0].GetHash(), 0);
+    mtxChild.vout.resize(1);
+    mtxChild.vout[0].nValue = 500;
+    CTransaction txChild(mtxChild);
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 100000, 0, 0.0, 1));
+    ASSERT_EQ(11, pool.size());
+
+    EXPECT_EQ(0, pool.TrimToSize(pool.DynamicMemoryUsage()));
+    EXPECT_EQ(11, pool.size());
+    EXPECT_EQ(CFeeRate(0), pool.GetMinFee(pool.DynamicMemoryUsage()));
+
+    EXPECT_EQ(1, pool.TrimToSize(pool.DynamicMemoryUsage() - 1));
+    EXPECT_FALSE(pool.exists(vtx[1].GetHash()));
+    EXPECT_TRUE(pool.exists(vtx[0].GetHash()));
+    EXPECT_TRUE(pool.exists(txChild.GetHash()));
+
+    EXPECT_EQ(1, pool.TrimToSize(pool.DynamicMemoryUsage() - 1));
+    EXPECT_FALSE(pool.exists(vtx[2].GetHash()));
+
+    // Getting back in takes more than the evicted transactions paid
+    CFeeRate rateEvicted(3000, nTxSize);
+    EXPECT_EQ(CFeeRate(rateEvicted.GetFeePerK() + 1000), pool.GetMinFee(pool.DynamicMemoryUsage()));
+
+    // Prioritising a transaction keeps it in
+    pool.PrioritiseTransaction(vtx[3].GetHash(), vtx[3].GetHash().ToString(), 0, 1000000);
+    EXPECT_EQ(1, pool.TrimToSize(pool.DynamicMemoryUsage() - 1));
+    EXPECT_TRUE(pool.exists(vtx[3].GetHash()));
+    EXPECT_FALSE(pool.exists(vtx[4].GetHash()));
+
+    // The parent goes with its child
+    EXPECT_EQ(8, pool.TrimToSize(0));
+    EXPECT_EQ(0, pool.size());
+    EXPECT_EQ(11, pool.GetTransactionsEvicted());
+}
+
+static CTransaction JoinSplitSpending(const uint256& anchor)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.vjoinsplit.resize(1);
+    mtx.vjoinsplit[0].anchor = anchor;
+    mtx.vjoinsplit[0].nullifiers[0] = GetRandHash();
+    mtx.vjoinsplit[0].nullifiers[1] = GetRandHash();
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    return mtx;
+}
+
+TEST(Mempool, RemoveWithAnchorOnlyTouchesItsSpenders) {
+    CTxMemPool pool(CFeeRate(0));
+    uint256 anchor = GetRandHash();
+    CTransaction tx1 = JoinSplitSpending(anchor);
+    CTransaction tx2 = JoinSplitSpending(anchor);
+    CTransaction txOther = JoinSplitSpending(GetRandHash());
+    CTransaction txChild = Spending(COutPoint(tx1.GetHash(), 0));
+    for (const CTransaction& tx : {tx1, tx2, txOther, txChild}) {
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+    }
+
+    pool.removeWithAnchor(GetRandHash());
+    EXPECT_EQ(4, pool.size());
+
+    pool.removeWithAnchor(anchor);
+    EXPECT_EQ(1, pool.size());
+    EXPECT_TRUE(pool.exists(txOther.GetHash()));
+    EXPECT_FALSE(pool.exists(txChild.GetHash()));
+
+    // The emptied anchor is forgotten, so removing it again finds nothing
+    pool.removeWithAnchor(anchor);
+    EXPECT_EQ(1, pool.size());
+}
+
+TEST(Mempool, RemoveCoinbaseSpendsByMaturityHeight) {
+    CTxMemPool pool(CFeeRate(0));
+    CTransaction txOld = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txYoung = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txYoungChild = Spending(COutPoint(txYoung.GetHash(), 0));
+    CTransaction txNoCoinbase = Spending(COutPoint(GetRandHash(), 0));
+    pool.addUnchecked(txOld.GetHash(), CTxMemPoolEntry(txOld, 0, 0, 0.0, 1, true, 100));
+    pool.addUnchecked(txYoung.GetHash(), CTxMemPoolEntry(txYoung, 0, 0, 0.0, 1, true, 150));
+    pool.addUnchecked(txYoungChild.GetHash(), CTxMemPoolEntry(txYoungChild, 0, 0, 0.0, 1));
+    pool.addUnchecked(txNoCoinbase.GetHash(), CTxMemPoolEntry(txNoCoinbase, 0, 0, 0.0, 1));
+
+    // Both coinbases are mature for a block at 250
+    pool.removeCoinbaseSpends(250);
+    EXPECT_EQ(4, pool.size());
+
+    // The one at 150 is not for a block at 249
+    pool.removeCoinbaseSpends(249);
+    EXPECT_EQ(2, pool.size());
+    EXPECT_FALSE(pool.exists(txYoung.GetHash()));
+    EXPECT_FALSE(pool.exists(txYoungChild.GetHash()));
+
+    pool.removeCoinbaseSpends(150);
+    EXPECT_EQ(1, pool.size());
+    EXPECT_TRUE(pool.exists(txNoCoinbase.GetHash()));
+}
+
+TEST(Mempool, TracksAncestorAndDescendantPackages) {
+    CTxMemPool pool(CFeeRate(0));
+    CTransaction txParent = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txChild = Spending(COutPoint(txParent.GetHash(), 0));
+    CTransaction txGrandChild = Spending(COutPoint(txChild.GetHash(), 0));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 100, 0, 0.0, 1, true, -1, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000, 0, 0.0, 1, false, -1, 2));
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 300, 0, 0.0, 1, false, -1, 3));
+    unsigned int nTxSize = pool.mapTx[txParent.GetHash()].GetTxSize();
+
+    const CTxMemPoolEntry& parent = pool.mapTx[txParent.GetHash()];
+    EXPECT_EQ(1, parent.GetCountWithAncestors());
+    EXPECT_EQ(3, parent.GetCountWithDescendants());
+    EXPECT_EQ(3 * nTxSize, parent.GetSizeWithDescendants());
+    EXPECT_EQ(20400, parent.GetModFeesWithDescendants());
+    const CTxMemPoolEntry& grandChild = pool.mapTx[txGrandChild.GetHash()];
+    EXPECT_EQ(3, grandChild.GetCountWithAncestors());
+    EXPECT_EQ(20400, grandChild.GetModFeesWithAncestors());
+    EXPECT_EQ(6, grandChild.GetSigOpsWithAncestors());
+
+    // The child pays for its parent, so that package scores best
+    ASSERT_EQ(3, pool.GetAncestorScoreIndex().size());
+    EXPECT_EQ(txChild.GetHash(), pool.GetAncestorScoreIndex().rbegin()->second);
+    EXPECT_EQ(txParent.GetHash(), pool.GetAncestorScoreIndex().begin()->second);
+
+    // Prioritising the parent raises the package fees of its descendants
+    pool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0, 1000);
+    EXPECT_EQ(1100, pool.mapTx[txParent.GetHash()].GetModifiedFee());
+    EXPECT_EQ(21400, pool.mapTx[txGrandChild.GetHash()].GetModFeesWithAncestors());
+
+    // Mining the parent leaves the rest with smaller ancestor packages
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed);
+    const CTxMemPoolEntry& child = pool.mapTx[txChild.GetHash()];
+    EXPECT_EQ(1, child.GetCountWithAncestors());
+    EXPECT_EQ(20000, child.GetModFeesWithAncestors());
+    EXPECT_EQ(2, child.GetCountWithDescendants());
+    EXPECT_EQ(2, pool.mapTx[txGrandChild.GetHash()].GetCountWithAncestors());
+    EXPECT_EQ(20300, pool.mapTx[txGrandChild.GetHash()].GetModFeesWithAncestors());
+    EXPECT_EQ(2, pool.GetAncestorScoreIndex().size());
+
+    // Evicting the grandchild shrinks its ancestors' descendant packages
+    pool.remove(txGrandChild, removed);
+    EXPECT_EQ(1, pool.mapTx[txChild.GetHash()].GetCountWithDescendants());
+    EXPECT_EQ(20000, pool.mapTx[txChild.GetHash()].GetModFeesWithDescendants());
+}
+
+TEST(Mempool, AncestorsWithinPackageLimits) {
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<CTransaction> vChain(1, Spending(COutPoint(GetRandHash(), 0)));
+    for (int i = 1; i < 3; i++)
+        vChain.push_back(Spending(COutPoint(vChain.back().GetHash(), 0)));
+    for (const CTransaction& tx : vChain)
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+    unsigned int nTxSize = pool.mapTx[vChain[0].GetHash()].GetTxSize();
+
+    CTransaction txNext = Spending(COutPoint(vChain.back().GetHash(), 0));
+    CTxMemPoolEntry entry(txNext, 0, 0, 0.0, 1);
+    LOCK(pool.cs);
+    std::set<uint256> setAncestors;
+    std::string errString;
+    EXPECT_TRUE(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 4 * nTxSize, 4, 4 * nTxSize, errString));
+    EXPECT_EQ(3u, setAncestors.size());
+
+    // One over any of the limits is refused
+    setAncestors.clear();
+    EXPECT_FALSE(pool.CalculateMemPoolAncestors(entry, setAncestors, 3, 4 * nTxSize, 4, 4 * nTxSize, errString));
+    EXPECT_EQ("too many unconfirmed ancestors [limit: 3]", errString);
+    setAncestors.clear();
+    EXPECT_FALSE(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 4 * nTxSize - 1, 4, 4 * nTxSize, errString));
+    setAncestors.clear();
+    EXPECT_FALSE(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 4 * nTxSize, 3, 4 * nTxSize, errString));
+    setAncestors.clear();
+    EXPECT_FALSE(pool.CalculateMemPoolAncestors(entry, setAncestors, 4, 4 * nTxSize, 4, 4 * nTxSize - 1, errString));
+
+    // A transaction spending nothing in the pool has no package to check
+    CTxMemPoolEntry entryAlone(Spending(COutPoint(GetRandHash(), 0)), 0, 0, 0.0, 1);
+    setAncestors.clear();
+    EXPECT_TRUE(pool.CalculateMemPoolAncestors(entryAlone, setAncestors, 0, 0, 0, 0, errString));
+    EXPECT_TRUE(setAncestors.empty());
+}
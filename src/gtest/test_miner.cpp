@@ -1,14 +1,19 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "chain.h"
 #include "chainparams.h"
 #include "key.h"
 #include "miner.h"
+#include "random.h"
+#include "txmempool.h"
 #include "util.h"
+#include "utils.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
 #endif
 
+#include <boost/bind.hpp>
 #include <boost/optional.hpp>
 
 using ::testing::Return;
@@ -101,3 +106,111 @@ TEST(Miner, GetMinerScriptPubKey) {
     EXPECT_TRUE((bool) scriptPubKey);
     EXPECT_EQ(expectedScriptPubKey, *scriptPubKey);
 }
+
+// To test private methods, a friend class can act as a proxy
+class TEST_FRIEND_CBlockTemplateEngine {
+public:
+    CBlockTemplateEngine& engine;
+
+    TEST_FRIEND_CBlockTemplateEngine(CBlockTemplateEngine& engineIn) : engine(engineIn) {}
+
+    // Follow the mempool like GetBlockTemplate does, without a template on the active chain
+    void Start(CBlockIndex* pindexTip) {
+        engine.pindexPrev = pindexTip;
+        engine.connAdded = engine.pool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateEngine::AddCandidate, &engine, _1, _2));
+        engine.connRemoved = engine.pool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateEngine::RemoveCandidate, &engine, _1));
+    }
+
+    // The transactions Assemble puts after the coinbase
+    std::vector<uint256> AddCandidates() {
+        LOCK(engine.pool.cs);
+        CBlockTemplate blocktemplate;
+        blocktemplate.block.vtx.push_back(CTransaction());
+        blocktemplate.vTxFees.push_back(-1);
+        blocktemplate.vTxSigOps.push_back(-1);
+        uint64_t nBlockSize, nBlockTx;
+        CAmount nFees;
+        engine.AddCandidates(&blocktemplate, 0, nBlockSize, nBlockTx, nFees);
+        EXPECT_EQ(blocktemplate.block.vtx.size() - 1, nBlockTx);
+
+        std::vector<uint256> vHashes;
+        for (size_t i = 1; i < blocktemplate.block.vtx.size(); i++)
+            vHashes.push_back(blocktemplate.block.vtx[i].GetHash());
+        return vHashes;
+    }
+};
+
+TEST(Miner, BlockTemplateEngineFollowsMempool) {
+    SelectParams(CBaseChainParams::MAIN);
+    CTxMemPool pool(CFeeRate(0));
+    CBlockTemplateEngine engine(pool);
+    TEST_FRIEND_CBlockTemplateEngine proxy(engine);
+    CBlockIndex index;
+    index.nHeight = 1000;
+    proxy.Start(&index);
+
+    // The entries are temporaries, the engine has to keep to the ones in the mempool
+    CTransaction txParent = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txChild = Spending(COutPoint(txParent.GetHash(), 0));
+    CTransaction txOther = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txRemoved = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txFee = Spending(COutPoint(GetRandHash(), 0));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 1e9, 1000));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 1000, 0, 1e10, 1000));
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 1000, 0, 2e9, 1000));
+    pool.addUnchecked(txRemoved.GetHash(), CTxMemPoolEntry(txRemoved, 1000, 0, 3e9, 1000));
+    pool.addUnchecked(txFee.GetHash(), CTxMemPoolEntry(txFee, 10000, 0, 0.0, 1000));
+
+    std::list<CTransaction> removed;
+    pool.remove(txRemoved, removed);
+
+    // By priority, the child after its parent, then the one paying a fee by fee rate
+    std::vector<uint256> vHashes = proxy.AddCandidates();
+    ASSERT_EQ(4u, vHashes.size());
+    EXPECT_EQ(txOther.GetHash(), vHashes[0]);
+    EXPECT_EQ(txParent.GetHash(), vHashes[1]);
+    EXPECT_EQ(txChild.GetHash(), vHashes[2]);
+    EXPECT_EQ(txFee.GetHash(), vHashes[3]);
+
+    // Transactions leave the candidates with the mempool
+    pool.remove(txOther, removed);
+    vHashes = proxy.AddCandidates();
+    ASSERT_EQ(3u, vHashes.size());
+    EXPECT_EQ(txParent.GetHash(), vHashes[0]);
+    EXPECT_EQ(txChild.GetHash(), vHashes[1]);
+    pool.remove(txParent, removed, true);
+    vHashes = proxy.AddCandidates();
+    ASSERT_EQ(1u, vHashes.size());
+    EXPECT_EQ(txFee.GetHash(), vHashes[0]);
+
+    pool.clear();
+    EXPECT_TRUE(proxy.AddCandidates().empty());
+}
+
+TEST(Miner, PackageIncludedOnceWithWaitingMembers) {
+    SelectParams(CBaseChainParams::MAIN);
+    mapArgs["-blockprioritysize"] = "0";
+    CTxMemPool pool(CFeeRate(0));
+    CBlockTemplateEngine engine(pool);
+    TEST_FRIEND_CBlockTemplateEngine proxy(engine);
+    CBlockIndex index;
+    index.nHeight = 1000;
+    proxy.Start(&index);
+
+    // Once the parent is in, the low fee child and the grandchild paying for it wait
+    // with smaller packages, and the grandchild takes the child in with it
+    CTransaction txParent = Spending(COutPoint(GetRandHash(), 0));
+    CTransaction txChild = Spending(COutPoint(txParent.GetHash(), 0));
+    CTransaction txGrandChild = Spending(COutPoint(txChild.GetHash(), 0));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 50000, 0, 0.0, 1000));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 100, 0, 0.0, 1000));
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 30000, 0, 0.0, 1000));
+
+    std::vector<uint256> vHashes = proxy.AddCandidates();
+    ASSERT_EQ(3u, vHashes.size());
+    EXPECT_EQ(txParent.GetHash(), vHashes[0]);
+    EXPECT_EQ(txChild.GetHash(), vHashes[1]);
+    EXPECT_EQ(txGrandChild.GetHash(), vHashes[2]);
+
+    mapArgs.erase("-blockprioritysize");
+}
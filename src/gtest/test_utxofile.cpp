@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+#include "utils.h"
+#include "utxofile.h"
+#include "version.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
+
+class UTXOFileTest : public TempDatadirTest {};
+
+// The checksum is stored byte reversed after the fields it covers
+static void AppendChecksum(std::string& strRecord, size_t nBegin)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)strRecord.data() + nBegin, strRecord.size() - nBegin).Finalize(hash);
+    for (int i = CSHA256::OUTPUT_SIZE - 1; i >= 0; i--)
+        strRecord.push_back(hash[i]);
+}
+
+static std::string TransparentRecord(uint64_t nAmount, const CScript& script)
+{
+    std::string strRecord(16, '\0');
+    WriteLE64((unsigned char*)&strRecord[0], nAmount);
+    WriteLE64((unsigned char*)&strRecord[8], script.size());
+    strRecord.append(script.begin(), script.end());
+    AppendChecksum(strRecord, 0);
+    strRecord.push_back('\n');
+    return strRecord;
+}
+
+static std::string ShieldedRecord(const CTransaction& tx)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    std::string strRecord;
+    for (int i = 31; i >= 0; i--)
+        strRecord.push_back(((ss.size() >> i) & 1) ? '1' : '0');
+    strRecord.append(ss.begin(), ss.end());
+    AppendChecksum(strRecord, 0);
+    return strRecord;
+}
+
+static std::string WriteFile(const boost::filesystem::path& path, const std::string& strData)
+{
+    std::ofstream file(path.string().c_str(), std::ios::binary | std::ios::trunc);
+    file.write(strData.data(), strData.size());
+    return path.string();
+}
+
+TEST_F(UTXOFileTest, ReadsTransparentRecords) {
+    std::string strData;
+    for (int i = 0; i < 1000; i++)
+        strData += TransparentRecord(i + 1, CScript() << OP_DUP << OP_HASH160 << ToByteVector(GetRandHash()));
+    std::string strPath = WriteFile(pathTemp / "utxo-00001.bin", strData);
+
+    CUTXOFile file;
+    ASSERT_TRUE(ReadUTXOFile(strPath, false, 0, 4, file));
+    EXPECT_FALSE(file.fChecksumMismatch);
+    ASSERT_EQ(1000, file.size());
+    for (size_t i = 0; i < file.size(); i++)
+        EXPECT_EQ(i + 1, file.vRecords[i].nAmount);
+    EXPECT_TRUE(boost::filesystem::exists(GetDataDir() / "utxoindex" / "utxo-00001.bin.idx"));
+
+    // The sidecar is used on the second read, with the same records
+    CUTXOFile fileIndexed;
+    ASSERT_TRUE(ReadUTXOFile(strPath, false, 0, 4, fileIndexed));
+    ASSERT_EQ(file.size(), fileIndexed.size());
+    for (size_t i = 0; i < file.size(); i++)
+        EXPECT_EQ(file.vRecords[i].scriptPubKey, fileIndexed.vRecords[i].scriptPubKey);
+
+    // At most nMaxRecords are read
+    CUTXOFile fileCapped;
+    ASSERT_TRUE(ReadUTXOFile(strPath, false, 10, 1, fileCapped));
+    EXPECT_EQ(10, fileCapped.size());
+}
+
+TEST_F(UTXOFileTest, StopsAtChecksumMismatch) {
+    std::string strData;
+    for (int i = 0; i < 5; i++) {
+        std::string strRecord = TransparentRecord(100, CScript() << OP_TRUE);
+        if (i == 3)
+            strRecord[0] ^= 1;
+        strData += strRecord;
+    }
+    std::string strPath = WriteFile(pathTemp / "utxo-00002.bin", strData);
+
+    CUTXOFile file;
+    ASSERT_TRUE(ReadUTXOFile(strPath, false, 0, 2, file));
+    EXPECT_TRUE(file.fChecksumMismatch);
+    EXPECT_EQ(3, file.size());
+    EXPECT_FALSE(boost::filesystem::exists(GetDataDir() / "utxoindex" / "utxo-00002.bin.idx"));
+}
+
+TEST_F(UTXOFileTest, ReadsShieldedTransactions) {
+    std::vector<CTransaction> vtx;
+    std::string strData;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), i);
+        mtx.vout.resize(2);
+        mtx.vout[0].nValue = i;
+        vtx.push_back(mtx);
+        strData += ShieldedRecord(vtx.back());
+    }
+    std::string strPath = WriteFile(pathTemp / "utxo-00003.bin", strData);
+
+    std::shared_ptr<const CUTXOFile> pfile = utxoFileCache.Get(strPath, true, 0, 2);
+    ASSERT_TRUE(pfile.get() != NULL);
+    EXPECT_FALSE(pfile->fChecksumMismatch);
+    ASSERT_EQ(vtx.size(), pfile->size());
+    for (size_t i = 0; i < vtx.size(); i++)
+        EXPECT_EQ(vtx[i].GetHash(), pfile->vTransactions[i].GetHash());
+
+    // Later lookups share the parsed file
+    EXPECT_EQ(pfile, utxoFileCache.Get(strPath, true, 0, 2));
+
+    // but not with another record cap
+    std::shared_ptr<const CUTXOFile> pfileCapped = utxoFileCache.Get(strPath, true, 2, 2);
+    ASSERT_TRUE(pfileCapped.get() != NULL);
+    EXPECT_EQ(2u, pfileCapped->size());
+    EXPECT_EQ(vtx.size(), utxoFileCache.Get(strPath, true, 0, 2)->size());
+    utxoFileCache.Clear();
+
+    EXPECT_TRUE(utxoFileCache.Get((pathTemp / "missing.bin").string(), true, 0, 2).get() == NULL);
+}
+
+TEST_F(UTXOFileTest, PrefetchesFilesInBackground) {
+    std::vector<std::string> vPaths;
+    for (int i = 0; i < 3; i++) {
+        std::string strData;
+        for (int j = 0; j < 100; j++)
+            strData += TransparentRecord(j, CScript() << OP_TRUE);
+        vPaths.push_back(WriteFile(pathTemp / strprintf("utxo-%05i.bin", 10 + i), strData));
+    }
+
+    utxoFileCache.Clear();
+    utxoFileCache.SetPrefetch(2);
+    uint64_t nLoadedStart, nPrefetchedStart, nLoaded, nPrefetched;
+    int64_t nLoadTime, nPrefetchTime, nWaitTime;
+    utxoFileCache.GetStats(nLoadedStart, nPrefetchedStart, nLoadTime, nPrefetchTime, nWaitTime);
+
+    boost::thread thread(&ThreadUTXOPrefetch);
+    utxoFileCache.Prefetch(vPaths[1], false, 0, 1);
+    utxoFileCache.Prefetch(vPaths[2], false, 0, 1);
+    ASSERT_TRUE(utxoFileCache.Get(vPaths[0], false, 0, 1).get() != NULL);
+
+    // A file being read ahead is waited for, not read again
+    for (int i = 1; i < 3; i++) {
+        std::shared_ptr<const CUTXOFile> pfile = utxoFileCache.Get(vPaths[i], false, 0, 1);
+        ASSERT_TRUE(pfile.get() != NULL);
+        EXPECT_EQ(100, pfile->size());
+        EXPECT_EQ(pfile, utxoFileCache.Get(vPaths[i], false, 0, 1));
+    }
+
+    thread.interrupt();
+    thread.join();
+    utxoFileCache.GetStats(nLoaded, nPrefetched, nLoadTime, nPrefetchTime, nWaitTime);
+    EXPECT_EQ(3, (nLoaded - nLoadedStart) + (nPrefetched - nPrefetchedStart));
+
+    utxoFileCache.SetPrefetch(0);
+    utxoFileCache.Clear();
+}
@@ -1,3 +1,8 @@
+#include "utils.h"
+
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
 #include "zcash/JoinSplit.hpp"
 
 ZCJoinSplit* params = ZCJoinSplit::Unopened();
@@ -11,3 +16,28 @@ int GenMax(int n)
 {
     return n-1;
 }
+
+void TempDatadirTest::SetUp()
+{
+    pathTemp = GetTempPath() / strprintf("test_zcash_gtest_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+}
+
+void TempDatadirTest::TearDown()
+{
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+    boost::filesystem::remove_all(pathTemp);
+}
+
+CTransaction Spending(const COutPoint& prevout)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = prevout;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    return mtx;
+}
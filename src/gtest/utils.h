@@ -0,0 +1,22 @@
+#ifndef ZCASH_GTEST_UTILS_H
+#define ZCASH_GTEST_UTILS_H
+
+#include <gtest/gtest.h>
+
+#include "primitives/transaction.h"
+
+#include <boost/filesystem.hpp>
+
+/** Runs each test with -datadir set to a fresh temporary directory, removed afterwards */
+class TempDatadirTest : public ::testing::Test {
+protected:
+    boost::filesystem::path pathTemp;
+
+    virtual void SetUp();
+    virtual void TearDown();
+};
+
+/** A transaction spending prevout into a single 1000 zatoshi output */
+CTransaction Spending(const COutPoint& prevout);
+
+#endif // ZCASH_GTEST_UTILS_H
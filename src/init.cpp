@@ -11,6 +11,7 @@
 #include "crypto/common.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
 #ifdef ENABLE_MINING
 #include "base58.h"
 #endif
@@ -36,6 +37,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxofile.h"
 #include "validationinterface.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -179,6 +181,50 @@ static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
+// Kept open between dumps, journaled caches only append what changed since the last one
+static boost::scoped_ptr<CFlatDB<CMasternodeMan> > pflatdbMasternodes;
+static boost::scoped_ptr<CFlatDB<CMasternodePayments> > pflatdbPayments;
+static boost::scoped_ptr<CFlatDB<CGovernanceManager> > pflatdbGovernance;
+
+static void OpenMasternodeCaches()
+{
+    bool fJournal = GetBoolArg("-cachejournal", DEFAULT_FLATDB_JOURNAL);
+    pflatdbMasternodes.reset(new CFlatDB<CMasternodeMan>("mncache.dat", "magicMasternodeCache", fJournal));
+    pflatdbPayments.reset(new CFlatDB<CMasternodePayments>("mnpayments.dat", "magicMasternodePaymentsCache", fJournal));
+    pflatdbGovernance.reset(new CFlatDB<CGovernanceManager>("governance.dat", "magicGovernanceCache", fJournal));
+}
+
+static void DumpMasternodeCaches()
+{
+    int64_t nPauseMasternodes = 0, nPausePayments = 0, nPauseGovernance = 0;
+    bool fStarted = pflatdbMasternodes->DumpInBackground(mnodeman, nPauseMasternodes);
+    fStarted &= pflatdbPayments->DumpInBackground(mnpayments, nPausePayments);
+    fStarted &= pflatdbGovernance->DumpInBackground(governance, nPauseGovernance);
+    if (!fStarted)
+        LogPrintf("%s: Skipping caches still being dumped\n", __func__);
+    LogPrint("bench", "%s: Paused %.2fms for mncache.dat, %.2fms for mnpayments.dat, %.2fms for governance.dat\n", __func__,
+             nPauseMasternodes * 0.001, nPausePayments * 0.001, nPauseGovernance * 0.001);
+}
+
+template <typename T>
+static void AddDumpStats(const CFlatDB<T>& flatdb, const std::string& strFilename, std::vector<CCacheDumpStats>& vStatsRet)
+{
+    CCacheDumpStats stats;
+    stats.strFilename = strFilename;
+    flatdb.GetDumpStats(stats.nDumps, stats.nLastPauseMicros, stats.nMaxPauseMicros, stats.nLastWriteMillis);
+    vStatsRet.push_back(stats);
+}
+
+void GetMasternodeCacheDumpStats(std::vector<CCacheDumpStats>& vStatsRet)
+{
+    vStatsRet.clear();
+    if (!pflatdbMasternodes)
+        return;
+    AddDumpStats(*pflatdbMasternodes, "mncache.dat", vStatsRet);
+    AddDumpStats(*pflatdbPayments, "mnpayments.dat", vStatsRet);
+    AddDumpStats(*pflatdbGovernance, "governance.dat", vStatsRet);
+}
+
 void Interrupt(boost::thread_group& threadGroup)
 {
     InterruptHTTPServer();
@@ -224,12 +270,15 @@ void Shutdown()
     UnregisterNodeSignals(GetNodeSignals());
 
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
-    CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
-    flatdb1.Dump(mnodeman);
-    CFlatDB<CMasternodePayments> flatdb2("mnpayments.dat", "magicMasternodePaymentsCache");
-    flatdb2.Dump(mnpayments);
-    CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
-    flatdb3.Dump(governance);
+    if (!pflatdbMasternodes)
+        OpenMasternodeCaches();
+    pflatdbMasternodes->Dump(mnodeman);
+    pflatdbPayments->Dump(mnpayments);
+    pflatdbGovernance->Dump(governance);
+    // waits for journal compactions
+    pflatdbMasternodes.reset();
+    pflatdbPayments.reset();
+    pflatdbGovernance.reset();
     CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
     flatdb4.Dump(netfulfilledman);
 
@@ -376,11 +425,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-disabledeprecation=<version>", strprintf(_("Disable block-height node deprecation and automatic shutdown (example: -disabledeprecation=%s)"),
         FormatVersion(CLIENT_VERSION)));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep up to <n> megabytes of recently connected blocks in memory for serving to peers and RPC (default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-cachedumpinterval=<n>", strprintf(_("Dump the masternode, payment and governance caches every <n> seconds in the background (0 to disable, default: %u)"), DEFAULT_CACHE_DUMP_INTERVAL));
+    strUsage += HelpMessageOpt("-cachejournal", strprintf(_("Store the masternode, payment and governance caches as journals of their changes (default: %u)"), DEFAULT_FLATDB_JOURNAL));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script and JoinSplit proof verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "anond.pid"));
@@ -479,6 +532,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", 1));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
+        strUsage += HelpMessageOpt("-paranoidblockreads", strprintf("Re-check Equihash and proof of work of every block read from disk, even if already validated (default: %u)", DEFAULT_PARANOID_BLOCK_READS));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", 0));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
@@ -498,7 +552,12 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxmsgsigcachesize=<n>", strprintf("Limit size of masternode message signature cache to <n> entries (default: %u)", DEFAULT_MAX_MSG_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in ANON/kB) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-printtoconsole", _("Send trace/debug info to console instead of debug.log file"));
@@ -526,6 +585,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifdef FORK_CB_INPUT
     strUsage += HelpMessageGroup(_("Fork:"));
     strUsage += HelpMessageOpt("-utxo-path=<path>", _("Specify location of UTXO files"));
+    strUsage += HelpMessageOpt("-utxoprefetch=<n>", strprintf(_("Read the UTXO files of the next <n> fork blocks ahead while validating one (0 to disable, default: %d)"), DEFAULT_UTXO_PREFETCH));
 #endif
 
 #ifdef ENABLE_MINING
@@ -941,6 +1001,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     forkStartHeight = GetArg("-fork-startheight", chainparams.ForkStartHeight());
     forkHeightRange = GetArg("-fork-heightrange", chainparams.ForkHeightRange());
     forkCBPerBlock = GetArg("-fork-cbperblock", FORK_COINBASE_PER_BLOCK);
+    utxoFileCache.SetPrefetch(GetArg("-utxoprefetch", DEFAULT_UTXO_PREFETCH));
     LogPrintf("Running with fork parameters datadir=%s forkStartHeight=%d, nForkHeightRange=%d\n", forkUtxoPath, forkStartHeight, forkHeightRange);
 #endif
 
@@ -978,6 +1039,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     mempool.setSanityCheck(GetBoolArg("-checkmempool", chainparams.DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    fParanoidBlockReads = GetBoolArg("-paranoidblockreads", DEFAULT_PARANOID_BLOCK_READS);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -1156,16 +1218,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script, proof and message signature verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadProofCheck);
+            threadGroup.create_thread(&ThreadMessageSignatureCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
+#ifdef FORK_CB_INPUT
+    if (utxoFileCache.GetPrefetch() > 0)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "utxoprefetch", &ThreadUTXOPrefetch));
+#endif
+
     // Count uptime
     MarkStartTime();
 
@@ -1410,6 +1480,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    blockCache.SetMaxUsage(std::max((int64_t)0, GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE)) << 20);
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Max cache setting possible %.1fMiB\n", nMaxDbCache);
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
@@ -1649,7 +1720,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+            if (pwalletMain->ScanForWalletTransactions(pindexRescan, true) < 0)
+                return InitError(_("Error: the wallet rescan could not read a block, see debug.log"));
             LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
             pwalletMain->SetBestChain(chainActive.GetLocator());
             nWalletDBUpdated++;
@@ -1784,21 +1856,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         // LOAD SERIALIZED DAT FILES INTO DATA CACHES FOR INTERNAL USE
 
         uiInterface.InitMessage(_("Loading masternode cache..."));
-        CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
-        if (!flatdb1.Load(mnodeman)) {
+        OpenMasternodeCaches();
+        if (!pflatdbMasternodes->Load(mnodeman)) {
             return InitError("Failed to load masternode cache from mncache.dat");
         }
 
         if (mnodeman.size()) {
             uiInterface.InitMessage(_("Loading masternode payment cache..."));
-            CFlatDB<CMasternodePayments> flatdb2("mnpayments.dat", "magicMasternodePaymentsCache");
-            if (!flatdb2.Load(mnpayments)) {
+            if (!pflatdbPayments->Load(mnpayments)) {
                 return InitError("Failed to load masternode payments cache from mnpayments.dat");
             }
 
             // uiInterface.InitMessage(_("Loading governance cache..."));
-            CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
-            if (!flatdb3.Load(governance)) {
+            if (!pflatdbGovernance->Load(governance)) {
                 return InitError("Failed to load governance cache from governance.dat");
             }
             governance.InitOnLoad();
@@ -1868,6 +1938,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
     scheduler.scheduleEvery(f, nPowTargetSpacing);
 
+    int64_t nCacheDumpInterval = GetArg("-cachedumpinterval", DEFAULT_CACHE_DUMP_INTERVAL);
+    if (nCacheDumpInterval > 0)
+        scheduler.scheduleEvery(&DumpMasternodeCaches, nCacheDumpInterval);
+
 #ifdef ENABLE_MINING
     // Generate coins in the background
  #ifdef ENABLE_WALLET
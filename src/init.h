@@ -6,7 +6,9 @@
 #ifndef BITCOIN_INIT_H
 #define BITCOIN_INIT_H
 
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "zcash/JoinSplit.hpp"
 
@@ -33,6 +35,18 @@ void InitParameterInteraction();
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler);
 void PrepareShutdown();
 
+/** Counters of the background dumps of a masternode cache file */
+struct CCacheDumpStats
+{
+    std::string strFilename;
+    int nDumps;
+    int64_t nLastPauseMicros;
+    int64_t nMaxPauseMicros;
+    int64_t nLastWriteMillis;
+};
+/** The dump counters of mncache.dat, mnpayments.dat and governance.dat, empty before they are opened */
+void GetMasternodeCacheDumpStats(std::vector<CCacheDumpStats>& vStatsRet);
+
 /** The help message mode determines what help message to show */
 enum HelpMessageMode {
     HMM_BITCOIND
@@ -10,12 +10,15 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/validation.h"
 #include "deprecation.h"
 #include "init.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
@@ -27,11 +30,13 @@
 #include "undo.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxofile.h"
 #include "validationinterface.h"
 #include "versionbits.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 
+#include "darksend.h"
 #include "governance.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
@@ -80,6 +85,8 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+bool fParanoidBlockReads = DEFAULT_PARANOID_BLOCK_READS;
+CBlockIndexLoadStats blockIndexLoadStats;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -251,6 +258,12 @@ int nPreferredDownload = 0;
 /** Dirty block index entries. */
 set<CBlockIndex*> setDirtyBlockIndex;
 
+/**
+ * Equihash solutions of block index entries that have not been written to the
+ * block tree database yet. All other solutions are loaded on demand.
+ */
+map<const CBlockIndex*, std::vector<unsigned char>> mapUnflushedSolutions;
+
 /** Dirty block file entries. */
 set<int> setDirtyFileInfo;
 } // namespace
@@ -302,6 +315,10 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer can rebuild compact blocks, so may be sent them.
+    bool fSupportsCompactBlocks;
+    //! The compact block from this peer waiting for a blocktxn.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
 
     CNodeState()
     {
@@ -316,6 +333,7 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        fSupportsCompactBlocks = false;
     }
 };
 
@@ -393,6 +411,8 @@ bool MarkBlockAsReceived(const uint256& hash)
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
+        if (state->partialBlock && state->partialBlock->header.GetHash() == hash)
+            state->partialBlock.reset();
         mapBlocksInFlight.erase(itInFlight);
         return true;
     }
@@ -854,7 +874,7 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     return nSigOps;
 }
 
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier, bool isZUTXO)
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier, bool isZUTXO, std::vector<CProofCheck>* pvProofChecks)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
@@ -863,6 +883,11 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash:
 
     if (!CheckTransactionWithoutProofVerification(tx, state, isZUTXO)) {
         return false;
+    } else if (pvProofChecks) {
+        // Defer the zk-SNARK checks to the caller's proof check queue
+        for (unsigned int i = 0; i < tx.vjoinsplit.size(); i++)
+            pvProofChecks->push_back(CProofCheck(tx, i));
+        return true;
     } else {
         // Ensure that zk-SNARKs verify
         BOOST_FOREACH (const JSDescription& joinsplit, tx.vjoinsplit) {
@@ -1217,7 +1242,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         CAmount nFees = nValueIn - nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        // Remember the youngest coinbase it spends, it becomes immature again
+        // if a reorg takes the chain back below its maturity.
+        int nCoinbaseSpendHeight = -1;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            if (coins->IsCoinBase())
+                nCoinbaseSpendHeight = std::max(nCoinbaseSpendHeight, coins->nHeight);
+        }
+
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), nCoinbaseSpendHeight, nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
@@ -1231,6 +1265,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                                  REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
 
+        // A full mempool evicted packages paying less than this, do not take them right back
+        CAmount nModifiedFees = nFees;
+        double dPriorityDummy = 0;
+        pool.ApplyDeltas(hash, dPriorityDummy, nModifiedFees);
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (fLimitFree && mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d", hash.ToString(), nModifiedFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1264,6 +1307,21 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Keep the unconfirmed chains short, adding and removing an entry walks all
+        // its ancestors and descendants
+        {
+            LOCK(pool.cs);
+            uint64_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+            uint64_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+            uint64_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+            uint64_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+            std::set<uint256> setAncestors;
+            std::string errString;
+            if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+                return state.DoS(0, error("AcceptToMemoryPool: %s %s", hash.ToString(), errString),
+                                 REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus())) {
@@ -1286,6 +1344,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
 
+        // Trim the pool back under -maxmempool. If that evicted this transaction
+        // it pays too little to compete with the transactions already in the pool.
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+
 		// Add memory address index
          if (fAddressIndex) {
              pool.addAddressIndex(entry, view);
@@ -1417,7 +1481,7 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1438,12 +1502,8 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::M
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos
-#ifdef FORK_CB_INPUT
-                       ,
-                       int nHeight
-#endif
-)
+/** Deserialize a block from disk without validating its header */
+static bool ReadBlockFromDiskUnchecked(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
@@ -1459,6 +1519,30 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+/**
+ * Whether the header of a stored block can be trusted without re-running
+ * Equihash and proof of work checks: it was fully checked when the block
+ * index entry reached BLOCK_VALID_TREE, and comparing the hash of what we
+ * read against the index is enough to detect on-disk corruption.
+ */
+static bool IsTrustedBlockRead(const CBlockIndex* pindex, bool fParanoid = fParanoidBlockReads)
+{
+    return !fParanoid && pindex->IsValid(BLOCK_VALID_TREE);
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos
+#ifdef FORK_CB_INPUT
+                       ,
+                       int nHeight
+#endif
+)
+{
+    if (!ReadBlockFromDiskUnchecked(block, pos))
+        return false;
+
     // Check the header
     if (!(CheckEquihashSolution(&block, Params()) &&
           CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())))
@@ -1469,7 +1553,15 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()
+    return ReadBlockFromDisk(block, pindex, fParanoidBlockReads);
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fParanoid)
+{
+    if (IsTrustedBlockRead(pindex, fParanoid)) {
+        if (!ReadBlockFromDiskUnchecked(block, pindex->GetBlockPos()))
+            return false;
+    } else if (!ReadBlockFromDisk(block, pindex->GetBlockPos()
 #ifdef FORK_CB_INPUT
                                       ,
                            pindex->nHeight
@@ -1482,6 +1574,54 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+std::shared_ptr<const CBlock> ReadBlockCached(const CBlockIndex* pindex)
+{
+    std::shared_ptr<const CBlock> pblock = blockCache.GetBlock(pindex->GetBlockHash());
+    if (pblock)
+        return pblock;
+    std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pindex))
+        return std::shared_ptr<const CBlock>();
+    return pblockRead;
+}
+
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // WriteBlockToDisk puts the message start and the block size in front of the block
+    unsigned int nPrefixSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nPrefixSize)
+        return error("%s: no block size prefix at %s", __func__, pos.ToString());
+
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - nPrefixSize), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    size_t nStart = ss.size();
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0 || nSize < 80 || nSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+            return error("%s: bad block size prefix at %s", __func__, pos.ToString());
+
+        // Only the header is deserialized, to detect corruption like the trusted CBlock reads do
+        CBlockHeader header;
+        filein >> header;
+        if (header.GetHash() != hash)
+            return error("%s: GetHash() doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString());
+        if (fseek(filein.Get(), pos.nPos, SEEK_SET) != 0)
+            return error("%s: fseek failed for %s", __func__, pos.ToString());
+
+        ss.resize(nStart + nSize);
+        filein.read(&ss[nStart], nSize);
+    } catch (const std::exception& e) {
+        ss.resize(nStart);
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = 50 * COIN;
@@ -1535,19 +1675,8 @@ CAmount GetMasternodePayment(int nHeight, CAmount blockValue)
 //ANON
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
-    block.SetNull();
-
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-
-    // Read block
-    try {
-        filein >> block;
-    } catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
-    }
+    if (!ReadBlockFromDiskUnchecked(block, pos))
+        return false;
 
     // Check the header
     if (!CheckProofOfWork(block.GetHash(), block.nBits, consensusParams))
@@ -1558,7 +1687,10 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (IsTrustedBlockRead(pindex)) {
+        if (!ReadBlockFromDiskUnchecked(block, pindex->GetBlockPos()))
+            return false;
+    } else if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1566,6 +1698,61 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool GetBlockSolution(const CBlockIndex* pindex, std::vector<unsigned char>& nSolution)
+{
+    AssertLockHeld(cs_main);
+
+    map<const CBlockIndex*, std::vector<unsigned char>>::const_iterator it = mapUnflushedSolutions.find(pindex);
+    if (it != mapUnflushedSolutions.end()) {
+        nSolution = it->second;
+        return true;
+    }
+
+    CDiskBlockIndex diskindex;
+    if (pblocktree->ReadBlockIndex(pindex->GetBlockHash(), diskindex)) {
+        nSolution.swap(diskindex.nSolution);
+        return true;
+    }
+
+    // Fall back to the header at the start of the stored block
+    if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(), true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pindex->GetBlockPos().ToString());
+        CBlockHeader header;
+        try {
+            filein >> header;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pindex->GetBlockPos().ToString());
+        }
+        if (header.GetHash() != pindex->GetBlockHash())
+            return error("%s: GetHash() doesn't match index for %s", __func__, pindex->ToString());
+        nSolution.swap(header.nSolution);
+        return true;
+    }
+
+    return error("%s: no Equihash solution available for %s", __func__, pindex->ToString());
+}
+
+bool GetBlockHeader(const CBlockIndex* pindex, CBlockHeader& header)
+{
+    header = pindex->GetBlockHeaderWithoutSolution();
+    return GetBlockSolution(pindex, header.nSolution);
+}
+
+size_t GetBlockIndexMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+
+    size_t nUsage = memusage::DynamicUsage(mapBlockIndex);
+    nUsage += mapBlockIndex.size() * memusage::MallocUsage(sizeof(CBlockIndex));
+    nUsage += memusage::DynamicUsage(mapUnflushedSolutions);
+    for (const auto& entry : mapUnflushedSolutions) {
+        nUsage += memusage::DynamicUsage(entry.second);
+    }
+    return nUsage;
+}
+
 
 bool IsInitialBlockDownload(bool includeFork)
 {
@@ -1755,6 +1942,15 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     UpdateCoins(tx, state, inputs, txundo, nHeight);
 }
 
+bool CProofCheck::operator()()
+{
+    const JSDescription& joinsplit = ptx->vjoinsplit[nJoinSplit];
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!joinsplit.Verify(*pzcashParams, verifier, ptx->joinSplitPubKey))
+        return ::error("CProofCheck(): %s:%d joinsplit does not verify", ptx->GetHash().ToString(), nJoinSplit);
+    return true;
+}
+
 bool CScriptCheck::operator()()
 {
     const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
@@ -2214,6 +2410,14 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CProofCheck> proofcheckqueue(16);
+
+void ThreadProofCheck()
+{
+    RenameThread("zcash-proofch");
+    proofcheckqueue.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2367,9 +2571,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
 
+    // With verification threads available, JoinSplit proofs are handed to
+    // the proof check queue and verified while inputs and scripts are checked.
+    bool fParallelProofs = fExpensiveChecks && nScriptCheckThreads;
+    std::vector<CProofCheck> vProofChecks;
+
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck, isZUTXO))
+    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck, isZUTXO, fParallelProofs ? &vProofChecks : NULL))
         return false;
+
+    CCheckQueueControl<CProofCheck> proofcontrol(fParallelProofs ? &proofcheckqueue : NULL);
+    proofcontrol.Add(vProofChecks);
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
     assert(hashPrevBlock == view.GetBestBlock());
@@ -2594,6 +2806,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    if (!proofcontrol.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
@@ -2747,15 +2962,21 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                     vFiles.push_back(make_pair(*it, &vinfoBlockFile[*it]));
                     setDirtyFileInfo.erase(it++);
                 }
-                std::vector<const CBlockIndex*> vBlocks;
+                std::vector<CDiskBlockIndex> vBlocks;
                 vBlocks.reserve(setDirtyBlockIndex.size());
                 for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();) {
-                    vBlocks.push_back(*it);
+                    std::vector<unsigned char> nSolution;
+                    if (!GetBlockSolution(*it, nSolution)) {
+                        return AbortNode(state, "Failed to read Equihash solution for block index entry");
+                    }
+                    vBlocks.push_back(CDiskBlockIndex(*it, nSolution));
                     setDirtyBlockIndex.erase(it++);
                 }
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Files to write to block index database");
                 }
+                // The written solutions can now be loaded from the block tree database
+                mapUnflushedSolutions.clear();
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -2894,10 +3115,11 @@ bool static DisconnectTip(CValidationState& state)
         // in which case we don't want to evict from the mempool yet!
         mempool.removeWithAnchor(anchorBeforeDisconnect);
     }
-    mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
+    mempool.removeCoinbaseSpends(pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    mnodeman.DisconnectBlockPayments(pindexDelete);
     // Get the current commitment tree
     ZCIncrementalMerkleTree newTree;
     assert(pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), newTree));
@@ -2977,6 +3199,10 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    mnodeman.ConnectBlockPayments(*pblock, pindexNew);
+    // Peers and RPC clients ask for a new tip right away
+    if (!IsInitialBlockDownload())
+        blockCache.Add(*pblock);
 
     // Tell wallet about transactions that went from mempool
     // to conflicted:
@@ -3298,6 +3524,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
 
+    mapUnflushedSolutions[pindexNew] = block.nSolution;
     setDirtyBlockIndex.insert(pindexNew);
 
     return pindexNew;
@@ -3460,7 +3687,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, libzcash::ProofVerifier& verifier, bool fCheckPOW, bool fCheckMerkleRoot, bool isZUTXO)
+bool CheckBlock(const CBlock& block, CValidationState& state, libzcash::ProofVerifier& verifier, bool fCheckPOW, bool fCheckMerkleRoot, bool isZUTXO, std::vector<CProofCheck>* pvProofChecks)
 {
     // These are checks that are independent of context.
     // Check that the header is valid (particularly PoW).  This is mostly
@@ -3517,7 +3744,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, libzcash::ProofVer
 
     // Check transactions
     BOOST_FOREACH (const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier, isZUTXO))
+        if (!CheckTransaction(tx, state, verifier, isZUTXO, pvProofChecks))
             return error("CheckBlock(): CheckTransaction failed");
 
     unsigned int nSigOps = 0;
@@ -3674,6 +3901,9 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     return true;
 }
 
+static int64_t nTimeForkLoad = 0;
+static int64_t nTimeForkCompare = 0;
+
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp, bool isZUTXO)
 {
     const CChainParams& chainparams = Params();
@@ -3734,101 +3964,36 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     const int zShieldedStartBlock = chainparams.ZshieldedStartBlock();
     const int zTransparentStartBlock = chainparams.ZtransparentStartBlock();
     if (fExpensiveChecks && isForkBlock(nHeight) && nHeight < zShieldedStartBlock ) {
-        CSHA256 hasher;
         //if block is in forking region validate it against file records
         if (!forkUtxoPath.empty()) {
         LogPrintf("AcceptBlock(): Starting to validate forking range against file records\n" );
+            int64_t nTimeStart = GetTimeMicros();
             std::string utxo_file_path = GetUTXOFileName(nHeight);
-            std::ifstream if_utxo(utxo_file_path, std::ios::binary | std::ios::in);
-            if (!if_utxo.is_open()) {
+            // The file was usually read already, ahead of this block or when it was mined
+            std::shared_ptr<const CUTXOFile> pfile = utxoFileCache.Get(utxo_file_path, false, forkCBPerBlock,
+                                                                       std::max(nScriptCheckThreads, 1));
+            // Read the next files while this block is checked and connected
+            for (int i = 1; i <= utxoFileCache.GetPrefetch(); i++) {
+                if (!isForkBlock(nHeight + i) || nHeight + i >= zShieldedStartBlock)
+                    break;
+                utxoFileCache.Prefetch(GetUTXOFileName(nHeight + i), false, forkCBPerBlock,
+                                       std::max(nScriptCheckThreads, 1));
+            }
+            int64_t nTime1 = GetTimeMicros(); nTimeForkLoad += nTime1 - nTimeStart;
+            LogPrint("bench", "  - Load UTXO file: %.2fms [%.2fs]\n", (nTime1 - nTimeStart) * 0.001, nTimeForkLoad * 0.000001);
+            if (!pfile) {
                 LogPrintf("AcceptBlock(): FORK Block - Cannot open UTXO file - %s\n", utxo_file_path);
             } else {
                 LogPrintf("AcceptBlock(): FORK Block - Validating block - %u / %s  with UTXO file - %s\n",
                           nHeight, block.GetHash().ToString(), utxo_file_path);
 
-                vector<pair<uint64_t, CScript>> txFromFile;
-                txFromFile.reserve(forkCBPerBlock);
-                int recs = 0;
+                //quit if checksums doesn't match
+                assert(!pfile->fChecksumMismatch && "Utxo checksum doesn't match");
 
-                while (if_utxo && recs < forkCBPerBlock) {
-                    char term = 0;
-                    char coin[8] = {};
-                    if (!if_utxo.read(coin, 8)) {
-                        LogPrintf("AcceptBlock(): FORK Block - No more data in the file \n");
-                        break;
-                    }
-                    uint64_t amount = bytes2uint64(coin);
-
-                    if(nHeight >= zTransparentStartBlock){
-                       amount = amount * 2;
-                   }
-                    char pubkeysize[8] = {};
-                    if (!if_utxo.read(pubkeysize, 8)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Not more data (PubKeyScript size)\n");
-                        break;
-                    }
-                    int pbsize = bytes2uint64(pubkeysize);
-                    if (pbsize == 0) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Warning! PubKeyScript size = 0\n");
-                        //but proceed
-                    }
-                    std::unique_ptr<char[]> pubKeyScript(new char[pbsize]);
-                    if (!if_utxo.read(&pubKeyScript[0], pbsize)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Not more data (PubKeyScript)\n");
-                        break;
-                    }
-                    unsigned char* pks = (unsigned char*)pubKeyScript.get();
-                    CScript script = CScript(pks, pks + pbsize);
-
-                    ///////////////////////CHECKSUM//////////////////////////////////
-                    hasher.Reset();
-
-                    unsigned char* script2 = (unsigned char*)pubKeyScript.get();
-                    const unsigned char* utxoSize = reinterpret_cast<unsigned char*>(pubkeysize);
-                    const unsigned char* unsignedCoin = reinterpret_cast<unsigned char*>(coin);
-
-                    hasher.Write(unsignedCoin, 8);
-                    hasher.Write(utxoSize, 8);
-                    hasher.Write(script2, pbsize);
-                    uint256 utxoHash;
-                    hasher.Finalize(utxoHash.begin());
-
-                    //read checksum sha256 hash from the file
-                    char* checksum = new char[32];
-                    if (!if_utxo.read(checksum, 32)) {
-                        LogPrintf("ERROR: CreateNewForkBlock(): [%u]: Couldn't read the transaction checksum.\n", nHeight);
-                        break;
-                    }
-                    //converting binary raw checksum to hex-string string checksum  10111011111010 => 2EFA
-                    std::stringstream cc;
-                    cc << std::hex << std::setfill('0');
-                    for (int i = 0; i < 32; ++i) {
-                        cc << std::setw(2) << (unsigned int)(unsigned char)(checksum[i]);
-                    }
-                    std::string checksumString = cc.str();
-                    uint256 transChecksum = uint256S(checksumString);
-
-                    //quit if checksums doesn't match
-                    assert(utxoHash == transChecksum && "Utxo checksum doesn't match");
-                    ///////////////////////CHECKSUM END//////////////////////////////////
-
-                    txFromFile.push_back(make_pair(amount, script));
-
-                    if (!if_utxo.read(&term, 1)) {
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - No more data (record separator)\n");
-                        break;
-                    }
-                    if (term != '\n') {
-                        //This maybe not an error, but warning none the less
-                        LogPrintf("AcceptBlock(): FORK Block - UTXO file corrupted? - Warning! No record separator ('0xA') was found\n");
-                        if_utxo.seekg(-1, ios_base::cur); //move one char back - if it is not a separator, maybe there is not separators at all
-                    }
-                    recs++;
-                }
+                size_t recs = pfile->vRecords.size();
                 LogPrintf("AcceptBlock(): FORK Block - %d records read from UTXO file\n", recs);
 
-                if (txFromFile.size() != block.vtx.size() ||
-                    recs != block.vtx.size()) {
+                if (recs != block.vtx.size()) {
                     state.DoS(100, error("AcceptBlock(): Number of file records - %d doesn't match number of transcations in block - %d\n", recs, block.vtx.size()),
                               REJECT_INVALID, "bad-fork-block");
                     pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3836,17 +4001,19 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                     return false;
                 }
 
-                int txid = 0;
-                typedef boost::tuple<pair<uint64_t, CScript>&, const CTransaction&> fork_cmp_tuple;
-                BOOST_FOREACH (fork_cmp_tuple cmp, boost::combine(txFromFile, block.vtx)) {
-                    pair<uint64_t, CScript>& rec = cmp.get<0>();
-                    const CTransaction& tx = cmp.get<1>();
+                for (size_t txid = 0; txid < recs; txid++) {
+                    const CUTXORecord& rec = pfile->vRecords[txid];
+                    const CTransaction& tx = block.vtx[txid];
+                    uint64_t amount = rec.nAmount;
+                    if (nHeight >= zTransparentStartBlock) {
+                        amount = amount * 2;
+                    }
 
-                    if (rec.first != tx.vout[0].nValue ||
-                        rec.second != tx.vout[0].scriptPubKey) {
+                    if (amount != tx.vout[0].nValue ||
+                        rec.scriptPubKey != tx.vout[0].scriptPubKey) {
                         LogPrintf("AcceptBlock(): FORK Block - Error: Transaction (%d) mismatch\n", txid);
                         LogPrintf("AcceptBlock(): Transaction: Amount: %d; scriptPubKey: %s\n", tx.vout[0].nValue, tx.vout[0].scriptPubKey.ToString());
-                        LogPrintf("AcceptBlock(): File Record: Amount: %d; scriptPubKey: %s\n", rec.first, rec.second.ToString());
+                        LogPrintf("AcceptBlock(): File Record: Amount: %d; scriptPubKey: %s\n", amount, rec.scriptPubKey.ToString());
                         state.DoS(100, error("AcceptBlock(): FORK Block - Transaction (%d) doesn't match record in the UTXO file", txid),
                                   REJECT_INVALID, "bad-fork-block");
                         pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3854,7 +4021,14 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                         return false;
                     }
                 }
-                txid++;
+
+                int64_t nTime2 = GetTimeMicros(); nTimeForkCompare += nTime2 - nTime1;
+                LogPrint("bench", "  - Compare with UTXO file: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeForkCompare * 0.000001);
+                uint64_t nLoaded, nPrefetched;
+                int64_t nLoadTime, nPrefetchTime, nWaitTime;
+                utxoFileCache.GetStats(nLoaded, nPrefetched, nLoadTime, nPrefetchTime, nWaitTime);
+                LogPrint("bench", "  - UTXO files: %u read ahead [%.2fs], %u read on demand [%.2fs], waited for read ahead [%.2fs]\n",
+                         nPrefetched, nPrefetchTime * 0.000001, nLoaded, nLoadTime * 0.000001, nWaitTime * 0.000001);
             }
         }
     }
@@ -4137,12 +4311,15 @@ bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
 
-    if (!pblocktree->LoadBlockIndexGuts())
+    int64_t nTimeStart = GetTimeMicros();
+    CBlockIndexLoadStats stats;
+    if (!pblocktree->LoadBlockIndexGuts(std::max(nScriptCheckThreads, 1), stats))
         return false;
 
     boost::this_thread::interruption_point();
 
     // Calculate nChainWork
+    int64_t nTimeChainWorkStart = GetTimeMicros();
     vector<pair<int, CBlockIndex*>> vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*) & item, mapBlockIndex) {
@@ -4176,6 +4353,12 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    int64_t nTimeEnd = GetTimeMicros();
+    stats.nTimeChainWork = nTimeEnd - nTimeChainWorkStart;
+    stats.nTimeTotal = nTimeEnd - nTimeStart;
+    blockIndexLoadStats = stats;
+    LogPrintf("%s: block index loaded in %.2fms (read %.2fms, merge %.2fms, chain work %.2fms)\n", __func__,
+              0.001 * stats.nTimeTotal, 0.001 * stats.nTimeRead, 0.001 * stats.nTimeMerge, 0.001 * stats.nTimeChainWork);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -4380,6 +4563,7 @@ void UnloadBlockIndex()
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
+    mapUnflushedSolutions.clear();
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
@@ -4895,6 +5079,21 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+// Requires cs_main.
+/** Whether a block may be sent to a peer that asks for it or for some of its transactions */
+static bool CanSendBlock(const CBlockIndex* pindex)
+{
+    if (chainActive.Contains(pindex))
+        return true;
+    static const int nOneMonth = 30 * 24 * 60 * 60;
+    // To prevent fingerprinting attacks, only send blocks outside of the active
+    // chain if they are valid, and no more than a month older (both in time, and in
+    // best equivalent proof of work) than the best header chain we know about.
+    return pindex->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+           (pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() < nOneMonth) &&
+           (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -4913,33 +5112,67 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                               (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                               (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-                        }
+                    send = CanSendBlock(mi->second);
+                    if (!send) {
+                        LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
                     }
                 }
+                // Only recent blocks are sent compact, the peer is unlikely to have
+                // the transactions of older ones in its mempool.
+                bool fCompact = send && inv.type == MSG_CMPCT_BLOCK &&
+                                mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA) && (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fCompact)) &&
+                    IsTrustedBlockRead(mi->second)) {
+                    // Send the stored bytes as they are, with cs_main released during the
+                    // file I/O: a stored block never moves once its position is known.
+                    CBlockIndex* pindex = mi->second;
+                    CDiskBlockPos pos = pindex->GetBlockPos();
+                    bool fContinue = inv.hash == pfrom->hashContinue;
+                    LEAVE_CRITICAL_SECTION(cs_main);
+                    pfrom->BeginMessage("block");
+                    bool fSent = blockCache.GetSerializedBlock(inv.hash, pfrom->ssSend) ||
+                                 ReadRawBlockFromDisk(pfrom->ssSend, pos, inv.hash, Params().MessageStart());
+                    if (fSent)
+                        pfrom->EndMessage();
+                    else
+                        pfrom->AbortMessage();
+                    ENTER_CRITICAL_SECTION(cs_main);
+
+                    if (!fSent) {
+                        // The stored bytes did not check out, read and send the block the usual way
+                        std::shared_ptr<const CBlock> pblock = ReadBlockCached(pindex);
+                        if (pblock) {
+                            pfrom->PushMessage("block", *pblock);
+                            fSent = true;
+                        } else {
+                            LogPrintf("%s: cannot read block %s for peer=%i\n", __func__, inv.hash.ToString(), pfrom->GetId());
+                            vNotFound.push_back(inv);
+                        }
+                    }
+
+                    // Trigger the peer node to send a getblocks request for the next batch of inventory
+                    if (fContinue && fSent) {
+                        vector<CInv> vInv;
+                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        pfrom->PushMessage("inv", vInv);
+                        pfrom->hashContinue.SetNull();
+                    }
+                } else if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
+                    std::shared_ptr<const CBlock> pblock = ReadBlockCached((*mi).second);
+                    if (!pblock)
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    const CBlock& block = *pblock;
+                    if (fCompact && block.vtx.size() <= std::numeric_limits<uint16_t>::max()) {
+                        CBlockHeaderAndShortTxIDs cmpctblock(block);
+                        pfrom->PushMessage(NetMsgType::CMPCTBLOCK, cmpctblock);
+                    } else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                         pfrom->PushMessage("block", block);
                     else // MSG_FILTERED_BLOCK)
                     {
@@ -5057,7 +5290,12 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+                    // announcements sent on dseg are kept serialized
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    if (mnodeman.GetSerializedBroadcast(inv.hash, ss)) {
+                        pfrom->PushMessage(NetMsgType::MNANNOUNCE, ss);
+                        pushed = true;
+                    } else if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash].second;
@@ -5067,7 +5305,11 @@ void static ProcessGetData(CNode* pfrom)
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_PING) {
-                    if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
+                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    if (mnodeman.GetSerializedPing(inv.hash, ss)) {
+                        pfrom->PushMessage(NetMsgType::MNPING, ss);
+                        pushed = true;
+                    } else if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
                         ss << mnodeman.mapSeenMasternodePing[inv.hash];
@@ -5142,7 +5384,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5161,6 +5403,32 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Validate and connect a block received whole or rebuilt from a compact block */
+void static ProcessReceivedBlock(CNode* pfrom, CBlock& block)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
+
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", string(NetMsgType::BLOCK), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -5306,6 +5574,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer we can rebuild the blocks it sends us from the mempool
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION)
+            pfrom->PushMessage(NetMsgType::SENDCMPCT, false, (uint64_t)1);
+    }
+
+
+    else if (strCommand == NetMsgType::SENDCMPCT) {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // New blocks are still announced by inv, the compact block is only sent when asked for
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fSupportsCompactBlocks = true;
+        }
     }
 
 
@@ -5410,7 +5694,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState* nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        // A block announced at the tip is mostly made of transactions we
+                        // already have, so ask for it compact if the peer can send that.
+                        vToFetch.push_back(CInv(nodestate->fSupportsCompactBlocks ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5513,7 +5799,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
         for (; pindex; pindex = chainActive.Next(pindex)) {
-            vHeaders.push_back(pindex->GetBlockHeader());
+            CBlockHeader header;
+            if (!GetBlockHeader(pindex, header))
+                break;
+            vHeaders.push_back(header);
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -5700,28 +5989,156 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CBlock block;
         vRecv >> block;
 
-        CInv inv(MSG_BLOCK, block.GetHash());
-        LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
+        ProcessReceivedBlock(pfrom, block);
+    }
 
-        pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s (%u txs) peer=%d\n", hash.ToString(), cmpctblock.BlockTxCount(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+            // Compact blocks are only asked for close to the tip, never sent unrequested
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator>>::iterator itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId()) {
+                LogPrint("net", "unrequested cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+                return true;
+            }
+
+            vector<CInv> vGetBlock(1, CInv(MSG_BLOCK, hash));
+            if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock)) {
+                // The headers before it did not arrive yet, take the full block path
+                pfrom->PushMessage("getdata", vGetBlock);
+                return true;
+            }
+
+            CValidationState state;
+            CBlockIndex* pindex = NULL;
+            if (!AcceptBlockHeader(cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("invalid header received in cmpctblock %s", hash.ToString());
+            }
+            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                // Got it meanwhile, stop waiting for it from this peer
+                MarkBlockAsReceived(hash);
+                return true;
+            }
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock());
+            ReadStatus status = partialBlock->InitData(cmpctblock, mempool);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hash.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                pfrom->PushMessage("getdata", vGetBlock);
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            req.blockhash = hash;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock->IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                LogPrint("net", "getblocktxn %s (%u of %u txs missing) to peer=%d\n", hash.ToString(),
+                         req.indexes.size(), cmpctblock.BlockTxCount(), pfrom->id);
+                State(pfrom->GetId())->partialBlock = partialBlock;
+                pfrom->PushMessage(NetMsgType::GETBLOCKTXN, req);
+                return true;
+            }
+
+            status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+            if (status != READ_STATUS_OK) {
+                pfrom->PushMessage("getdata", vGetBlock);
+                return true;
+            }
+        }
+
+        // Every transaction was in the mempool
+        ProcessReceivedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN)
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        std::shared_ptr<const CBlock> pblock;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+            if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint("net", "peer=%d asked for transactions of unknown block %s\n", pfrom->id, req.blockhash.ToString());
+                return true;
+            }
+            if (!CanSendBlock(mi->second)) {
+                LogPrintf("%s: ignoring getblocktxn from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                return true;
+            }
+            if (mi->second->nHeight >= chainActive.Height() - MAX_BLOCKTXN_DEPTH)
+                pblock = ReadBlockCached(mi->second);
+        }
+
+        if (!pblock) {
+            // Too old for a compact block we sent, answer with the whole block like a getdata
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= pblock->vtx.size()) {
                 LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent getblocktxn with out-of-bounds index %u", pfrom->id, req.indexes[i]);
             }
+            resp.txn[i] = pblock->vtx[req.indexes[i]];
         }
+        pfrom->PushMessage(NetMsgType::BLOCKTXN, resp);
+    }
 
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex)
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "unrequested blocktxn %s peer=%d\n", resp.blockhash.ToString(), pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = nodestate->partialBlock->FillBlock(block, resp.txn);
+            nodestate->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent blocktxn not matching getblocktxn for %s", pfrom->id, resp.blockhash.ToString());
+            }
+            if (status == READ_STATUS_FAILED) {
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+                return true;
+            }
+        }
+
+        ProcessReceivedBlock(pfrom, block);
     }
 
 
@@ -5977,6 +6394,55 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+/**
+ * Masternode payment and governance votes arrive in bursts during sync. When the next
+ * message is a vote, verify the signatures of all the votes already queued behind it on
+ * the message signature check threads, so that processing them one at a time only hits
+ * the signature cache. No cs_main or manager locks are held while verifying.
+ */
+// requires LOCK(cs_vRecvMsg)
+static void PreverifyMessageSignatures(CNode* pfrom)
+{
+    if (pfrom->vRecvMsg.empty() || pfrom->vRecvMsg.front().fSigsPreverified)
+        return;
+
+    std::vector<CMessageSignatureCheck> vChecks;
+    BOOST_FOREACH(CNetMessage& msg, pfrom->vRecvMsg) {
+        if (!msg.complete())
+            break;
+        std::string strCommand = msg.hdr.GetCommand();
+        bool fPaymentVote = strCommand == NetMsgType::MASTERNODEPAYMENTVOTE;
+        if (!fPaymentVote && strCommand != NetMsgType::MNGOVERNANCEOBJECTVOTE) {
+            if (vChecks.empty())
+                return;
+            continue;
+        }
+        msg.fSigsPreverified = true;
+        try {
+            CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), msg.vRecv.GetType(), msg.vRecv.GetVersion());
+            CMessageSignatureCheck check;
+            bool fKnown;
+            if (fPaymentVote) {
+                CMasternodePaymentVote vote;
+                vRecv >> vote;
+                fKnown = vote.GetSignatureCheck(check);
+            } else {
+                CGovernanceVote vote;
+                vRecv >> vote;
+                fKnown = vote.GetSignatureCheck(check);
+            }
+            if (fKnown) {
+                vChecks.push_back(CMessageSignatureCheck());
+                vChecks.back().swap(check);
+            }
+        } catch (const std::exception&) {
+            // Malformed messages are rejected when processed
+        }
+    }
+
+    darkSendSigner.VerifyMessages(vChecks);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -6000,6 +6466,8 @@ bool ProcessMessages(CNode* pfrom)
     if (!pfrom->vRecvGetData.empty())
         return fOk;
 
+    PreverifyMessageSignatures(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -47,11 +48,13 @@ class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
 class CInv;
+class CProofCheck;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
 
+struct CBlockIndexLoadStats;
 struct CNodeStateStats;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
@@ -89,6 +92,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -138,6 +143,8 @@ static const bool DEFAULT_RELAYPRIORITY = true;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -paranoidblockreads, re-checking Equihash and PoW of every block read from disk */
+static const bool DEFAULT_PARANOID_BLOCK_READS = false;
 static const bool DEFAULT_TXINDEX = true;
 static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
@@ -186,6 +193,9 @@ extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fParanoidBlockReads;
+/** Per-phase timings of the block index load at startup */
+extern CBlockIndexLoadStats blockIndexLoadStats;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
@@ -272,6 +282,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle);
 
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the JoinSplit proof checking thread */
+void ThreadProofCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex* const& bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -797,7 +809,7 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState& state, cons
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier, bool isZUTXO = false);
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier, bool isZUTXO = false, std::vector<CProofCheck>* pvProofChecks = NULL);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state, bool isZUTXO = false);
 bool CheckJoinSplitSigs(const CTransaction& tx, CValidationState &state, const unsigned int flags);
 
@@ -881,6 +893,29 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one JoinSplit proof verification
+ * Note that this stores references to the transaction holding the JoinSplit
+ */
+class CProofCheck
+{
+private:
+    const CTransaction* ptx;
+    unsigned int nJoinSplit;
+
+public:
+    CProofCheck() : ptx(0), nJoinSplit(0) {}
+    CProofCheck(const CTransaction& txIn, unsigned int nJoinSplitIn) : ptx(&txIn), nJoinSplit(nJoinSplitIn) {}
+
+    bool operator()();
+
+    void swap(CProofCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(nJoinSplit, check.nJoinSplit);
+    }
+};
+
 // bool GetTimestampIndex(const unsigned int& high, const unsigned int& low, std::vector<uint256>& hashes);
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes);
 bool GetSpentIndex(CSpentIndexKey& key, CSpentIndexValue& value);
@@ -896,9 +931,24 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos
 #endif
 );
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** As above, re-checking the header if fParanoid whatever -paranoidblockreads says */
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fParanoid);
 
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Get a block from the recently connected block cache, or else read it from disk. NULL on failure */
+std::shared_ptr<const CBlock> ReadBlockCached(const CBlockIndex* pindex);
+/**
+ * Append the serialized bytes of the stored block with the given hash to ss, without
+ * deserializing it. Only the header is checked against the hash. Does not need cs_main.
+ */
+bool ReadRawBlockFromDisk(CDataStream& ss, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart);
+/** Load the Equihash solution of an indexed block, which is not kept in memory */
+bool GetBlockSolution(const CBlockIndex* pindex, std::vector<unsigned char>& nSolution);
+/** Reconstruct the full header, including the Equihash solution, of an indexed block */
+bool GetBlockHeader(const CBlockIndex* pindex, CBlockHeader& header);
+/** Bytes of memory used by the block index */
+size_t GetBlockIndexMemoryUsage();
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -921,7 +971,8 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
 
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool isZUTXO = false);
+                bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool isZUTXO = false,
+                std::vector<CProofCheck>* pvProofChecks = NULL);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev, bool isZUTXO);
@@ -100,6 +100,13 @@ void CMasternodePayments::Clear()
     mapMasternodePaymentVotes.clear();
 }
 
+void CMasternodePayments::GetSnapshot(CMasternodePayments &snapshotRet) const
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+    snapshotRet.mapMasternodePaymentVotes = mapMasternodePaymentVotes;
+    snapshotRet.mapMasternodeBlocks = mapMasternodeBlocks;
+}
+
 bool CMasternodePayments::CanVote(COutPoint outMasternode, int nBlockHeight)
 {
     LOCK(cs_mapMasternodePaymentVotes);
@@ -294,12 +301,25 @@ void CMasternodePayments::ProcessMessage(CNode *pfrom, std::string &strCommand,
     }
 }
 
+std::string CMasternodePaymentVote::GetSignatureMessage() const
+{
+    return vinMasternode.prevout.ToStringShort() +
+           boost::lexical_cast<std::string>(nBlockHeight) +
+           ScriptToAsmStr(payee);
+}
+
+bool CMasternodePaymentVote::GetSignatureCheck(CMessageSignatureCheck& checkRet) const
+{
+    masternode_info_t mnInfo = mnodeman.GetMasternodeInfo(vinMasternode);
+    if(!mnInfo.fInfoValid) return false;
+    checkRet = CMessageSignatureCheck(mnInfo.pubKeyMasternode, vchSig, GetSignatureMessage());
+    return true;
+}
+
 bool CMasternodePaymentVote::Sign()
 {
     std::string strError;
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                             boost::lexical_cast<std::string>(nBlockHeight) +
-                             ScriptToAsmStr(payee);
+    std::string strMessage = GetSignatureMessage();
 
     if (!darkSendSigner.SignMessage(strMessage, vchSig, activeMasternode.keyMasternode))
     {
@@ -352,6 +372,26 @@ bool CMasternodePayments::IsScheduled(CMasternode &mn, int nNotBlockHeight)
     return false;
 }
 
+void CMasternodePayments::GetScheduledPayees(int nNotBlockHeight, std::set<CScript> &setPayeesRet)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    setPayeesRet.clear();
+    if (!pCurrentBlockIndex)
+        return;
+
+    CScript payee;
+    for (int64_t h = pCurrentBlockIndex->nHeight; h <= pCurrentBlockIndex->nHeight + 8; h++)
+    {
+        if (h == nNotBlockHeight)
+            continue;
+        if (mapMasternodeBlocks.count(h) && mapMasternodeBlocks[h].GetBestPayee(payee))
+        {
+            setPayeesRet.insert(payee);
+        }
+    }
+}
+
 bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote &vote)
 {
     uint256 blockHash = uint256();
@@ -726,9 +766,7 @@ bool CMasternodePaymentVote::CheckSignature(const CPubKey &pubKeyMasternode, int
     // do not ban by default
     nDos = 0;
 
-    std::string strMessage = vinMasternode.prevout.ToStringShort() +
-                             boost::lexical_cast<std::string>(nBlockHeight) +
-                             ScriptToAsmStr(payee);
+    std::string strMessage = GetSignatureMessage();
 
     std::string strError = "";
     if (!darkSendSigner.VerifyMessage(pubKeyMasternode, vchSig, strMessage, strError))
@@ -14,6 +14,7 @@
 class CMasternodePayments;
 class CMasternodePaymentVote;
 class CMasternodeBlockPayees;
+class CMessageSignatureCheck;
 
 // static const int MNPAYMENTS_SIGNATURES_REQUIRED = 6;
 // static const int MNPAYMENTS_SIGNATURES_TOTAL = 10;
@@ -151,6 +152,12 @@ class CMasternodePaymentVote
         return ss.GetHash();
     }
 
+    /// The message signed by the masternode
+    std::string GetSignatureMessage() const;
+
+    /// Prepare the signature check for parallel verification, false if the masternode is unknown
+    bool GetSignatureCheck(CMessageSignatureCheck& checkRet) const;
+
     bool Sign();
     bool CheckSignature(const CPubKey &pubKeyMasternode, int nValidationHeight, int &nDos);
 
@@ -199,6 +206,9 @@ class CMasternodePayments
 
     void Clear();
 
+    /// Copy what is stored in mnpayments.dat, so that it can be serialized without holding the locks
+    void GetSnapshot(CMasternodePayments &snapshotRet) const;
+
     bool AddPaymentVote(const CMasternodePaymentVote &vote);
     bool HasVerifiedPaymentVote(uint256 hashIn);
     bool ProcessBlock(int nBlockHeight);
@@ -212,6 +222,8 @@ class CMasternodePayments
     bool GetBlockPayee(int nBlockHeight, CScript &payee);
     bool IsTransactionValid(const CTransaction &txNew, int nBlockHeight);
     bool IsScheduled(CMasternode &mn, int nNotBlockHeight);
+    /// Payees of the next blocks (same range as IsScheduled), for checking many masternodes at once
+    void GetScheduledPayees(int nNotBlockHeight, std::set<CScript> &setPayeesRet);
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight);
 
@@ -405,45 +405,24 @@ int CMasternode::GetCollateralAge()
     return nHeight - nCacheCollateralBlock;
 }
 
-void CMasternode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack)
+void CMasternode::UpdateLastPaid(const CScript &mnpayee, const std::vector<std::pair<int, int64_t>> &vecPayments)
 {
-    if (!pindex)
-        return;
-
-    const CBlockIndex *BlockReading = pindex;
-
-    CScript mnpayee = GetScriptForDestination(pubKeyCollateralAddress.GetID());
     LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s\n", vin.prevout.ToStringShort());
 
     LOCK(cs_mapMasternodeBlocks);
 
-    for (int i = 0; BlockReading && BlockReading->nHeight > nBlockLastPaid && i < nMaxBlocksToScanBack; i++)
+    for (std::vector<std::pair<int, int64_t>>::const_iterator it = vecPayments.begin(); it != vecPayments.end(); ++it)
     {
-        if (mnpayments.mapMasternodeBlocks.count(BlockReading->nHeight) &&
-            mnpayments.mapMasternodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2))
-        {
-            CBlock block;
-            if (!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
-                continue;
-
-            CAmount nMasternodePayment = GetMasternodePayment(BlockReading->nHeight, block.vtx[0].GetValueOut());
-
-            BOOST_FOREACH (CTxOut txout, block.vtx[0].vout)
-                if (mnpayee == txout.scriptPubKey && nMasternodePayment == txout.nValue)
-                {
-                    nBlockLastPaid = BlockReading->nHeight;
-                    nTimeLastPaid = BlockReading->nTime;
-                    LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", vin.prevout.ToStringShort(), nBlockLastPaid);
-                    return;
-                }
-        }
-
-        if (BlockReading->pprev == NULL)
-        {
-            assert(BlockReading);
+        if (it->first <= nBlockLastPaid)
             break;
+        if (mnpayments.mapMasternodeBlocks.count(it->first) &&
+            mnpayments.mapMasternodeBlocks[it->first].HasPayeeWithVotes(mnpayee, 2))
+        {
+            nBlockLastPaid = it->first;
+            nTimeLastPaid = it->second;
+            LogPrint("masternode", "CMasternode::UpdateLastPaidBlock -- searching for block with payment to %s -- found new %d\n", vin.prevout.ToStringShort(), nBlockLastPaid);
+            return;
         }
-        BlockReading = BlockReading->pprev;
     }
 
     // Last payment for this masternode wasn't found in latest mnpayments blocks
@@ -663,7 +642,10 @@ bool CMasternodeBroadcast::Update(CMasternode *pmn, int &nDos)
     {
         // take the newest entry
         LogPrintf("CMasternodeBroadcast::Update -- Got UPDATED Masternode entry: addr=%s\n", addr.ToString());
-        if (pmn->UpdateFromNewBroadcast((*this)))
+        CPubKey pubKeyMasternodeOld = pmn->pubKeyMasternode;
+        bool fUpdated = pmn->UpdateFromNewBroadcast((*this));
+        mnodeman.UpdateLookupIndexes(pubKeyMasternodeOld, pmn);
+        if (fUpdated)
         {
             pmn->Check();
             Relay();
@@ -305,7 +305,8 @@ public:
 
     int GetLastPaidTime() { return nTimeLastPaid; }
     int GetLastPaidBlock() { return nBlockLastPaid; }
-    void UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanBack);
+    /// Take the newest block of vecPayments, (height, time) of blocks paying mnpayee newest first, that was voted for
+    void UpdateLastPaid(const CScript& mnpayee, const std::vector<std::pair<int, int64_t> >& vecPayments);
 
     // KEEP TRACK OF EACH GOVERNANCE ITEM INCASE THIS NODE GOES OFFLINE, SO WE CAN RECALC THEIR STATUS
     void AddGovernanceVote(uint256 nGovernanceObjectHash);
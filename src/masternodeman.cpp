@@ -16,16 +16,7 @@
 /** Masternode manager */
 CMasternodeMan mnodeman;
 
-const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-4";
-
-struct CompareLastPaidBlock
-{
-    bool operator()(const std::pair<int, CMasternode *> &t1,
-                    const std::pair<int, CMasternode *> &t2) const
-    {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
-    }
-};
+const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-5";
 
 struct CompareScoreMN
 {
@@ -102,9 +93,147 @@ void CMasternodeIndex::RebuildIndex()
     }
 }
 
+bool CMasternodeLastPaidIndex::IsSynced(const CBlockIndex *pindexTip) const
+{
+    return pindexTip && hashBestBlock == pindexTip->GetBlockHash();
+}
+
+void CMasternodeLastPaidIndex::AddBlock(int nHeight, int64_t nTime, const std::vector<CScript> &vecPayees)
+{
+    mapPaidBlocks[nHeight] = std::make_pair(nTime, vecPayees);
+    BOOST_FOREACH (const CScript &payee, vecPayees)
+    {
+        mapPayeeHeights[payee].insert(nHeight);
+    }
+}
+
+void CMasternodeLastPaidIndex::RemoveBlock(int nHeight)
+{
+    std::map<int, std::pair<int64_t, std::vector<CScript>>>::iterator it = mapPaidBlocks.find(nHeight);
+    if (it == mapPaidBlocks.end())
+        return;
+    BOOST_FOREACH (const CScript &payee, it->second.second)
+    {
+        std::map<CScript, std::set<int>>::iterator itPayee = mapPayeeHeights.find(payee);
+        if (itPayee == mapPayeeHeights.end())
+            continue;
+        itPayee->second.erase(nHeight);
+        if (itPayee->second.empty())
+            mapPayeeHeights.erase(itPayee);
+    }
+    mapPaidBlocks.erase(it);
+}
+
+void CMasternodeLastPaidIndex::ConnectBlock(const CBlock &block, const CBlockIndex *pindex)
+{
+    // a gap would leave payments out, have the next user rebuild the index instead
+    if (!pindex->pprev || hashBestBlock != pindex->pprev->GetBlockHash())
+    {
+        Clear();
+        return;
+    }
+
+    const CTransaction &txCoinbase = block.vtx[0];
+    CAmount nMasternodePayment = GetMasternodePayment(pindex->nHeight, txCoinbase.GetValueOut());
+    std::vector<CScript> vecPayees;
+    BOOST_FOREACH (const CTxOut &txout, txCoinbase.vout)
+    {
+        if (txout.nValue == nMasternodePayment)
+            vecPayees.push_back(txout.scriptPubKey);
+    }
+    AddBlock(pindex->nHeight, pindex->nTime, vecPayees);
+    hashBestBlock = pindex->GetBlockHash();
+}
+
+void CMasternodeLastPaidIndex::DisconnectBlock(const CBlockIndex *pindex)
+{
+    if (hashBestBlock != pindex->GetBlockHash())
+    {
+        Clear();
+        return;
+    }
+
+    RemoveBlock(pindex->nHeight);
+    hashBestBlock = pindex->pprev ? pindex->pprev->GetBlockHash() : uint256();
+}
+
+bool CMasternodeLastPaidIndex::Rebuild(const CBlockIndex *pindexTip, int nDepth)
+{
+    AssertLockHeld(cs_main);
+
+    Clear();
+    if (!pindexTip)
+        return false;
+
+    int64_t nTimeStart = GetTimeMicros();
+    const CBlockIndex *pindex = pindexTip;
+    for (int i = 0; pindex && i < nDepth; i++, pindex = pindex->pprev)
+    {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+        {
+            Clear();
+            return error("CMasternodeLastPaidIndex::Rebuild -- failed to read block %s", pindex->GetBlockHash().ToString());
+        }
+
+        const CTransaction &txCoinbase = block.vtx[0];
+        CAmount nMasternodePayment = GetMasternodePayment(pindex->nHeight, txCoinbase.GetValueOut());
+        std::vector<CScript> vecPayees;
+        BOOST_FOREACH (const CTxOut &txout, txCoinbase.vout)
+        {
+            if (txout.nValue == nMasternodePayment)
+                vecPayees.push_back(txout.scriptPubKey);
+        }
+        AddBlock(pindex->nHeight, pindex->nTime, vecPayees);
+    }
+    hashBestBlock = pindexTip->GetBlockHash();
+
+    LogPrint("mnpayments", "CMasternodeLastPaidIndex::Rebuild -- indexed %d blocks up to height %d in %.2fms\n",
+             (int)mapPaidBlocks.size(), pindexTip->nHeight, 0.001 * (GetTimeMicros() - nTimeStart));
+    return true;
+}
+
+void CMasternodeLastPaidIndex::Prune(int nHeight)
+{
+    while (!mapPaidBlocks.empty() && mapPaidBlocks.begin()->first < nHeight)
+    {
+        RemoveBlock(mapPaidBlocks.begin()->first);
+    }
+}
+
+void CMasternodeLastPaidIndex::GetPayments(const CScript &payee, int nHeightMin, int nHeightMax, std::vector<std::pair<int, int64_t>> &vecPaymentsRet) const
+{
+    vecPaymentsRet.clear();
+
+    std::map<CScript, std::set<int>>::const_iterator itPayee = mapPayeeHeights.find(payee);
+    if (itPayee == mapPayeeHeights.end())
+        return;
+
+    for (std::set<int>::const_reverse_iterator it = itPayee->second.rbegin(); it != itPayee->second.rend(); ++it)
+    {
+        if (*it <= nHeightMin)
+            break;
+        if (*it > nHeightMax)
+            continue;
+        vecPaymentsRet.push_back(std::make_pair(*it, mapPaidBlocks.find(*it)->second.first));
+    }
+}
+
+void CMasternodeLastPaidIndex::Clear()
+{
+    hashBestBlock.SetNull();
+    mapPaidBlocks.clear();
+    mapPayeeHeights.clear();
+}
+
 CMasternodeMan::CMasternodeMan()
     : cs(),
       vMasternodes(),
+      mapIndexByOutpoint(),
+      mapIndexByPubKey(),
+      mapIndexByPayee(),
+      setPaymentQueue(),
+      lastPaidIndex(),
       mAskedUsForMasternodeList(),
       mWeAskedForMasternodeList(),
       mWeAskedForMasternodeListEntry(),
@@ -112,6 +241,10 @@ CMasternodeMan::CMasternodeMan()
       mMnbRecoveryRequests(),
       mMnbRecoveryGoodReplies(),
       listScheduledMnbRequestConnections(),
+      mapScoreCache(),
+      listScoreCacheOrder(),
+      nScoreCacheHits(0),
+      nScoreCacheMisses(0),
       nLastIndexRebuildTime(0),
       indexMasternodes(),
       indexMasternodesOld(),
@@ -119,6 +252,7 @@ CMasternodeMan::CMasternodeMan()
       fMasternodesAdded(false),
       fMasternodesRemoved(false),
       vecDirtyGovernanceObjectHashes(),
+      vecRekeyedMasternodes(),
       nLastWatchdogVoteTime(0),
       mapSeenMasternodeBroadcast(),
       mapSeenMasternodePing(),
@@ -135,6 +269,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
     {
         LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        AddToLookupIndexes(vMasternodes.size() - 1);
+        ClearScoreCache();
         indexMasternodes.AddMasternodeVIN(mn.vin);
         fMasternodesAdded = true;
         return true;
@@ -211,6 +347,7 @@ void CMasternodeMan::CheckAndRemove()
         std::vector<std::pair<int, CMasternode>> vecMasternodeRanks;
         // ask for up to MNB_RECOVERY_MAX_ASK_ENTRIES masternode entries at a time
         int nAskForMnbRecovery = MNB_RECOVERY_MAX_ASK_ENTRIES;
+        bool fErased = false;
         while (it != vMasternodes.end())
         {
             CMasternodeBroadcast mnb = CMasternodeBroadcast(*it);
@@ -227,7 +364,9 @@ void CMasternodeMan::CheckAndRemove()
                 // and finally remove it from the list
                 it->FlagGovernanceItemsAsDirty();
                 it = vMasternodes.erase(it);
+                ClearScoreCache();
                 fMasternodesRemoved = true;
+                fErased = true;
             }
             else
             {
@@ -271,6 +410,12 @@ void CMasternodeMan::CheckAndRemove()
             }
         }
 
+        // positions behind the erased entries have shifted
+        if (fErased)
+        {
+            RebuildLookupIndexes();
+        }
+
         // proces replies for MASTERNODE_NEW_START_REQUIRED masternodes
         LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- mMnbRecoveryGoodReplies size=%d\n", (int)mMnbRecoveryGoodReplies.size());
         std::map<uint256, std::vector<CMasternodeBroadcast>>::iterator itMnbReplies = mMnbRecoveryGoodReplies.begin();
@@ -400,6 +545,23 @@ void CMasternodeMan::CheckAndRemove()
             }
         }
 
+        // remove serialized messages of masternodes no longer on the list
+        std::map<COutPoint, CSerializedMasternode>::iterator itSerialized = mapSerializedMasternodes.begin();
+        while (itSerialized != mapSerializedMasternodes.end())
+        {
+            if (!mapIndexByOutpoint.count(itSerialized->first))
+            {
+                mapSerializedHashes.erase(itSerialized->second.hashBroadcast);
+                if (!itSerialized->second.vchPing.empty())
+                    mapSerializedHashes.erase(itSerialized->second.hashPing);
+                mapSerializedMasternodes.erase(itSerialized++);
+            }
+            else
+            {
+                ++itSerialized;
+            }
+        }
+
         // remove expired mapSeenMasternodeVerification
         std::map<uint256, CMasternodeVerification>::iterator itv2 = mapSeenMasternodeVerification.begin();
         while (itv2 != mapSeenMasternodeVerification.end())
@@ -433,6 +595,12 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapIndexByOutpoint.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    setPaymentQueue.clear();
+    lastPaidIndex.Clear();
+    ClearScoreCache();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -442,6 +610,25 @@ void CMasternodeMan::Clear()
     nLastWatchdogVoteTime = 0;
     indexMasternodes.Clear();
     indexMasternodesOld.Clear();
+    mapSerializedMasternodes.clear();
+    mapSerializedHashes.clear();
+}
+
+void CMasternodeMan::GetSnapshot(CMasternodeMan &snapshotRet) const
+{
+    LOCK(cs);
+    snapshotRet.vMasternodes = vMasternodes;
+    snapshotRet.mAskedUsForMasternodeList = mAskedUsForMasternodeList;
+    snapshotRet.mWeAskedForMasternodeList = mWeAskedForMasternodeList;
+    snapshotRet.mWeAskedForMasternodeListEntry = mWeAskedForMasternodeListEntry;
+    snapshotRet.mMnbRecoveryRequests = mMnbRecoveryRequests;
+    snapshotRet.mMnbRecoveryGoodReplies = mMnbRecoveryGoodReplies;
+    snapshotRet.nLastWatchdogVoteTime = nLastWatchdogVoteTime;
+    snapshotRet.nDsqCount = nDsqCount;
+    snapshotRet.mapSeenMasternodeBroadcast = mapSeenMasternodeBroadcast;
+    snapshotRet.mapSeenMasternodePing = mapSeenMasternodePing;
+    snapshotRet.indexMasternodes = indexMasternodes;
+    snapshotRet.lastPaidIndex = lastPaidIndex;
 }
 
 int CMasternodeMan::CountMasternodes(int nProtocolVersion)
@@ -517,40 +704,203 @@ void CMasternodeMan::DsegUpdate(CNode *pnode)
     LogPrint("masternode", "CMasternodeMan::DsegUpdate -- asked %s for the list\n", pnode->addr.ToString());
 }
 
-CMasternode *CMasternodeMan::Find(const CScript &payee)
+const CSerializedMasternode &CMasternodeMan::GetSerialized(const CMasternode &mn)
+{
+    CSerializedMasternode &serialized = mapSerializedMasternodes[mn.vin.prevout];
+    if (serialized.IsCurrent(mn))
+        return serialized;
+
+    mapSerializedHashes.erase(serialized.hashBroadcast);
+    if (!serialized.vchPing.empty())
+        mapSerializedHashes.erase(serialized.hashPing);
+
+    CMasternodeBroadcast mnb(mn);
+    serialized.hashBroadcast = mnb.GetHash();
+    serialized.hashPing = mn.lastPing.GetHash();
+    serialized.nSigTime = mn.sigTime;
+    serialized.vchSig = mn.vchSig;
+    serialized.nPingSigTime = mn.lastPing.sigTime;
+    serialized.vchPingSig = mn.lastPing.vchSig;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << mnb;
+    serialized.vchBroadcast.assign(ss.begin(), ss.end());
+    serialized.vchPing.clear();
+    if (!(mn.lastPing == CMasternodePing()))
+    {
+        ss.clear();
+        ss << mn.lastPing;
+        serialized.vchPing.assign(ss.begin(), ss.end());
+        // masternodes without a ping all share the hash of the empty one
+        mapSerializedHashes[serialized.hashPing] = mn.vin.prevout;
+    }
+    mapSerializedHashes[serialized.hashBroadcast] = mn.vin.prevout;
+
+    return serialized;
+}
+
+bool CMasternodeMan::GetSerialized(const uint256 &hash, bool fPing, CDataStream &ssRet)
+{
+    LOCK(cs);
+
+    std::map<uint256, COutPoint>::iterator it = mapSerializedHashes.find(hash);
+    if (it == mapSerializedHashes.end())
+        return false;
+
+    CMasternode *pmn = Find(CTxIn(it->second));
+    if (!pmn)
+        return false;
+
+    // the masternode may have changed since, then the hash asked for is not the current one
+    const CSerializedMasternode &serialized = GetSerialized(*pmn);
+    const std::vector<char> &vch = fPing ? serialized.vchPing : serialized.vchBroadcast;
+    if ((fPing ? serialized.hashPing : serialized.hashBroadcast) != hash || vch.empty())
+        return false;
+
+    ssRet.write(&vch[0], vch.size());
+    return true;
+}
+
+int CMasternodeMan::GetListInventory(const CTxIn &vin, std::vector<CInv> &vInvRet)
 {
     LOCK(cs);
 
+    int nInvCount = 0;
+
     BOOST_FOREACH (CMasternode &mn, vMasternodes)
     {
-        if (GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()) == payee)
-            return &mn;
+        if (vin != CTxIn() && vin != mn.vin)
+            continue; // asked for specific vin but we are not there yet
+        if (mn.addr.IsRFC1918() || mn.addr.IsLocal())
+            continue; // do not send local network masternode
+        if (mn.IsUpdateRequired())
+            continue; // do not send outdated masternodes
+
+        LogPrint("masternode", "DSEG -- Sending Masternode entry: masternode=%s  addr=%s\n", mn.vin.prevout.ToStringShort(), mn.addr.ToString());
+        const CSerializedMasternode &serialized = GetSerialized(mn);
+        vInvRet.push_back(CInv(MSG_MASTERNODE_ANNOUNCE, serialized.hashBroadcast));
+        vInvRet.push_back(CInv(MSG_MASTERNODE_PING, serialized.hashPing));
+        nInvCount++;
+
+        if (!mapSeenMasternodeBroadcast.count(serialized.hashBroadcast))
+        {
+            mapSeenMasternodeBroadcast.insert(std::make_pair(serialized.hashBroadcast, std::make_pair(GetTime(), CMasternodeBroadcast(mn))));
+        }
+
+        if (vin == mn.vin)
+            break;
     }
-    return NULL;
+
+    return nInvCount;
 }
 
-CMasternode *CMasternodeMan::Find(const CTxIn &vin)
+void CMasternodeMan::AddToLookupIndexes(size_t nPos)
 {
-    LOCK(cs);
+    const CMasternode &mn = vMasternodes[nPos];
+    CScript payee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+    // insert() keeps an existing entry, so earlier masternodes win on duplicate keys
+    mapIndexByOutpoint.insert(std::make_pair(mn.vin.prevout, nPos));
+    mapIndexByPubKey.insert(std::make_pair(mn.pubKeyMasternode, nPos));
+    mapIndexByPayee.insert(std::make_pair(payee, nPos));
+    setPaymentQueue.insert(CMasternodePaymentQueueEntry(mn.nBlockLastPaid, mn.vin.prevout, payee));
+}
 
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+void CMasternodeMan::RebuildLookupIndexes()
+{
+    mapIndexByOutpoint.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    setPaymentQueue.clear();
+    mapIndexByOutpoint.reserve(vMasternodes.size());
+    mapIndexByPubKey.reserve(vMasternodes.size());
+    mapIndexByPayee.reserve(vMasternodes.size());
+    for (size_t i = 0; i < vMasternodes.size(); ++i)
     {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
+        AddToLookupIndexes(i);
     }
-    return NULL;
 }
 
-CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
+void CMasternodeMan::UpdateLookupIndexes(const CPubKey &pubKeyMasternodeOld, const CMasternode *pmn)
 {
     LOCK(cs);
 
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    if (pmn->pubKeyMasternode == pubKeyMasternodeOld)
+        return;
+
+    // votes signed with the old key are not valid anymore
+    vecRekeyedMasternodes.push_back(pmn->vin);
+
+    if (vMasternodes.empty() || pmn < &vMasternodes.front() || pmn > &vMasternodes.back())
+        return;
+    size_t nPos = pmn - &vMasternodes.front();
+
+    // drop the old key, handing it over to the next masternode still using it (if any)
+    pubkey_index_t::iterator it = mapIndexByPubKey.find(pubKeyMasternodeOld);
+    if (it != mapIndexByPubKey.end() && it->second == nPos)
     {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+        mapIndexByPubKey.erase(it);
+        for (size_t i = nPos + 1; i < vMasternodes.size(); ++i)
+        {
+            if (vMasternodes[i].pubKeyMasternode == pubKeyMasternodeOld)
+            {
+                mapIndexByPubKey.insert(std::make_pair(pubKeyMasternodeOld, i));
+                break;
+            }
+        }
     }
-    return NULL;
+
+    it = mapIndexByPubKey.find(pmn->pubKeyMasternode);
+    if (it == mapIndexByPubKey.end())
+    {
+        mapIndexByPubKey.insert(std::make_pair(pmn->pubKeyMasternode, nPos));
+    }
+    else if (it->second > nPos)
+    {
+        it->second = nPos;
+    }
+}
+
+void CMasternodeMan::UpdatePaymentQueue(const CMasternode &mn, int nBlockLastPaidOld)
+{
+    if (mn.nBlockLastPaid == nBlockLastPaidOld)
+        return;
+
+    std::set<CMasternodePaymentQueueEntry>::iterator it = setPaymentQueue.find(CMasternodePaymentQueueEntry(nBlockLastPaidOld, mn.vin.prevout));
+    if (it == setPaymentQueue.end())
+        return;
+    CMasternodePaymentQueueEntry entry(mn.nBlockLastPaid, mn.vin.prevout, it->payee);
+    setPaymentQueue.erase(it);
+    setPaymentQueue.insert(entry);
+}
+
+CMasternode *CMasternodeMan::Find(const CScript &payee)
+{
+    LOCK(cs);
+
+    payee_index_t::const_iterator it = mapIndexByPayee.find(payee);
+    if (it == mapIndexByPayee.end())
+        return NULL;
+    return &vMasternodes[it->second];
+}
+
+CMasternode *CMasternodeMan::Find(const CTxIn &vin)
+{
+    LOCK(cs);
+
+    outpoint_index_t::const_iterator it = mapIndexByOutpoint.find(vin.prevout);
+    if (it == mapIndexByOutpoint.end())
+        return NULL;
+    return &vMasternodes[it->second];
+}
+
+CMasternode *CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
+{
+    LOCK(cs);
+
+    pubkey_index_t::const_iterator it = mapIndexByPubKey.find(pubKeyMasternode);
+    if (it == mapIndexByPubKey.end())
+        return NULL;
+    return &vMasternodes[it->second];
 }
 
 bool CMasternodeMan::Get(const CPubKey &pubKeyMasternode, CMasternode &masternode)
@@ -630,75 +980,113 @@ CMasternode *CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     // Need LOCK2 here to ensure consistent locking order because the GetBlockHash call below locks cs_main
     LOCK2(cs_main, cs);
 
-    CMasternode *pBestMasternode = NULL;
-    std::vector<std::pair<int, CMasternode *>> vecMasternodeLastPaid;
+    int nMnCount = CountEnabled();
+    int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+    int64_t nAdjustedTime = GetAdjustedTime();
+
+    std::set<CScript> setScheduledPayees;
+    mnpayments.GetScheduledPayees(nBlockHeight, setScheduledPayees);
 
     /*
-        Make a vector with all of the last paid times
+        Walk the masternodes from the least recently paid, keeping the oldest candidates
     */
 
-    int nMnCount = CountEnabled();
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
-    {
-        if (!mn.IsValidForPayment())
-            continue;
-
-        // //check protocol version
-        if (mn.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto())
-            continue;
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
+    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
+    //  -- (chance per block * chances before IsScheduled will fire)
+    int nTenthNetwork = nMnCount / 10;
+    std::vector<CMasternode *> vecOldest = GetPaymentQueue(
+        [&](CMasternode &mn, const CScript &payee) {
+            if (!mn.IsValidForPayment())
+                return false;
 
-        //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if (mnpayments.IsScheduled(mn, nBlockHeight))
-            continue;
+            // //check protocol version
+            if (mn.nProtocolVersion < nMinProtocol)
+                return false;
 
-        //it's too new, wait for a cycle
-        if (fFilterSigTime && mn.sigTime + (nMnCount * 2.6 * 60) > GetAdjustedTime())
-            continue;
+            //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
+            if (setScheduledPayees.count(payee))
+                return false;
 
-        //make sure it has at least as many confirmations as there are masternodes
-        if (mn.GetCollateralAge() < nMnCount)
-            continue;
+            //it's too new, wait for a cycle
+            if (fFilterSigTime && mn.sigTime + (nMnCount * 2.6 * 60) > nAdjustedTime)
+                return false;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mn.GetLastPaidBlock(), &mn));
-    }
+            //make sure it has at least as many confirmations as there are masternodes
+            if (mn.GetCollateralAge() < nMnCount)
+                return false;
 
-    nCount = (int)vecMasternodeLastPaid.size();
+            return true;
+        },
+        std::max(nTenthNetwork, 1), nCount);
 
     //when the network is in the process of upgrading, don't penalize nodes that recently restarted
     if (fFilterSigTime && nCount < nMnCount / 3)
         return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount);
 
-    // Sort them low to high
-    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
-
     uint256 blockHash;
     if (!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CMasternode::GetNextMasternodeInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 10);
         return NULL;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
-    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
-    //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount / 10;
-    //int nTenthNetwork = 10;
-    int nCountTenth = 0;
+
+    return GetBestScoring(vecOldest, blockHash);
+}
+
+std::vector<CMasternode *> CMasternodeMan::GetPaymentQueue(const std::function<bool(CMasternode &, const CScript &)> &fEligible, size_t nMax, int &nCountRet)
+{
+    LOCK(cs);
+
+    std::vector<CMasternode *> vecMasternodes;
+    nCountRet = 0;
+    BOOST_FOREACH (const CMasternodePaymentQueueEntry &entry, setPaymentQueue)
+    {
+        outpoint_index_t::const_iterator it = mapIndexByOutpoint.find(entry.outpoint);
+        if (it == mapIndexByOutpoint.end())
+            continue;
+        CMasternode &mn = vMasternodes[it->second];
+        // the collateral pubkey is fixed for a masternode, so the cached payee is current
+        if (!fEligible(mn, entry.payee))
+            continue;
+        nCountRet++;
+        if (vecMasternodes.size() < nMax)
+            vecMasternodes.push_back(&mn);
+    }
+    return vecMasternodes;
+}
+
+CMasternode *CMasternodeMan::GetBestScoring(const std::vector<CMasternode *> &vecCandidates, const uint256 &blockHash)
+{
+    CMasternode *pBestMasternode = NULL;
     arith_uint256 nHighest = 0;
-    BOOST_FOREACH (PAIRTYPE(int, CMasternode *) & s, vecMasternodeLastPaid)
+    BOOST_FOREACH (CMasternode *pmn, vecCandidates)
     {
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+        arith_uint256 nScore = pmn->CalculateScore(blockHash);
         if (nScore > nHighest)
         {
             nHighest = nScore;
-            pBestMasternode = s.second;
+            pBestMasternode = pmn;
         }
-        nCountTenth++;
-        if (nCountTenth >= nTenthNetwork)
-            break;
     }
     return pBestMasternode;
 }
 
+bool CMasternodeMan::SetLastPaid(const CTxIn &vin, int nBlockLastPaid, int64_t nTimeLastPaid)
+{
+    LOCK(cs);
+    CMasternode *pmn = Find(vin);
+    if (!pmn)
+    {
+        return false;
+    }
+    int nBlockLastPaidOld = pmn->nBlockLastPaid;
+    pmn->nBlockLastPaid = nBlockLastPaid;
+    pmn->nTimeLastPaid = nTimeLastPaid;
+    UpdatePaymentQueue(*pmn, nBlockLastPaidOld);
+    return true;
+}
+
 CMasternode *CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &vecToExclude, int nProtocolVersion)
 {
     LOCK(cs);
@@ -749,10 +1137,48 @@ CMasternode *CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &vecToE
     return NULL;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+const CMasternodeMan::score_pair_vec_t &CMasternodeMan::GetMasternodeScores(const uint256 &nBlockHash)
 {
-    std::vector<std::pair<int64_t, CMasternode *>> vecMasternodeScores;
+    AssertLockHeld(cs);
+
+    std::map<uint256, score_pair_vec_t>::const_iterator it = mapScoreCache.find(nBlockHash);
+    if (it != mapScoreCache.end())
+    {
+        nScoreCacheHits++;
+        return it->second;
+    }
+    nScoreCacheMisses++;
+
+    if (mapScoreCache.size() >= MAX_SCORE_CACHE_BLOCKS)
+    {
+        mapScoreCache.erase(listScoreCacheOrder.front());
+        listScoreCacheOrder.pop_front();
+    }
+
+    score_pair_vec_t &vecMasternodeScores = mapScoreCache[nBlockHash];
+    listScoreCacheOrder.push_back(nBlockHash);
+
+    vecMasternodeScores.reserve(vMasternodes.size());
+    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    {
+        int64_t nScore = mn.CalculateScore(nBlockHash).GetCompact(false);
+
+        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
+    }
+
+    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
+
+    return vecMasternodeScores;
+}
 
+void CMasternodeMan::ClearScoreCache()
+{
+    mapScoreCache.clear();
+    listScoreCacheOrder.clear();
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+{
     //make sure we know about this block
     uint256 blockHash = uint256();
     if (!GetBlockHash(blockHash, nBlockHeight))
@@ -761,9 +1187,10 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nM
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    int nRank = 0;
+    BOOST_FOREACH (const score_pair_t &scorePair, GetMasternodeScores(blockHash))
     {
+        CMasternode &mn = *scorePair.second;
         if (mn.nProtocolVersion < nMinProtocol)
             continue;
         if (fOnlyActive)
@@ -776,18 +1203,8 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nM
             if (!mn.IsValidForPayment())
                 continue;
         }
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode *) & scorePair, vecMasternodeScores)
-    {
         nRank++;
-        if (scorePair.second->vin.prevout == vin.prevout)
+        if (mn.vin.prevout == vin.prevout)
             return nRank;
     }
 
@@ -796,7 +1213,6 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nM
 
 std::vector<std::pair<int, CMasternode>> CMasternodeMan::GetMasternodeRanks(int nBlockHeight, int nMinProtocol)
 {
-    std::vector<std::pair<int64_t, CMasternode *>> vecMasternodeScores;
     std::vector<std::pair<int, CMasternode>> vecMasternodeRanks;
 
     //make sure we know about this block
@@ -807,25 +1223,14 @@ std::vector<std::pair<int, CMasternode>> CMasternodeMan::GetMasternodeRanks(int
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    int nRank = 0;
+    BOOST_FOREACH (const score_pair_t &scorePair, GetMasternodeScores(blockHash))
     {
-
+        CMasternode &mn = *scorePair.second;
         if (mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled())
             continue;
-
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode *) & s, vecMasternodeScores)
-    {
         nRank++;
-        vecMasternodeRanks.push_back(std::make_pair(nRank, *s.second));
+        vecMasternodeRanks.push_back(std::make_pair(nRank, mn));
     }
 
     return vecMasternodeRanks;
@@ -848,36 +1253,19 @@ bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMast
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    // if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
-    //     return false;
-
-    // scan for winner
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
-    {
-
+    int nRank = 0;
+    for (const auto& scorePair : GetMasternodeScores(nBlockHash)) {
+        CMasternode &mn = *scorePair.second;
         if (mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled())
             continue;
-
-        int64_t nScore = mn.CalculateScore(nBlockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int nRank = 0;
-    for (const auto& scorePair : vecMasternodeScores) {
         nRank++;
-        vecMasternodeRanksRet.push_back(std::make_pair(nRank, *scorePair.second));
+        vecMasternodeRanksRet.push_back(std::make_pair(nRank, mn));
     }
 
     return true;
 }
 CMasternode *CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CMasternode *>> vecMasternodeScores;
-
     LOCK(cs);
 
     uint256 blockHash;
@@ -887,58 +1275,24 @@ CMasternode *CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, in
         return NULL;
     }
 
-    // Fill scores
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    int rank = 0;
+    BOOST_FOREACH (const score_pair_t &scorePair, GetMasternodeScores(blockHash))
     {
-
-        if (mn.nProtocolVersion < nMinProtocol)
+        CMasternode *pmn = scorePair.second;
+        if (pmn->nProtocolVersion < nMinProtocol)
             continue;
-        if (fOnlyActive && !mn.IsEnabled())
+        if (fOnlyActive && !pmn->IsEnabled())
             continue;
-
-        int64_t nScore = mn.CalculateScore(blockHash).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode *) & s, vecMasternodeScores)
-    {
         rank++;
         if (rank == nRank)
         {
-            return s.second;
+            return pmn;
         }
     }
 
     return NULL;
 }
 
-// bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeMan::score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol)
-// {
-//     vecMasternodeScoresRet.clear();
-
-//     if (!masternodeSync.IsMasternodeListSynced())
-//         return false;
-
-//     AssertLockHeld(cs);
-
-//     if (mapMasternodes.empty())
-//         return false;
-
-//     // calculate scores
-//     for (const auto& mnpair : mapMasternodes) {
-//         if (mnpair.second.nProtocolVersion >= nMinProtocol) {
-//             vecMasternodeScoresRet.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
-//         }
-//     }
-
-//     sort(vecMasternodeScoresRet.rbegin(), vecMasternodeScoresRet.rend(), CompareScoreMN());
-//     return !vecMasternodeScoresRet.empty();
-// }
-
 void CMasternodeMan::ProcessMasternodeConnections()
 {
     //we don't care about this for regtest
@@ -1109,34 +1463,15 @@ void CMasternodeMan::ProcessMessage(CNode *pfrom, std::string &strCommand, CData
             }
         } //else, asking for a specific node which is ok
 
-        int nInvCount = 0;
+        std::vector<CInv> vInv;
+        int nInvCount = GetListInventory(vin, vInv);
+        BOOST_FOREACH (const CInv &inv, vInv)
+            pfrom->PushInventory(inv);
 
-        BOOST_FOREACH (CMasternode &mn, vMasternodes)
+        if (vin != CTxIn() && nInvCount > 0)
         {
-            if (vin != CTxIn() && vin != mn.vin)
-                continue; // asked for specific vin but we are not there yet
-            if (mn.addr.IsRFC1918() || mn.addr.IsLocal())
-                continue; // do not send local network masternode
-            if (mn.IsUpdateRequired())
-                continue; // do not send outdated masternodes
-
-            LogPrint("masternode", "DSEG -- Sending Masternode entry: masternode=%s  addr=%s\n", mn.vin.prevout.ToStringShort(), mn.addr.ToString());
-            CMasternodeBroadcast mnb = CMasternodeBroadcast(mn);
-            uint256 hash = mnb.GetHash();
-            pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
-            pfrom->PushInventory(CInv(MSG_MASTERNODE_PING, mn.lastPing.GetHash()));
-            nInvCount++;
-
-            if (!mapSeenMasternodeBroadcast.count(hash))
-            {
-                mapSeenMasternodeBroadcast.insert(std::make_pair(hash, std::make_pair(GetTime(), mnb)));
-            }
-
-            if (vin == mn.vin)
-            {
-                LogPrintf("DSEG -- Sent 1 Masternode inv to peer %d\n", pfrom->id);
-                return;
-            }
+            LogPrintf("DSEG -- Sent 1 Masternode inv to peer %d\n", pfrom->id);
+            return;
         }
 
         if (vin == CTxIn())
@@ -1677,7 +2012,10 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
     else
     {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-        if (pmn->UpdateFromNewBroadcast(mnb))
+        CPubKey pubKeyMasternodeOld = pmn->pubKeyMasternode;
+        bool fUpdated = pmn->UpdateFromNewBroadcast(mnb);
+        UpdateLookupIndexes(pubKeyMasternodeOld, pmn);
+        if (fUpdated)
         {
             masternodeSync.AddedMasternodeList();
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
@@ -1799,30 +2137,82 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode *pfrom, CMasternodeBr
     return true;
 }
 
-void CMasternodeMan::UpdateLastPaid()
+int CMasternodeMan::GetLastPaidIndexDepth() const
 {
-    LOCK(cs);
+    return std::max(mnpayments.GetStorageLimit(), (int)LAST_PAID_SCAN_BLOCKS);
+}
 
+void CMasternodeMan::UpdateLastPaid()
+{
     if (fLiteMode)
         return;
-    if (!pCurrentBlockIndex)
-        return;
 
-    static bool IsFirstRun = true;
-    // Do full scan on first run or if we are not a masternode
-    // (MNs should update this info on every block, so limited scan should be enough for them)
-    int nMaxBlocksToScanBack = (IsFirstRun || !fMasterNode) ? mnpayments.GetStorageLimit() : LAST_PAID_SCAN_BLOCKS;
+    // cs_main is needed to rebuild the last paid index from disk, and keeps the
+    // active chain and so the index from changing. cs is not held while reading
+    // the blocks, so a rebuild does not stall the masternode list.
+    LOCK(cs_main);
 
-    LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
-                            pCurrentBlockIndex->nHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
+    const CBlockIndex *pindexTip;
+    bool fSynced;
+    {
+        LOCK(cs);
+        pindexTip = pCurrentBlockIndex;
+        fSynced = lastPaidIndex.IsSynced(pindexTip);
+    }
+    if (!pindexTip)
+        return;
 
-    BOOST_FOREACH (CMasternode &mn, vMasternodes)
+    CMasternodeLastPaidIndex indexRebuilt;
+    if (!fSynced)
     {
-        mn.UpdateLastPaid(pCurrentBlockIndex, nMaxBlocksToScanBack);
+        // left empty if a block can't be read
+        indexRebuilt.Rebuild(pindexTip, GetLastPaidIndexDepth());
     }
 
-    // every time is like the first time if winners list is not synced
-    IsFirstRun = !masternodeSync.IsWinnersListSynced();
+    {
+        LOCK(cs);
+
+        if (!fSynced)
+        {
+            std::swap(lastPaidIndex, indexRebuilt);
+        }
+
+        static bool IsFirstRun = true;
+        // Do full scan on first run or if we are not a masternode
+        // (MNs should update this info on every block, so limited scan should be enough for them)
+        int nMaxBlocksToScanBack = (IsFirstRun || !fMasterNode) ? mnpayments.GetStorageLimit() : LAST_PAID_SCAN_BLOCKS;
+
+        LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
+                                pindexTip->nHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
+
+        std::vector<std::pair<int, int64_t>> vecPayments;
+        BOOST_FOREACH (CMasternode &mn, vMasternodes)
+        {
+            int nBlockLastPaidOld = mn.nBlockLastPaid;
+            int nHeightMin = std::max(mn.nBlockLastPaid, pindexTip->nHeight - nMaxBlocksToScanBack);
+            CScript mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+            lastPaidIndex.GetPayments(mnpayee, nHeightMin, pindexTip->nHeight, vecPayments);
+            mn.UpdateLastPaid(mnpayee, vecPayments);
+            UpdatePaymentQueue(mn, nBlockLastPaidOld);
+        }
+
+        // every time is like the first time if winners list is not synced
+        IsFirstRun = !masternodeSync.IsWinnersListSynced();
+    }
+}
+
+void CMasternodeMan::ConnectBlockPayments(const CBlock &block, const CBlockIndex *pindex)
+{
+    LOCK(cs);
+    lastPaidIndex.ConnectBlock(block, pindex);
+    // blocks are connected whether or not UpdateLastPaid() ever runs
+    lastPaidIndex.Prune(pindex->nHeight - GetLastPaidIndexDepth() + 1);
+}
+
+void CMasternodeMan::DisconnectBlockPayments(const CBlockIndex *pindex)
+{
+    LOCK(cs);
+    lastPaidIndex.DisconnectBlock(pindex);
 }
 
 void CMasternodeMan::CheckAndRebuildMasternodeIndex()
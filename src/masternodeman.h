@@ -7,6 +7,11 @@
 #include "masternode.h"
 #include "sync.h"
 
+#include <functional>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
 using namespace std;
 
 class CMasternodeMan;
@@ -78,6 +83,119 @@ class CMasternodeIndex
     void RebuildIndex();
 };
 
+/**
+ * Entry of the masternode payment queue. Entries are ordered by the block the
+ * masternode was last paid in, ties broken by collateral outpoint, which is
+ * the order masternodes are considered for payment in.
+ */
+struct CMasternodePaymentQueueEntry
+{
+    int nBlockLastPaid;
+    COutPoint outpoint;
+    // payee script of the masternode, kept here to avoid rehashing its collateral key
+    CScript payee;
+
+    CMasternodePaymentQueueEntry(int nBlockLastPaidIn, const COutPoint &outpointIn, const CScript &payeeIn = CScript())
+        : nBlockLastPaid(nBlockLastPaidIn), outpoint(outpointIn), payee(payeeIn) {}
+
+    friend bool operator<(const CMasternodePaymentQueueEntry &a, const CMasternodePaymentQueueEntry &b)
+    {
+        return (a.nBlockLastPaid != b.nBlockLastPaid) ? (a.nBlockLastPaid < b.nBlockLastPaid) : (a.outpoint < b.outpoint);
+    }
+};
+
+/**
+ * Masternode rewards paid by the most recent blocks of the active chain, by payee.
+ *
+ * Lets the last paid block of every masternode be updated without reading blocks
+ * from disk. It follows the tip through ConnectTip()/DisconnectTip(), is stored with
+ * the masternode cache, and is rebuilt from disk whenever it does not end at the tip.
+ */
+class CMasternodeLastPaidIndex
+{
+  private:
+    /// Block the index is up to date with
+    uint256 hashBestBlock;
+
+    /// Block height -> block time and the payees of its coinbase outputs worth the masternode reward
+    std::map<int, std::pair<int64_t, std::vector<CScript>>> mapPaidBlocks;
+
+    /// Payee -> heights of the blocks which paid it, derived from mapPaidBlocks
+    std::map<CScript, std::set<int>> mapPayeeHeights;
+
+    void AddBlock(int nHeight, int64_t nTime, const std::vector<CScript> &vecPayees);
+    void RemoveBlock(int nHeight);
+
+  public:
+    CMasternodeLastPaidIndex() : hashBestBlock(), mapPaidBlocks(), mapPayeeHeights() {}
+
+    bool IsSynced(const CBlockIndex *pindexTip) const;
+
+    void ConnectBlock(const CBlock &block, const CBlockIndex *pindex);
+    void DisconnectBlock(const CBlockIndex *pindex);
+
+    /// Reindex the last nDepth blocks up to pindexTip from disk
+    bool Rebuild(const CBlockIndex *pindexTip, int nDepth);
+
+    /// Forget blocks below nHeight
+    void Prune(int nHeight);
+
+    /// Blocks in (nHeightMin, nHeightMax] that paid payee as (height, time), newest first
+    void GetPayments(const CScript &payee, int nHeightMin, int nHeightMax, std::vector<std::pair<int, int64_t>> &vecPaymentsRet) const;
+
+    size_t size() const { return mapPaidBlocks.size(); }
+
+    void Clear();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream &s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBestBlock);
+        READWRITE(mapPaidBlocks);
+        if (ser_action.ForRead())
+        {
+            mapPayeeHeights.clear();
+            for (const auto &block : mapPaidBlocks)
+            {
+                for (const CScript &payee : block.second.second)
+                {
+                    mapPayeeHeights[payee].insert(block.first);
+                }
+            }
+        }
+    }
+};
+
+/**
+ * Announcement and last ping of a masternode as serialized for the network, kept to
+ * answer dseg and the getdata that follow without building and serializing them again.
+ * Serialized again once the signature or ping of the masternode changed, since every
+ * change to the announced fields comes with a new signature.
+ */
+struct CSerializedMasternode
+{
+    int64_t nSigTime;
+    std::vector<unsigned char> vchSig;
+    int64_t nPingSigTime;
+    std::vector<unsigned char> vchPingSig;
+
+    uint256 hashBroadcast;
+    uint256 hashPing;
+    std::vector<char> vchBroadcast;
+    /// empty while the masternode has no ping
+    std::vector<char> vchPing;
+
+    CSerializedMasternode() : nSigTime(0), nPingSigTime(0) {}
+
+    bool IsCurrent(const CMasternode &mn) const
+    {
+        return !vchBroadcast.empty() && nSigTime == mn.sigTime && nPingSigTime == mn.lastPing.sigTime &&
+               vchSig == mn.vchSig && vchPingSig == mn.lastPing.vchSig;
+    }
+};
+
 class CMasternodeMan
 {
   public:
@@ -95,6 +213,28 @@ class CMasternodeMan
 
     typedef std::vector<score_pair_t> score_pair_vec_t;
 
+    struct OutPointHasher
+    {
+        size_t operator()(const COutPoint &outpoint) const { return outpoint.hash.GetCheapHash() ^ outpoint.n; }
+    };
+
+    struct PubKeyHasher
+    {
+        size_t operator()(const CPubKey &pubkey) const { return boost::hash_range(pubkey.begin(), pubkey.end()); }
+    };
+
+    struct ScriptHasher
+    {
+        size_t operator()(const CScript &script) const { return boost::hash_range(script.begin(), script.end()); }
+    };
+
+    /// Lookup indexes map a key to the position of its masternode in vMasternodes
+    typedef boost::unordered_map<COutPoint, size_t, OutPointHasher> outpoint_index_t;
+
+    typedef boost::unordered_map<CPubKey, size_t, PubKeyHasher> pubkey_index_t;
+
+    typedef boost::unordered_map<CScript, size_t, ScriptHasher> payee_index_t;
+
   private:
     static const int MAX_EXPECTED_INDEX_SIZE = 30000;
 
@@ -118,6 +258,9 @@ class CMasternodeMan
     static const int MNB_RECOVERY_WAIT_SECONDS = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS = 3 * 60 * 60;
 
+    /// Number of blocks to keep sorted masternode scores for
+    static const size_t MAX_SCORE_CACHE_BLOCKS = 16;
+
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
@@ -126,6 +269,15 @@ class CMasternodeMan
 
     // map to hold all MNs
     std::vector<CMasternode> vMasternodes;
+    // lookup indexes over vMasternodes used by Find(), rebuilt whenever entries are erased.
+    // When several masternodes share a key the first one in vMasternodes wins, same as a linear scan.
+    outpoint_index_t mapIndexByOutpoint;
+    pubkey_index_t mapIndexByPubKey;
+    payee_index_t mapIndexByPayee;
+    // every masternode in payment queue order, maintained alongside the lookup indexes
+    std::set<CMasternodePaymentQueueEntry> setPaymentQueue;
+    // recent masternode payments by payee, used to update last paid blocks
+    CMasternodeLastPaidIndex lastPaidIndex;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -140,8 +292,37 @@ class CMasternodeMan
     std::map<uint256, std::vector<CMasternodeBroadcast>> mMnbRecoveryGoodReplies;
     std::list<std::pair<CService, uint256>> listScheduledMnbRequestConnections;
 
-    bool GetMasternodeScores(const uint256& nBlockHash, score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol = 0);
+    // sorted (best first) scores of every masternode, per block hash. Entries point into
+    // vMasternodes, so the cache is dropped whenever masternodes are added or removed.
+    std::map<uint256, score_pair_vec_t> mapScoreCache;
+    std::list<uint256> listScoreCacheOrder;
+    uint64_t nScoreCacheHits;
+    uint64_t nScoreCacheMisses;
+
+    /// Scores of all masternodes for nBlockHash sorted best first, served from mapScoreCache when possible.
+    /// Callers filter by protocol version and state themselves, which keeps the relative order and so the ranks intact.
+    const score_pair_vec_t& GetMasternodeScores(const uint256& nBlockHash);
+    void ClearScoreCache();
+
+    /// Move a masternode within the payment queue after its last paid block changed
+    void UpdatePaymentQueue(const CMasternode &mn, int nBlockLastPaidOld);
 
+    /// Blocks kept in the last paid index, every block a full scan may look at
+    int GetLastPaidIndexDepth() const;
+
+    /// Add the masternode at vMasternodes[nPos] to the lookup indexes
+    void AddToLookupIndexes(size_t nPos);
+    /// Recreate the lookup indexes from vMasternodes
+    void RebuildLookupIndexes();
+
+    /// Messages of the masternodes sent on dseg, by collateral
+    std::map<COutPoint, CSerializedMasternode> mapSerializedMasternodes;
+    /// Collateral of the masternode whose serialized announcement or ping has this hash
+    std::map<uint256, COutPoint> mapSerializedHashes;
+
+    /// Serialized messages of a masternode, serialized again if they changed
+    const CSerializedMasternode &GetSerialized(const CMasternode &mn);
+    bool GetSerialized(const uint256 &hash, bool fPing, CDataStream &ssRet);
 
     int64_t nLastIndexRebuildTime;
 
@@ -160,6 +341,9 @@ class CMasternodeMan
 
     std::vector<uint256> vecDirtyGovernanceObjectHashes;
 
+    /// Masternodes whose key changed since CGovernanceManager last checked their votes again
+    std::vector<CTxIn> vecRekeyedMasternodes;
+
     int64_t nLastWatchdogVoteTime;
 
     friend class CMasternodeSync;
@@ -192,6 +376,11 @@ class CMasternodeMan
         }
 
         READWRITE(vMasternodes);
+        if (ser_action.ForRead())
+        {
+            RebuildLookupIndexes();
+            ClearScoreCache();
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -203,6 +392,7 @@ class CMasternodeMan
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
         READWRITE(indexMasternodes);
+        READWRITE(lastPaidIndex);
         if (ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING))
         {
             Clear();
@@ -227,6 +417,9 @@ class CMasternodeMan
     /// Clear Masternode vector
     void Clear();
 
+    /// Copy what is stored in mncache.dat, so that it can be serialized without holding the lock
+    void GetSnapshot(CMasternodeMan &snapshotRet) const;
+
     /// Count Masternodes filtered by nProtocolVersion.
     /// Masternode nProtocolVersion should match or be above the one specified in param here.
     int CountMasternodes(int nProtocolVersion = -1);
@@ -239,6 +432,16 @@ class CMasternodeMan
 
     void DsegUpdate(CNode *pnode);
 
+    /**
+     * Inventory of the announcements and pings sent on dseg, of the whole list or of the
+     * masternode with this vin. Returns the number of masternodes.
+     */
+    int GetListInventory(const CTxIn &vin, std::vector<CInv> &vInvRet);
+
+    /// The announcement or ping with this hash as serialized on dseg, if it is still current
+    bool GetSerializedBroadcast(const uint256 &hash, CDataStream &ssRet) { return GetSerialized(hash, false, ssRet); }
+    bool GetSerializedPing(const uint256 &hash, CDataStream &ssRet) { return GetSerialized(hash, true, ssRet); }
+
     /// Find an entry
     CMasternode *Find(const CScript &payee);
     CMasternode *Find(const CTxIn &vin);
@@ -309,6 +512,18 @@ class CMasternodeMan
     /// Same as above but use current block height
     CMasternode *GetNextMasternodeInQueueForPayment(bool fFilterSigTime, int &nCount);
 
+    /**
+     * Walk the payment queue, least recently paid first. Returns up to nMax masternodes
+     * accepted by fEligible (given the masternode and its payee script) while nCountRet
+     * counts every accepted masternode.
+     */
+    std::vector<CMasternode *> GetPaymentQueue(const std::function<bool(CMasternode &, const CScript &)> &fEligible, size_t nMax, int &nCountRet);
+    /// The best scoring masternode for blockHash, the earliest one on equal scores
+    static CMasternode *GetBestScoring(const std::vector<CMasternode *> &vecCandidates, const uint256 &blockHash);
+
+    /// Set the block and time a masternode was last paid at
+    bool SetLastPaid(const CTxIn &vin, int nBlockLastPaid, int64_t nTimeLastPaid);
+
     /// Find a random entry
     CMasternode *FindRandomNotInVec(const std::vector<CTxIn> &vecToExclude, int nProtocolVersion = -1);
 
@@ -320,6 +535,14 @@ class CMasternodeMan
     int GetMasternodeRank(const CTxIn &vin, int nBlockHeight, int nMinProtocol = 0, bool fOnlyActive = true);
     CMasternode *GetMasternodeByRank(int nRank, int nBlockHeight, int nMinProtocol = 0, bool fOnlyActive = true);
 
+    void GetScoreCacheStats(size_t &nBlocksRet, uint64_t &nHitsRet, uint64_t &nMissesRet) const
+    {
+        LOCK(cs);
+        nBlocksRet = mapScoreCache.size();
+        nHitsRet = nScoreCacheHits;
+        nMissesRet = nScoreCacheMisses;
+    }
+
     void ProcessMasternodeConnections();
     std::pair<CService, std::set<uint256>> PopScheduledMnbRequestConnection();
 
@@ -337,6 +560,9 @@ class CMasternodeMan
 
     std::string ToString() const;
 
+    /// Keep the lookup indexes in sync after an mnb changed the masternode key of pmn
+    void UpdateLookupIndexes(const CPubKey &pubKeyMasternodeOld, const CMasternode *pmn);
+
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
     /// Perform complete check and only then update list and maps
@@ -345,6 +571,10 @@ class CMasternodeMan
 
     void UpdateLastPaid();
 
+    /// Keep the last paid index in step with the active chain
+    void ConnectBlockPayments(const CBlock &block, const CBlockIndex *pindex);
+    void DisconnectBlockPayments(const CBlockIndex *pindex);
+
     void CheckAndRebuildMasternodeIndex();
 
     void AddDirtyGovernanceObjectHash(const uint256 &nHash)
@@ -362,6 +592,14 @@ class CMasternodeMan
         ;
     }
 
+    std::vector<CTxIn> GetAndClearRekeyedMasternodes()
+    {
+        LOCK(cs);
+        std::vector<CTxIn> vecTmp;
+        vecTmp.swap(vecRekeyedMasternodes);
+        return vecTmp;
+    }
+
     bool IsWatchdogActive();
     void UpdateWatchdogVoteTime(const CTxIn &vin);
     bool AddGovernanceVote(const CTxIn &vin, uint256 nGovernanceObjectHash);
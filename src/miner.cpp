@@ -29,6 +29,7 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utxofile.h"
 
 #include "flat-database.h"
 #ifdef ENABLE_WALLET
@@ -68,6 +69,7 @@
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 
 #include <univalue.h>
 
@@ -201,15 +203,18 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
     LogPrintf("nHeight: %d \n", nHeight);
     string utxo_file_path = GetUTXOFileName(nHeight);
     LogPrintf("utxo_file_path: %s \n", utxo_file_path);
-    //Read from the specified UTXO file
-    std::ifstream if_utxo(utxo_file_path, std::ios::binary | std::ios::in);
-
-    if (!if_utxo.is_open()) {
+    //Read from the specified UTXO file, or take it from the cache if the block was built or checked before
+    std::shared_ptr<const CUTXOFile> pfile = utxoFileCache.Get(utxo_file_path, nHeight >= zShieldedStartBlock,
+                                                               nHeight >= zShieldedStartBlock ? 0 : forkCBPerBlock,
+                                                               std::max(nScriptCheckThreads, 1));
+    if (!pfile) {
         bFileNotFound = true;
         LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: Cannot open UTXO file - %s\n",
                   nHeight, nForkHeight, nForkHeightRange, utxo_file_path);
         return NULL;
     }
+    //quit if checksums doesn't match
+    assert(!pfile->fChecksumMismatch && "Utxo checksum doesn't match");
 
 
     // Create new block
@@ -227,9 +232,6 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
     uint64_t nBlockTx = 0;
     uint64_t nBlockSigOps = 100;
 
-    int tCounter = 0;
-    //while utxo files exists, and the number of tx in the block is less than set man (where is forkCBPerBlock)
-    CSHA256 hasher;
     //START MINING Z-ADDRESSES
     if (nHeight >= zShieldedStartBlock) {
         
@@ -251,105 +253,19 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
         pblocktemplate->vTxFees.push_back(-1); // updated at end
         pblocktemplate->vTxSigOps.push_back(-1);
 
-        int loopCounter = 0;
-
-        while (true) {
-            //break if there are no more transactions in the file
-            if (if_utxo.eof()) {
-                break;
-            }
-
-            CTransaction* txNew = new CTransaction();
-
-            char* transSize = new char[32];
-            for (int i = 0; i < 32; i++) {
-                transSize[i] = 0;
-            }
-            //retrieve transaction size
-            if (!if_utxo.read(transSize, 32)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - Coudn't read the transaction size\n",
-                          nHeight, nForkHeight, forkHeightRange);
-                break;
-            }
-            
-            //convert binary size to int size
-            int size = 0;
-
-            for (int i = 0; i < 32; i++) {
-                if (transSize[i] == 48) {
-                    continue;
-                } else if (transSize[i] == 49) {
-                    size += pow(2, 31 - i);
-                } else
-                    assert(0 && "Unknown character. String size must be in binary - 0 or 1.");
-            }
-
-            if (size == 0) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: End of UTXO file ? - Strtol failed\n",
-                          nHeight, nForkHeight, forkHeightRange);
-                break;
-            }
-
-            char* rawTransaction = new char[size];
-            for (int i = 0; i < size; i++) {
-                rawTransaction[i] = 0;
-            }
-            if (!if_utxo.read(rawTransaction, size)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - Coudn't read the transaction\n", nHeight, nForkHeight, forkHeightRange);
-                break;
-            }
-            
-            hasher.Reset();
-            const unsigned char *unsignedTransSize = reinterpret_cast<unsigned char*>(transSize);
-            const unsigned char *unsignedRawTransaction = reinterpret_cast<unsigned char*>(rawTransaction);
-            hasher.Write(unsignedTransSize, 32);
-            hasher.Write(unsignedRawTransaction, size);
-            uint256 txhash;
-            hasher.Finalize(txhash.begin());
-
-            //read checksum sha256 hash from the file
-            char* checksum = new char[32];
-            if (!if_utxo.read(checksum, 32)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: Couldn't read the transaction checksum.\n", nHeight, nForkHeight, forkHeightRange);
-                break;
-            }
-            //converting binary raw checksum to hex-string string checksum  10111011111010 => 2EFA
-            std::stringstream cc;
-            cc << std::hex << std::setfill('0');
-            for (int i = 0; i < 32; ++i) {
-                cc << std::setw(2) << (unsigned int)(unsigned char)(checksum[i]);
-            }
-            std::string checksumString = cc.str();
-            uint256 transChecksum = uint256S(checksumString);
-
-            //quit if checksums doesn't match
-            assert(txhash == transChecksum && "Joinsplit checksum doesn't match");
-
-            //converting binary raw transaction to hex-string raw transaction  10111011111010 => 2EFA
-            std::stringstream ss;
-            ss << std::hex << std::setfill('0');
-            for (int i = 0; i < size; ++i) {
-                ss << std::setw(2) << (unsigned int)(unsigned char)(rawTransaction[i]);
-            }
-            std::string rawTransactionHex = ss.str();
-
-            UniValue hexString = UniValue(rawTransactionHex);
-
-            decoderawtransaction2(*txNew, hexString, false);
-
-            CMutableTransaction* txM = new CMutableTransaction(*txNew);
+        for (size_t i = 0; i < pfile->vTransactions.size(); i++) {
+            CMutableTransaction txM(pfile->vTransactions[i]);
 
             // Add coinbase tx's
-            // CMutableTransaction txNew;
-            txM->vin.resize(1);
+            txM.vin.resize(1);
             //No input cuz coinbase
-            txM->vin[0].prevout.SetNull();
-            txM->vout.resize(1);
-            txM->vout[0].nValue = 0;
+            txM.vin[0].prevout.SetNull();
+            txM.vout.resize(1);
+            txM.vout[0].nValue = 0;
 
-            unsigned int nTxSize = ::GetSerializeSize(*txM, SER_NETWORK, PROTOCOL_VERSION);
+            unsigned int nTxSize = ::GetSerializeSize(txM, SER_NETWORK, PROTOCOL_VERSION);
             if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                LogPrintf("Counter: %d\n", tCounter);
+                LogPrintf("Counter: %d\n", i);
                 LogPrintf("nTxSize: %d\n", nTxSize);
                 LogPrintf("Total size: %d\n", nTxSize + nBlockSize);
                 LogPrintf("ERROR:  CreateNewForkBlock(): [%u, %u of %u]: %u: block would exceed max size\n",
@@ -358,102 +274,26 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
             }
 
             // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(*txM);
+            unsigned int nTxSigOps = GetLegacySigOpCount(txM);
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
                 LogPrintf("ERROR:  CreateNewForkBlock(): [%u, %u of %u]: %u: block would exceed max sigops\n",
                           nHeight, nForkHeight, forkHeightRange, nBlockTx);
                 break;
             }
 
-            pblock->vtx.push_back(*txM);
+            pblock->vtx.push_back(txM);
             pblocktemplate->vTxFees.push_back(0);
             pblocktemplate->vTxSigOps.push_back(nTxSigOps);
             nBlockSize += nTxSize;
             nBlockSigOps += nTxSigOps;
             ++nBlockTx;
-            loopCounter++;
-            delete txNew;
-            delete txM;
-            delete transSize;
-            delete rawTransaction;
-            delete checksum;
-            tCounter++;
         }
-        // assert(isUTXOFileLoadedProperly && "Error: not all airdrop transaction were loaded into the block");
 
     } else {
         LogPrintf("ANON Miner: switching into t-fork mode\n");
-        while (if_utxo && nBlockTx < forkCBPerBlock) {
-            char term = 0;
-            ////////////////////////Format checks, explore more when looking at UTXO raw
-            //Value
-            char coin[8] = {};
-            if (!if_utxo.read(coin, 8)) {
-                // the last file may be shorter than forkCBPerBlock
-                if (!if_utxo.eof() || nForkHeight != nForkHeightRange)
-                    LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - No more data (Amount)\n",
-                              nHeight, nForkHeight, nForkHeightRange);
-                break;
-            }
-            //public key
-            char pubkeysize[8] = {};
-            //cout this guy
-            if (!if_utxo.read(pubkeysize, 8)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? - Not more data (PubKeyScript size)\n",
-                          nHeight, nForkHeight, nForkHeightRange);
-                break;
-            }
-            //convert to base 64
-            int pbsize = bytes2uint64(pubkeysize);
-            if (pbsize == 0) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? -  PubKeyScript size = 0\n",
-                          nHeight, nForkHeight, nForkHeightRange);
-                //but proceed
-            }
-            //Initialize array of characters that is the size of pubkey?
-            std::unique_ptr<char[]> pubKeyScript(new char[pbsize]);
-
-            if (!if_utxo.read(&pubKeyScript[0], pbsize)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: UTXO file corrupted? Not more data (PubKeyScript)\n",
-                          nHeight, nForkHeight, nForkHeightRange);
-                break;
-            }
-            ///////////////////////CHECKSUM//////////////////////////////////
-            hasher.Reset();
-   
-            unsigned char* script = (unsigned char*)pubKeyScript.get();
-            const unsigned char *utxoSize = reinterpret_cast<unsigned char*>(pubkeysize);
-            const unsigned char *unsignedCoin = reinterpret_cast<unsigned char*>(coin);
-
-            hasher.Write(unsignedCoin, 8);
-            hasher.Write(utxoSize, 8);
-            hasher.Write(script, pbsize);
-            uint256 utxoHash;
-            hasher.Finalize(utxoHash.begin());
-            
-            //read checksum sha256 hash from the file
-            char* checksum = new char[32];
-            if (!if_utxo.read(checksum, 32)) {
-                LogPrintf("ERROR: CreateNewForkBlock(): [%u, %u of %u]: Couldn't read the transaction checksum.\n", nHeight, nForkHeight, forkHeightRange);
-                break;
-            }
-            //converting binary raw checksum to hex-string string checksum  10111011111010 => 2EFA
-            std::stringstream cc;
-            cc << std::hex << std::setfill('0');
-            for (int i = 0; i < 32; ++i) {
-                cc << std::setw(2) << (unsigned int)(unsigned char)(checksum[i]);
-            }
-            std::string checksumString = cc.str();
-            uint256 transChecksum = uint256S(checksumString);
-
-            //quit if checksums doesn't match
-            assert(utxoHash == transChecksum && "Utxo checksum doesn't match");
-            ///////////////////////CHECKSUM END//////////////////////////////////
-
-            //Needs ut64 for files? Part of .bin?
-            uint64_t amount = bytes2uint64(coin);
-            //makes array into string
-            unsigned char* pks = (unsigned char*)pubKeyScript.get();
+        for (size_t i = 0; i < pfile->vRecords.size(); i++) {
+            const CUTXORecord& record = pfile->vRecords[i];
+            uint64_t amount = record.nAmount;
 
             // Add coinbase tx's
             CMutableTransaction txNew;
@@ -462,7 +302,7 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
             txNew.vin[0].prevout.SetNull();
             //Just create
             txNew.vout.resize(1);
-            txNew.vout[0].scriptPubKey = CScript(pks, pks + pbsize);
+            txNew.vout[0].scriptPubKey = record.scriptPubKey;
 
             //coin value
             if(nHeight >= zTransparentStartBlock){
@@ -500,13 +340,6 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
             nBlockSigOps += nTxSigOps;
             nBlockTotalAmount += amount;
             ++nBlockTx;
-            delete checksum;
-
-            if (!if_utxo.read(&term, 1) || term != '\n') {
-                LogPrintf("ERROR:  CreateNewForkBlock(): [%u, %u of %u]: invalid record separator\n",
-                          nHeight, nForkHeight, nForkHeightRange);
-                break;
-            }
         }
     }   
         assert(nBlockTx > 0 && "Error: airdrop block shoudn't have 1 transaction! Perhaps, the utxo file corrupted?");
@@ -528,39 +361,275 @@ CBlockTemplate* CreateNewForkBlock(bool& bFileNotFound, const int nHeight)
         return pblocktemplate.release();
     }
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+/** The coinbase paying to scriptPubKeyIn, its value and scriptSig are filled in by FinishBlockTemplate */
+static CMutableTransaction CreateCoinbaseTransaction(const CScript& scriptPubKeyIn)
 {
-    const CChainParams& chainparams = Params();
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if (!pblocktemplate.get())
-        return NULL;
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
-
-    // INSTEAD OF CREATING DUMMY TX, CREATE MUTABLE TX
-    // Add dummy coinbase tx as first transaction
-
-    // Create coinbase tx
     CMutableTransaction txNew;
     txNew.vin.resize(1);
     txNew.vin[0].prevout.SetNull();
     txNew.vout.resize(1);
     txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+    return txNew;
+}
 
+static void GetBlockSizeLimits(unsigned int& nBlockMaxSize, unsigned int& nBlockPrioritySize, unsigned int& nBlockMinSize)
+{
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
     nBlockMaxSize = std::max((unsigned int)0, std::min((unsigned int)(MAX_BLOCK_SIZE), nBlockMaxSize));
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
+    nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
+    nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
+}
+
+/** Pay the subsidy, nFees and the masternode and governance payments in txNew, and fill in the header on top of pindexPrev */
+static void FinishBlockTemplate(CBlockTemplate* pblocktemplate, CMutableTransaction& txNew, const CBlockIndex* pindexPrev, CAmount nFees)
+{
+    const CChainParams& chainparams = Params();
+    CBlock* pblock = &pblocktemplate->block;
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
+    CAmount blockReward = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+
+    // Compute regular coinbase transaction.
+    txNew.vout[0].nValue = blockReward;
+    txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+
+    // Update coinbase transaction with additional info about masternode and governance payments,
+    // get some info back to pass to getblocktemplate
+    FillBlockPayments(txNew, nHeight, blockReward, pblock->txoutMasternode);
+    LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s txNew %s",
+              nHeight, blockReward, pblock->txoutMasternode.ToString(), txNew.ToString());
+
+    // Update block coinbase
+    pblock->vtx[0] = txNew;
+    pblocktemplate->vTxFees[0] = -nFees;
+    // Randomise nonce
+    arith_uint256 nonce = UintToArith256(GetRandHash());
+    // Clear the top and bottom 16 bits (for local use as thread flags and counters)
+    nonce <<= 32;
+    nonce >>= 16;
+    pblock->nNonce = ArithToUint256(nonce);
+
+    // Fill in header
+    pblock->hashPrevBlock = pindexPrev->GetBlockHash();
+    pblock->hashReserved = uint256();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nSolution.clear();
+    pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+}
+
+// A package's totals once some of its ancestors are in the block
+struct CModifiedPackage {
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpsWithAncestors;
+
+    double GetScore() const { return (double)nModFeesWithAncestors / nSizeWithAncestors; }
+};
+
+/**
+ * Fill the rest of the block with packages, a mempool transaction together with its
+ * ancestors that are not in the block yet, best package fee rate first. A child
+ * paying for a low fee parent so gets both in, where the parent alone would not make it.
+ *
+ * The packages come from the mempool's ancestor score index. Once some of its ancestors
+ * are in the block, a transaction competes with its remaining package instead, from
+ * mapModified. With pview the transactions are checked against and spent in it,
+ * otherwise the fees and sigops cached by the mempool are used as they are.
+ */
+static void AddPackageTxs(CTxMemPool& pool, CBlockTemplate* pblocktemplate, std::set<uint256>& setInBlock, CCoinsViewCache* pview,
+                          int nHeight, int64_t nLockTimeCutoff, unsigned int nBlockMaxSize, unsigned int nBlockMinSize,
+                          uint64_t& nBlockSize, uint64_t& nBlockTx, int& nBlockSigOps, CAmount& nFees)
+{
+    AssertLockHeld(pool.cs);
+    CBlock* pblock = &pblocktemplate->block;
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+
+    std::map<uint256, CModifiedPackage> mapModified;
+    std::set<std::pair<double, uint256> > setModifiedScore;
+    std::set<uint256> setFailed;
+
+    const CTxMemPool::ancestorscore_index_t& index = pool.GetAncestorScoreIndex();
+    CTxMemPool::ancestorscore_index_t::const_reverse_iterator mi = index.rbegin();
+    while (mi != index.rend() || !setModifiedScore.empty()) {
+        if (mi != index.rend() && (setInBlock.count(mi->second) || setFailed.count(mi->second) || mapModified.count(mi->second))) {
+            ++mi;
+            continue;
+        }
+
+        uint256 hash;
+        CModifiedPackage package;
+        if (mi == index.rend() || (!setModifiedScore.empty() && setModifiedScore.rbegin()->first > mi->first)) {
+            hash = setModifiedScore.rbegin()->second;
+            setModifiedScore.erase(--setModifiedScore.end());
+            package = mapModified[hash];
+            mapModified.erase(hash);
+            if (setInBlock.count(hash) || setFailed.count(hash))
+                continue;
+        } else {
+            hash = mi->second;
+            ++mi;
+            const CTxMemPoolEntry& entry = pool.mapTx.find(hash)->second;
+            package.nSizeWithAncestors = entry.GetSizeWithAncestors();
+            package.nModFeesWithAncestors = entry.GetModFeesWithAncestors();
+            package.nSigOpsWithAncestors = entry.GetSigOpsWithAncestors();
+        }
+
+        // Past the minimum block size only packages paying the relay fee go in, and
+        // the ones after this pay even less
+        if ((package.nModFeesWithAncestors < ::minRelayTxFee.GetFee(package.nSizeWithAncestors)) &&
+            (nBlockSize + package.nSizeWithAncestors >= nBlockMinSize))
+            break;
+
+        if (nBlockSize + package.nSizeWithAncestors >= nBlockMaxSize ||
+            nBlockSigOps + package.nSigOpsWithAncestors >= MAX_BLOCK_SIGOPS) {
+            setFailed.insert(hash);
+            continue;
+        }
+
+        // A transaction always has fewer ancestors than its children, so sorting by
+        // ancestor count puts the package in a valid order
+        const CTxMemPoolEntry& entry = pool.mapTx.find(hash)->second;
+        std::set<uint256> setAncestors;
+        pool.CalculateMemPoolAncestors(entry.GetTx(), setAncestors);
+        std::vector<std::pair<uint64_t, uint256> > vPackage;
+        bool fFailed = false;
+        BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+            if (setInBlock.count(hashAncestor))
+                continue;
+            if (setFailed.count(hashAncestor))
+                fFailed = true;
+            vPackage.push_back(std::make_pair(pool.mapTx.find(hashAncestor)->second.GetCountWithAncestors(), hashAncestor));
+        }
+        vPackage.push_back(std::make_pair(entry.GetCountWithAncestors(), hash));
+        std::sort(vPackage.begin(), vPackage.end());
+
+        std::unique_ptr<CCoinsViewCache> pviewPackage;
+        if (pview)
+            pviewPackage.reset(new CCoinsViewCache(pview));
+        std::vector<CAmount> vTxFees;
+        std::vector<unsigned int> vTxSigOps;
+        unsigned int nPackageSigOps = 0;
+        for (size_t i = 0; i < vPackage.size() && !fFailed; i++) {
+            const CTxMemPoolEntry& member = pool.mapTx.find(vPackage[i].second)->second;
+            const CTransaction& tx = member.GetTx();
+            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff)) {
+                fFailed = true;
+                break;
+            }
+            CAmount nTxFees = member.GetFee();
+            unsigned int nTxSigOps = member.GetSigOps();
+            if (pviewPackage) {
+                if (!pviewPackage->HaveInputs(tx)) {
+                    fFailed = true;
+                    break;
+                }
+                nTxFees = pviewPackage->GetValueIn(tx) - tx.GetValueOut();
+                nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, *pviewPackage);
+
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                CValidationState state;
+                if (!ContextualCheckInputs(tx, state, *pviewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus())) {
+                    fFailed = true;
+                    break;
+                }
+                UpdateCoins(tx, state, *pviewPackage, nHeight);
+            }
+            vTxFees.push_back(nTxFees);
+            vTxSigOps.push_back(nTxSigOps);
+            nPackageSigOps += nTxSigOps;
+        }
+        if (fFailed || nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS) {
+            setFailed.insert(hash);
+            continue;
+        }
+        if (pviewPackage)
+            pviewPackage->Flush();
+
+        for (size_t i = 0; i < vPackage.size(); i++) {
+            const uint256& hashMember = vPackage[i].second;
+            const CTxMemPoolEntry& member = pool.mapTx.find(hashMember)->second;
+            pblock->vtx.push_back(member.GetTx());
+            pblocktemplate->vTxFees.push_back(vTxFees[i]);
+            pblocktemplate->vTxSigOps.push_back(vTxSigOps[i]);
+            nBlockSize += member.GetTxSize();
+            ++nBlockTx;
+            nBlockSigOps += vTxSigOps[i];
+            nFees += vTxFees[i];
+            setInBlock.insert(hashMember);
+
+            // A member waiting with a smaller package is in now
+            std::map<uint256, CModifiedPackage>::iterator itModified = mapModified.find(hashMember);
+            if (itModified != mapModified.end()) {
+                setModifiedScore.erase(std::make_pair(itModified->second.GetScore(), hashMember));
+                mapModified.erase(itModified);
+            }
+
+            if (fPrintPriority) {
+                LogPrintf("package fee rate %s fee %s txid %s\n",
+                          CFeeRate(package.nModFeesWithAncestors, package.nSizeWithAncestors).ToString(),
+                          FormatMoney(vTxFees[i]), hashMember.ToString());
+            }
+        }
+
+        // The packages of their descendants got smaller
+        for (size_t i = 0; i < vPackage.size(); i++) {
+            const CTxMemPoolEntry& member = pool.mapTx.find(vPackage[i].second)->second;
+            std::set<uint256> setDescendants;
+            pool.CalculateDescendants(vPackage[i].second, setDescendants);
+            BOOST_FOREACH (const uint256& hashDescendant, setDescendants) {
+                if (setInBlock.count(hashDescendant) || setFailed.count(hashDescendant))
+                    continue;
+                std::map<uint256, CModifiedPackage>::iterator it = mapModified.find(hashDescendant);
+                if (it == mapModified.end()) {
+                    const CTxMemPoolEntry& descendant = pool.mapTx.find(hashDescendant)->second;
+                    CModifiedPackage modified;
+                    modified.nSizeWithAncestors = descendant.GetSizeWithAncestors();
+                    modified.nModFeesWithAncestors = descendant.GetModFeesWithAncestors();
+                    modified.nSigOpsWithAncestors = descendant.GetSigOpsWithAncestors();
+                    it = mapModified.insert(std::make_pair(hashDescendant, modified)).first;
+                } else {
+                    setModifiedScore.erase(std::make_pair(it->second.GetScore(), hashDescendant));
+                }
+                it->second.nSizeWithAncestors -= member.GetTxSize();
+                it->second.nModFeesWithAncestors -= member.GetModifiedFee();
+                it->second.nSigOpsWithAncestors -= member.GetSigOps();
+                setModifiedScore.insert(std::make_pair(it->second.GetScore(), hashDescendant));
+            }
+        }
+    }
+}
+
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    const CChainParams& chainparams = Params();
+    // Create new block
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if (!pblocktemplate.get())
+        return NULL;
+    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+
+    // INSTEAD OF CREATING DUMMY TX, CREATE MUTABLE TX
+    // Add dummy coinbase tx as first transaction
+
+    // Create coinbase tx
+    CMutableTransaction txNew = CreateCoinbaseTransaction(scriptPubKeyIn);
+
+    unsigned int nBlockMaxSize, nBlockPrioritySize, nBlockMinSize;
+    GetBlockSizeLimits(nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
 
     // Collect memory pool transactions into the block
     CAmount nFees = 0;
@@ -587,15 +656,17 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         map<uint256, vector<COrphan*>> mapDependers;
         bool fPrintPriority = GetBoolArg("-printpriority", false);
 
-        // This vector will be sorted into a priority queue:
+        const int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST) ? nMedianTimePast : pblock->GetBlockTime();
+
+        // This vector will be sorted into a priority queue. Only the priority area of
+        // the block needs priorities, the rest is filled by package fee rate.
         vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
+        if (nBlockPrioritySize > 0)
+            vecPriority.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txentry_map_t::iterator mi = mempool.mapTx.begin();
+             nBlockPrioritySize > 0 && mi != mempool.mapTx.end(); ++mi) {
             const CTransaction& tx = mi->second.GetTx();
 
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST) ? nMedianTimePast : pblock->GetBlockTime();
-
             if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff))
                 continue;
 
@@ -665,9 +736,9 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         uint64_t nBlockSize = 1000;
         uint64_t nBlockTx = 0;
         int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
+        std::set<uint256> setInBlock;
 
-        TxPriorityCompare comparer(fSortedByFee);
+        TxPriorityCompare comparer(false);
         std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
         while (!vecPriority.empty()) {
@@ -689,22 +760,11 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
                 continue;
 
-            // Skip free transactions if we're past the minimum block size:
+            // Select by package fee rate once past the priority size or we run out of
+            // high-priority transactions, this one competes there as well:
             const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+            if ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))
+                break;
 
             if (!view.HaveInputs(tx))
                 continue;
@@ -732,6 +792,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             ++nBlockTx;
             nBlockSigOps += nTxSigOps;
             nFees += nTxFees;
+            setInBlock.insert(hash);
 
             if (fPrintPriority) {
                 LogPrintf("priority %.1f fee %s txid %s\n",
@@ -752,41 +813,14 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             }
         }
 
+        AddPackageTxs(mempool, pblocktemplate.get(), setInBlock, &view, nHeight, nLockTimeCutoff, nBlockMaxSize, nBlockMinSize,
+                      nBlockSize, nBlockTx, nBlockSigOps, nFees);
+
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
-
-        // NOTE: unlike in bitcoin, we need to pass PREVIOUS block height here
-        CAmount blockReward = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-        
-        // Compute regular coinbase transaction.
-        txNew.vout[0].nValue = blockReward;
-        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
-
-        // Update coinbase transaction with additional info about masternode and governance payments,
-        // get some info back to pass to getblocktemplate
-        FillBlockPayments(txNew, nHeight, blockReward, pblock->txoutMasternode);
-        LogPrintf("CreateNewBlock -- nBlockHeight %d blockReward %lld txoutMasternode %s txNew %s",
-                  nHeight, blockReward, pblock->txoutMasternode.ToString(), txNew.ToString());
-
-        // Update block coinbase
-        pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
-        // Randomise nonce
-        arith_uint256 nonce = UintToArith256(GetRandHash());
-        // Clear the top and bottom 16 bits (for local use as thread flags and counters)
-        nonce <<= 32;
-        nonce >>= 16;
-        pblock->nNonce = ArithToUint256(nonce);
-
-        // Fill in header
-        pblock->hashPrevBlock = pindexPrev->GetBlockHash();
-        pblock->hashReserved = uint256();
-        UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, Params().GetConsensus());
-        pblock->nSolution.clear();
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+        FinishBlockTemplate(pblocktemplate.get(), txNew, pindexPrev, nFees);
 
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
@@ -838,6 +872,229 @@ CBlockTemplate* CreateNewBlockWithKey()
     return CreateNewBlock(*scriptPubKey);
 }
 
+CBlockTemplateEngine blockTemplateEngine(mempool);
+
+CBlockTemplateEngine::CBlockTemplateEngine(CTxMemPool& poolIn) :
+        pool(poolIn), pindexPrev(NULL), nTransactionsUpdated(0),
+        nRebuilds(0), nUpdates(0), nRebuildTime(0), nUpdateTime(0) {}
+
+void CBlockTemplateEngine::AddCandidate(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    if (!pindexPrev || entry.GetTx().IsCoinBase())
+        return;
+
+    CCandidate candidate;
+    candidate.ptx = &entry.GetTx();
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    pool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+    candidate.nFee = entry.GetFee();
+    candidate.nTxSize = entry.GetTxSize();
+    candidate.nSigOps = entry.GetSigOps();
+    candidate.dPriority = entry.GetPriority(pindexPrev->nHeight + 1) + dPriorityDelta;
+    candidate.feeRate = CFeeRate(entry.GetFee() + nFeeDelta, entry.GetTxSize());
+    BOOST_FOREACH (const CTxIn& txin, candidate.ptx->vin) {
+        if (pool.mapTx.count(txin.prevout.hash) &&
+            std::find(candidate.vParents.begin(), candidate.vParents.end(), txin.prevout.hash) == candidate.vParents.end())
+            candidate.vParents.push_back(txin.prevout.hash);
+    }
+
+    RemoveCandidate(hash);
+    setByPriority.insert(std::make_pair(candidate.dPriority, hash));
+    mapCandidates.insert(std::make_pair(hash, candidate));
+}
+
+void CBlockTemplateEngine::RemoveCandidate(const uint256& hash)
+{
+    candidate_map_t::iterator it = mapCandidates.find(hash);
+    if (it == mapCandidates.end())
+        return;
+    setByPriority.erase(std::make_pair(it->second.dPriority, hash));
+    mapCandidates.erase(it);
+}
+
+void CBlockTemplateEngine::Rebuild(const CScript& scriptPubKeyIn, CBlockIndex* pindexTip)
+{
+    pblocktemplate.reset(CreateNewBlock(scriptPubKeyIn));
+    pindexPrev = pindexTip;
+
+    // The priorities age with the tip, so the candidates are recomputed as well
+    mapCandidates.clear();
+    setByPriority.clear();
+    for (CTxMemPool::txentry_map_t::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it)
+        AddCandidate(it->first, it->second);
+}
+
+void CBlockTemplateEngine::AddCandidates(CBlockTemplate* pblocktemplateNew, int64_t nLockTimeCutoff,
+                                         uint64_t& nBlockSize, uint64_t& nBlockTx, CAmount& nFees)
+{
+    CBlock* pblock = &pblocktemplateNew->block;
+    const int nHeight = pindexPrev->nHeight + 1;
+    unsigned int nBlockMaxSize, nBlockPrioritySize, nBlockMinSize;
+    GetBlockSizeLimits(nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+
+    nBlockSize = 1000;
+    nBlockTx = 0;
+    int nBlockSigOps = 100;
+    nFees = 0;
+    TxPriorityCompare comparer(false);
+
+    // The priority area comes out of setByPriority best first. A candidate spending a
+    // mempool transaction that is not in the block yet waits until all its parents are,
+    // and then competes from vecReady, like the orphans of CreateNewBlock.
+    std::set<std::pair<double, uint256> >::const_reverse_iterator itPriority = setByPriority.rbegin();
+    std::set<uint256> setInBlock;
+    std::map<uint256, std::vector<uint256> > mapDependers;
+    std::map<uint256, size_t> mapMissingParents;
+    std::vector<TxPriority> vecReady;
+
+    while (nBlockPrioritySize > 0) {
+        uint256 hash;
+        bool fReady = false;
+        if (!vecReady.empty()) {
+            if (itPriority != setByPriority.rend()) {
+                const CCandidate& next = mapCandidates.find(itPriority->second)->second;
+                fReady = !comparer(vecReady.front(), TxPriority(next.dPriority, next.feeRate, next.ptx));
+            } else {
+                fReady = true;
+            }
+        }
+        if (fReady) {
+            hash = vecReady.front().get<2>()->GetHash();
+            std::pop_heap(vecReady.begin(), vecReady.end(), comparer);
+            vecReady.pop_back();
+        } else if (itPriority != setByPriority.rend()) {
+            hash = itPriority->second;
+            ++itPriority;
+        } else {
+            break;
+        }
+        const CCandidate& candidate = mapCandidates.find(hash)->second;
+        const CTransaction& tx = *candidate.ptx;
+
+        if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
+            continue;
+
+        if (!fReady) {
+            size_t nMissing = 0;
+            BOOST_FOREACH (const uint256& hashParent, candidate.vParents) {
+                if (!setInBlock.count(hashParent)) {
+                    mapDependers[hashParent].push_back(hash);
+                    nMissing++;
+                }
+            }
+            if (nMissing > 0) {
+                mapMissingParents[hash] = nMissing;
+                continue;
+            }
+        }
+
+        // Size limits
+        if (nBlockSize + candidate.nTxSize >= nBlockMaxSize)
+            continue;
+
+        // Legacy and P2SH limits on sigOps, the mempool counted them against the tip:
+        if (nBlockSigOps + candidate.nSigOps >= MAX_BLOCK_SIGOPS)
+            continue;
+
+        // Select by package fee rate once past the priority size or we run out of
+        // high-priority transactions:
+        if ((nBlockSize + candidate.nTxSize >= nBlockPrioritySize) || !AllowFree(candidate.dPriority))
+            break;
+
+        pblock->vtx.push_back(tx);
+        pblocktemplateNew->vTxFees.push_back(candidate.nFee);
+        pblocktemplateNew->vTxSigOps.push_back(candidate.nSigOps);
+        nBlockSize += candidate.nTxSize;
+        ++nBlockTx;
+        nBlockSigOps += candidate.nSigOps;
+        nFees += candidate.nFee;
+        setInBlock.insert(hash);
+
+        if (fPrintPriority) {
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                      candidate.dPriority, candidate.feeRate.ToString(), hash.ToString());
+        }
+
+        // Release the transactions waiting for this one
+        std::map<uint256, std::vector<uint256> >::const_iterator itDependers = mapDependers.find(hash);
+        if (itDependers != mapDependers.end()) {
+            BOOST_FOREACH (const uint256& hashChild, itDependers->second) {
+                if (--mapMissingParents[hashChild] == 0) {
+                    const CCandidate& child = mapCandidates.find(hashChild)->second;
+                    vecReady.push_back(TxPriority(child.dPriority, child.feeRate, child.ptx));
+                    std::push_heap(vecReady.begin(), vecReady.end(), comparer);
+                }
+            }
+        }
+    }
+
+    // The mempool checked these against the tip already
+    AddPackageTxs(pool, pblocktemplateNew, setInBlock, NULL, nHeight, nLockTimeCutoff, nBlockMaxSize, nBlockMinSize,
+                  nBlockSize, nBlockTx, nBlockSigOps, nFees);
+}
+
+void CBlockTemplateEngine::Assemble(const CScript& scriptPubKeyIn)
+{
+    std::unique_ptr<CBlockTemplate> pblocktemplateNew(new CBlockTemplate());
+    CBlock* pblock = &pblocktemplateNew->block;
+
+    CMutableTransaction txNew = CreateCoinbaseTransaction(scriptPubKeyIn);
+
+    // Same tip, so the same version as the template CreateNewBlock built for it
+    pblock->nVersion = pblocktemplate->block.nVersion;
+    pblock->nTime = GetAdjustedTime();
+    const int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST) ? pindexPrev->GetMedianTimePast() : pblock->GetBlockTime();
+    pblock->vtx.push_back(txNew);
+    pblocktemplateNew->vTxFees.push_back(-1);   // updated at end
+    pblocktemplateNew->vTxSigOps.push_back(-1); // updated at end
+
+    uint64_t nBlockSize, nBlockTx;
+    CAmount nFees;
+    AddCandidates(pblocktemplateNew.get(), nLockTimeCutoff, nBlockSize, nBlockTx, nFees);
+
+    FinishBlockTemplate(pblocktemplateNew.get(), txNew, pindexPrev, nFees);
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    pblocktemplate.swap(pblocktemplateNew);
+}
+
+CBlockTemplate* CBlockTemplateEngine::GetBlockTemplate(const CScript& scriptPubKeyIn)
+{
+    AssertLockHeld(cs_main);
+    LOCK(pool.cs);
+    if (!connAdded.connected()) {
+        connAdded = pool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateEngine::AddCandidate, this, _1, _2));
+        connRemoved = pool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateEngine::RemoveCandidate, this, _1));
+    }
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+    int64_t nStart = GetTimeMicros();
+    if (!pblocktemplate || pindexPrev != pindexTip) {
+        Rebuild(scriptPubKeyIn, pindexTip);
+        nRebuilds++;
+        nRebuildTime = GetTimeMicros() - nStart;
+    } else if (nTransactionsUpdated != pool.GetTransactionsUpdated() || scriptPubKey != scriptPubKeyIn) {
+        Assemble(scriptPubKeyIn);
+        nUpdates++;
+        nUpdateTime = GetTimeMicros() - nStart;
+    }
+    scriptPubKey = scriptPubKeyIn;
+    nTransactionsUpdated = pool.GetTransactionsUpdated();
+    return pblocktemplate.get();
+}
+
+void CBlockTemplateEngine::GetStats(uint64_t& nRebuildsRet, uint64_t& nUpdatesRet, int64_t& nRebuildTimeRet, int64_t& nUpdateTimeRet) const
+{
+    LOCK(pool.cs);
+    nRebuildsRet = nRebuilds;
+    nUpdatesRet = nUpdates;
+    nRebuildTimeRet = nRebuildTime;
+    nUpdateTimeRet = nUpdateTime;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
@@ -1249,20 +1506,3 @@ void GenerateBitcoins(bool fGenerate, int nThreads)
 
 #endif // ENABLE_MINING
 
-
-UniValue decoderawtransaction2(CTransaction& tx, const UniValue& params, bool fHelp)
-{
-    LOCK(cs_main);
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR));
-    // CTransaction tx;
-    if (!DecodeHexTx(tx, params.get_str()))
-        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
-    UniValue result(UniValue::VOBJ);
-    TxToJSON(tx, uint256(), result);
-
-    string strJSON = result.write() + "\n";
-    // LogPrintf("JSON: \n");
-    // LogPrintf("%s", strJSON);
-
-    return result;
-}
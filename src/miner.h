@@ -6,15 +6,25 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "coins.h"
 #include "primitives/block.h"
+#include "script/script.h"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
 
 #include <boost/optional.hpp>
+#include <boost/signals2/connection.hpp>
+#include <boost/unordered_map.hpp>
 #include <stdint.h>
 
 #include <univalue.h>
 
 class CBlockIndex;
-class CScript;
+class CTxMemPool;
+class CTxMemPoolEntry;
 #ifdef ENABLE_WALLET
 class CReserveKey;
 class CWallet;
@@ -37,7 +47,76 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
 boost::optional<CScript> GetMinerScriptPubKey();
 CBlockTemplate* CreateNewBlockWithKey();
 #endif
-UniValue decoderawtransaction2(CTransaction &tx , const UniValue& params, bool fHelp);
+
+/**
+ * Keeps the mempool transactions ordered by priority as they enter and leave the
+ * pool, so that getblocktemplate neither walks the whole mempool nor looks up every
+ * input on each call. The rest of the block is filled from the mempool's own
+ * ancestor score index.
+ *
+ * The template is built from scratch by CreateNewBlock only when the tip changes. In
+ * between, when the mempool changed, it is reassembled from the ordered candidates by
+ * the same rules. Those transactions were checked against this tip when they entered
+ * the mempool, and their fees and sigops are cached in the entries, so no coins are
+ * needed for that. Only a template built from scratch is checked by TestBlockValidity,
+ * which needs the coins of every transaction. A reassembly is not, so that polling
+ * getblocktemplate does not repeat a full validation under cs_main on every change.
+ *
+ * All state is guarded by the mempool's cs.
+ */
+class CBlockTemplateEngine
+{
+private:
+    struct CCandidate {
+        const CTransaction* ptx; //! owned by the mempool entry
+        CAmount nFee;
+        double dPriority; //! at the height of the next block, including prioritisetransaction deltas
+        CFeeRate feeRate; //! including prioritisetransaction deltas, breaks priority ties
+        unsigned int nTxSize;
+        unsigned int nSigOps;
+        std::vector<uint256> vParents; //! mempool transactions it spends
+    };
+    typedef boost::unordered_map<uint256, CCandidate, CCoinsKeyHasher> candidate_map_t;
+
+    CTxMemPool& pool;
+    candidate_map_t mapCandidates;
+    std::set<std::pair<double, uint256> > setByPriority;
+    boost::signals2::scoped_connection connAdded;
+    boost::signals2::scoped_connection connRemoved;
+
+    CBlockIndex* pindexPrev; //! the tip the candidates and the template are for
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    CScript scriptPubKey;
+    unsigned int nTransactionsUpdated; //! of the mempool when the template was made
+
+    uint64_t nRebuilds;
+    uint64_t nUpdates;
+    int64_t nRebuildTime; //! microseconds the last full rebuild took
+    int64_t nUpdateTime; //! microseconds the last reassembly took
+
+    void AddCandidate(const uint256& hash, const CTxMemPoolEntry& entry);
+    void RemoveCandidate(const uint256& hash);
+    void Rebuild(const CScript& scriptPubKeyIn, CBlockIndex* pindexTip);
+    /** Fill pblocktemplateNew after its coinbase with the candidates, the priority area first */
+    void AddCandidates(CBlockTemplate* pblocktemplateNew, int64_t nLockTimeCutoff,
+                       uint64_t& nBlockSize, uint64_t& nBlockTx, CAmount& nFees);
+    /** Reassemble the template from the candidates */
+    void Assemble(const CScript& scriptPubKeyIn);
+
+    friend class TEST_FRIEND_CBlockTemplateEngine;    // class for unit testing
+
+public:
+    CBlockTemplateEngine(CTxMemPool& poolIn);
+
+    /**
+     * The template for a block on the current tip paying to scriptPubKeyIn, without
+     * valid proof-of-work. Owned by the engine and valid until the next call; requires cs_main.
+     */
+    CBlockTemplate* GetBlockTemplate(const CScript& scriptPubKeyIn);
+    void GetStats(uint64_t& nRebuildsRet, uint64_t& nUpdatesRet, int64_t& nRebuildTimeRet, int64_t& nUpdateTimeRet) const;
+};
+
+extern CBlockTemplateEngine blockTemplateEngine;
 
 #ifdef ENABLE_MINING
 /** Modify the extranonce in a block */
@@ -219,6 +219,30 @@ extern const char* REJECT;
  * @see https://bitcoin.org/en/developer-reference#sendheaders
  */
 extern const char* SENDHEADERS;
+/**
+ * Indicates that a node can reconstruct blocks announced as "cmpctblock"
+ * from its mempool. Contains a bool (high bandwidth announcements, unused)
+ * and the uint64_t compact block encoding version.
+ * @since protocol version 180005, adapted from BIP152.
+ */
+extern const char* SENDCMPCT;
+/**
+ * Contains a block header, short transaction ids and prefilled transactions,
+ * sent in response to a getdata for MSG_CMPCT_BLOCK.
+ * @since protocol version 180005, adapted from BIP152.
+ */
+extern const char* CMPCTBLOCK;
+/**
+ * Requests the transactions of a compact block that could not be found in
+ * the mempool, by index.
+ * @since protocol version 180005, adapted from BIP152.
+ */
+extern const char* GETBLOCKTXN;
+/**
+ * Contains the transactions requested by a getblocktxn.
+ * @since protocol version 180005, adapted from BIP152.
+ */
+extern const char* BLOCKTXN;
 
 // Dash message types
 // NOTE: do NOT declare non-implmented here, we don't want them to be exposed to the outside
@@ -363,6 +387,9 @@ enum {
     MSG_GOVERNANCE_OBJECT,
     MSG_GOVERNANCE_OBJECT_VOTE,
     MSG_MASTERNODE_VERIFY,
+    // Only appears in getdata, asks for a "cmpctblock" instead of a "block". Dash
+    // types took the BIP152 value, so this is appended instead.
+    MSG_CMPCT_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
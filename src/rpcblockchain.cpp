@@ -7,6 +7,7 @@
 #include "amount.h"
 
 #include "base58.h"
+#include "blockcache.h"
 #include "chain.h"
 #include "checkpoints.h"
 #include "consensus/validation.h"
@@ -19,6 +20,7 @@
 #include "script/sign.h"
 #include "script/standard.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -102,7 +104,10 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("merkleroot", blockindex->hashMerkleRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    std::vector<unsigned char> nSolution;
+    if (!GetBlockSolution(blockindex, nSolution))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block solution from disk");
+    result.push_back(Pair("solution", HexStr(nSolution)));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
@@ -428,6 +433,12 @@ UniValue mempoolToJSON(bool fVerbose = false)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -482,6 +493,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees of in-mempool descendants (including this one) in satoshis, with prioritisetransaction deltas\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees of in-mempool ancestors (including this one) in satoshis, with prioritisetransaction deltas\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -573,8 +590,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
 
     if (!fVerbose)
     {
+        CBlockHeader header;
+        if (!GetBlockHeader(pblockindex, header))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block header from disk");
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
+        ssBlock << header;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
     }
@@ -655,14 +675,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex))
+    std::shared_ptr<const CBlock> pblock = ReadBlockCached(pblockindex);
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     if (!fVerbose)
     {
@@ -881,6 +902,23 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
+            "  \"blockindexmemory\": xxxxxx, (numeric) bytes of memory used by the in-memory block index\n"
+            "  \"blockcache\": {             (object) cache of recently connected blocks\n"
+            "     \"entries\": xx,           (numeric) number of cached blocks\n"
+            "     \"usage\": xx,             (numeric) bytes of memory used by the cached blocks\n"
+            "     \"maxusage\": xx,          (numeric) byte budget set by -blockcachesize\n"
+            "     \"hits\": xx,              (numeric) block requests served from the cache\n"
+            "     \"misses\": xx             (numeric) block requests that went to disk\n"
+            "  },\n"
+            "  \"blockindexload\": {         (object) timings of the block index load at startup\n"
+            "     \"threads\": xx,           (numeric) number of threads used to read the block index database\n"
+            "     \"entries\": xx,           (numeric) number of block index entries loaded\n"
+            "     \"powchecksskipped\": xx,  (numeric) entries below the last checkpoint whose PoW was not rechecked\n"
+            "     \"readms\": xx,            (numeric) milliseconds spent deserializing, hashing and checking entries\n"
+            "     \"mergems\": xx,           (numeric) milliseconds spent linking entries into the block index\n"
+            "     \"chainworkms\": xx,       (numeric) milliseconds spent computing chain work\n"
+            "     \"totalms\": xx            (numeric) total milliseconds spent loading the block index\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -921,6 +959,28 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     ZCIncrementalMerkleTree tree;
     pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), tree);
     obj.push_back(Pair("commitments",           tree.size()));
+    obj.push_back(Pair("blockindexmemory",      (uint64_t)GetBlockIndexMemoryUsage()));
+
+    size_t nCacheEntries, nCacheUsage, nCacheMaxUsage;
+    uint64_t nCacheHits, nCacheMisses;
+    blockCache.GetStats(nCacheEntries, nCacheUsage, nCacheMaxUsage, nCacheHits, nCacheMisses);
+    UniValue cache(UniValue::VOBJ);
+    cache.push_back(Pair("entries",             (uint64_t)nCacheEntries));
+    cache.push_back(Pair("usage",               (uint64_t)nCacheUsage));
+    cache.push_back(Pair("maxusage",            (uint64_t)nCacheMaxUsage));
+    cache.push_back(Pair("hits",                nCacheHits));
+    cache.push_back(Pair("misses",              nCacheMisses));
+    obj.push_back(Pair("blockcache",            cache));
+
+    UniValue load(UniValue::VOBJ);
+    load.push_back(Pair("threads",              blockIndexLoadStats.nThreads));
+    load.push_back(Pair("entries",              blockIndexLoadStats.nEntries));
+    load.push_back(Pair("powchecksskipped",     blockIndexLoadStats.nPowChecksSkipped));
+    load.push_back(Pair("readms",               0.001 * blockIndexLoadStats.nTimeRead));
+    load.push_back(Pair("mergems",              0.001 * blockIndexLoadStats.nTimeMerge));
+    load.push_back(Pair("chainworkms",          0.001 * blockIndexLoadStats.nTimeChainWork));
+    load.push_back(Pair("totalms",              0.001 * blockIndexLoadStats.nTimeTotal));
+    obj.push_back(Pair("blockindexload",        load));
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
@@ -1054,6 +1114,9 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("maxmempool", (int64_t) GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000));
+    ret.push_back(Pair("evicted", (int64_t) mempool.GetTransactionsEvicted()));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK())));
 
     return ret;
 }
@@ -1069,6 +1132,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool, lowest fee rate packages are evicted beyond it\n"
+            "  \"evicted\": xxxxx             (numeric) Number of transactions evicted to stay below maxmempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in ANON/kB for a transaction to be accepted, raised by evictions\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
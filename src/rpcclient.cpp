@@ -113,6 +113,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
+    { "zcbenchmark", 4 },
     { "getblocksubsidy", 0},
     { "z_listreceivedbyaddress", 1},
     { "z_getbalance", 1},
@@ -843,6 +843,18 @@ UniValue getgovernanceinfo(const UniValue& params, bool fHelp)
             "  \"governanceminquorum\": xxxxx,           (numeric) the absolute minimum number of votes needed to trigger a governance action\n"
             "  \"masternodewatchdogmaxseconds\": xxxxx,  (numeric) sentinel watchdog expiration time in seconds\n"
             "  \"proposalfee\": xxx.xx,                  (numeric) the collateral transaction fee which must be paid to create a proposal in\n"
+            "  \"objects\": xxxxx,                       (numeric) the number of governance objects\n"
+            "  \"votes\": xxxxx,                         (numeric) the number of votes stored for them\n"
+            "  \"votestorememory\": xxxxx,               (numeric) bytes used by the stored votes and their signatures\n"
+            "  \"voterecordmemory\": xxxxx,              (numeric) bytes used by the current vote of each masternode\n"
+            "  \"cachedumps\": {                         (object) periodic dumps of the masternode caches, by file name\n"
+            "    \"file\": {\n"
+            "      \"dumps\": xxxxx,                       (numeric) the number of dumps written in the background\n"
+            "      \"lastpausemicros\": xxxxx,             (numeric) how long the last dump held up the caller, in microseconds\n"
+            "      \"maxpausemicros\": xxxxx,              (numeric) the longest such pause\n"
+            "      \"lastwritemillis\": xxxxx              (numeric) how long writing the last dump took, in milliseconds\n"
+            "    }, ...\n"
+            "  }\n"
             // "  \"superblockcycle\": xxxxx,               (numeric) the number of blocks between superblocks\n"
             // "  \"lastsuperblock\": xxxxx,                (numeric) the block number of the last superblock\n"
             // "  \"nextsuperblock\": xxxxx,                (numeric) the block number of the next superblock\n"
@@ -883,6 +895,27 @@ UniValue getgovernanceinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("governanceminquorum", nGovernanceMinQuorum));
     obj.push_back(Pair("masternodewatchdogmaxseconds", MASTERNODE_WATCHDOG_MAX_SECONDS));
     obj.push_back(Pair("proposalfee", ValueFromAmount(GOVERNANCE_PROPOSAL_FEE_TX)));
+
+    int nObjects, nVotes;
+    size_t nVoteStoreBytes, nVoteRecordBytes;
+    governance.GetVoteMemoryUsage(nObjects, nVotes, nVoteStoreBytes, nVoteRecordBytes);
+    obj.push_back(Pair("objects", nObjects));
+    obj.push_back(Pair("votes", nVotes));
+    obj.push_back(Pair("votestorememory", (uint64_t)nVoteStoreBytes));
+    obj.push_back(Pair("voterecordmemory", (uint64_t)nVoteRecordBytes));
+
+    std::vector<CCacheDumpStats> vDumpStats;
+    GetMasternodeCacheDumpStats(vDumpStats);
+    UniValue cachedumps(UniValue::VOBJ);
+    for (const CCacheDumpStats& stats : vDumpStats) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("dumps", stats.nDumps));
+        entry.push_back(Pair("lastpausemicros", stats.nLastPauseMicros));
+        entry.push_back(Pair("maxpausemicros", stats.nMaxPauseMicros));
+        entry.push_back(Pair("lastwritemillis", stats.nLastWriteMillis));
+        cachedumps.push_back(Pair(stats.strFilename, entry));
+    }
+    obj.push_back(Pair("cachedumps", cachedumps));
     // obj.push_back(Pair("superblockcycle", Params().GetConsensus().nSuperblockCycle));
     // obj.push_back(Pair("lastsuperblock", nLastSuperblock));
     // obj.push_back(Pair("nextsuperblock", nNextSuperblock));
@@ -2,6 +2,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "activemasternode.h"
+#include "darksend.h"
 #include "init.h"
 #include "main.h"
 #include "masternode-payments.h"
@@ -39,7 +40,7 @@ UniValue masternode(const UniValue& params, bool fHelp)
             "\nArguments:\n"
             "1. \"command\"        (string or set of strings, required) The command to execute\n"
             "\nAvailable commands:\n"
-            "  count        - Print number of all known masternodes (optional: 'ps', 'enabled', 'all', 'qualify')\n"
+            "  count        - Print number of all known masternodes (optional: 'ps', 'enabled', 'all', 'qualify', 'scorecache', 'sigcache')\n"
             "  current      - Print info on current masternode winner to be paid the next block (calculated locally)\n"
             "  debug        - Print masternode status\n"
             "  genkey       - Generate new masternodeprivkey\n"
@@ -92,6 +93,28 @@ UniValue masternode(const UniValue& params, bool fHelp)
         if (strMode == "enabled")
             return mnodeman.CountEnabled();
 
+        if (strMode == "scorecache") {
+            size_t nBlocks;
+            uint64_t nHits, nMisses;
+            mnodeman.GetScoreCacheStats(nBlocks, nHits, nMisses);
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("blocks", (uint64_t)nBlocks));
+            obj.push_back(Pair("hits", nHits));
+            obj.push_back(Pair("misses", nMisses));
+            return obj;
+        }
+
+        if (strMode == "sigcache") {
+            size_t nEntries;
+            uint64_t nHits, nMisses;
+            CDarkSendSigner::GetCacheStats(nEntries, nHits, nMisses);
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("entries", (uint64_t)nEntries));
+            obj.push_back(Pair("hits", nHits));
+            obj.push_back(Pair("misses", nMisses));
+            return obj;
+        }
+
         int nCount;
         mnodeman.GetNextMasternodeInQueueForPayment(true, nCount);
 
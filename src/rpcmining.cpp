@@ -356,6 +356,10 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"templaterebuilds\": n,       (numeric) Block templates built from scratch for a new tip\n"
+            "  \"templateupdates\": n,        (numeric) Block templates reassembled for mempool changes\n"
+            "  \"templaterebuildtime\": x.xxx (numeric) Milliseconds the last rebuild took\n"
+            "  \"templateupdatetime\": x.xxx  (numeric) Milliseconds the last reassembly took\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -378,6 +382,13 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
+    uint64_t nTemplateRebuilds, nTemplateUpdates;
+    int64_t nTemplateRebuildTime, nTemplateUpdateTime;
+    blockTemplateEngine.GetStats(nTemplateRebuilds, nTemplateUpdates, nTemplateRebuildTime, nTemplateUpdateTime);
+    obj.push_back(Pair("templaterebuilds",    nTemplateRebuilds));
+    obj.push_back(Pair("templateupdates",     nTemplateUpdates));
+    obj.push_back(Pair("templaterebuildtime", nTemplateRebuildTime * 0.001));
+    obj.push_back(Pair("templateupdatetime",  nTemplateUpdateTime * 0.001));
 #ifdef ENABLE_MINING
     obj.push_back(Pair("generate",         getgenerate(params, false)));
 #endif
@@ -650,39 +661,20 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlockWithKey, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
+    // Update block. The engine only rebuilds and validates it when the tip changed,
+    // mempool changes are reassembled without coin lookups or TestBlockValidity, so
+    // every call gets the current transactions.
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    CBlockIndex* pindexPrev = chainActive.Tip();
 #ifdef ENABLE_WALLET
-        CReserveKey reservekey(pwalletMain);
-        pblocktemplate = CreateNewBlockWithKey(reservekey);
+    CReserveKey reservekey(pwalletMain);
+    boost::optional<CScript> scriptPubKey = GetMinerScriptPubKey(reservekey);
 #else
-        pblocktemplate = CreateNewBlockWithKey();
+    boost::optional<CScript> scriptPubKey = GetMinerScriptPubKey();
 #endif
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlockWithKey succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    CBlockTemplate* pblocktemplate = scriptPubKey ? blockTemplateEngine.GetBlockTemplate(*scriptPubKey) : NULL;
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -371,6 +371,7 @@ static const CRPCCommand vRPCCommands[] =
         {"wallet", "getrawchangeaddress", &getrawchangeaddress, true},
         {"wallet", "getreceivedbyaccount", &getreceivedbyaccount, false},
         {"wallet", "getreceivedbyaddress", &getreceivedbyaddress, false},
+        {"wallet", "getrescaninfo", &getrescaninfo, true},
         {"wallet", "gettransaction", &gettransaction, false},
         {"wallet", "getunconfirmedbalance", &getunconfirmedbalance, false},
         {"wallet", "getwalletinfo", &getwalletinfo, false},
@@ -6,6 +6,7 @@
 #include "txdb.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "checkpoints.h"
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
@@ -245,18 +246,22 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
-bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<CDiskBlockIndex>& blockinfo) {
     CLevelDBBatch batch;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
     }
     batch.Write(DB_LAST_BLOCK, nLastFile);
-    for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
-        batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
+    for (std::vector<CDiskBlockIndex>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
+        batch.Write(make_pair(DB_BLOCK_INDEX, it->GetBlockHash()), *it);
     }
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), diskindex);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
@@ -481,57 +486,160 @@ bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
      return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+/** A block index entry loaded from disk, before it is linked into mapBlockIndex */
+struct CLoadedBlockIndex
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    uint256 hash;
+    uint256 hashPrev;
+    CBlockIndex* pindex;
+};
+
+/**
+ * Deserialize and hash the block index entries whose hash starts with a byte
+ * in [nBegin, nEnd). Keys are block hashes, so these ranges split the entries
+ * evenly and can be read by independent iterators.
+ */
+static bool LoadBlockIndexRange(CBlockTreeDB &db, unsigned int nBegin, unsigned int nEnd, int nCheckpointHeight,
+                                std::vector<CLoadedBlockIndex> &vLoaded, uint64_t &nPowChecksSkipped, std::string &strError)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
 
+    uint256 hashStart;
+    *hashStart.begin() = nBegin;
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair(DB_BLOCK_INDEX, uint256());
+    ssKeySet << make_pair(DB_BLOCK_INDEX, hashStart);
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == DB_BLOCK_INDEX) {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashAnchor     = diskindex.hashAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashReserved   = diskindex.hashReserved;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+            if (chType != DB_BLOCK_INDEX)
+                break;
+            uint256 hashKey;
+            ssKey >> hashKey;
+            if (*hashKey.begin() >= nEnd)
+                break;
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+
+            uint256 hash = diskindex.GetBlockHash();
+            if (hash != hashKey) {
+                strError = strprintf("LoadBlockIndex(): hash mismatch for %s", hashKey.ToString());
+                return false;
+            }
+
+            if (diskindex.nHeight <= nCheckpointHeight) {
+                nPowChecksSkipped++;
+            } else if (!CheckProofOfWork(hash, diskindex.nBits, Params().GetConsensus())) {
+                strError = strprintf("LoadBlockIndex(): CheckProofOfWork failed: %s", diskindex.ToString());
+                return false;
             }
+
+            // Construct block index object; the Equihash solution is not kept
+            CBlockIndex* pindexNew = new CBlockIndex();
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->hashAnchor     = diskindex.hashAnchor;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->hashReserved   = diskindex.hashReserved;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            vLoaded.push_back(CLoadedBlockIndex{hash, diskindex.hashPrev, pindexNew});
+
+            pcursor->Next();
         } catch (const std::exception& e) {
-            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            strError = strprintf("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return false;
         }
     }
 
     return true;
 }
+
+bool CBlockTreeDB::LoadBlockIndexGuts(int nThreads, CBlockIndexLoadStats &stats)
+{
+    nThreads = std::max(1, std::min(nThreads, 256));
+    stats.nThreads = nThreads;
+
+    // Entries at or below the last checkpoint were checked when they were
+    // accepted and are pinned by the checkpoint, so their PoW is not rechecked.
+    int nCheckpointHeight = fCheckpointsEnabled ? Checkpoints::GetTotalBlocksEstimate(Params().Checkpoints()) : -1;
+
+    // Deserialize, hash and check the entries in parallel, one hash prefix range per thread
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<std::vector<CLoadedBlockIndex> > vvLoaded(nThreads);
+    std::vector<uint64_t> vSkipped(nThreads, 0);
+    std::vector<std::string> vError(nThreads);
+    std::vector<char> vOk(nThreads, false);
+    {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++) {
+            unsigned int nBegin = 256 * i / nThreads;
+            unsigned int nEnd = 256 * (i + 1) / nThreads;
+            threads.create_thread([this, i, nBegin, nEnd, nCheckpointHeight, &vvLoaded, &vSkipped, &vError, &vOk]() {
+                vOk[i] = LoadBlockIndexRange(*this, nBegin, nEnd, nCheckpointHeight, vvLoaded[i], vSkipped[i], vError[i]);
+            });
+        }
+        threads.join_all();
+    }
+    std::string strError;
+    for (int i = 0; i < nThreads; i++) {
+        if (!vOk[i] && strError.empty())
+            strError = vError[i];
+        stats.nEntries += vvLoaded[i].size();
+        stats.nPowChecksSkipped += vSkipped[i];
+    }
+    if (!strError.empty()) {
+        BOOST_FOREACH(const std::vector<CLoadedBlockIndex> &vLoaded, vvLoaded) {
+            BOOST_FOREACH(const CLoadedBlockIndex &loaded, vLoaded) {
+                delete loaded.pindex;
+            }
+        }
+        return error("%s", strError);
+    }
+    int64_t nTimeRead = GetTimeMicros();
+    stats.nTimeRead = nTimeRead - nTimeStart;
+
+    boost::this_thread::interruption_point();
+
+    // Load mapBlockIndex
+    mapBlockIndex.reserve(stats.nEntries);
+    BOOST_FOREACH(const std::vector<CLoadedBlockIndex> &vLoaded, vvLoaded) {
+        BOOST_FOREACH(const CLoadedBlockIndex &loaded, vLoaded) {
+            CBlockIndex* pindexNew;
+            BlockMap::iterator mi = mapBlockIndex.find(loaded.hash);
+            if (mi == mapBlockIndex.end()) {
+                pindexNew = loaded.pindex;
+                mi = mapBlockIndex.insert(make_pair(loaded.hash, pindexNew)).first;
+                pindexNew->phashBlock = &((*mi).first);
+            } else {
+                // A child already created a placeholder for this entry; fill
+                // that in so the child's pprev stays valid.
+                pindexNew = mi->second;
+                const uint256* phashBlock = pindexNew->phashBlock;
+                *pindexNew = *loaded.pindex;
+                pindexNew->phashBlock = phashBlock;
+                delete loaded.pindex;
+            }
+            pindexNew->pprev = InsertBlockIndex(loaded.hashPrev);
+        }
+    }
+    stats.nTimeMerge = GetTimeMicros() - nTimeRead;
+
+    LogPrintf("%s: loaded %u entries with %d threads (%u PoW checks skipped below checkpoint): read %.2fms, merge %.2fms\n",
+              __func__, stats.nEntries, nThreads, stats.nPowChecksSkipped, 0.001 * stats.nTimeRead, 0.001 * stats.nTimeMerge);
+
+    return true;
+}
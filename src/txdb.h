@@ -16,6 +16,7 @@
 
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 struct CAddressUnspentKey;
 struct CAddressUnspentValue;
@@ -60,6 +61,23 @@ public:
     bool GetStats(CCoinsStats &stats) const;
 };
 
+/** Per-phase statistics of the block index load at startup */
+struct CBlockIndexLoadStats
+{
+    int nThreads;
+    uint64_t nEntries;
+    //! Entries at or below the last checkpoint, whose PoW was not rechecked
+    uint64_t nPowChecksSkipped;
+    //! Microseconds spent in each phase
+    int64_t nTimeRead;
+    int64_t nTimeMerge;
+    int64_t nTimeChainWork;
+    int64_t nTimeTotal;
+
+    CBlockIndexLoadStats() : nThreads(0), nEntries(0), nPowChecksSkipped(0),
+                             nTimeRead(0), nTimeMerge(0), nTimeChainWork(0), nTimeTotal(0) {}
+};
+
 /** Access to the block database (blocks/index/) */
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
@@ -70,7 +88,8 @@ private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<CDiskBlockIndex>& blockinfo);
+    bool ReadBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
@@ -95,7 +114,7 @@ public:
     bool ReadFlag(const std::string &name, bool &fValue);
 	bool blockOnchainActive(const uint256 &hash);
 
-    bool LoadBlockIndexGuts();
+    bool LoadBlockIndexGuts(int nThreads, CBlockIndexLoadStats &stats);
 };
 
 #endif // BITCOIN_TXDB_H
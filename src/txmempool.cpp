@@ -10,6 +10,7 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -18,20 +19,33 @@
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false)
+    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false),
+    nCoinbaseSpendHeight(-1), nSigOps(0), nFeeDelta(0),
+    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0), nSigOpsWithAncestors(0),
+    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
-                                 unsigned int _nHeight, bool poolHasNoInputsOf):
+                                 unsigned int _nHeight, bool poolHasNoInputsOf,
+                                 int _nCoinbaseSpendHeight, unsigned int _nSigOps):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
-    hadNoDependencies(poolHasNoInputsOf)
+    hadNoDependencies(poolHasNoInputsOf), nCoinbaseSpendHeight(_nCoinbaseSpendHeight),
+    nSigOps(_nSigOps), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nSigOpsWithAncestors = nSigOps;
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -48,8 +62,37 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta, int nSigOpsDelta)
+{
+    nSizeWithAncestors += nSizeDelta;
+    nModFeesWithAncestors += nModFeeDelta;
+    nCountWithAncestors += nCountDelta;
+    nSigOpsWithAncestors += nSigOpsDelta;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta)
+{
+    nSizeWithDescendants += nSizeDelta;
+    nModFeesWithDescendants += nModFeeDelta;
+    nCountWithDescendants += nCountDelta;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
+CAmount CTxMemPoolEntry::UpdateFeeDelta(CAmount nNewFeeDelta)
+{
+    CAmount nChange = nNewFeeDelta - nFeeDelta;
+    nFeeDelta = nNewFeeDelta;
+    nModFeesWithAncestors += nChange;
+    nModFeesWithDescendants += nChange;
+    return nChange;
+}
+
+CMempoolOutPointHasher::CMempoolOutPointHasher() : salt(GetRandHash()) {}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), minReasonableRelayFee(_minRelayFee),
+    nLastRollingFeeUpdate(GetTime()), fBlockSinceLastRollingFeeBump(false), dRollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -68,12 +111,10 @@ void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 {
     LOCK(cs);
 
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
+    // look up every output of hashTx in mapNextTx and remove the spent ones from coins
+    for (unsigned int n = 0; n < coins.vout.size(); n++) {
+        if (mapNextTx.count(COutPoint(hashTx, n)))
+            coins.Spend(n);
     }
 }
 
@@ -97,7 +138,12 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     mapTx[hash] = entry;
-    const CTransaction& tx = mapTx[hash].GetTx();
+    CTxMemPoolEntry& newEntry = mapTx[hash];
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator itDelta = mapDeltas.find(hash);
+    if (itDelta != mapDeltas.end())
+        newEntry.UpdateFeeDelta(itDelta->second.second);
+    addPackageState(hash, newEntry);
+    const CTransaction& tx = newEntry.GetTx();
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
@@ -106,13 +152,155 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         }
     }
     nTransactionsUpdated++;
+    addIndexes(hash, entry);
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    NotifyEntryAdded(hash, newEntry);
 
     return true;
 }
 
+void CTxMemPool::addIndexes(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    BOOST_FOREACH(const JSDescription& joinsplit, entry.GetTx().vjoinsplit) {
+        mapAnchorTxs[joinsplit.anchor].insert(hash);
+    }
+    if (entry.GetCoinbaseSpendHeight() >= 0)
+        setCoinbaseSpends.insert(std::make_pair(entry.GetCoinbaseSpendHeight(), hash));
+}
+
+void CTxMemPool::CalculateMemPoolAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const
+{
+    std::vector<const CTransaction*> vToVisit(1, &tx);
+    while (!vToVisit.empty()) {
+        const CTransaction* ptx = vToVisit.back();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin) {
+            txentry_map_t::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it != mapTx.end() && setAncestors.insert(it->first).second)
+                vToVisit.push_back(&it->second.GetTx());
+        }
+    }
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, std::set<uint256>& setAncestors,
+                                           uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                                           uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize,
+                                           std::string& errString) const
+{
+    // Stops at the limits, so a long chain costs no more than the limits allow
+    uint64_t nSizeWithAncestors = entry.GetTxSize();
+    std::vector<const CTransaction*> vToVisit(1, &entry.GetTx());
+    while (!vToVisit.empty()) {
+        const CTransaction* ptx = vToVisit.back();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin) {
+            txentry_map_t::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it == mapTx.end() || !setAncestors.insert(it->first).second)
+                continue;
+            const CTxMemPoolEntry& ancestor = it->second;
+            if (ancestor.GetCountWithDescendants() + 1 > nLimitDescendantCount) {
+                errString = strprintf("too many descendants for tx %s [limit: %u]", it->first.ToString(), nLimitDescendantCount);
+                return false;
+            }
+            if (ancestor.GetSizeWithDescendants() + entry.GetTxSize() > nLimitDescendantSize) {
+                errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", it->first.ToString(), nLimitDescendantSize);
+                return false;
+            }
+            nSizeWithAncestors += ancestor.GetTxSize();
+            if (nSizeWithAncestors > nLimitAncestorSize) {
+                errString = strprintf("exceeds ancestor size limit [limit: %u]", nLimitAncestorSize);
+                return false;
+            }
+            if (setAncestors.size() + 1 > nLimitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", nLimitAncestorCount);
+                return false;
+            }
+            vToVisit.push_back(&ancestor.GetTx());
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    std::vector<uint256> vToVisit(1, hash);
+    while (!vToVisit.empty()) {
+        uint256 hashVisit = vToVisit.back();
+        vToVisit.pop_back();
+        txentry_map_t::const_iterator it = mapTx.find(hashVisit);
+        if (it == mapTx.end())
+            continue;
+        for (unsigned int i = 0; i < it->second.GetTx().vout.size(); i++) {
+            nexttx_map_t::const_iterator itNext = mapNextTx.find(COutPoint(hashVisit, i));
+            if (itNext == mapNextTx.end())
+                continue;
+            const uint256& hashChild = itNext->second.ptx->GetHash();
+            if (setDescendants.insert(hashChild).second)
+                vToVisit.push_back(hashChild);
+        }
+    }
+}
+
+void CTxMemPool::updateAncestorState(const uint256& hash, CTxMemPoolEntry& entry, int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta, int nSigOpsDelta)
+{
+    setAncestorScoreIndex.erase(std::make_pair(entry.GetAncestorScore(), hash));
+    entry.UpdateAncestorState(nSizeDelta, nModFeeDelta, nCountDelta, nSigOpsDelta);
+    setAncestorScoreIndex.insert(std::make_pair(entry.GetAncestorScore(), hash));
+}
+
+void CTxMemPool::updateDescendantState(const uint256& hash, CTxMemPoolEntry& entry, int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta)
+{
+    setDescendantScoreIndex.erase(std::make_pair(entry.GetDescendantScore(), hash));
+    entry.UpdateDescendantState(nSizeDelta, nModFeeDelta, nCountDelta);
+    setDescendantScoreIndex.insert(std::make_pair(entry.GetDescendantScore(), hash));
+}
+
+void CTxMemPool::addPackageState(const uint256& hash, CTxMemPoolEntry& entry)
+{
+    // Transactions enter after their parents, so a new entry has no descendants yet
+    std::set<uint256> setAncestors;
+    CalculateMemPoolAncestors(entry.GetTx(), setAncestors);
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors) {
+        CTxMemPoolEntry& ancestor = mapTx[hashAncestor];
+        entry.UpdateAncestorState(ancestor.GetTxSize(), ancestor.GetModifiedFee(), 1, ancestor.GetSigOps());
+        updateDescendantState(hashAncestor, ancestor, entry.GetTxSize(), entry.GetModifiedFee(), 1);
+    }
+    setAncestorScoreIndex.insert(std::make_pair(entry.GetAncestorScore(), hash));
+    setDescendantScoreIndex.insert(std::make_pair(entry.GetDescendantScore(), hash));
+}
+
+void CTxMemPool::removePackageState(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    std::set<uint256> setAncestors;
+    CalculateMemPoolAncestors(entry.GetTx(), setAncestors);
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors) {
+        updateDescendantState(hashAncestor, mapTx[hashAncestor], -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee(), -1);
+    }
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    BOOST_FOREACH(const uint256& hashDescendant, setDescendants) {
+        updateAncestorState(hashDescendant, mapTx[hashDescendant], -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee(), -1, -(int)entry.GetSigOps());
+    }
+    setAncestorScoreIndex.erase(std::make_pair(entry.GetAncestorScore(), hash));
+    setDescendantScoreIndex.erase(std::make_pair(entry.GetDescendantScore(), hash));
+}
+
+void CTxMemPool::removeIndexes(const uint256& hash, const CTxMemPoolEntry& entry)
+{
+    BOOST_FOREACH(const JSDescription& joinsplit, entry.GetTx().vjoinsplit) {
+        anchor_map_t::iterator it = mapAnchorTxs.find(joinsplit.anchor);
+        if (it == mapAnchorTxs.end())
+            continue;
+        it->second.erase(hash);
+        if (it->second.empty())
+            mapAnchorTxs.erase(it);
+    }
+    if (entry.GetCoinbaseSpendHeight() >= 0)
+        setCoinbaseSpends.erase(std::make_pair(entry.GetCoinbaseSpendHeight(), hash));
+}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
  {
      LOCK(cs);
@@ -266,7 +454,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                nexttx_map_t::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
                 txToRemove.push_back(it->second.ptx->GetHash());
@@ -278,10 +466,11 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             txToRemove.pop_front();
             if (!mapTx.count(hash))
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            const CTxMemPoolEntry& entry = mapTx[hash];
+            const CTransaction& tx = entry.GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+                    nexttx_map_t::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
                         continue;
                     txToRemove.push_back(it->second.ptx->GetHash());
@@ -296,8 +485,11 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             }
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            cachedInnerUsage -= mapTx[hash].DynamicMemoryUsage();
+            NotifyEntryRemoved(hash);
+            removePackageState(hash, entry);
+            removeIndexes(hash, entry);
+            totalTxSize -= entry.GetTxSize();
+            cachedInnerUsage -= entry.DynamicMemoryUsage();
             mapTx.erase(hash);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
@@ -307,24 +499,18 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
     }
 }
 
-void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight)
+void CTxMemPool::removeCoinbaseSpends(unsigned int nMemPoolHeight)
 {
-    // Remove transactions spending a coinbase which are now immature
+    // Remove transactions spending a coinbase which are now immature, which
+    // are the ones spending a coinbase less than COINBASE_MATURITY blocks deep.
+    // Transactions whose inputs went missing altogether are removed along with
+    // the disconnected transactions they spend.
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
-        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
-            if (it2 != mapTx.end())
-                continue;
-            const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-            if (fSanityCheck) assert(coins);
-            if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
-                transactionsToRemove.push_back(tx);
-                break;
-            }
-        }
+    int nImmatureHeight = (int)nMemPoolHeight - COINBASE_MATURITY + 1;
+    for (coinbasespend_index_t::const_iterator it = setCoinbaseSpends.lower_bound(std::make_pair(nImmatureHeight, uint256()));
+         it != setCoinbaseSpends.end(); it++) {
+        transactionsToRemove.push_back(mapTx[it->second].GetTx());
     }
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
@@ -342,14 +528,11 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot)
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
 
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
-        BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
-            if (joinsplit.anchor == invalidRoot) {
-                transactionsToRemove.push_back(tx);
-                break;
-            }
-        }
+    anchor_map_t::const_iterator it = mapAnchorTxs.find(invalidRoot);
+    if (it == mapAnchorTxs.end())
+        return;
+    BOOST_FOREACH(const uint256& hash, it->second) {
+        transactionsToRemove.push_back(mapTx[hash].GetTx());
     }
 
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
@@ -364,7 +547,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     list<CTransaction> result;
     LOCK(cs);
     BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        nexttx_map_t::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -376,7 +559,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapNullifiers.find(nf);
+            nullifier_map_t::iterator it = mapNullifiers.find(nf);
             if (it != mapNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx)
@@ -411,13 +594,24 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    nLastRollingFeeUpdate = GetTime();
+    fBlockSinceLastRollingFeeBump = true;
 }
 
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    if (!NotifyEntryRemoved.empty()) {
+        for (txentry_map_t::const_iterator it = mapTx.begin(); it != mapTx.end(); ++it)
+            NotifyEntryRemoved(it->first);
+    }
     mapTx.clear();
     mapNextTx.clear();
+    mapNullifiers.clear();
+    setDescendantScoreIndex.clear();
+    mapAnchorTxs.clear();
+    setCoinbaseSpends.clear();
+    setAncestorScoreIndex.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -432,20 +626,48 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     uint64_t checkTotal = 0;
     uint64_t innerUsage = 0;
+    size_t nCoinbaseSpends = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
     LOCK(cs);
     list<const CTxMemPoolEntry*> waitingOnDependants;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+    for (txentry_map_t::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->second.GetTxSize();
         innerUsage += it->second.DynamicMemoryUsage();
+        assert(setDescendantScoreIndex.count(std::make_pair(it->second.GetDescendantScore(), it->first)));
+        assert(setAncestorScoreIndex.count(std::make_pair(it->second.GetAncestorScore(), it->first)));
+        std::set<uint256> setAncestors;
+        CalculateMemPoolAncestors(it->second.GetTx(), setAncestors);
+        uint64_t nSizeWithAncestors = it->second.GetTxSize();
+        CAmount nModFeesWithAncestors = it->second.GetModifiedFee();
+        BOOST_FOREACH(const uint256& hashAncestor, setAncestors) {
+            const CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+            nSizeWithAncestors += ancestor.GetTxSize();
+            nModFeesWithAncestors += ancestor.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->second.GetSizeWithAncestors() == nSizeWithAncestors);
+        assert(it->second.GetModFeesWithAncestors() == nModFeesWithAncestors);
+        std::set<uint256> setDescendants;
+        CalculateDescendants(it->first, setDescendants);
+        uint64_t nSizeWithDescendants = it->second.GetTxSize();
+        CAmount nModFeesWithDescendants = it->second.GetModifiedFee();
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants) {
+            const CTxMemPoolEntry& descendant = mapTx.find(hashDescendant)->second;
+            nSizeWithDescendants += descendant.GetTxSize();
+            nModFeesWithDescendants += descendant.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->second.GetSizeWithDescendants() == nSizeWithDescendants);
+        assert(it->second.GetModFeesWithDescendants() == nModFeesWithDescendants);
         const CTransaction& tx = it->second.GetTx();
         bool fDependsWait = false;
+        int nCoinbaseSpendHeight = -1;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+            txentry_map_t::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end()) {
                 const CTransaction& tx2 = it2->second.GetTx();
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
@@ -453,14 +675,21 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             } else {
                 const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
                 assert(coins && coins->IsAvailable(txin.prevout.n));
+                if (coins->IsCoinBase())
+                    nCoinbaseSpendHeight = std::max(nCoinbaseSpendHeight, coins->nHeight);
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            nexttx_map_t::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
             i++;
         }
+        assert(it->second.GetCoinbaseSpendHeight() == nCoinbaseSpendHeight);
+        if (nCoinbaseSpendHeight >= 0) {
+            assert(setCoinbaseSpends.count(std::make_pair(nCoinbaseSpendHeight, it->first)));
+            nCoinbaseSpends++;
+        }
 
         boost::unordered_map<uint256, ZCIncrementalMerkleTree, CCoinsKeyHasher> intermediates;
 
@@ -469,6 +698,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(!pcoins->GetNullifier(nf));
             }
 
+            anchor_map_t::const_iterator itAnchor = mapAnchorTxs.find(joinsplit.anchor);
+            assert(itAnchor != mapAnchorTxs.end() && itAnchor->second.count(it->first));
+
             ZCIncrementalMerkleTree tree;
             auto it = intermediates.find(joinsplit.anchor);
             if (it != intermediates.end()) {
@@ -507,9 +739,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (nexttx_map_t::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
+        txentry_map_t::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->second.GetTx();
         assert(it2 != mapTx.end());
         assert(&tx == it->second.ptx);
@@ -517,32 +749,98 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
-    for (std::map<uint256, const CTransaction*>::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
+    for (nullifier_map_t::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
         uint256 hash = it->second->GetHash();
-        map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
+        txentry_map_t::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->second.GetTx();
         assert(it2 != mapTx.end());
         assert(&tx == it->second);
     }
 
+    assert(setDescendantScoreIndex.size() == mapTx.size());
+    assert(setAncestorScoreIndex.size() == mapTx.size());
+    assert(setCoinbaseSpends.size() == nCoinbaseSpends);
+    for (anchor_map_t::const_iterator it = mapAnchorTxs.begin(); it != mapAnchorTxs.end(); it++) {
+        assert(!it->second.empty());
+        BOOST_FOREACH(const uint256& hash, it->second) {
+            assert(mapTx.count(hash));
+        }
+    }
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
 }
 
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > dRollingMinimumFeeRate) {
+        dRollingMinimumFeeRate = rate.GetFeePerK();
+        fBlockSinceLastRollingFeeBump = false;
+    }
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t nSizeLimit) const
+{
+    LOCK(cs);
+    if (!fBlockSinceLastRollingFeeBump || dRollingMinimumFeeRate == 0)
+        return CFeeRate(dRollingMinimumFeeRate);
+
+    int64_t nTime = GetTime();
+    if (nTime > nLastRollingFeeUpdate + 10) {
+        double dHalflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < nSizeLimit / 4)
+            dHalflife /= 4;
+        else if (DynamicMemoryUsage() < nSizeLimit / 2)
+            dHalflife /= 2;
+
+        dRollingMinimumFeeRate = dRollingMinimumFeeRate / pow(2.0, (nTime - nLastRollingFeeUpdate) / dHalflife);
+        nLastRollingFeeUpdate = nTime;
+
+        if (dRollingMinimumFeeRate < minReasonableRelayFee.GetFeePerK() / 2) {
+            dRollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(dRollingMinimumFeeRate), minReasonableRelayFee);
+}
+
+unsigned int CTxMemPool::TrimToSize(size_t nSizeLimit)
+{
+    LOCK(cs);
+    unsigned int nEvicted = 0;
+    while (!setDescendantScoreIndex.empty() && DynamicMemoryUsage() > nSizeLimit) {
+        // Getting back in takes more than the evicted package paid
+        const CTxMemPoolEntry& entry = mapTx[setDescendantScoreIndex.begin()->second];
+        CFeeRate rateRemoved(entry.GetModFeesWithDescendants(), entry.GetSizeWithDescendants());
+        trackPackageRemoved(CFeeRate(rateRemoved.GetFeePerK() + minReasonableRelayFee.GetFeePerK()));
+
+        // Copy the transaction out, remove() erases the entry it refers to
+        CTransaction tx = entry.GetTx();
+        std::list<CTransaction> removed;
+        remove(tx, removed, true);
+        nEvicted += removed.size();
+    }
+    if (nEvicted) {
+        nTransactionsEvicted += nEvicted;
+        LogPrint("mempool", "TrimToSize(): evicted %u transactions, usage %u bytes\n", nEvicted, DynamicMemoryUsage());
+    }
+    return nEvicted;
+}
+
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
 {
     vtxid.clear();
 
     LOCK(cs);
     vtxid.reserve(mapTx.size());
-    for (map<uint256, CTxMemPoolEntry>::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+    for (txentry_map_t::iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
         vtxid.push_back((*mi).first);
 }
 
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
-    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    txentry_map_t::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
     result = i->second.GetTx();
     return true;
@@ -601,6 +899,30 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        txentry_map_t::iterator it = mapTx.find(hash);
+        if (it != mapTx.end()) {
+            // Carry the new fee into the package totals
+            setAncestorScoreIndex.erase(std::make_pair(it->second.GetAncestorScore(), hash));
+            setDescendantScoreIndex.erase(std::make_pair(it->second.GetDescendantScore(), hash));
+            CAmount nChange = it->second.UpdateFeeDelta(deltas.second);
+            setAncestorScoreIndex.insert(std::make_pair(it->second.GetAncestorScore(), hash));
+            setDescendantScoreIndex.insert(std::make_pair(it->second.GetDescendantScore(), hash));
+            std::set<uint256> setAncestors;
+            CalculateMemPoolAncestors(it->second.GetTx(), setAncestors);
+            BOOST_FOREACH(const uint256& hashAncestor, setAncestors) {
+                updateDescendantState(hashAncestor, mapTx[hashAncestor], 0, nChange, 0);
+            }
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH(const uint256& hashDescendant, setDescendants) {
+                updateAncestorState(hashDescendant, mapTx[hashDescendant], 0, nChange, 0, 0);
+            }
+
+            // Let the block template engine reorder it
+            NotifyEntryRemoved(hash);
+            NotifyEntryAdded(hash, it->second);
+            nTransactionsUpdated++;
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -657,5 +979,12 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Only a few recent anchors are in use at any time
+    size_t nAnchorUsage = memusage::DynamicUsage(mapAnchorTxs);
+    for (anchor_map_t::const_iterator it = mapAnchorTxs.begin(); it != mapAnchorTxs.end(); it++)
+        nAnchorUsage += memusage::DynamicUsage(it->second);
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapNullifiers) +
+        memusage::DynamicUsage(setDescendantScoreIndex) + memusage::DynamicUsage(setCoinbaseSpends) + nAnchorUsage +
+        memusage::DynamicUsage(setAncestorScoreIndex) +
+        memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
 }
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <algorithm>
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -15,6 +17,9 @@
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/signals2/signal.hpp>
+#include <boost/unordered_map.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -47,10 +52,24 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    int nCoinbaseSpendHeight; //! Height of the youngest coinbase it spends from the chain, or -1
+    unsigned int nSigOps; //! Legacy plus P2SH sigops, so block assembly needs no coin lookups
+    CAmount nFeeDelta; //! prioritisetransaction fee delta, counted in the package fees below
+
+    //! Totals over this entry and its in-mempool ancestors, maintained by the mempool
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpsWithAncestors;
+    //! ... and over this entry and its in-mempool descendants
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
-                    int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false);
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false,
+                    int _nCoinbaseSpendHeight = -1, unsigned int _nSigOps = 0);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
@@ -61,6 +80,29 @@ public:
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
+    int GetCoinbaseSpendHeight() const { return nCoinbaseSpendHeight; }
+    unsigned int GetSigOps() const { return nSigOps; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    unsigned int GetSigOpsWithAncestors() const { return nSigOpsWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+    /** Fee rate of the package made of this entry and its ancestors, in satoshis per byte */
+    double GetAncestorScore() const { return (double)nModFeesWithAncestors / nSizeWithAncestors; }
+    /** The better of its own fee rate and that of it with its descendants, in satoshis per byte */
+    double GetDescendantScore() const
+    {
+        return std::max((double)GetModifiedFee() / nTxSize, (double)nModFeesWithDescendants / nSizeWithDescendants);
+    }
+
+    void UpdateAncestorState(int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta, int nSigOpsDelta);
+    void UpdateDescendantState(int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta);
+    /** Set the prioritisetransaction delta, returns how much the modified fee changed */
+    CAmount UpdateFeeDelta(CAmount nNewFeeDelta);
     size_t DynamicMemoryUsage() const { return nUsageSize; }
 };
 
@@ -80,6 +122,20 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/** Salted hasher for the spent outpoint index, so peers can not aim transactions at one bucket */
+class CMempoolOutPointHasher
+{
+private:
+    uint256 salt;
+
+public:
+    CMempoolOutPointHasher();
+
+    size_t operator()(const COutPoint& outpoint) const {
+        return outpoint.hash.GetHash(salt) ^ outpoint.n;
+    }
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -99,10 +155,28 @@ private:
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t nTransactionsEvicted = 0; //! transactions removed by TrimToSize()
+    CFeeRate minReasonableRelayFee; //! added to the fee rate of an evicted package for the rolling minimum
+
+    mutable int64_t nLastRollingFeeUpdate;
+    mutable bool fBlockSinceLastRollingFeeBump;
+    mutable double dRollingMinimumFeeRate; //! satoshis per 1000 bytes, decays once blocks come in
 
 public:
+    typedef boost::unordered_map<uint256, CTxMemPoolEntry, CCoinsKeyHasher> txentry_map_t;
+    typedef boost::unordered_map<COutPoint, CInPoint, CMempoolOutPointHasher> nexttx_map_t;
+    typedef boost::unordered_map<uint256, const CTransaction*, CCoinsKeyHasher> nullifier_map_t;
+    //! (descendant score, txid), lowest first
+    typedef std::set<std::pair<double, uint256> > descendantscore_index_t;
+    //! JoinSplit anchor -> txids of the transactions spending from it
+    typedef boost::unordered_map<uint256, std::set<uint256>, CCoinsKeyHasher> anchor_map_t;
+    //! (youngest coinbase height spent, txid), for the transactions spending coinbases
+    typedef std::set<std::pair<int, uint256> > coinbasespend_index_t;
+    //! (ancestor score, txid), lowest package fee rate first
+    typedef std::set<std::pair<double, uint256> > ancestorscore_index_t;
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    txentry_map_t mapTx;
 	private:
      typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
      addressDeltaMap mapAddress;
@@ -116,11 +190,37 @@ public:
      typedef std::map<uint256, std::vector<CSpentIndexKey> > mapSpentIndexInserted;
      mapSpentIndexInserted mapSpentInserted;
  
+    descendantscore_index_t setDescendantScoreIndex; //! eviction order for TrimToSize()
+    anchor_map_t mapAnchorTxs; //! lets removeWithAnchor() skip unrelated transactions
+    coinbasespend_index_t setCoinbaseSpends; //! lets removeCoinbaseSpends() skip unrelated transactions
+    ancestorscore_index_t setAncestorScoreIndex; //! package selection order for CreateNewBlock()
+
+    void addIndexes(const uint256& hash, const CTxMemPoolEntry& entry);
+    void removeIndexes(const uint256& hash, const CTxMemPoolEntry& entry);
+    /** Add the entry to the package totals of its ancestors, and theirs to its own */
+    void addPackageState(const uint256& hash, CTxMemPoolEntry& entry);
+    /** Take the entry, which is about to be erased, out of the package totals of its relatives */
+    void removePackageState(const uint256& hash, const CTxMemPoolEntry& entry);
+    /** Change the ancestor totals of an entry, keeping setAncestorScoreIndex in order */
+    void updateAncestorState(const uint256& hash, CTxMemPoolEntry& entry, int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta, int nSigOpsDelta);
+    /** Change the descendant totals of an entry, keeping setDescendantScoreIndex in order */
+    void updateDescendantState(const uint256& hash, CTxMemPoolEntry& entry, int64_t nSizeDelta, CAmount nModFeeDelta, int64_t nCountDelta);
+    /** Raise the rolling minimum fee rate to rate after evicting a package */
+    void trackPackageRemoved(const CFeeRate& rate);
+
 public:
-    std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint256, const CTransaction*> mapNullifiers;
+    nexttx_map_t mapNextTx;
+    nullifier_map_t mapNullifiers;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /**
+     * Fired with cs held when a transaction enters the pool, and when it leaves it
+     * before its entry is erased. A prioritised transaction leaves and re-enters.
+     * The entry passed is the one in mapTx, so it stays put until it is removed.
+     */
+    boost::signals2::signal<void (const uint256& hash, const CTxMemPoolEntry& entry)> NotifyEntryAdded;
+    boost::signals2::signal<void (const uint256& hash)> NotifyEntryRemoved;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -145,11 +245,28 @@ public:
      bool removeSpentIndex(const uint256 txhash);
     void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
     void removeWithAnchor(const uint256 &invalidRoot);
-    void removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight);
+    /** Remove the transactions whose coinbase inputs are immature for a block at nMemPoolHeight */
+    void removeCoinbaseSpends(unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
+    /**
+     * Evict the transactions with the lowest descendant score, together with everything
+     * spending them, until the dynamic memory usage is at most nSizeLimit bytes. A low fee
+     * parent whose children pay for it so stays with them. Raises the rolling minimum fee
+     * above the evicted packages. Returns the number of transactions removed.
+     */
+    unsigned int TrimToSize(size_t nSizeLimit);
+
+    /** Halflife of the rolling minimum fee rate with the mempool at least half full, in seconds */
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
+    /**
+     * The fee rate a transaction has to pay to enter a mempool limited to nSizeLimit
+     * bytes. Zero until a transaction was evicted, then above the evicted packages, and
+     * decaying once blocks come in, faster the emptier the mempool is.
+     */
+    CFeeRate GetMinFee(size_t nSizeLimit) const;
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
@@ -160,6 +277,22 @@ public:
      */
     bool HasNoInputsOf(const CTransaction& tx) const;
 
+    /** The in-mempool transactions tx spends from, directly or indirectly */
+    void CalculateMemPoolAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const;
+    /**
+     * The same for an entry about to be added, false with errString as soon as it would
+     * have more ancestors than the limits, or would take one of them past its descendant
+     * limits. The sizes are in bytes; requires cs.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, std::set<uint256>& setAncestors,
+                                   uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                                   uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize,
+                                   std::string& errString) const;
+    /** The in-mempool transactions spending from hash, directly or indirectly */
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+    /** Entries by ancestor score, lowest first; requires cs */
+    const ancestorscore_index_t& GetAncestorScoreIndex() const { return setAncestorScoreIndex; }
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
@@ -177,6 +310,12 @@ public:
         return totalTxSize;
     }
 
+    uint64_t GetTransactionsEvicted()
+    {
+        LOCK(cs);
+        return nTransactionsEvicted;
+    }
+
     bool exists(uint256 hash) const
     {
         LOCK(cs);
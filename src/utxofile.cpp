@@ -0,0 +1,401 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxofile.h"
+
+#include "clientversion.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/thread.hpp>
+
+CUTXOFileCache utxoFileCache;
+
+namespace {
+
+const size_t CHECKSUM_SIZE = 32;
+const size_t SIZE_DIGITS = 32;
+
+enum RecordStatus {
+    RECORD_OK,
+    RECORD_CHECKSUM_MISMATCH,
+    RECORD_MALFORMED,
+};
+
+/**
+ * Find the bounds of the record at nOffset: the bytes covered by its checksum, and
+ * where the next record starts. False if the file ends within the record, or at a
+ * zero size which ends the shielded files.
+ */
+bool ScanRecord(const unsigned char* pbegin, size_t nSize, size_t nOffset, bool fShielded, size_t& nPayloadRet, size_t& nNextRet)
+{
+    const unsigned char* p = pbegin + nOffset;
+    size_t nLeft = nSize - nOffset;
+    if (fShielded) {
+        if (nLeft < SIZE_DIGITS)
+            return false;
+        uint64_t nTxSize = 0;
+        for (size_t i = 0; i < SIZE_DIGITS; i++) {
+            if (p[i] != '0' && p[i] != '1')
+                return false;
+            nTxSize = (nTxSize << 1) | (p[i] - '0');
+        }
+        if (nTxSize == 0 || nTxSize > nLeft - SIZE_DIGITS)
+            return false;
+        nPayloadRet = SIZE_DIGITS + nTxSize;
+    } else {
+        if (nLeft < 16)
+            return false;
+        uint64_t nScriptSize = ReadLE64(p + 8);
+        if (nScriptSize > nLeft - 16)
+            return false;
+        nPayloadRet = 16 + nScriptSize;
+    }
+    if (nLeft - nPayloadRet < CHECKSUM_SIZE)
+        return false;
+    nNextRet = nOffset + nPayloadRet + CHECKSUM_SIZE;
+    // Transparent records end in a separator, which some files lack
+    if (!fShielded && nNextRet < nSize && pbegin[nNextRet] == '\n')
+        nNextRet++;
+    return true;
+}
+
+uint256 ReadChecksum(const unsigned char* p)
+{
+    uint256 checksum;
+    for (size_t i = 0; i < CHECKSUM_SIZE; i++)
+        *(checksum.begin() + i) = p[CHECKSUM_SIZE - 1 - i];
+    return checksum;
+}
+
+/** Parse and check the records [nBegin, nEnd) of the mapped file */
+void ParseRecords(const unsigned char* pbegin, size_t nSize, const CUTXOFileIndex& index, bool fVerified,
+                  size_t nBegin, size_t nEnd, CUTXOFile& file, std::vector<uint256>& vChecksums, std::vector<char>& vStatus)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        size_t nOffset = index.vOffsets[i];
+        size_t nPayload, nNext;
+        if (!ScanRecord(pbegin, nSize, nOffset, index.fShielded, nPayload, nNext)) {
+            vStatus[i] = RECORD_MALFORMED;
+            continue;
+        }
+        const unsigned char* p = pbegin + nOffset;
+        vChecksums[i] = ReadChecksum(p + nPayload);
+        if (fVerified) {
+            if (vChecksums[i] != index.vChecksums[i]) {
+                vStatus[i] = RECORD_CHECKSUM_MISMATCH;
+                continue;
+            }
+        } else {
+            uint256 hash;
+            CSHA256().Write(p, nPayload).Finalize(hash.begin());
+            if (hash != vChecksums[i]) {
+                vStatus[i] = RECORD_CHECKSUM_MISMATCH;
+                continue;
+            }
+        }
+
+        if (index.fShielded) {
+            try {
+                CDataStream ss((const char*)p + SIZE_DIGITS, (const char*)p + nPayload, SER_NETWORK, PROTOCOL_VERSION);
+                ss >> file.vTransactions[i];
+            } catch (const std::exception&) {
+                vStatus[i] = RECORD_MALFORMED;
+                continue;
+            }
+        } else {
+            file.vRecords[i].nAmount = ReadLE64(p);
+            file.vRecords[i].scriptPubKey = CScript(p + 16, p + nPayload);
+        }
+        vStatus[i] = RECORD_OK;
+    }
+}
+
+boost::filesystem::path GetUTXOIndexPath(const boost::filesystem::path& path)
+{
+    return GetDataDir() / "utxoindex" / (path.filename().string() + ".idx");
+}
+
+bool ReadUTXOFileIndex(const boost::filesystem::path& pathIndex, CUTXOFileIndex& index)
+{
+    CAutoFile filein(fopen(pathIndex.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    try {
+        filein >> index;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: ignoring %s: %s\n", __func__, pathIndex.string(), e.what());
+        return false;
+    }
+    return true;
+}
+
+void WriteUTXOFileIndex(const boost::filesystem::path& pathIndex, const CUTXOFileIndex& index)
+{
+    TryCreateDirectory(pathIndex.parent_path());
+    boost::filesystem::path pathTmp = pathIndex;
+    pathTmp += ".new";
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        LogPrintf("%s: cannot write %s\n", __func__, pathTmp.string());
+        return;
+    }
+    try {
+        fileout << index;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: cannot write %s: %s\n", __func__, pathTmp.string(), e.what());
+        return;
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, pathIndex))
+        LogPrintf("%s: cannot rename %s\n", __func__, pathTmp.string());
+}
+
+} // anon namespace
+
+bool ReadUTXOFile(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads, CUTXOFile& fileRet)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    boost::filesystem::path path(strPath);
+    boost::system::error_code ec;
+    uint64_t nFileSize = boost::filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+    int64_t nFileTime = boost::filesystem::last_write_time(path, ec);
+    if (ec)
+        return false;
+
+    fileRet = CUTXOFile();
+    fileRet.fShielded = fShielded;
+    fileRet.nMaxRecords = nMaxRecords;
+    if (nFileSize == 0)
+        return true;
+
+    try {
+        boost::interprocess::file_mapping mapping(strPath.c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        const unsigned char* pbegin = static_cast<const unsigned char*>(region.get_address());
+        size_t nSize = region.get_size();
+
+        boost::filesystem::path pathIndex = GetUTXOIndexPath(path);
+        CUTXOFileIndex index;
+        bool fVerified = ReadUTXOFileIndex(pathIndex, index) &&
+                         index.nVersion == CUTXOFileIndex::CURRENT_VERSION && index.nFileSize == nFileSize &&
+                         index.nFileTime == nFileTime && index.fShielded == fShielded &&
+                         index.nMaxRecords == nMaxRecords && index.vChecksums.size() == index.vOffsets.size();
+        if (!fVerified) {
+            // Find the records, which is cheap next to hashing and parsing them
+            index = CUTXOFileIndex();
+            index.nFileSize = nFileSize;
+            index.nFileTime = nFileTime;
+            index.fShielded = fShielded;
+            index.nMaxRecords = nMaxRecords;
+            size_t nOffset = 0;
+            while (nOffset < nSize && (nMaxRecords == 0 || index.vOffsets.size() < nMaxRecords)) {
+                size_t nPayload, nNext;
+                if (!ScanRecord(pbegin, nSize, nOffset, fShielded, nPayload, nNext)) {
+                    if (!fShielded)
+                        LogPrintf("%s: %s is truncated after %u records\n", __func__, strPath, index.vOffsets.size());
+                    break;
+                }
+                index.vOffsets.push_back(nOffset);
+                nOffset = nNext;
+            }
+        }
+
+        size_t nRecords = index.vOffsets.size();
+        if (fShielded)
+            fileRet.vTransactions.resize(nRecords);
+        else
+            fileRet.vRecords.resize(nRecords);
+        std::vector<uint256> vChecksums(nRecords);
+        std::vector<char> vStatus(nRecords, RECORD_MALFORMED);
+
+        nThreads = std::max(1, std::min<int>(nThreads, nRecords / 256 + 1));
+        if (nThreads == 1) {
+            ParseRecords(pbegin, nSize, index, fVerified, 0, nRecords, fileRet, vChecksums, vStatus);
+        } else {
+            // The workers write into the mapping and the vectors above, wait for them even on shutdown
+            boost::this_thread::disable_interruption di;
+            boost::thread_group threads;
+            for (int i = 0; i < nThreads; i++) {
+                size_t nBegin = nRecords * i / nThreads;
+                size_t nEnd = nRecords * (i + 1) / nThreads;
+                threads.create_thread([pbegin, nSize, nBegin, nEnd, fVerified, &index, &fileRet, &vChecksums, &vStatus]() {
+                    ParseRecords(pbegin, nSize, index, fVerified, nBegin, nEnd, fileRet, vChecksums, vStatus);
+                });
+            }
+            threads.join_all();
+        }
+
+        // Keep the records before the first bad one, as the sequential readers did
+        size_t nGood = 0;
+        while (nGood < nRecords && vStatus[nGood] == RECORD_OK)
+            nGood++;
+        if (nGood < nRecords) {
+            fileRet.fChecksumMismatch = (vStatus[nGood] == RECORD_CHECKSUM_MISMATCH);
+            LogPrintf("%s: %s record %u is %s\n", __func__, strPath, nGood,
+                      fileRet.fChecksumMismatch ? "not matching its checksum" : "malformed");
+            fileRet.vTransactions.resize(fShielded ? nGood : 0);
+            fileRet.vRecords.resize(fShielded ? 0 : nGood);
+        } else if (!fVerified) {
+            index.vChecksums = vChecksums;
+            WriteUTXOFileIndex(pathIndex, index);
+        }
+
+        LogPrint("bench", "%s: %s: %u records in %.2fms (%s, %d threads)\n", __func__, strPath, nGood,
+                 (GetTimeMicros() - nTimeStart) * 0.001, fVerified ? "indexed" : "hashed", nThreads);
+    } catch (const boost::interprocess::interprocess_exception& e) {
+        LogPrintf("%s: cannot map %s: %s\n", __func__, strPath, e.what());
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const CUTXOFile> CUTXOFileCache::Load(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads, bool fPrefetch)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    std::shared_ptr<CUTXOFile> pfile = std::make_shared<CUTXOFile>();
+    bool fRead;
+    try {
+        fRead = ReadUTXOFile(strPath, fShielded, nMaxRecords, nThreads, *pfile);
+    } catch (const boost::thread_interrupted&) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        setLoading.erase(strPath);
+        cond.notify_all();
+        throw;
+    }
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    setLoading.erase(strPath);
+    cond.notify_all();
+    if (!fRead)
+        return std::shared_ptr<const CUTXOFile>();
+    if (fPrefetch) {
+        nPrefetched++;
+        nPrefetchTime += nTime;
+    } else {
+        nLoaded++;
+        nLoadTime += nTime;
+    }
+    if (!mapFiles.count(strPath))
+        listLRU.push_front(strPath);
+    mapFiles[strPath] = pfile;
+    while (listLRU.size() > nMaxFiles) {
+        mapFiles.erase(listLRU.back());
+        listLRU.pop_back();
+    }
+    return pfile;
+}
+
+std::shared_ptr<const CUTXOFile> CUTXOFileCache::Get(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            std::map<std::string, std::shared_ptr<const CUTXOFile> >::iterator it = mapFiles.find(strPath);
+            if (it != mapFiles.end() && it->second->fShielded == fShielded && it->second->nMaxRecords == nMaxRecords) {
+                listLRU.remove(strPath);
+                listLRU.push_front(strPath);
+                return it->second;
+            }
+            if (!setLoading.count(strPath))
+                break;
+            // Being read ahead, which finishes sooner than reading it again
+            boost::this_thread::disable_interruption di;
+            int64_t nTimeStart = GetTimeMicros();
+            cond.wait(lock);
+            nWaitTime += GetTimeMicros() - nTimeStart;
+        }
+        setLoading.insert(strPath);
+    }
+
+    // Read outside the lock, the miner and block validation may want different files
+    return Load(strPath, fShielded, nMaxRecords, nThreads, false);
+}
+
+void CUTXOFileCache::Prefetch(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (nPrefetch <= 0 || mapFiles.count(strPath) || setLoading.count(strPath))
+        return;
+    for (std::deque<CPrefetchRequest>::const_iterator it = queuePrefetch.begin(); it != queuePrefetch.end(); ++it)
+        if (it->strPath == strPath)
+            return;
+    CPrefetchRequest req;
+    req.strPath = strPath;
+    req.fShielded = fShielded;
+    req.nMaxRecords = nMaxRecords;
+    req.nThreads = nThreads;
+    queuePrefetch.push_back(req);
+    // Requests for blocks already validated are of no use
+    while (queuePrefetch.size() > (size_t)nPrefetch)
+        queuePrefetch.pop_front();
+    cond.notify_all();
+}
+
+void CUTXOFileCache::ThreadPrefetch()
+{
+    while (true) {
+        CPrefetchRequest req;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (queuePrefetch.empty())
+                cond.wait(lock);
+            req = queuePrefetch.front();
+            queuePrefetch.pop_front();
+            if (mapFiles.count(req.strPath) || setLoading.count(req.strPath))
+                continue;
+            setLoading.insert(req.strPath);
+        }
+        Load(req.strPath, req.fShielded, req.nMaxRecords, req.nThreads, true);
+    }
+}
+
+void CUTXOFileCache::SetPrefetch(int nFiles)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    nPrefetch = std::max(nFiles, 0);
+    // The files read ahead plus the ones of the blocks being mined and validated
+    nMaxFiles = std::max(DEFAULT_UTXO_FILE_CACHE_SIZE, (size_t)nPrefetch + 2);
+}
+
+int CUTXOFileCache::GetPrefetch() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nPrefetch;
+}
+
+void CUTXOFileCache::GetStats(uint64_t& nLoadedRet, uint64_t& nPrefetchedRet, int64_t& nLoadTimeRet,
+                              int64_t& nPrefetchTimeRet, int64_t& nWaitTimeRet) const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    nLoadedRet = nLoaded;
+    nPrefetchedRet = nPrefetched;
+    nLoadTimeRet = nLoadTime;
+    nPrefetchTimeRet = nPrefetchTime;
+    nWaitTimeRet = nWaitTime;
+}
+
+void CUTXOFileCache::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    mapFiles.clear();
+    listLRU.clear();
+    queuePrefetch.clear();
+}
+
+void ThreadUTXOPrefetch()
+{
+    utxoFileCache.ThreadPrefetch();
+}
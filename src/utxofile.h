@@ -0,0 +1,159 @@
+// Copyright (c) 2018 The Anonymous Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOFILE_H
+#define BITCOIN_UTXOFILE_H
+
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Number of parsed airdrop UTXO files kept in memory */
+static const size_t DEFAULT_UTXO_FILE_CACHE_SIZE = 8;
+/** Number of UTXO files read ahead of the fork block being validated */
+static const int DEFAULT_UTXO_PREFETCH = 2;
+
+/** An airdrop record of the transparent fork range, with the amount as it is in the file */
+struct CUTXORecord {
+    uint64_t nAmount;
+    CScript scriptPubKey;
+};
+
+/**
+ * The parsed records of one utxo-%05i.bin file. Records of the transparent range are
+ * [amount:8][script size:8][script][checksum:32]['\n'], those of the shielded range
+ * [size as 32 binary digits][raw transaction][checksum:32]. The checksum is the SHA256
+ * of the fields before it, stored byte reversed.
+ */
+class CUTXOFile
+{
+public:
+    bool fShielded;
+    size_t nMaxRecords; //! the cap it was read with, 0 for all records
+    std::vector<CUTXORecord> vRecords;        //! transparent range
+    std::vector<CTransaction> vTransactions;  //! shielded range
+    /** A record did not match its checksum, the ones before it were read */
+    bool fChecksumMismatch;
+
+    CUTXOFile() : fShielded(false), nMaxRecords(0), fChecksumMismatch(false) {}
+
+    size_t size() const { return fShielded ? vTransactions.size() : vRecords.size(); }
+};
+
+/**
+ * Sidecar of a UTXO file, kept in the data directory: where its records start and
+ * their checksums. Records are variable length, so without it a file has to be
+ * scanned sequentially before it can be parsed in parallel. The checksums were
+ * verified when the sidecar was written, so while the file keeps its size and
+ * modification time they are only compared, not recomputed.
+ */
+class CUTXOFileIndex
+{
+public:
+    static const int CURRENT_VERSION = 1;
+
+    int nVersion;
+    uint64_t nFileSize;
+    int64_t nFileTime;
+    bool fShielded;
+    uint64_t nMaxRecords;
+    std::vector<uint64_t> vOffsets;
+    std::vector<uint256> vChecksums;
+
+    CUTXOFileIndex() : nVersion(CURRENT_VERSION), nFileSize(0), nFileTime(0), fShielded(false), nMaxRecords(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(nVersion);
+        READWRITE(nFileSize);
+        READWRITE(nFileTime);
+        READWRITE(fShielded);
+        READWRITE(nMaxRecords);
+        READWRITE(vOffsets);
+        READWRITE(vChecksums);
+    }
+};
+
+/**
+ * Read a UTXO file through a memory mapping, parsing and checking its records on
+ * nThreads threads. At most nMaxRecords are read, 0 for all. Returns false if the
+ * file cannot be opened.
+ */
+bool ReadUTXOFile(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads, CUTXOFile& fileRet);
+
+/**
+ * The recently read UTXO files by path. A fork block is checked against its file
+ * when it is mined and again when it is accepted, and blocks of the fork range can
+ * be accepted more than once during a resync, so each file is only read once.
+ *
+ * While a fork block is validated and connected, the files of the next blocks are
+ * read ahead on the prefetch thread, so syncing the fork range does not wait on
+ * the disk. A file being read is only read once, Get waits for the prefetch.
+ * A cached file is only returned for the range and record cap it was read with.
+ */
+class CUTXOFileCache
+{
+private:
+    struct CPrefetchRequest {
+        std::string strPath;
+        bool fShielded;
+        size_t nMaxRecords;
+        int nThreads;
+    };
+
+    mutable boost::mutex cs;
+    boost::condition_variable cond; //! a file was loaded or a prefetch queued
+    std::map<std::string, std::shared_ptr<const CUTXOFile> > mapFiles;
+    std::list<std::string> listLRU; //! most recently used first
+    std::set<std::string> setLoading;
+    std::deque<CPrefetchRequest> queuePrefetch;
+    size_t nMaxFiles;
+    int nPrefetch;
+
+    uint64_t nLoaded;
+    uint64_t nPrefetched;
+    int64_t nLoadTime;     //! microseconds reading files on demand
+    int64_t nPrefetchTime; //! microseconds reading files ahead
+    int64_t nWaitTime;     //! microseconds waiting for a prefetch to finish
+
+    std::shared_ptr<const CUTXOFile> Load(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads, bool fPrefetch);
+
+public:
+    CUTXOFileCache() : nMaxFiles(DEFAULT_UTXO_FILE_CACHE_SIZE), nPrefetch(0), nLoaded(0), nPrefetched(0),
+                       nLoadTime(0), nPrefetchTime(0), nWaitTime(0) {}
+
+    /** The records of the file at strPath, or NULL if it cannot be opened */
+    std::shared_ptr<const CUTXOFile> Get(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads);
+    /** Queue the file at strPath for the prefetch thread, unless it is cached or being read */
+    void Prefetch(const std::string& strPath, bool fShielded, size_t nMaxRecords, int nThreads);
+    /** Set how many files are read ahead, and keep enough files to hold them */
+    void SetPrefetch(int nFiles);
+    int GetPrefetch() const;
+    void GetStats(uint64_t& nLoadedRet, uint64_t& nPrefetchedRet, int64_t& nLoadTimeRet,
+                  int64_t& nPrefetchTimeRet, int64_t& nWaitTimeRet) const;
+    void Clear();
+
+    /** Read the queued files until interrupted */
+    void ThreadPrefetch();
+};
+
+extern CUTXOFileCache utxoFileCache;
+
+void ThreadUTXOPrefetch();
+
+#endif // BITCOIN_UTXOFILE_H
@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 180004;
+static const int PROTOCOL_VERSION = 180005;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -34,4 +34,7 @@ static const int BIP0031_VERSION = 60000;
 //! "mempool" command, enhanced "getdata" behavior starts with this version
 static const int MEMPOOL_GD_VERSION = 60002;
 
+//! "sendcmpct", "cmpctblock", "getblocktxn" and "blocktxn" start with this version
+static const int COMPACT_BLOCKS_VERSION = 180005;
+
 #endif // BITCOIN_VERSION_H
@@ -810,6 +810,171 @@ TEST(wallet_tests, CachedWitnessesCleanIndex) {
     }
 }
 
+TEST(wallet_tests, CachedWitnessesManyCommitments) {
+    TestWallet wallet;
+    ZCIncrementalMerkleTree tree;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    // Notes witnessed in earlier blocks
+    std::vector<JSOutPoint> notes;
+    for (int i = 0; i < 3; i++) {
+        CBlock block;
+        CBlockIndex index(block);
+        index.nHeight = i + 1;
+        notes.push_back(CreateValidBlock(wallet, sk, index, block, tree));
+    }
+
+    // A block of commitments that are not ours, with a new note among them
+    CBlock block;
+    for (int i = 0; i < 400; i++) {
+        CMutableTransaction mtx;
+        mtx.nVersion = 2;
+        JSDescription jsdesc;
+        jsdesc.commitments[0] = GetRandHash();
+        jsdesc.commitments[1] = GetRandHash();
+        mtx.vjoinsplit.push_back(jsdesc);
+        block.vtx.push_back(mtx);
+
+        if (i == 200) {
+            auto wtx = GetValidReceive(sk, 50, true);
+            auto note = GetNote(sk, wtx, 0, 1);
+            mapNoteData_t noteData;
+            JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+            CNoteData nd {sk.address(), note.nullifier(sk)};
+            noteData[jsoutpt] = nd;
+            wtx.SetNoteData(noteData);
+            wallet.AddToWallet(wtx, true, NULL);
+            block.vtx.push_back(wtx);
+            notes.push_back(jsoutpt);
+        }
+    }
+    CBlockIndex index(block);
+    index.nHeight = 4;
+
+    // Enough work to increment the witnesses on several threads
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 4;
+    wallet.IncrementNoteWitnesses(&index, &block, tree);
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+
+    // Every witness has all commitments of the block
+    std::vector<boost::optional<ZCIncrementalWitness>> witnesses;
+    uint256 anchor;
+    wallet.GetNoteWitnesses(notes, witnesses, anchor);
+    EXPECT_EQ(tree.root(), anchor);
+    for (size_t i = 0; i < witnesses.size(); i++) {
+        ASSERT_TRUE((bool) witnesses[i]);
+        EXPECT_EQ(tree.root(), witnesses[i]->root());
+    }
+}
+
+// Only the anchor of the empty tree, where a rescan from genesis starts
+class RescanCoinsView : public CCoinsView {
+public:
+    bool GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
+        if (rt != ZCIncrementalMerkleTree::empty_root())
+            return false;
+        tree = ZCIncrementalMerkleTree();
+        return true;
+    }
+};
+
+TEST(wallet_tests, RescanMatchesSerialWitnesses) {
+    SelectParams(CBaseChainParams::TESTNET);
+    TestWallet serial;
+    TestWallet wallet;
+
+    auto sk = libzcash::SpendingKey::random();
+    serial.AddSpendingKey(sk);
+    wallet.AddSpendingKey(sk);
+
+    // A short chain on disk with notes to us, and a block without any
+    size_t numBlocks = 5;
+    std::vector<CBlock> blocks(numBlocks);
+    std::vector<uint256> hashes(numBlocks);
+    std::vector<CBlockIndex> indices(numBlocks);
+    std::vector<JSOutPoint> notes;
+    ZCIncrementalMerkleTree tree;
+    CDiskBlockPos pos(0, 0);
+    for (size_t i = 0; i < numBlocks; i++) {
+        if (i == 2) {
+            CMutableTransaction mtx;
+            mtx.nVersion = 2;
+            JSDescription jsdesc;
+            jsdesc.commitments[0] = GetRandHash();
+            jsdesc.commitments[1] = GetRandHash();
+            mtx.vjoinsplit.push_back(jsdesc);
+            blocks[i].vtx.push_back(mtx);
+        } else {
+            auto wtx = GetValidReceive(sk, 50, true);
+            auto note = GetNote(sk, wtx, 0, 1);
+            mapNoteData_t noteData;
+            JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+            CNoteData nd {sk.address(), note.nullifier(sk)};
+            noteData[jsoutpt] = nd;
+            wtx.SetNoteData(noteData);
+            serial.AddToWallet(wtx, true, NULL);
+            blocks[i].vtx.push_back(wtx);
+            notes.push_back(jsoutpt);
+        }
+        blocks[i].nTime = i;
+        if (i > 0)
+            blocks[i].hashPrevBlock = hashes[i - 1];
+
+        ASSERT_TRUE(WriteBlockToDisk(blocks[i], pos, Params().MessageStart()));
+        hashes[i] = blocks[i].GetHash();
+        indices[i].phashBlock = &hashes[i];
+        indices[i].pprev = i > 0 ? &indices[i - 1] : NULL;
+        indices[i].nHeight = i;
+        indices[i].nTime = blocks[i].nTime;
+        indices[i].nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA;
+        indices[i].nFile = pos.nFile;
+        indices[i].nDataPos = pos.nPos;
+        pos.nPos += ::GetSerializeSize(blocks[i], SER_DISK, CLIENT_VERSION);
+
+        // The serial reference: one block at a time, as ChainTip does
+        serial.IncrementNoteWitnesses(&indices[i], &blocks[i], tree);
+    }
+    indices[0].hashAnchor = ZCIncrementalMerkleTree::empty_root();
+
+    RescanCoinsView view;
+    CCoinsViewCache* pcoinsTipOld = pcoinsTip;
+    pcoinsTip = new CCoinsViewCache(&view);
+    chainActive.SetTip(&indices.back());
+
+    // Read and match on several threads
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 3;
+    wallet.ScanForWalletTransactions(&indices[0]);
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+
+    chainActive.SetTip(NULL);
+    delete pcoinsTip;
+    pcoinsTip = pcoinsTipOld;
+
+    // Same notes, witnesses and witness heights as the serial wallet
+    for (const JSOutPoint& jsoutpt : notes) {
+        ASSERT_EQ(1u, wallet.mapWallet.count(jsoutpt.hash));
+        const CNoteData& nd = wallet.mapWallet[jsoutpt.hash].mapNoteData[jsoutpt];
+        const CNoteData& ndSerial = serial.mapWallet[jsoutpt.hash].mapNoteData[jsoutpt];
+        EXPECT_EQ(ndSerial.witnessHeight, nd.witnessHeight);
+        EXPECT_EQ(ndSerial.witnesses, nd.witnesses);
+    }
+    std::vector<boost::optional<ZCIncrementalWitness>> witnesses;
+    uint256 anchor;
+    wallet.GetNoteWitnesses(notes, witnesses, anchor);
+    EXPECT_EQ(tree.root(), anchor);
+
+    CRescanProgress progress = wallet.GetRescanProgress();
+    EXPECT_FALSE(progress.fRunning);
+    EXPECT_EQ(0, progress.nStartHeight);
+    EXPECT_EQ((int)numBlocks - 1, progress.nHeight);
+    EXPECT_EQ((int)numBlocks - 1, progress.nTipHeight);
+    EXPECT_EQ(numBlocks, progress.nBlocks);
+}
+
 TEST(wallet_tests, ClearNoteWitnessCache) {
     TestWallet wallet;
 
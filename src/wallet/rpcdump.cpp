@@ -99,6 +99,7 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false")
         );
 
+    LOCK(pwalletMain->cs_rescan);
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -145,7 +146,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     }
 
     if (fRescan) {
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true) < 0)
+            throw JSONRPCError(RPC_WALLET_ERROR, "Rescan aborted, a block could not be read");
     }
 
     return NullUniValue;
@@ -174,6 +176,7 @@ UniValue importaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
+    LOCK(pwalletMain->cs_rescan);
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     CScript script;
@@ -216,7 +219,8 @@ UniValue importaddress(const UniValue& params, bool fHelp)
 
         if (fRescan)
         {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+            if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true) < 0)
+                throw JSONRPCError(RPC_WALLET_ERROR, "Rescan aborted, a block could not be read");
             pwalletMain->ReacceptWalletTransactions();
         }
     }
@@ -272,6 +276,7 @@ UniValue importwallet(const UniValue& params, bool fHelp)
 
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
 {
+    LOCK(pwalletMain->cs_rescan);
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -375,7 +380,8 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
         pwalletMain->nTimeFirstKey = nTimeBegin;
 
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
+    if (pwalletMain->ScanForWalletTransactions(pindex) < 0)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Rescan aborted, a block could not be read");
     pwalletMain->MarkDirty();
 
     if (!fGood)
@@ -578,6 +584,7 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
         );
 
+    LOCK(pwalletMain->cs_rescan);
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -640,7 +647,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
 
         // We want to scan for transactions and notes
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+            if (pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true) < 0)
+                throw JSONRPCError(RPC_WALLET_ERROR, "Rescan aborted, a block could not be read");
         }
     }
 
@@ -2293,6 +2293,52 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getrescaninfo(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrescaninfo\n"
+            "Returns the progress of the running wallet rescan, or the last one if none is running.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"rescanning\": true|false,   (boolean) whether a rescan is running\n"
+            "  \"startheight\": n,           (numeric) the first block scanned\n"
+            "  \"height\": n,                (numeric) the last block committed to the wallet\n"
+            "  \"tipheight\": n,             (numeric) the tip when the rescan started\n"
+            "  \"progress\": x.xxx,          (numeric) the fraction of the blocks committed\n"
+            "  \"blocks\": n,                (numeric) the number of blocks committed\n"
+            "  \"transactions\": n,          (numeric) the number of wallet transactions found\n"
+            "  \"duration\": x.xxx,          (numeric) seconds since the rescan started, or that it took\n"
+            "  \"blockspersecond\": x.xxx,   (numeric) the blocks committed per second\n"
+            "  \"aborted\": true|false,      (boolean) whether the rescan stopped on a block it could not read\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrescaninfo", "")
+            + HelpExampleRpc("getrescaninfo", "")
+        );
+
+    // No locks, the rescans of importprivkey and z_importkey hold cs_main and cs_wallet
+    CRescanProgress progress = pwalletMain->GetRescanProgress();
+    int nBlocksTotal = progress.nTipHeight - progress.nStartHeight + 1;
+    double dDuration = 0.000001 * ((progress.fRunning ? GetTimeMicros() : progress.nEndTime) - progress.nStartTime);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("rescanning", progress.fRunning));
+    obj.push_back(Pair("startheight", progress.nStartHeight));
+    obj.push_back(Pair("height", progress.nHeight));
+    obj.push_back(Pair("tipheight", progress.nTipHeight));
+    obj.push_back(Pair("progress", nBlocksTotal > 0 ? (double)progress.nBlocks / nBlocksTotal : 1.0));
+    obj.push_back(Pair("blocks", progress.nBlocks));
+    obj.push_back(Pair("transactions", progress.nTransactions));
+    obj.push_back(Pair("duration", progress.nStartTime ? dDuration : 0.0));
+    obj.push_back(Pair("blockspersecond", dDuration > 0 ? progress.nBlocks / dDuration : 0.0));
+    obj.push_back(Pair("aborted", progress.fAborted));
+    return obj;
+}
+
 UniValue resendwallettransactions(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -2560,7 +2606,7 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
 
     JSDescription samplejoinsplit;
 
-    if (benchmarktype == "verifyjoinsplit") {
+    if (benchmarktype == "verifyjoinsplit" || benchmarktype == "verifyjoinsplitblock") {
         CDataStream ss(ParseHexV(params[2].get_str(), "js"), SER_NETWORK, PROTOCOL_VERSION);
         ss >> samplejoinsplit;
     }
@@ -2582,6 +2628,15 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             }
         } else if (benchmarktype == "verifyjoinsplit") {
             sample_times.push_back(benchmark_verify_joinsplit(samplejoinsplit));
+        } else if (benchmarktype == "verifyjoinsplitblock") {
+            int nJoinSplits = params[3].get_int();
+            int nThreads = params.size() > 4 ? params[4].get_int() : GetNumCores();
+            if (nJoinSplits <= 0 || nThreads <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of joinsplits or threads");
+            }
+            // One sample per thread count, from 1 to nThreads
+            std::vector<double> vals = benchmark_verify_joinsplit_block(samplejoinsplit, nJoinSplits, nThreads);
+            sample_times.insert(sample_times.end(), vals.begin(), vals.end());
 #ifdef ENABLE_MINING
         } else if (benchmarktype == "solveequihash") {
             if (params.size() < 3) {
@@ -2601,12 +2656,46 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_try_decrypt_notes(nAddrs));
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
-            sample_times.push_back(benchmark_increment_note_witnesses(nTxs));
+            int nJoinSplits = params.size() > 3 ? params[3].get_int() : 1;
+            if (nTxs <= 0 || nJoinSplits < 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of transactions or joinsplits");
+            }
+            // One sample per wallet size, doubling up to nTxs notes
+            std::vector<double> vals = benchmark_increment_note_witnesses(nTxs, nJoinSplits);
+            sample_times.insert(sample_times.end(), vals.begin(), vals.end());
         } else if (benchmarktype == "connectblockslow") {
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
             sample_times.push_back(benchmark_connectblock_slow());
+        } else if (benchmarktype == "serveblocks") {
+            int nBlocks = params[2].get_int();
+            bool fParanoid = params.size() > 3 ? params[3].get_bool() : false;
+            sample_times.push_back(benchmark_serve_blocks(nBlocks, fParanoid));
+        } else if (benchmarktype == "masternodelookups") {
+            int nMasternodes = params.size() > 2 ? params[2].get_int() : 10000;
+            if (nMasternodes <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of masternodes");
+            }
+            sample_times.push_back(benchmark_masternode_lookups(nMasternodes));
+        } else if (benchmarktype == "governancevotesync") {
+            if (Params().NetworkIDString() != "regtest") {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
+            }
+            int nVotes = params.size() > 2 ? params[2].get_int() : 5000;
+            if (nVotes <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of votes");
+            }
+            // Three samples: checking every vote, then the first and a later sync of the vote file
+            std::vector<double> vals = benchmark_governance_vote_sync(nVotes);
+            sample_times.insert(sample_times.end(), vals.begin(), vals.end());
+        } else if (benchmarktype == "mempoolmaintenance") {
+            int nTxs = params.size() > 2 ? params[2].get_int() : 100000;
+            int nBlocks = params.size() > 3 ? params[3].get_int() : 10;
+            if (nTxs <= 0 || nBlocks <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid number of transactions or blocks");
+            }
+            sample_times.push_back(benchmark_mempool_maintenance(nTxs, nBlocks));
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
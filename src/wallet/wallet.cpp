@@ -373,6 +373,12 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 void CWallet::ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
                        ZCIncrementalMerkleTree tree, bool added)
 {
+    LOCK(cs_wallet);
+    if (fRescanning) {
+        CDeferredChainTip tip {pindex, tree, added};
+        vDeferredChainTips.push_back(tip);
+        return;
+    }
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, tree);
     } else {
@@ -644,6 +650,9 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 {
     {
         LOCK(cs_wallet);
+        // The notes to increment, found in one pass over the wallet rather
+        // than once for every commitment in the block
+        std::vector<CNoteData*> vNotes;
         for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
             for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
                 CNoteData* nd = &(item.second);
@@ -666,6 +675,7 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                     if (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
                         nd->witnesses.pop_back();
                     }
+                    vNotes.push_back(nd);
                 }
             }
         }
@@ -680,73 +690,92 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             pblock = &block;
         }
 
+        // Append the commitments to the tree and witness our notes among them.
+        // The existing witnesses get all commitments of the block afterwards,
+        // a new witness only the ones after its note.
+        std::vector<uint256> vCommitments;
+        std::map<const CNoteData*, size_t> mapFirstCommitment;
         for (const CTransaction& tx : pblock->vtx) {
             auto hash = tx.GetHash();
-            bool txIsOurs = mapWallet.count(hash);
+            std::map<uint256, CWalletTx>::iterator itWtx = mapWallet.find(hash);
             for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
                 const JSDescription& jsdesc = tx.vjoinsplit[i];
                 for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                     const uint256& note_commitment = jsdesc.commitments[j];
                     tree.append(note_commitment);
-
-                    // Increment existing witnesses
-                    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                        for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                            CNoteData* nd = &(item.second);
-                            if (nd->witnessHeight < pindex->nHeight &&
-                                    nd->witnesses.size() > 0) {
-                                // Check the validity of the cache
-                                // See earlier comment about validity.
-                                assert(nWitnessCacheSize >= nd->witnesses.size());
-                                nd->witnesses.front().append(note_commitment);
-                            }
-                        }
-                    }
+                    vCommitments.push_back(note_commitment);
 
                     // If this is our note, witness it
-                    if (txIsOurs) {
-                        JSOutPoint jsoutpt {hash, i, j};
-                        if (mapWallet[hash].mapNoteData.count(jsoutpt) &&
-                                mapWallet[hash].mapNoteData[jsoutpt].witnessHeight < pindex->nHeight) {
-                            CNoteData* nd = &(mapWallet[hash].mapNoteData[jsoutpt]);
-                            if (nd->witnesses.size() > 0) {
-                                // We think this can happen because we write out the
-                                // witness cache state after every block increment or
-                                // decrement, but the block index itself is written in
-                                // batches. So if the node crashes in between these two
-                                // operations, it is possible for IncrementNoteWitnesses
-                                // to be called again on previously-cached blocks. This
-                                // doesn't affect existing cached notes because of the
-                                // CNoteData::witnessHeight checks. See #1378 for details.
-                                LogPrintf("Inconsistent witness cache state found for %s\n- Cache size: %d\n- Top (height %d): %s\n- New (height %d): %s\n",
-                                          jsoutpt.ToString(), nd->witnesses.size(),
-                                          nd->witnessHeight,
-                                          nd->witnesses.front().root().GetHex(),
-                                          pindex->nHeight,
-                                          tree.witness().root().GetHex());
-                                nd->witnesses.clear();
-                            }
-                            nd->witnesses.push_front(tree.witness());
-                            // Set height to one less than pindex so it gets incremented
-                            nd->witnessHeight = pindex->nHeight - 1;
-                            // Check the validity of the cache
-                            assert(nWitnessCacheSize >= nd->witnesses.size());
+                    if (itWtx == mapWallet.end())
+                        continue;
+                    JSOutPoint jsoutpt {hash, i, j};
+                    mapNoteData_t::iterator itNote = itWtx->second.mapNoteData.find(jsoutpt);
+                    if (itNote != itWtx->second.mapNoteData.end() &&
+                            itNote->second.witnessHeight < pindex->nHeight) {
+                        CNoteData* nd = &(itNote->second);
+                        if (nd->witnesses.size() > 0) {
+                            // We think this can happen because we write out the
+                            // witness cache state after every block increment or
+                            // decrement, but the block index itself is written in
+                            // batches. So if the node crashes in between these two
+                            // operations, it is possible for IncrementNoteWitnesses
+                            // to be called again on previously-cached blocks. This
+                            // doesn't affect existing cached notes because of the
+                            // CNoteData::witnessHeight checks. See #1378 for details.
+                            LogPrintf("Inconsistent witness cache state found for %s\n- Cache size: %d\n- Top (height %d): %s\n- New (height %d): %s\n",
+                                      jsoutpt.ToString(), nd->witnesses.size(),
+                                      nd->witnessHeight,
+                                      nd->witnesses.front().root().GetHex(),
+                                      pindex->nHeight,
+                                      tree.witness().root().GetHex());
+                            nd->witnesses.clear();
                         }
+                        nd->witnesses.push_front(tree.witness());
+                        // Set height to one less than pindex so it gets incremented
+                        nd->witnessHeight = pindex->nHeight - 1;
+                        // Check the validity of the cache
+                        assert(nWitnessCacheSize >= nd->witnesses.size());
+                        mapFirstCommitment[nd] = vCommitments.size();
                     }
                 }
             }
         }
 
+        // Increment the witnesses, which are independent of each other
+        auto appendCommitments = [&vNotes, &vCommitments, &mapFirstCommitment](size_t nBegin, size_t nEnd) {
+            for (size_t n = nBegin; n < nEnd; n++) {
+                CNoteData* nd = vNotes[n];
+                if (nd->witnesses.empty())
+                    continue;
+                std::map<const CNoteData*, size_t>::const_iterator it = mapFirstCommitment.find(nd);
+                size_t nFirst = (it == mapFirstCommitment.end()) ? 0 : it->second;
+                for (size_t k = nFirst; k < vCommitments.size(); k++)
+                    nd->witnesses.front().append(vCommitments[k]);
+            }
+        };
+        size_t nThreads = std::min<size_t>(std::max(nScriptCheckThreads, 1),
+                                           vNotes.size() * vCommitments.size() / 1024 + 1);
+        if (nThreads <= 1) {
+            appendCommitments(0, vNotes.size());
+        } else {
+            // The witnesses must not be left partly incremented on shutdown
+            boost::this_thread::disable_interruption di;
+            boost::thread_group threads;
+            for (size_t t = 0; t < nThreads; t++) {
+                size_t nBegin = vNotes.size() * t / nThreads;
+                size_t nEnd = vNotes.size() * (t + 1) / nThreads;
+                threads.create_thread([&appendCommitments, nBegin, nEnd]() { appendCommitments(nBegin, nEnd); });
+            }
+            threads.join_all();
+        }
+
         // Update witness heights
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                if (nd->witnessHeight < pindex->nHeight) {
-                    nd->witnessHeight = pindex->nHeight;
-                    // Check the validity of the cache
-                    // See earlier comment about validity.
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                }
+        for (CNoteData* nd : vNotes) {
+            if (nd->witnessHeight < pindex->nHeight) {
+                nd->witnessHeight = pindex->nHeight;
+                // Check the validity of the cache
+                // See earlier comment about validity.
+                assert(nWitnessCacheSize >= nd->witnesses.size());
             }
         }
 
@@ -1145,13 +1174,21 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * If fUpdate is true, existing transactions will be updated.
  */
 bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    bool fExisted = mapWallet.count(tx.GetHash()) != 0;
+    if (fExisted && !fUpdate) return false;
+    return AddToWalletIfInvolvingMe(tx, pblock, fUpdate, FindMyNotes(tx), !fExisted && IsMine(tx));
+}
+
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                       mapNoteData_t noteData, bool fIsMine)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto noteData = FindMyNotes(tx);
-        if (fExisted || IsMine(tx) || IsFromMe(tx) || noteData.size() > 0)
+        if (fExisted || fIsMine || IsFromMe(tx) || noteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
 
@@ -1252,13 +1289,18 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
 mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx) const
 {
     LOCK(cs_SpendingKeyStore);
+    return FindMyNotes(tx, mapNoteDecryptors);
+}
+
+mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const
+{
     uint256 hash = tx.GetHash();
 
     mapNoteData_t noteData;
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
         auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
         for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+            for (const NoteDecryptorMap::value_type& item : decryptors) {
                 try {
                     auto address = item.first;
                     JSOutPoint jsoutpt {hash, i, j};
@@ -1740,6 +1782,150 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+namespace {
+
+/** A block of a rescan, read and matched against the wallet's keys */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fRead;
+    std::vector<mapNoteData_t> vNoteData;
+    std::vector<bool> vIsMine;
+};
+
+/**
+ * Reads the blocks of a rescan and matches their transactions against the
+ * wallet's keys on worker threads, without cs_main or cs_wallet. What can only
+ * be decided in order, like spends of our outputs, is left to the commit. At
+ * most nWindow blocks ahead of the one being committed are kept in memory.
+ */
+class CRescanPipeline
+{
+private:
+    const CWallet& wallet;
+    const std::vector<CBlockIndex*>& vBlocks;
+    const NoteDecryptorMap& decryptors;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::vector<std::shared_ptr<CRescanBlock> > vWindow; //! block i in slot i % nWindow
+    size_t nWindow;
+    size_t nNext;   //! next block for a worker
+    size_t nCommit; //! next block to commit
+    bool fStop;
+    boost::thread_group threads;
+
+    void Worker()
+    {
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && nNext < vBlocks.size() && nNext >= nCommit + nWindow)
+                    cond.wait(lock);
+                if (fStop || nNext >= vBlocks.size())
+                    return;
+                i = nNext++;
+            }
+
+            std::shared_ptr<CRescanBlock> pmatched = std::make_shared<CRescanBlock>();
+            pmatched->pindex = vBlocks[i];
+            pmatched->fRead = ReadBlockFromDisk(pmatched->block, pmatched->pindex);
+            if (pmatched->fRead) {
+                for (const CTransaction& tx : pmatched->block.vtx) {
+                    pmatched->vNoteData.push_back(wallet.FindMyNotes(tx, decryptors));
+                    pmatched->vIsMine.push_back(wallet.IsMine(tx));
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            vWindow[i % nWindow] = pmatched;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CRescanPipeline(const CWallet& walletIn, const std::vector<CBlockIndex*>& vBlocksIn,
+                    const NoteDecryptorMap& decryptorsIn, int nThreads) :
+        wallet(walletIn), vBlocks(vBlocksIn), decryptors(decryptorsIn),
+        nWindow(4 * nThreads + 4), nNext(0), nCommit(0), fStop(false)
+    {
+        vWindow.resize(nWindow);
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread([this]() { Worker(); });
+    }
+
+    ~CRescanPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        boost::this_thread::disable_interruption di;
+        threads.join_all();
+    }
+
+    /** The next block in chain order once it is matched, NULL after the last one */
+    std::shared_ptr<CRescanBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nCommit >= vBlocks.size())
+            return std::shared_ptr<CRescanBlock>();
+        std::shared_ptr<CRescanBlock>& slot = vWindow[nCommit % nWindow];
+        while (!slot)
+            cond.wait(lock);
+        std::shared_ptr<CRescanBlock> pmatched;
+        pmatched.swap(slot);
+        nCommit++;
+        cond.notify_all();
+        return pmatched;
+    }
+};
+
+} // anon namespace
+
+class CWallet::CRescanGuard
+{
+private:
+    CWallet& wallet;
+    bool fFinished;
+
+public:
+    CRescanGuard(CWallet& walletIn) : wallet(walletIn), fFinished(false) {}
+
+    /** Every block was committed, the deferred tips apply on top of them */
+    void Finish() { fFinished = true; }
+
+    ~CRescanGuard()
+    {
+        {
+            LOCK2(cs_main, wallet.cs_wallet);
+            if (fFinished) {
+                // Catch up with the blocks connected and disconnected during the rescan
+                for (CDeferredChainTip& tip : wallet.vDeferredChainTips) {
+                    if (tip.added) {
+                        wallet.IncrementNoteWitnesses(tip.pindex, NULL, tip.tree);
+                    } else {
+                        wallet.DecrementNoteWitnesses(tip.pindex);
+                    }
+                }
+            } else if (!wallet.vDeferredChainTips.empty()) {
+                // They were relative to the blocks the rescan did not reach
+                LogPrintf("%s: rescan did not finish, dropping %u deferred chain tips\n", __func__, wallet.vDeferredChainTips.size());
+            }
+            wallet.vDeferredChainTips.clear();
+            wallet.fRescanning = false;
+            wallet.ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        }
+
+        LOCK(wallet.cs_rescanprogress);
+        wallet.rescanProgress.fRunning = false;
+        wallet.rescanProgress.nEndTime = GetTimeMicros();
+    }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1747,53 +1933,115 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    LOCK(cs_rescan);
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
-    CBlockIndex* pindex = pindexStart;
+    std::vector<CBlockIndex*> vBlocks;
+    NoteDecryptorMap decryptors;
+    ZCIncrementalMerkleTree tree;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
+        CBlockIndex* pindex = pindexStart;
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
+        if (pindex) {
+            // This should never fail: we should always be able to get the tree
+            // state on the path to the tip of our chain
+            assert(pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree));
+        }
+        for (; pindex; pindex = chainActive.Next(pindex))
+            vBlocks.push_back(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), vBlocks.empty() ? NULL : vBlocks.front(), false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
         {
+            LOCK(cs_SpendingKeyStore);
+            decryptors = mapNoteDecryptors;
+        }
+        fRescanning = true;
+    }
+    CRescanGuard guard(*this);
+
+    {
+        LOCK(cs_rescanprogress);
+        rescanProgress = CRescanProgress();
+        rescanProgress.fRunning = true;
+        if (!vBlocks.empty()) {
+            rescanProgress.nStartHeight = vBlocks.front()->nHeight;
+            rescanProgress.nHeight = vBlocks.front()->nHeight - 1;
+            rescanProgress.nTipHeight = vBlocks.back()->nHeight;
+        }
+        rescanProgress.nStartTime = GetTimeMicros();
+    }
+
+    {
+        CRescanPipeline pipeline(*this, vBlocks, decryptors, std::max(nScriptCheckThreads, 1));
+        while (std::shared_ptr<CRescanBlock> pmatched = pipeline.Next()) {
+            CBlockIndex* pindex = pmatched->pindex;
+            if (!pmatched->fRead) {
+                error("%s: failed to read block %s at height %d, rescan aborted", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+                LOCK(cs_rescanprogress);
+                rescanProgress.fAborted = true;
+                return -1;
+            }
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            int nFound = 0;
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
+                LOCK2(cs_main, cs_wallet);
+                // vBlocks was the chain when the rescan started. A block disconnected
+                // since still goes into the witnesses, as the deferred tips replay its
+                // disconnection, but its transactions must not be confirmed in it.
+                const CBlock* pblock = chainActive.Contains(pindex) ? &pmatched->block : NULL;
+                for (size_t i = 0; i < pmatched->block.vtx.size(); i++) {
+                    if (AddToWalletIfInvolvingMe(pmatched->block.vtx[i], pblock, fUpdate,
+                                                 pmatched->vNoteData[i], pmatched->vIsMine[i]))
+                        nFound++;
+                }
 
-            ZCIncrementalMerkleTree tree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetAnchorAt(pindex->hashAnchor, tree));
-            // Increment note witness caches
-            IncrementNoteWitnesses(pindex, &block, tree);
+                // Increment note witness caches, which appends the block to tree
+                IncrementNoteWitnesses(pindex, &pmatched->block, tree);
+            }
+            ret += nFound;
 
-            pindex = chainActive.Next(pindex);
+            int64_t nTimeStart;
+            uint64_t nBlocks;
+            {
+                LOCK(cs_rescanprogress);
+                rescanProgress.nHeight = pindex->nHeight;
+                rescanProgress.nBlocks++;
+                rescanProgress.nTransactions += nFound;
+                nTimeStart = rescanProgress.nStartTime;
+                nBlocks = rescanProgress.nBlocks;
+            }
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                LogPrintf("Still rescanning. At block %d. Progress=%f, %.2f blocks/s\n", pindex->nHeight,
+                          Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex),
+                          nBlocks / std::max(0.000001 * (GetTimeMicros() - nTimeStart), 0.001));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+
+    guard.Finish();
     return ret;
 }
 
+CRescanProgress CWallet::GetRescanProgress() const
+{
+    LOCK(cs_rescanprogress);
+    return rescanProgress;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -598,6 +598,23 @@ public:
 };
 
 
+/** Progress of the running or the last wallet rescan, reported by getrescaninfo */
+struct CRescanProgress
+{
+    bool fRunning;
+    int nStartHeight;
+    int nHeight;        //! last block committed
+    int nTipHeight;
+    uint64_t nBlocks;
+    uint64_t nTransactions;
+    int64_t nStartTime; //! microseconds
+    int64_t nEndTime;
+    bool fAborted;      //! a block could not be read
+
+    CRescanProgress() : fRunning(false), nStartHeight(-1), nHeight(-1), nTipHeight(-1),
+                        nBlocks(0), nTransactions(0), nStartTime(0), nEndTime(0), fAborted(false) {}
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -638,7 +655,36 @@ private:
     void AddToSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /** Add tx if it is ours, given its notes and whether it pays us, as matched ahead by a rescan */
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate,
+                                  mapNoteData_t noteData, bool fIsMine);
+
+    /**
+     * A rescan commits its blocks without holding cs_main throughout, so the
+     * witness increments and decrements of blocks connected and disconnected
+     * meanwhile are replayed after it, as if the rescan had run at once.
+     * Protected by cs_wallet.
+     */
+    struct CDeferredChainTip {
+        const CBlockIndex* pindex;
+        ZCIncrementalMerkleTree tree;
+        bool added;
+    };
+    bool fRescanning;
+    std::vector<CDeferredChainTip> vDeferredChainTips;
+    /** Ends a rescan on every exit, replaying the deferred tips only if it finished */
+    class CRescanGuard;
+
+    mutable CCriticalSection cs_rescanprogress;
+    CRescanProgress rescanProgress;
+
 public:
+    /**
+     * One rescan at a time. Taken before cs_main and cs_wallet, so callers
+     * that rescan while holding those must lock it first.
+     */
+    CCriticalSection cs_rescan;
+
     /*
      * Size of the incremental witness cache for the notes in our wallet.
      * This will always be greater than or equal to the size of the largest
@@ -760,6 +806,7 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fRescanning = false;
     }
 
     /**
@@ -933,7 +980,14 @@ public:
          std::vector<uint256> commitments,
          std::vector<boost::optional<ZCIncrementalWitness>>& witnesses,
          uint256 &final_anchor);
+    /**
+     * Add the wallet's transactions in the blocks from pindexStart to the tip. The
+     * blocks are read and matched against the keys on several threads, cs_main and
+     * cs_wallet are only held to commit each block in order. Returns the number of
+     * transactions found, or -1 if a block could not be read and the rescan stopped.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    CRescanProgress GetRescanProgress() const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
@@ -977,6 +1031,8 @@ public:
         const uint256& hSig,
         uint8_t n) const;
     mapNoteData_t FindMyNotes(const CTransaction& tx) const;
+    /** Trial-decrypt with a copy of the note decryptors, so several threads can at once */
+    mapNoteData_t FindMyNotes(const CTransaction& tx, const NoteDecryptorMap& decryptors) const;
     bool IsFromMe(const uint256& nullifier) const;
     void GetNoteWitnesses(
          std::vector<JSOutPoint> notes,
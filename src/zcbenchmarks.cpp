@@ -4,19 +4,26 @@
 #include <thread>
 #include <unistd.h>
 #include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
 
+#include "checkqueue.h"
 #include "coins.h"
 #include "util.h"
 #include "init.h"
 #include "primitives/transaction.h"
 #include "base58.h"
+#include "bloom.h"
 #include "crypto/equihash.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
+#include "darksend.h"
+#include "governance-votedb.h"
 #include "main.h"
+#include "masternodeman.h"
 #include "miner.h"
 #include "pow.h"
+#include "random.h"
 #include "script/sign.h"
 #include "sodium.h"
 #include "streams.h"
@@ -130,6 +137,46 @@ double benchmark_verify_joinsplit(const JSDescription &joinsplit)
     return timer_stop(tv_start);
 }
 
+// Verifies a synthetic block of nJoinSplits copies of the given JoinSplit
+// through a proof check queue, as ConnectBlock does, with 1..nMaxThreads
+// threads. Returns one running time per thread count.
+std::vector<double> benchmark_verify_joinsplit_block(const JSDescription &joinsplit, size_t nJoinSplits, int nMaxThreads)
+{
+    CMutableTransaction mtx;
+    mtx.vjoinsplit.assign(nJoinSplits, joinsplit);
+    CTransaction tx(mtx);
+
+    std::vector<double> ret;
+    struct timeval tv_start;
+
+    for (int nThreads = 1; nThreads <= nMaxThreads; nThreads++) {
+        CCheckQueue<CProofCheck> queue(16);
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads - 1; i++) {
+            threads.create_thread(boost::bind(&CCheckQueue<CProofCheck>::Thread, &queue));
+        }
+
+        std::vector<CProofCheck> vChecks;
+        for (unsigned int i = 0; i < tx.vjoinsplit.size(); i++) {
+            vChecks.push_back(CProofCheck(tx, i));
+        }
+
+        timer_start(tv_start);
+        bool fValid;
+        {
+            CCheckQueueControl<CProofCheck> control(&queue);
+            control.Add(vChecks);
+            fValid = control.Wait();
+        }
+        ret.push_back(timer_stop(tv_start));
+        assert(fValid);
+
+        threads.interrupt_all();
+        threads.join_all();
+    }
+    return ret;
+}
+
 #ifdef ENABLE_MINING
 double benchmark_solve_equihash()
 {
@@ -270,7 +317,7 @@ double benchmark_try_decrypt_notes(size_t nAddrs)
     return timer_stop(tv_start);
 }
 
-double benchmark_increment_note_witnesses(size_t nTxs)
+std::vector<double> benchmark_increment_note_witnesses(size_t nTxs, size_t nJoinSplits)
 {
     CWallet wallet;
     ZCIncrementalMerkleTree tree;
@@ -278,52 +325,59 @@ double benchmark_increment_note_witnesses(size_t nTxs)
     auto sk = libzcash::SpendingKey::random();
     wallet.AddSpendingKey(sk);
 
-    // First block
-    CBlock block1;
-    for (int i = 0; i < nTxs; i++) {
-        auto wtx = GetValidReceive(*pzcashParams, sk, 10, true);
-        auto note = GetNote(*pzcashParams, sk, wtx, 0, 1);
-        auto nullifier = note.nullifier(sk);
-
-        mapNoteData_t noteData;
-        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
-        CNoteData nd {sk.address(), nullifier};
-        noteData[jsoutpt] = nd;
-
-        wtx.SetNoteData(noteData);
-        wallet.AddToWallet(wtx, true, NULL);
-        block1.vtx.push_back(wtx);
-    }
-    CBlockIndex index1(block1);
-    index1.nHeight = 1;
+    // One sample per wallet size, doubling up to nTxs notes
+    std::vector<double> times;
+    size_t nNotes = 0;
+    int nHeight = 0;
+    for (size_t nSize = 1; ; nSize *= 2) {
+        nSize = std::min(nSize, nTxs);
+
+        // Receive notes until the wallet has nSize of them
+        CBlock blockNotes;
+        for (; nNotes < nSize; nNotes++) {
+            auto wtx = GetValidReceive(*pzcashParams, sk, 10, true);
+            auto note = GetNote(*pzcashParams, sk, wtx, 0, 1);
+            auto nullifier = note.nullifier(sk);
+
+            mapNoteData_t noteData;
+            JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+            CNoteData nd {sk.address(), nullifier};
+            noteData[jsoutpt] = nd;
+
+            wtx.SetNoteData(noteData);
+            wallet.AddToWallet(wtx, true, NULL);
+            blockNotes.vtx.push_back(wtx);
+        }
+        CBlockIndex indexNotes(blockNotes);
+        indexNotes.nHeight = ++nHeight;
+
+        // Increment to get transactions witnessed
+        wallet.ChainTip(&indexNotes, &blockNotes, tree, true);
+
+        // A block of JoinSplits that are not ours, every witness takes all their commitments
+        CBlock block;
+        block.hashPrevBlock = blockNotes.GetHash();
+        for (size_t i = 0; i < nJoinSplits; i++) {
+            CMutableTransaction mtx;
+            mtx.nVersion = 2;
+            JSDescription jsdesc;
+            jsdesc.commitments[0] = GetRandHash();
+            jsdesc.commitments[1] = GetRandHash();
+            mtx.vjoinsplit.push_back(jsdesc);
+            block.vtx.push_back(mtx);
+        }
+        CBlockIndex index(block);
+        index.nHeight = ++nHeight;
 
-    // Increment to get transactions witnessed
-    wallet.ChainTip(&index1, &block1, tree, true);
+        struct timeval tv_start;
+        timer_start(tv_start);
+        wallet.ChainTip(&index, &block, tree, true);
+        times.push_back(timer_stop(tv_start));
 
-    // Second block
-    CBlock block2;
-    block2.hashPrevBlock = block1.GetHash();
-    {
-        auto wtx = GetValidReceive(*pzcashParams, sk, 10, true);
-        auto note = GetNote(*pzcashParams, sk, wtx, 0, 1);
-        auto nullifier = note.nullifier(sk);
-
-        mapNoteData_t noteData;
-        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
-        CNoteData nd {sk.address(), nullifier};
-        noteData[jsoutpt] = nd;
-
-        wtx.SetNoteData(noteData);
-        wallet.AddToWallet(wtx, true, NULL);
-        block2.vtx.push_back(wtx);
+        if (nSize >= nTxs)
+            break;
     }
-    CBlockIndex index2(block2);
-    index2.nHeight = 2;
-
-    struct timeval tv_start;
-    timer_start(tv_start);
-    wallet.ChainTip(&index2, &block2, tree, true);
-    return timer_stop(tv_start);
+    return times;
 }
 
 // Fake the input of a given block
@@ -405,3 +459,181 @@ double benchmark_connectblock_slow()
     return duration;
 }
 
+// Reads the last nBlocks blocks of the active chain from disk with ReadBlockFromDisk
+// and serializes them into a "block" message, trusting the stored headers or, when
+// fParanoid, checking them again as -paranoidblockreads does. Divide nBlocks by the
+// running time to get the block-serving throughput in blocks/s.
+double benchmark_serve_blocks(int nBlocks, bool fParanoid)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < nBlocks && pindex; i++, pindex = pindex->pprev) {
+        vIndex.push_back(pindex);
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    bool fRead = true;
+    for (CBlockIndex* pindex : vIndex) {
+        // As with -paranoidblockreads set to fParanoid, without changing it for the node
+        CBlock block;
+        fRead &= ReadBlockFromDisk(block, pindex, fParanoid);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+    }
+    double ret = timer_stop(tv_start);
+    assert(fRead);
+    return ret;
+}
+
+// Drives nMasternodes simulated masternodes through the lookups done when
+// processing their pings (by collateral), governance votes (by collateral and
+// masternode key) and payment checks (by payee).
+double benchmark_masternode_lookups(int nMasternodes)
+{
+    CMasternodeMan mnman;
+    std::vector<CTxIn> vVins;
+    std::vector<CPubKey> vPubKeys;
+    std::vector<CScript> vPayees;
+    for (int i = 0; i < nMasternodes; i++) {
+        CKey keyCollateral, keyMasternode;
+        keyCollateral.MakeNewKey(true);
+        keyMasternode.MakeNewKey(true);
+        CTxIn vin(COutPoint(GetRandHash(), 0));
+        CMasternode mn(CService(), vin, keyCollateral.GetPubKey(), keyMasternode.GetPubKey(), PROTOCOL_VERSION);
+        mnman.Add(mn);
+        vVins.push_back(vin);
+        vPubKeys.push_back(keyMasternode.GetPubKey());
+        vPayees.push_back(GetScriptForDestination(keyCollateral.GetPubKey().GetID()));
+    }
+    uint256 nGovernanceObjectHash = GetRandHash();
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (int i = 0; i < nMasternodes; i++) {
+        // mnp
+        assert(mnman.Has(vVins[i]));
+        // governance vote
+        assert(mnman.AddGovernanceVote(vVins[i], nGovernanceObjectHash));
+        assert(mnman.GetMasternodeInfo(vPubKeys[i]).fInfoValid);
+        // mnw
+        assert(mnman.Find(vPayees[i]) != NULL);
+    }
+    return timer_stop(tv_start);
+}
+
+// Finds the votes of a governance object with nVotes votes to send to a peer
+// that has the first tenth of them, the way CGovernanceManager::Sync does:
+// copying and checking every vote as it was done before votes were validated
+// once, then through the vote file on its first and on a later sync. Returns
+// the three running times. The voting masternodes are added to the global
+// masternode list, which is cleared afterwards.
+std::vector<double> benchmark_governance_vote_sync(int nVotes)
+{
+    std::vector<CKey> vKeys;
+    std::vector<CTxIn> vVins;
+    for (int i = 0; i < nVotes; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        CTxIn vin(COutPoint(GetRandHash(), 0));
+        CMasternode mn(CService(), vin, key.GetPubKey(), key.GetPubKey(), PROTOCOL_VERSION);
+        mnodeman.Add(mn);
+        vKeys.push_back(key);
+        vVins.push_back(vin);
+    }
+
+    uint256 nParentHash = GetRandHash();
+    CGovernanceObjectVoteFile fileVotes;
+    CBloomFilter filter(nVotes, 0.0001, GetRandInt(999999), BLOOM_UPDATE_ALL);
+    for (int i = 0; i < nVotes; i++) {
+        CGovernanceVote vote(vVins[i], nParentHash, VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES);
+        std::vector<unsigned char> vchSig;
+        bool fSigned = darkSendSigner.SignMessage(vote.GetSignatureMessage(), vchSig, vKeys[i]);
+        assert(fSigned);
+        vote.SetSignature(vchSig);
+        fileVotes.AddVote(vote);
+        if (i < nVotes / 10)
+            filter.insert(vote.GetHash());
+    }
+
+    std::vector<double> ret;
+    struct timeval tv_start;
+
+    timer_start(tv_start);
+    int nCountLegacy = 0;
+    std::vector<CGovernanceVote> vecVotes = fileVotes.GetVotes();
+    for (size_t i = 0; i < vecVotes.size(); ++i) {
+        if (vecVotes[i].IsValid(true) && !filter.contains(vecVotes[i].GetHash()))
+            ++nCountLegacy;
+    }
+    ret.push_back(timer_stop(tv_start));
+
+    for (int nSync = 0; nSync < 2; nSync++) {
+        timer_start(tv_start);
+        int nCount = 0;
+        fileVotes.ValidateVotes();
+        fileVotes.ForEachValidatedVote([&](const uint256& nHash) {
+            if (!filter.contains(nHash))
+                ++nCount;
+        });
+        ret.push_back(timer_stop(tv_start));
+        assert(nCount == nCountLegacy);
+    }
+
+    mnodeman.Clear();
+    return ret;
+}
+
+// Connects nBlocks blocks of 500 transactions against a pool of nTxs
+// transactions the way ConnectTip and DisconnectTip maintain it: removing the
+// block's transactions, then evicting the spenders of a stale JoinSplit anchor
+// and of coinbases that became immature. A tenth of the pool spends from one
+// of a few anchors, another tenth spends recent coinbases. Returns the average
+// maintenance time per block.
+double benchmark_mempool_maintenance(int nTxs, int nBlocks)
+{
+    static const int nBlockTxs = 500;
+    static const int nAnchors = 8;
+    static const int nBaseHeight = 1000;
+
+    CTxMemPool pool(CFeeRate(0));
+    std::vector<uint256> vAnchors;
+    for (int i = 0; i < nAnchors; i++) {
+        vAnchors.push_back(GetRandHash());
+    }
+    std::vector<CTransaction> vtx;
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 1000;
+        if (i % 10 == 0) {
+            mtx.nVersion = 2;
+            mtx.vjoinsplit.resize(1);
+            mtx.vjoinsplit[0].anchor = vAnchors[GetRandInt(nAnchors)];
+            mtx.vjoinsplit[0].nullifiers[0] = GetRandHash();
+            mtx.vjoinsplit[0].nullifiers[1] = GetRandHash();
+        }
+        int nCoinbaseSpendHeight = i % 10 == 1 ? nBaseHeight - GetRandInt(COINBASE_MATURITY + nBlocks) : -1;
+        vtx.push_back(mtx);
+        pool.addUnchecked(vtx.back().GetHash(), CTxMemPoolEntry(vtx.back(), 1000, 0, 0.0, nBaseHeight, true, nCoinbaseSpendHeight));
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (int nBlock = 0; nBlock < nBlocks && pool.size() > 0; nBlock++) {
+        std::vector<CTransaction> vtxBlock;
+        for (int i = 0; i < nBlockTxs && !vtx.empty(); i++) {
+            vtxBlock.push_back(vtx.back());
+            vtx.pop_back();
+        }
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtxBlock, nBaseHeight + nBlock, conflicts, false);
+        // A reorg only drops the anchor of the disconnected block
+        pool.removeWithAnchor(GetRandHash());
+        pool.removeCoinbaseSpends(nBaseHeight - nBlock);
+    }
+    return timer_stop(tv_start) / nBlocks;
+}
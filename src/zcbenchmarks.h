@@ -11,10 +11,15 @@ extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
 extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
+extern std::vector<double> benchmark_verify_joinsplit_block(const JSDescription &joinsplit, size_t nJoinSplits, int nMaxThreads);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx();
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
-extern double benchmark_increment_note_witnesses(size_t nTxs);
+extern std::vector<double> benchmark_increment_note_witnesses(size_t nTxs, size_t nJoinSplits);
 extern double benchmark_connectblock_slow();
+extern double benchmark_serve_blocks(int nBlocks, bool fParanoid);
+extern double benchmark_masternode_lookups(int nMasternodes);
+extern std::vector<double> benchmark_governance_vote_sync(int nVotes);
+extern double benchmark_mempool_maintenance(int nTxs, int nBlocks);
 
 #endif